@@ -0,0 +1,31 @@
+#ifndef ACCESS_LOG_H
+#define ACCESS_LOG_H
+
+#include "common.h"
+#include "config.h"
+#include "connection.h"
+
+// Longest request line, referer or user agent kept in a record
+#define ACCESS_LOG_FIELD_MAX 512
+
+// What the access log needs from a request, taken before the handler
+// runs: upgrades and event streams reuse the read buffer
+typedef struct
+{
+    char request[ACCESS_LOG_FIELD_MAX];
+    size_t request_length;
+    char referer[ACCESS_LOG_FIELD_MAX];
+    size_t referer_length;
+    char agent[ACCESS_LOG_FIELD_MAX];
+    size_t agent_length;
+} AccessLogRequest;
+
+// Function prototypes
+int access_log_open(const ServerConfig *config);
+void access_log_close(void);
+void access_log_reopen(void);
+bool access_log_enabled(void);
+void access_log_begin(const Connection *conn, AccessLogRequest *request);
+void access_log_finish(const Connection *conn, const AccessLogRequest *request);
+
+#endif // ACCESS_LOG_H
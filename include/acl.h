@@ -0,0 +1,47 @@
+#ifndef ACL_H
+#define ACL_H
+
+#include "common.h"
+#include <stdint.h>
+
+// Path-compressed binary radix (Patricia) tree of CIDR rules. IPv4 rules
+// are stored as IPv4-mapped IPv6 prefixes so one tree serves both
+// families. Nodes live in one array and link by index, which keeps them
+// packed two to a cache line; a lookup touches one node per branching
+// point on the address' path, not one per bit.
+typedef struct
+{
+    uint8_t key[16];     // Prefix, bits past prefix_length are zero
+    uint8_t prefix_length;
+    int8_t action;       // ACL_ALLOW, ACL_DENY or -1 for a branching node
+    uint32_t child[2];   // Node indices, 0 = none
+} AclNode;
+
+#define ACL_DENY 0
+#define ACL_ALLOW 1
+
+// IPv4 lookups start from a table indexed by the first 16 address bits,
+// which replaces the top of the walk with a single load
+#define ACL_IPV4_JUMP_BITS 16
+
+typedef struct
+{
+    AclNode *nodes; // nodes[0] is unused so index 0 can mean "none"
+    uint32_t node_count;
+    uint32_t node_capacity;
+    uint32_t root;
+    uint32_t *ipv4_jump; // Resume node | (decision + 1) << 30, once built
+    int allow_rules;
+    int deny_rules;
+} AccessList;
+
+// Function prototypes
+AccessList *acl_create(void);
+void acl_destroy(AccessList *acl);
+int acl_add_rule(AccessList *acl, const char *cidr, int action);
+int acl_add_list(AccessList *acl, const char *list, int action);
+int acl_load_file(AccessList *acl, const char *path);
+int acl_build_index(AccessList *acl);
+bool acl_allows(const AccessList *acl, const struct sockaddr *addr);
+
+#endif // ACL_H
@@ -0,0 +1,55 @@
+#ifndef CHAT_BINARY_H
+#define CHAT_BINARY_H
+
+#include "common.h"
+#include "connection.h"
+#include <stdint.h>
+
+// Text line that switches a chat connection to binary framing
+#define CHAT_BINARY_HANDSHAKE "/binary"
+
+// Frame: 4-byte big-endian length of opcode + body, 1-byte opcode, body
+#define CHAT_BINARY_HEADER_SIZE 5
+#define CHAT_BINARY_MAX_BODY (BUFFER_SIZE - CHAT_BINARY_HEADER_SIZE - 1)
+
+typedef enum
+{
+    // Client to server
+    CHAT_OP_HANDSHAKE = 0x00, // Only ever answered, by the /binary status
+    CHAT_OP_JOIN = 0x01,      // room [NUL password]
+    CHAT_OP_LEAVE = 0x02,     // empty
+    CHAT_OP_MESSAGE = 0x03,   // text
+    CHAT_OP_PRIVMSG = 0x04,   // nick NUL text
+    CHAT_OP_NICK = 0x05,      // nick
+    CHAT_OP_PING = 0x06,      // empty, answered in order
+
+    // Server to client
+    CHAT_OP_STATUS = 0x80,          // request opcode (1 byte), status (2 bytes)
+    CHAT_OP_ROOM_MESSAGE = 0x81,    // formatted room line
+    CHAT_OP_PRIVATE_MESSAGE = 0x82  // formatted private line
+} ChatOpcode;
+
+typedef enum
+{
+    CHAT_STATUS_OK = 0,
+    CHAT_STATUS_BAD_REQUEST = 1,
+    CHAT_STATUS_UNKNOWN_OPCODE = 2,
+    CHAT_STATUS_TOO_LARGE = 3,
+    CHAT_STATUS_NOT_IN_ROOM = 4,
+    CHAT_STATUS_NO_SUCH_USER = 5,
+    CHAT_STATUS_NICK_TAKEN = 6,
+    CHAT_STATUS_BAD_PASSWORD = 7,
+    CHAT_STATUS_ROOM_FULL = 8,
+    CHAT_STATUS_ROOM_LIMIT = 9,
+    CHAT_STATUS_SERVER_ERROR = 10,
+    CHAT_STATUS_RATE_LIMITED = 11
+} ChatStatus;
+
+// Function prototypes
+void chat_binary_encode_header(unsigned char *header, ChatOpcode opcode, size_t body_length);
+int chat_binary_queue_frame(Connection *conn, ChatOpcode opcode, const char *body, size_t length);
+int chat_binary_queue_line(Connection *conn, ChatOpcode opcode, const char *line, size_t length);
+int chat_binary_queue_status(Connection *conn, ChatOpcode request, ChatStatus status);
+int chat_binary_next_frame(Connection *conn, ChatOpcode *opcode, char **body, size_t *length);
+
+#endif // CHAT_BINARY_H
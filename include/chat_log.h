@@ -0,0 +1,33 @@
+#ifndef CHAT_LOG_H
+#define CHAT_LOG_H
+
+#include "common.h"
+#include "config.h"
+#include <stdint.h>
+
+#define CHAT_LOG_MAGIC 0x4c43534d // "MSCL"
+#define CHAT_LOG_MAX_PENDING (4 * 1024 * 1024)
+
+// On-disk record header, followed by the room name and the message bytes
+typedef struct
+{
+    uint32_t magic;
+    uint32_t crc;           // CRC32 of everything after this field
+    int64_t timestamp;      // Wall-clock seconds
+    uint16_t room_length;   // Room name bytes following the header
+    uint16_t reserved;
+    uint32_t payload_length; // Message bytes following the room name
+} ChatLogRecordHeader;
+
+// Replay callback invoked for every valid record, oldest first
+typedef void (*ChatLogReplayFunc)(const char *room, const char *data, size_t length,
+                                  time_t timestamp, void *context);
+
+// Function prototypes
+int chat_log_open(const ServerConfig *config);
+void chat_log_close(void);
+bool chat_log_enabled(void);
+void chat_log_append(const char *room, const char *data, size_t length, time_t timestamp);
+int chat_log_replay(const char *directory, ChatLogReplayFunc callback, void *context);
+
+#endif // CHAT_LOG_H
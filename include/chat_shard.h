@@ -0,0 +1,107 @@
+#ifndef CHAT_SHARD_H
+#define CHAT_SHARD_H
+
+#include "common.h"
+#include "config.h"
+#include "connection.h"
+#include "enhanced_chat.h"
+
+#define MAX_CHAT_SHARDS 64
+#define CHAT_NICK_BUCKETS 1024
+
+// Cross-shard message types
+typedef enum
+{
+    SHARD_MSG_ADOPT = 0,    // Take over a connection (and its user)
+    SHARD_MSG_PRIVMSG,      // Route a private message via the nick owner
+    SHARD_MSG_DELIVER,      // Deliver a private message to a local user
+    SHARD_MSG_NOTICE,       // System message for a local user by id
+    SHARD_MSG_NOTICE_ROUTE, // Find a NOTICE recipient that moved, via its nick owner
+    SHARD_MSG_NICK_CLAIM,   // Reserve a nickname on its owner shard
+    SHARD_MSG_NICK_RESULT,  // Outcome of a claim, back to the origin shard
+    SHARD_MSG_NICK_RELEASE, // Drop a nickname reservation
+    SHARD_MSG_NICK_MOVE,    // User holding a nickname moved shards
+    SHARD_MSG_REMOTE        // Room message received from a federated node
+} ChatShardMessageType;
+
+// ChatShardMessage.target carries room names as well as nicknames
+#define CHAT_SHARD_TARGET_LENGTH \
+    (MAX_NICKNAME_LENGTH > MAX_ROOM_NAME_LENGTH ? MAX_NICKNAME_LENGTH : MAX_ROOM_NAME_LENGTH)
+
+// Message passed between shards through their inbox queues
+typedef struct ChatShardMessage
+{
+    struct ChatShardMessage *next; // Queue link
+    ChatShardMessageType type;
+    int origin;                    // Shard that posted the message
+    int shard;                     // Shard argument (NICK_MOVE, NICK_CLAIM)
+    unsigned long user_id;         // User addressed on the origin/target shard
+    bool ok;                       // NICK_RESULT outcome
+    int status;                    // NOTICE outcome for binary clients (ChatStatus)
+    int hops;                      // NOTICE re-routing attempts
+    Connection *connection;        // ADOPT
+    ChatUser *user;                // ADOPT (NULL for a fresh connection)
+    char nick[MAX_NICKNAME_LENGTH];        // Subject nickname
+    char target[CHAT_SHARD_TARGET_LENGTH]; // Room, recipient or previous nickname
+    char password[64];                     // ADOPT room password
+    char text[];                           // Message text
+} ChatShardMessage;
+
+// Lock-free multi-producer single-consumer queue (intrusive, Vyukov style)
+typedef struct
+{
+    ChatShardMessage *head; // Producers swap themselves in here
+    ChatShardMessage *tail; // Consumer side
+    ChatShardMessage stub;
+} ChatShardQueue;
+
+// Nickname registry entry, owned by the shard the nickname hashes to
+typedef struct ChatNickEntry
+{
+    char nick[MAX_NICKNAME_LENGTH];
+    int shard; // Shard the user currently lives on
+    struct ChatNickEntry *next;
+} ChatNickEntry;
+
+// One chat shard: its rooms and users, served by one event loop thread
+typedef struct
+{
+    int index;
+    ChatServer *server;
+    ConnectionPool *pool;
+    ChatShardQueue inbox;
+    int wake_fd;      // eventfd signalled when the inbox gains messages
+    int wake_pending; // Set while a wakeup is outstanding
+    pthread_t thread;
+    bool thread_started;
+    ChatNickEntry *nicks[CHAT_NICK_BUCKETS];
+} ChatShard;
+
+// Shard lifecycle
+int chat_shards_init(const ServerConfig *config);
+int chat_shards_start(ConnectionPool *main_pool);
+void chat_shards_stop(void);
+void chat_shards_destroy(void);
+
+// Shard lookup
+int chat_shard_count(void);
+int chat_shard_current(void);
+ChatServer *chat_shard_server(int index);
+ConnectionPool *chat_shard_pool(void);
+int chat_shard_for_name(const char *name);
+int chat_shard_wake_fd(void);
+void chat_shard_set_external(void);
+
+// Message passing
+ChatShardMessage *chat_shard_message_create(ChatShardMessageType type, const char *text);
+void chat_shard_post(int shard, ChatShardMessage *message);
+void chat_shard_process_inbox(void);
+int chat_shard_assign(Connection *conn);
+
+// Nickname registry (called on the owner shard only)
+bool chat_nick_claim(const char *nick, int shard);
+void chat_nick_release(const char *nick);
+void chat_nick_move(const char *nick, int shard);
+int chat_nick_lookup(const char *nick);
+
+#endif // CHAT_SHARD_H
@@ -0,0 +1,26 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include "common.h"
+
+// Length of the rendered "[HH:MM:SS] " chat prefix
+#define CLOCK_CHAT_PREFIX_LENGTH 11
+// Length of the rendered "YYYY-MM-DD HH:MM:SS" log timestamp
+#define CLOCK_LOG_TIMESTAMP_LENGTH 19
+// Length of the rendered "Sun, 06 Nov 1994 08:49:37 GMT" HTTP date
+#define CLOCK_HTTP_DATE_LENGTH 29
+// Length of the rendered "10/Oct/2000:13:55:36 -0700" access log date
+#define CLOCK_ACCESS_DATE_LENGTH 26
+
+// Function prototypes
+void clock_update(void);
+time_t clock_now_sec(void);
+long long clock_now_ms(void);
+const char *clock_chat_prefix(void);
+const char *clock_log_timestamp(void);
+const char *clock_http_date(void);
+const char *clock_access_date(void);
+long long clock_precise_us(void);
+long long clock_precise_ns(void);
+
+#endif // CLOCK_H
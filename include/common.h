@@ -36,7 +36,9 @@ typedef enum
     PROTOCOL_UNKNOWN = 0,
     PROTOCOL_HTTP,
     PROTOCOL_CHAT,
-    PROTOCOL_HTTPS
+    PROTOCOL_HTTPS,
+    PROTOCOL_WEBSOCKET,
+    PROTOCOL_SSE
 } ProtocolType;
 
 // Log levels
@@ -49,6 +51,16 @@ typedef enum
     LOG_FATAL
 } LogLevel;
 
+// Logging modules, each with its own runtime level
+typedef enum
+{
+    LOG_MODULE_SERVER = 0,
+    LOG_MODULE_CONNECTION,
+    LOG_MODULE_CHAT,
+    LOG_MODULE_CONFIG,
+    LOG_MODULE_COUNT
+} LogModule;
+
 // Global variables
 extern volatile sig_atomic_t running;
 extern volatile sig_atomic_t reload_config;
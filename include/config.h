@@ -3,6 +3,28 @@
 
 #include "common.h"
 
+// What happens to chat messages over the flood limits
+typedef enum
+{
+    FLOOD_ACTION_DROP = 0,   // Discard the message and tell the sender
+    FLOOD_ACTION_DELAY,      // Hold the sender's input until tokens refill
+    FLOOD_ACTION_DISCONNECT  // Close the sender's connection
+} FloodAction;
+
+// What a thread does when its async log buffer is full
+typedef enum
+{
+    LOG_OVERFLOW_DROP = 0, // Discard the message; the writer reports the count
+    LOG_OVERFLOW_BLOCK     // Wait for the writer thread to make room
+} LogOverflow;
+
+// Encoding of the log file
+typedef enum
+{
+    LOG_FILE_TEXT = 0, // Formatted lines
+    LOG_FILE_BINARY    // Raw records, rendered by tools/logdecode
+} LogFileFormat;
+
 // Server configuration structure
 typedef struct
 {
@@ -11,27 +33,70 @@ typedef struct
     int chat_port;
     int max_connections;
     char document_root[PATH_MAX];
+    int header_timeout; // Seconds to finish HTTP request headers
+    int write_timeout;  // Seconds pending output may go without progress
+    int slow_loop_ms;   // Report event loop iterations busy this long, 0 = off
 
     // Logging settings
     int log_level;
+    int log_module_levels[LOG_MODULE_COUNT]; // -1 follows log_level
     char log_file[PATH_MAX];
     bool log_to_console;
     bool log_to_file;
+    bool log_async;    // Hand records to a background writer thread
+    int log_buffer_kb; // Async buffer per logging thread
+    LogOverflow log_overflow;
+    LogFileFormat log_file_format;
+    int log_rotate_size_mb;  // Roll the file over at this size, 0 = never
+    int log_rotate_interval; // Seconds between time-based rollovers, 0 = never
+    int log_rotate_keep;     // Rotated files kept, 0 = all
+    bool log_rotate_compress;
+    char access_log_file[PATH_MAX]; // HTTP access log, empty = off
+    int access_log_sample;          // Log one request in N
+    int access_log_buffer_kb;
+    bool flight_recorder;           // Keep recent events per connection and loop
+    char flight_file[PATH_MAX];     // Where SIGUSR1 dumps them
 
     // HTTP settings
     char default_page[256];
     bool directory_listing;
     bool gzip_compression;
+    bool http_metrics; // Serve GET /metrics in Prometheus text format
 
     // Chat settings
     int max_rooms;
     int max_users_per_room;
     int idle_timeout;
+    int max_line_length;
+    int broadcast_batch_ms;
+    int history_size;
+    int history_replay;
+    bool chat_persist;
+    char chat_persist_dir[PATH_MAX];
+    int chat_segment_size_mb;
+    int chat_fsync_interval_ms;
+    int chat_shards;
+    int flood_user_rate;  // Messages per second per user (0 = unlimited)
+    int flood_user_burst;
+    int flood_room_rate;  // Messages per second per room (0 = unlimited)
+    int flood_room_burst;
+    FloodAction flood_action;
+
+    // Federation settings
+    bool federation_enabled;
+    char federation_node[64];
+    int federation_port;
+    char federation_bind[64]; // IPv4 address of the peer listener
+    char federation_peers[512];
+    int federation_reconnect_ms;
 
     // Security settings
     int rate_limit_requests;
     int rate_limit_window;
     bool enable_access_control;
+    char access_allow[1024]; // Comma-separated CIDR lists
+    char access_deny[1024];
+    char access_file[PATH_MAX]; // "allow|deny <cidr>" lines, for large lists
 } ServerConfig;
 
 // Function prototypes
@@ -2,6 +2,8 @@
 #define CONNECTION_H
 
 #include "common.h"
+#include "flight_recorder.h"
+#include "timer_wheel.h"
 
 // Connection state
 typedef enum
@@ -10,14 +12,30 @@ typedef enum
     CONN_STATE_READING,
     CONN_STATE_PROCESSING,
     CONN_STATE_WRITING,
-    CONN_STATE_CLOSING
+    CONN_STATE_CLOSING,
+    CONN_STATE_HANDOFF // Being moved to another event loop thread
 } ConnectionState;
 
+// Upper bound for queued output per connection (slow consumer protection)
+#define MAX_WRITE_BUFFER (1024 * 1024)
+
+// Per-connection deadlines, each an independent timer on the owning pool's wheel
+typedef enum
+{
+    CONN_DEADLINE_IDLE = 0, // No traffic in either direction
+    CONN_DEADLINE_HEADER,   // HTTP request headers not complete (slowloris)
+    CONN_DEADLINE_WRITE,    // Pending output made no progress
+    CONN_DEADLINE_COUNT
+} ConnectionDeadline;
+
+struct ConnectionPool;
+
 // Connection structure
 typedef struct
 {
     int fd;                    // Socket file descriptor
     char ip[INET6_ADDRSTRLEN]; // Client IP address
+    struct in_addr addr;       // Client IP address, binary
     int port;                  // Client port
     time_t connected_at;       // Connection timestamp
     time_t last_activity;      // Last activity timestamp
@@ -28,6 +46,13 @@ typedef struct
     char *read_buffer;       // Read buffer
     size_t read_buffer_size; // Read buffer size
     size_t read_buffer_used; // Bytes used in read buffer
+    size_t read_line_start;  // Start of the first unconsumed line
+    size_t read_scan_offset; // Bytes already scanned for a newline
+    bool discarding_line;    // Dropping the rest of an overlong line
+
+    char *ws_message;       // WebSocket message being reassembled
+    size_t ws_message_used; // Bytes of it received so far
+    bool ws_fragmented;     // A fragmented message is in progress
 
     char *write_buffer;       // Write buffer
     size_t write_buffer_size; // Write buffer size
@@ -38,18 +63,29 @@ typedef struct
     void *protocol_data;          // Protocol-specific data pointer
     void (*cleanup_func)(void *); // Cleanup function for protocol data
 
+    // Deadlines, armed while the connection belongs to a pool
+    struct ConnectionPool *pool;          // Owning pool, NULL while in transit
+    Timer deadlines[CONN_DEADLINE_COUNT]; // Indexed by ConnectionDeadline
+
+    long long request_started_us; // First byte of the HTTP request, for the access log
+    long long accepted_ns;        // Accept time until the first byte is sent, then 0
+    FlightRing flight;            // Recent events, dumped by the flight recorder
+
     // Flags
     bool keep_alive;       // Keep connection alive
     bool has_data_to_send; // Has data waiting to be sent
 } Connection;
 
-// Connection pool structure
-typedef struct
+// Connection pool structure; each pool is driven by exactly one event loop
+typedef struct ConnectionPool
 {
     Connection **connections; // Array of connection pointers
     int max_connections;      // Maximum connections allowed
     int active_connections;   // Currently active connections
     int total_connections;    // Total connections served
+
+    TimerWheel timers;                    // Deadlines of the pooled connections
+    int deadline_ms[CONN_DEADLINE_COUNT]; // Timeout per deadline kind
 } ConnectionPool;
 
 // Function prototypes
@@ -59,11 +95,24 @@ Connection *connection_create(int fd, struct sockaddr_in *client_addr);
 void connection_destroy(Connection *conn);
 int connection_pool_add(ConnectionPool *pool, Connection *conn);
 void connection_pool_remove(ConnectionPool *pool, Connection *conn);
+void connection_pool_detach(ConnectionPool *pool, Connection *conn);
 Connection *connection_pool_find_by_fd(ConnectionPool *pool, int fd);
-void connection_pool_cleanup_idle(ConnectionPool *pool, int timeout);
+void connection_pool_set_timeouts(ConnectionPool *pool, int idle_timeout, int header_timeout, int write_timeout);
+int connection_pool_expire(ConnectionPool *pool);
+void connection_arm_deadline(Connection *conn, ConnectionDeadline deadline);
+void connection_cancel_deadline(Connection *conn, ConnectionDeadline deadline);
 int connection_read(Connection *conn);
 int connection_write(Connection *conn);
 void connection_set_protocol_data(Connection *conn, void *data, void (*cleanup)(void *));
+const char *connection_protocol_name(ProtocolType protocol);
 void connection_prepare_response(Connection *conn, const char *data, size_t length);
+int connection_queue_data(Connection *conn, const char *data, size_t length);
+int connection_queue_raw(Connection *conn, const char *data, size_t length);
+int connection_reserve_write(Connection *conn, size_t length);
+
+// Line framing for newline-delimited protocols
+const char *connection_scan_newline(const char *data, size_t length);
+int connection_next_line(Connection *conn, size_t max_line_length, char **line, size_t *line_length);
+void connection_compact_read_buffer(Connection *conn);
 
 #endif // CONNECTION_H
@@ -2,17 +2,33 @@
 #define ENHANCED_CHAT_H
 
 #include "common.h"
+#include "config.h"
 #include "connection.h"
+#include "token_bucket.h"
 
 #define MAX_NICKNAME_LENGTH 32
 #define MAX_ROOM_NAME_LENGTH 32
 #define MAX_MESSAGE_LENGTH 512
 #define MAX_USERS_PER_ROOM 50
 #define MAX_ROOMS 100
+#define CHAT_BATCH_BYTES 16384
+#define CHAT_BATCH_ENTRIES 256
+
+// Immutable, reference-counted message shared by every consumer of a
+// broadcast (recipients, room history)
+typedef struct ChatPayload
+{
+    int refcount;
+    size_t length;
+    char data[];
+} ChatPayload;
+
+struct ChatShardMessage;
 
 // Chat user structure
 typedef struct ChatUser
 {
+    unsigned long id; // Unique across shards
     char nickname[MAX_NICKNAME_LENGTH];
     Connection *connection;
     struct ChatRoom *current_room;
@@ -20,8 +36,38 @@ typedef struct ChatUser
     time_t last_activity;
     bool authenticated;
     bool is_admin;
+    bool binary;       // Speaks the length-prefixed binary protocol
+    bool nick_pending; // Input is held until a nickname claim resolves
+
+    // Flood control
+    TokenBucket flood_bucket;
+    char *flood_held;          // Message delayed by the flood limit
+    long long flood_resume_ms; // When the delayed message may go out
+
+    // Join that completes once the connection reaches the room's shard
+    int pending_shard;
+    char pending_room[MAX_ROOM_NAME_LENGTH];
+    char pending_password[64];
 } ChatUser;
 
+// Message held in a room's batching window
+typedef struct
+{
+    struct ChatUser *sender; // Excluded recipient (NULL = everyone)
+    size_t offset;           // Offset into the batch data
+    size_t length;           // Formatted message length
+} ChatBatchEntry;
+
+// Messages produced during one batching window, fanned out together
+typedef struct
+{
+    char data[CHAT_BATCH_BYTES];
+    ChatBatchEntry entries[CHAT_BATCH_ENTRIES];
+    size_t used;
+    int count;
+    long long deadline_ms; // Monotonic time at which the window closes
+} ChatBatch;
+
 // Chat room structure
 typedef struct ChatRoom
 {
@@ -33,8 +79,28 @@ typedef struct ChatRoom
     bool password_protected;
     char password[64];
     bool private_room;
+    ChatBatch *batch; // Pending broadcast batch, allocated on first use
+    TokenBucket flood_bucket;
+
+    // Recent message history ring, allocated on first message
+    ChatPayload **history;
+    int history_capacity;
+    int history_head;  // Slot the next message is written to
+    int history_count; // Messages currently held
+
+    // Read-only event stream subscribers
+    Connection **watchers;
+    int watcher_count;
+    int watcher_capacity;
 } ChatRoom;
 
+// Event stream subscription held by a watcher connection
+typedef struct
+{
+    Connection *connection;
+    char room[MAX_ROOM_NAME_LENGTH];
+} ChatWatcher;
+
 // Chat server structure
 typedef struct ChatServer
 {
@@ -44,6 +110,21 @@ typedef struct ChatServer
     int user_count;
     time_t start_time;
 
+    // Limits
+    int max_line_length;
+    int broadcast_batch_ms;
+    int history_size;   // Messages kept per room (0 = off)
+    int history_replay; // Messages replayed on join (0 = off)
+    time_t last_heartbeat; // Last keep-alive sent to event streams
+
+    // Flood control (rates in messages per second, 0 = unlimited)
+    int flood_user_rate;
+    int flood_user_burst;
+    int flood_room_rate;
+    int flood_room_burst;
+    FloodAction flood_action;
+    int delayed_users; // Users holding a message back
+
     // Statistics
     int total_messages;
     int total_users_served;
@@ -54,6 +135,11 @@ typedef struct ChatServer
 ChatServer *chat_server_create(void);
 void chat_server_destroy(ChatServer *chat_server);
 
+// Shared payloads
+ChatPayload *chat_payload_create(const char *data, size_t length);
+ChatPayload *chat_payload_ref(ChatPayload *payload);
+void chat_payload_unref(ChatPayload *payload);
+
 // User management
 ChatUser *chat_user_create(Connection *conn);
 void chat_user_destroy(ChatUser *user);
@@ -64,8 +150,9 @@ int chat_authenticate_user(ChatUser *user, const char *nickname);
 // Room management
 ChatRoom *chat_room_create(const char *name);
 void chat_room_destroy(ChatRoom *room);
+bool chat_room_name_valid(const char *name);
 ChatRoom *chat_find_room(ChatServer *server, const char *name);
-int chat_join_room(ChatServer *server, ChatUser *user, const char *room_name, const char *password);
+int chat_join_room(ChatServer *server, ChatUser *user, const char *room_name, const char *password); // 0 or -ChatStatus
 int chat_leave_room(ChatUser *user);
 void chat_list_rooms(ChatServer *server, ChatUser *user);
 void chat_list_users_in_room(ChatRoom *room, ChatUser *requesting_user);
@@ -75,6 +162,14 @@ void chat_broadcast_to_room(ChatRoom *room, const char *message, ChatUser *sende
 void chat_send_private_message(ChatUser *sender, ChatUser *recipient, const char *message);
 void chat_send_system_message(ChatUser *user, const char *message);
 void chat_announce_to_room(ChatRoom *room, const char *message);
+void chat_flush_batches(ChatServer *server, bool force);
+void chat_release_delayed(ChatServer *server);
+bool chat_connection_paused(const Connection *conn);
+int chat_next_timeout_ms(ChatServer *server);
+
+// Event streams
+int chat_watch_room(Connection *conn, const char *room_name);
+void chat_send_heartbeats(ChatServer *server);
 
 // Command processing
 int chat_process_command(ChatServer *server, ChatUser *user, const char *input);
@@ -85,12 +180,24 @@ void chat_handle_nick_command(ChatServer *server, ChatUser *user, const char *ar
 void chat_handle_help_command(ChatUser *user);
 void chat_handle_list_command(ChatServer *server, ChatUser *user, const char *args);
 void chat_handle_stats_command(ChatServer *server, ChatUser *user);
+void chat_handle_history_command(ChatServer *server, ChatUser *user, const char *args);
+void chat_handle_binary_command(ChatUser *user);
+void chat_send_history(ChatRoom *room, ChatUser *user, int count);
 
 // Enhanced chat handler
+ChatUser *chat_attach_connection(ChatServer *server, Connection *conn);
 int enhanced_chat_handler(ChatServer *server, Connection *conn);
 
+// Shard integration
+void chat_set_current_server(ChatServer *server);
+void chat_handle_shard_message(ChatServer *server, struct ChatShardMessage *message);
+void chat_handoff_connection(Connection *conn);
+int chat_server_add_room(ChatServer *server, ChatRoom *room);
+ChatUser *chat_find_user_by_id(ChatServer *server, unsigned long id);
+
 // Global chat system functions
-int chat_system_init(void);
+int chat_system_init(const ServerConfig *config);
+int chat_system_start(const ServerConfig *config, ConnectionPool *main_pool);
 ChatServer *chat_get_server(void);
 void chat_system_cleanup(void);
 
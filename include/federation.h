@@ -0,0 +1,47 @@
+#ifndef FEDERATION_H
+#define FEDERATION_H
+
+#include "common.h"
+#include "config.h"
+#include "enhanced_chat.h"
+
+#define FEDERATION_MAX_PEERS 16
+#define FEDERATION_MAX_LINKS (FEDERATION_MAX_PEERS * 2)
+#define FEDERATION_MAX_LINE (BUFFER_SIZE + 128)
+#define FEDERATION_MAX_OUTPUT (1024 * 1024)
+#define FEDERATION_MAX_ADDRESSES 8
+
+// Link to another multiserver node; the first peer slots are the
+// configured outbound peers, the rest hold accepted inbound links
+typedef struct
+{
+    char host[256]; // Dial target (outbound links only)
+    int port;
+    bool outbound;
+    int fd;
+    bool connecting;      // Non-blocking connect in progress
+    bool ready;           // HELLO received
+    char node[64];        // Remote node name
+    char known_node[64];  // Node an outbound peer led to last time
+    long long retry_at;   // Next dial attempt (ms, outbound links only)
+    struct in_addr addresses[FEDERATION_MAX_ADDRESSES]; // IPv4 addresses host resolved to
+    int address_count;
+    char input[FEDERATION_MAX_LINE];
+    size_t input_used;
+    char *output;
+    size_t output_used;
+    size_t output_size;
+    char rooms[MAX_ROOMS][MAX_ROOM_NAME_LENGTH]; // Rooms the peer has members in
+    int room_count;
+} FederationPeer;
+
+// Function prototypes
+int federation_start(const ServerConfig *config);
+void federation_stop(void);
+bool federation_enabled(void);
+
+// Called by the shard owning the room
+void federation_publish(const char *room, const char *data, size_t length);
+void federation_subscribe(const char *room, bool subscribed);
+
+#endif // FEDERATION_H
@@ -0,0 +1,71 @@
+#ifndef FLIGHT_RECORDER_H
+#define FLIGHT_RECORDER_H
+
+#include "common.h"
+
+// Recent events of every connection and of every event loop, kept in
+// fixed rings and written to a file on SIGUSR1 or the admin endpoint
+typedef enum
+{
+    FLIGHT_ACCEPT = 1,   // value: fd, detail: protocol once known
+    FLIGHT_READ,         // value: bytes
+    FLIGHT_READ_EAGAIN,
+    FLIGHT_PROTOCOL,     // detail: detected protocol
+    FLIGHT_COMMAND,      // detail: Histogram of the chat command
+    FLIGHT_WRITE,        // value: bytes
+    FLIGHT_WRITE_EAGAIN, // value: bytes still pending
+    FLIGHT_HANDOFF,      // value: shard handing the connection over
+    FLIGHT_ADOPT,        // value: shard taking it
+    FLIGHT_CLOSE,        // value: fd, detail: FlightCloseReason
+    FLIGHT_WAKEUP,       // value: ready descriptors
+    FLIGHT_SLOW_LOOP,    // value: busy milliseconds
+    FLIGHT_SIGNAL,       // value: signal number
+    FLIGHT_EVENT_COUNT
+} FlightEventType;
+
+// First cause found for a connection going away
+typedef enum
+{
+    FLIGHT_CLOSE_UNKNOWN = 0,
+    FLIGHT_CLOSE_PEER,
+    FLIGHT_CLOSE_READ_ERROR,
+    FLIGHT_CLOSE_WRITE_ERROR,
+    FLIGHT_CLOSE_IDLE,
+    FLIGHT_CLOSE_HEADER_TIMEOUT,
+    FLIGHT_CLOSE_WRITE_TIMEOUT,
+    FLIGHT_CLOSE_HANDLER, // Protocol handler gave up on it, e.g. /quit
+    FLIGHT_CLOSE_DONE,    // Response sent on a connection without keep-alive
+    FLIGHT_CLOSE_REASON_COUNT
+} FlightCloseReason;
+
+// Ring sizes; powers of two
+#define FLIGHT_CONNECTION_EVENTS 32
+#define FLIGHT_LOOP_EVENTS 4096
+
+typedef struct
+{
+    long long ms; // Loop clock, monotonic
+    unsigned short type;
+    unsigned short detail;
+    int value;
+} FlightEvent;
+
+typedef struct
+{
+    FlightEvent events[FLIGHT_CONNECTION_EVENTS];
+    unsigned int next;
+    unsigned short close_reason;
+} FlightRing;
+
+struct ConnectionPool;
+
+// Function prototypes
+void flight_recorder_init(const char *path, bool enabled);
+void flight_recorder_attach(const char *loop_name);
+void flight_record(FlightRing *ring, FlightEventType type, int detail, int value);
+void flight_record_close(FlightRing *ring, FlightCloseReason reason);
+void flight_record_loop(FlightEventType type, int detail, int value);
+int flight_recorder_request_dump(const char *reason);
+void flight_recorder_poll(struct ConnectionPool *pool);
+
+#endif // FLIGHT_RECORDER_H
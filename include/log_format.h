@@ -0,0 +1,41 @@
+#ifndef LOG_FORMAT_H
+#define LOG_FORMAT_H
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Binary log files ([logging] format = binary) are a sequence of records,
+// each starting with a type byte. Integers are in host byte order; the
+// header's byte-order mark lets the decoder refuse foreign files.
+//
+//   header:  'H' "MSLOG" version(u8) byte_order(u32 = 0x01020304)
+//   format:  'F' id(u32) length(u16) text[length]
+//   message: 'M' time_ns(i64) level(u8) format_id(u32) length(u16) args[length]
+//
+// A header starts a new format table; every format is defined once
+// before the first message that uses it.
+#define LOG_BINARY_MAGIC "MSLOG"
+#define LOG_BINARY_VERSION 1
+#define LOG_BINARY_BYTE_ORDER 0x01020304u
+
+#define LOG_RECORD_HEADER 'H'
+#define LOG_RECORD_FORMAT 'F'
+#define LOG_RECORD_MESSAGE 'M'
+
+#define LOG_BINARY_HEADER_SIZE (1 + 5 + 1 + 4)
+#define LOG_BINARY_FORMAT_SIZE (1 + 4 + 2)
+#define LOG_BINARY_MESSAGE_SIZE (1 + 8 + 1 + 4 + 2)
+
+// Encoded arguments: a tag byte, then the value
+#define LOG_ARG_SIGNED 'i'   // int64
+#define LOG_ARG_UNSIGNED 'u' // uint64
+#define LOG_ARG_DOUBLE 'f'   // double
+#define LOG_ARG_POINTER 'p'  // uint64
+#define LOG_ARG_STRING 's'   // length(u16) bytes[length]
+
+// Function prototypes
+size_t log_args_encode(char *out, size_t size, const char *format, va_list args);
+size_t log_args_render(char *out, size_t size, const char *format, const char *args, size_t length);
+
+#endif // LOG_FORMAT_H
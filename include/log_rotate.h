@@ -0,0 +1,14 @@
+#ifndef LOG_ROTATE_H
+#define LOG_ROTATE_H
+
+#include "common.h"
+#include "config.h"
+
+// Function prototypes
+void log_rotate_init(const ServerConfig *config);
+bool log_rotate_enabled(void);
+bool log_rotate_due(long long file_bytes, time_t now);
+int log_rotate_archive(const char *path, char *archive, size_t size);
+void log_rotate_cleanup(void);
+
+#endif // LOG_ROTATE_H
@@ -15,22 +15,47 @@
 #define COLOR_WHITE "\033[37m"
 #define COLOR_GRAY "\033[90m"
 
+// Lowest level compiled in; calls below it disappear together with their
+// arguments (build with make LOG_MIN_LEVEL=INFO)
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL LOG_DEBUG
+#endif
+
+// Module of the including file; define LOG_MODULE before including this header
+#ifndef LOG_MODULE
+#define LOG_MODULE LOG_MODULE_SERVER
+#endif
+
 // Log level strings
 extern const char *log_level_strings[];
 extern const char *log_level_colors[];
+extern const char *log_module_names[];
+
+// Effective runtime level per module
+extern LogLevel log_module_levels[LOG_MODULE_COUNT];
 
 // Function prototypes
 int logging_init(const ServerConfig *config);
+int logging_start(void);
+void logging_reopen(void);
 void logging_cleanup(void);
 void log_message(LogLevel level, const char *format, ...);
 void log_raw(LogLevel level, const char *message);
 const char *get_timestamp(void);
 
-// Convenience macros
-#define log_debug(fmt, ...) log_message(LOG_DEBUG, fmt, ##__VA_ARGS__)
-#define log_info(fmt, ...)  log_message(LOG_INFO, fmt, ##__VA_ARGS__)
-#define log_warn(fmt, ...)  log_message(LOG_WARN, fmt, ##__VA_ARGS__)
-#define log_error(fmt, ...) log_message(LOG_ERROR, fmt, ##__VA_ARGS__)
-#define log_fatal(fmt, ...) log_message(LOG_FATAL, fmt, ##__VA_ARGS__)
+// Convenience macros; the level check happens here, so arguments of
+// disabled calls are never evaluated
+#define log_at(level, fmt, ...)                                                      \
+    do                                                                               \
+    {                                                                                \
+        if ((level) >= LOG_COMPILE_LEVEL && (level) >= log_module_levels[LOG_MODULE]) \
+            log_message(level, fmt, ##__VA_ARGS__);                                  \
+    } while (0)
+
+#define log_debug(fmt, ...) log_at(LOG_DEBUG, fmt, ##__VA_ARGS__)
+#define log_info(fmt, ...)  log_at(LOG_INFO, fmt, ##__VA_ARGS__)
+#define log_warn(fmt, ...)  log_at(LOG_WARN, fmt, ##__VA_ARGS__)
+#define log_error(fmt, ...) log_at(LOG_ERROR, fmt, ##__VA_ARGS__)
+#define log_fatal(fmt, ...) log_at(LOG_FATAL, fmt, ##__VA_ARGS__)
 
 #endif // LOGGING_H
@@ -0,0 +1,58 @@
+#ifndef LOOP_PROFILE_H
+#define LOOP_PROFILE_H
+
+#include "common.h"
+#include "connection.h"
+
+// What an event loop was doing when a handler ran
+typedef enum
+{
+    LOOP_STAGE_INBOX = 0, // Messages from other chat shards
+    LOOP_STAGE_ACCEPT,
+    LOOP_STAGE_READ,      // Read plus protocol handler
+    LOOP_STAGE_TIMERS,    // Batch windows, heartbeats, delayed senders
+    LOOP_STAGE_EXPIRE,    // Connection deadlines
+    LOOP_STAGE_WRITE,
+    LOOP_STAGE_HANDOFF,   // Moving a connection to another shard
+    LOOP_STAGE_COUNT
+} LoopStage;
+
+// Longest handlers kept per iteration for the slow-iteration report
+#define LOOP_PROFILE_TOP 3
+
+typedef struct
+{
+    LoopStage stage;
+    long long ns;
+    int fd; // -1 when no connection was involved
+    char peer[INET6_ADDRSTRLEN + 8];
+    ProtocolType protocol;
+} LoopHandlerSample;
+
+// Owned by one event loop; only that loop's thread touches it
+typedef struct
+{
+    char name[16];     // Loop named in reports, e.g. "main" or "shard 2"
+    long long slow_ns; // Report iterations busy for longer, 0 = off
+    long long iteration_started_ns;
+    long long wait_started_ns;
+    long long wait_ns;
+    long long handler_started_ns;
+    int events;
+    int handlers;
+    LoopHandlerSample top[LOOP_PROFILE_TOP];
+    int top_count;
+    time_t last_report;
+    int suppressed_reports;
+} LoopProfile;
+
+// Function prototypes
+void loop_profile_init(LoopProfile *profile, const char *name, int slow_ms);
+void loop_profile_begin(LoopProfile *profile);
+void loop_profile_wait_begin(LoopProfile *profile);
+void loop_profile_wait_end(LoopProfile *profile, int events);
+void loop_profile_handler_begin(LoopProfile *profile);
+void loop_profile_handler_end(LoopProfile *profile, LoopStage stage, const Connection *conn);
+void loop_profile_end(LoopProfile *profile);
+
+#endif // LOOP_PROFILE_H
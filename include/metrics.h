@@ -0,0 +1,81 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include "common.h"
+
+// Every counter and gauge the server exports; names, help texts and types
+// live in the table in metrics.c
+typedef enum
+{
+    METRIC_CONNECTIONS_ACCEPTED = 0,
+    METRIC_CONNECTIONS_ACTIVE, // Gauge
+    METRIC_CONNECTION_TIMEOUTS,
+    METRIC_HTTP_REQUESTS,
+    METRIC_CHAT_MESSAGES,
+    METRIC_BYTES_RECEIVED,
+    METRIC_BYTES_SENT,
+    METRIC_RATE_LIMITED,
+    METRIC_ACCESS_DENIED,
+    METRIC_LOOP_WAKEUPS,
+    METRIC_LOOP_EVENTS,
+    METRIC_SLOW_LOOPS,
+    METRIC_COUNT
+} Metric;
+
+// Latency histograms, in nanoseconds; chat commands share one family
+// with a command label
+typedef enum
+{
+    HISTOGRAM_FIRST_BYTE = 0,
+    HISTOGRAM_HTTP_REQUEST,
+    HISTOGRAM_LOOP_ITERATION,
+    HISTOGRAM_LOOP_SELECT,
+    HISTOGRAM_LOOP_HANDLER,
+    HISTOGRAM_CHAT_FANOUT,
+    HISTOGRAM_CHAT_MESSAGE,
+    HISTOGRAM_CHAT_HELP,
+    HISTOGRAM_CHAT_JOIN,
+    HISTOGRAM_CHAT_LEAVE,
+    HISTOGRAM_CHAT_MSG,
+    HISTOGRAM_CHAT_NICK,
+    HISTOGRAM_CHAT_LIST,
+    HISTOGRAM_CHAT_STATS,
+    HISTOGRAM_CHAT_HISTORY,
+    HISTOGRAM_CHAT_BINARY,
+    HISTOGRAM_CHAT_TIME,
+    HISTOGRAM_CHAT_CLEAR,
+    HISTOGRAM_CHAT_QUIT,
+    HISTOGRAM_CHAT_UNKNOWN,
+    HISTOGRAM_COUNT
+} Histogram;
+
+// Log-linear buckets: 16 per power of two (at most 6.25% error) up to
+// 2^40 ns, about 18 minutes; longer samples land in the last bucket
+#define HISTOGRAM_SUB_BUCKET_BITS 4
+#define HISTOGRAM_MAX_BITS 40
+#define HISTOGRAM_BUCKETS ((HISTOGRAM_MAX_BITS - HISTOGRAM_SUB_BUCKET_BITS + 1) << HISTOGRAM_SUB_BUCKET_BITS)
+
+// Percentiles report the highest value of their bucket
+typedef struct
+{
+    unsigned long count;
+    long long sum_ns;
+    long long p50_ns;
+    long long p90_ns;
+    long long p99_ns;
+    long long p999_ns;
+    long long max_ns;
+} HistogramSummary;
+
+// Threads with their own slot; later threads share one contended slot
+#define METRICS_MAX_THREADS 128
+
+// Function prototypes
+void metrics_add(Metric metric, long delta);
+long metrics_value(Metric metric);
+void metrics_observe(Histogram histogram, long long ns);
+bool metrics_summarize(Histogram histogram, HistogramSummary *summary);
+const char *metrics_histogram_name(Histogram histogram);
+size_t metrics_render(char *out, size_t size, time_t uptime);
+
+#endif // METRICS_H
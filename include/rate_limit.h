@@ -0,0 +1,37 @@
+#ifndef RATE_LIMIT_H
+#define RATE_LIMIT_H
+
+#include "common.h"
+#include <stdint.h>
+
+#define RATE_LIMIT_SETS 2048 // Power of two
+#define RATE_LIMIT_WAYS 4    // Entries per set, one cache line
+
+// Per-address sliding window, approximated from the counts of the
+// current and the previous fixed window
+typedef struct
+{
+    uint32_t addr;     // IPv4 address in network order (0 = free slot)
+    uint32_t window;   // Index of the current window
+    uint32_t current;  // Requests counted in the current window
+    uint32_t previous; // Requests counted in the previous window
+} RateLimitEntry;
+
+// Fixed-size, set-associative table: memory stays bounded however many
+// addresses show up, and the least recently active entry of a full set
+// is recycled. Only used by the main event loop, so it takes no locks.
+typedef struct
+{
+    RateLimitEntry sets[RATE_LIMIT_SETS][RATE_LIMIT_WAYS];
+    uint32_t limit;     // Requests allowed per window
+    long long window_ms;
+    char response[256]; // Prebuilt 429 answer
+    size_t response_length;
+} RateLimiter;
+
+// Function prototypes
+RateLimiter *rate_limit_create(int requests, int window_seconds);
+void rate_limit_destroy(RateLimiter *limiter);
+bool rate_limit_check(RateLimiter *limiter, struct in_addr addr, bool consume);
+
+#endif // RATE_LIMIT_H
@@ -5,17 +5,13 @@
 #include "config.h"
 #include "connection.h"
 #include "enhanced_chat.h"
+#include "acl.h"
+#include "rate_limit.h"
 
-// Server statistics
+// Server statistics; the counters themselves live in the metrics registry
 typedef struct
 {
-    int total_connections;
-    int active_connections;
-    int http_requests;
-    int chat_messages;
     time_t start_time;
-    unsigned long bytes_sent;
-    unsigned long bytes_received;
 } ServerStats;
 
 // Server structure
@@ -24,6 +20,8 @@ typedef struct
     ServerConfig *config;
     ConnectionPool *conn_pool;
     ServerStats stats;
+    RateLimiter *rate_limiter; // NULL when rate limiting is off
+    AccessList *access_list;   // NULL when access control is off
 
     // Sockets
     int http_socket;
@@ -0,0 +1,19 @@
+#ifndef SSE_H
+#define SSE_H
+
+#include "common.h"
+#include "connection.h"
+
+// Room event streams are served at /events/<room>
+#define SSE_PATH_PREFIX "/events/"
+
+// Seconds between keep-alive comments on idle streams
+#define SSE_HEARTBEAT_INTERVAL 15
+
+// Function prototypes
+int sse_parse_request(const char *request, size_t length, char *room, size_t room_size);
+int sse_accept(Connection *conn);
+char *sse_encode_event(const char *data, size_t length, size_t *event_length);
+int sse_queue_heartbeat(Connection *conn);
+
+#endif // SSE_H
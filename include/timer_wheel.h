@@ -0,0 +1,45 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include "common.h"
+
+// Hierarchical timing wheel: four levels of 64 slots over 100 ms ticks,
+// covering 6.4 s, 6.8 min, 7.3 h and 19.4 days. Later deadlines are
+// clamped to the last slot and simply fire early at that horizon.
+#define TIMER_WHEEL_TICK_MS 100
+#define TIMER_WHEEL_LEVELS 4
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+
+// Intrusive list link; the first member of Timer so slot heads can be bare links
+typedef struct TimerLink
+{
+    struct TimerLink *next;
+    struct TimerLink *prev;
+} TimerLink;
+
+typedef struct Timer
+{
+    TimerLink link;                        // Slot membership, NULL when not armed
+    unsigned long long expires;            // Tick the timer fires at
+    void (*callback)(struct Timer *timer); // Run by timer_wheel_advance
+    void *data;                            // Owner of the timer
+} Timer;
+
+// One wheel per event loop; never shared between threads
+typedef struct
+{
+    TimerLink slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+    unsigned long long next_tick; // First tick not yet processed
+    int armed;                    // Timers currently scheduled
+} TimerWheel;
+
+// Function prototypes
+void timer_wheel_init(TimerWheel *wheel, long long now_ms);
+void timer_init(Timer *timer, void (*callback)(Timer *timer), void *data);
+void timer_wheel_schedule(TimerWheel *wheel, Timer *timer, long long expires_ms);
+void timer_wheel_cancel(TimerWheel *wheel, Timer *timer);
+int timer_wheel_advance(TimerWheel *wheel, long long now_ms);
+bool timer_pending(const Timer *timer);
+
+#endif // TIMER_WHEEL_H
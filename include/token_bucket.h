@@ -0,0 +1,22 @@
+#ifndef TOKEN_BUCKET_H
+#define TOKEN_BUCKET_H
+
+#include "common.h"
+
+// Token bucket kept in thousandths of a token, so a rate of N tokens per
+// second refills exactly N units per millisecond. Rate and burst live in
+// the caller's configuration; the bucket only holds the running state.
+// A zeroed bucket starts full on its first refill.
+typedef struct
+{
+    long long units;      // Available thousandths of a token
+    long long updated_ms; // Monotonic time of the last refill
+} TokenBucket;
+
+// Function prototypes
+void token_bucket_refill(TokenBucket *bucket, int rate, int burst, long long now_ms);
+bool token_bucket_available(const TokenBucket *bucket);
+void token_bucket_take(TokenBucket *bucket);
+long long token_bucket_wait_ms(const TokenBucket *bucket, int rate);
+
+#endif // TOKEN_BUCKET_H
@@ -0,0 +1,37 @@
+#ifndef WEBSOCKET_H
+#define WEBSOCKET_H
+
+#include "common.h"
+#include "connection.h"
+
+#define WS_GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+#define WS_MAX_HEADER_SIZE 10 // Server frames are never masked
+#define WS_MAX_MESSAGE (BUFFER_SIZE - 16)
+
+// WebSocket opcodes (RFC 6455, section 5.2)
+typedef enum
+{
+    WS_OP_CONTINUATION = 0x0,
+    WS_OP_TEXT = 0x1,
+    WS_OP_BINARY = 0x2,
+    WS_OP_CLOSE = 0x8,
+    WS_OP_PING = 0x9,
+    WS_OP_PONG = 0xA
+} WebSocketOpcode;
+
+// Close status codes
+#define WS_CLOSE_NORMAL 1000
+#define WS_CLOSE_PROTOCOL_ERROR 1002
+#define WS_CLOSE_TOO_BIG 1009
+
+// Handshake
+bool websocket_is_upgrade(const char *request, size_t length);
+int websocket_accept(Connection *conn);
+
+// Framing
+size_t websocket_encode_header(unsigned char *header, WebSocketOpcode opcode, size_t length);
+char *websocket_encode_frame(WebSocketOpcode opcode, const char *data, size_t length, size_t *frame_length);
+int websocket_queue_frame(Connection *conn, WebSocketOpcode opcode, const char *data, size_t length);
+int websocket_next_message(Connection *conn, size_t max_length, char **message, size_t *length);
+
+#endif // WEBSOCKET_H
@@ -0,0 +1,362 @@
+#include "access_log.h"
+#include "clock.h"
+#include "logging.h"
+
+#define ACCESS_LOG_FLUSH_MS 1000
+
+// Lines are appended to active_buffer by the event loop under access_lock;
+// the writer thread swaps it out and does every write() itself, so the
+// loop never waits on the disk. Both buffers have the configured size.
+typedef struct
+{
+    char *data;
+    size_t used;
+} AccessLogBuffer;
+
+static bool access_enabled = false;
+static char access_path[PATH_MAX];
+static int access_fd = -1;
+static int sample_every = 1;
+static unsigned long sample_counter = 0;
+static size_t buffer_size = 0;
+
+static AccessLogBuffer active_buffer;
+static AccessLogBuffer flushing_buffer;
+static unsigned long dropped_lines = 0;
+
+static pthread_t writer_thread;
+static pthread_mutex_t access_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t access_cond = PTHREAD_COND_INITIALIZER;
+static bool flush_requested = false;
+static bool reopen_requested = false;
+static bool writer_stop = false;
+
+static int open_access_file(void)
+{
+    access_fd = open(access_path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    return access_fd < 0 ? -1 : 0;
+}
+
+static void write_fully(int fd, const char *data, size_t length)
+{
+    while (length > 0)
+    {
+        ssize_t written = write(fd, data, length);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            log_error("Access log write failed: %s", strerror(errno));
+            return;
+        }
+        data += written;
+        length -= (size_t)written;
+    }
+}
+
+static void *access_log_writer(void *arg)
+{
+    (void)arg;
+
+    pthread_mutex_lock(&access_lock);
+    for (;;)
+    {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += ACCESS_LOG_FLUSH_MS / 1000;
+
+        while (!writer_stop && !flush_requested && !reopen_requested)
+        {
+            if (pthread_cond_timedwait(&access_cond, &access_lock, &deadline) == ETIMEDOUT)
+                break;
+        }
+
+        AccessLogBuffer swap = flushing_buffer;
+        flushing_buffer = active_buffer;
+        active_buffer = swap;
+        active_buffer.used = 0;
+        flush_requested = false;
+        bool reopen = reopen_requested;
+        reopen_requested = false;
+        unsigned long dropped = dropped_lines;
+        dropped_lines = 0;
+        bool stopping = writer_stop;
+        pthread_mutex_unlock(&access_lock);
+
+        if (flushing_buffer.used > 0 && access_fd >= 0)
+            write_fully(access_fd, flushing_buffer.data, flushing_buffer.used);
+        flushing_buffer.used = 0;
+
+        if (dropped > 0)
+            log_warn("Access log buffer full, dropped %lu lines", dropped);
+
+        // Lines swapped out above still went to the old file
+        if (reopen)
+        {
+            if (access_fd >= 0)
+                close(access_fd);
+            if (open_access_file() < 0)
+                log_error("Failed to reopen access log %s: %s", access_path, strerror(errno));
+            else
+                log_info("Access log reopened");
+        }
+
+        if (stopping)
+            return NULL;
+
+        pthread_mutex_lock(&access_lock);
+    }
+}
+
+int access_log_open(const ServerConfig *config)
+{
+    if (!config || config->access_log_file[0] == '\0')
+        return 0;
+
+    snprintf(access_path, sizeof(access_path), "%s", config->access_log_file);
+    sample_every = config->access_log_sample;
+    buffer_size = (size_t)config->access_log_buffer_kb * 1024;
+
+    if (open_access_file() < 0)
+    {
+        log_error("Failed to open access log %s: %s", access_path, strerror(errno));
+        return -1;
+    }
+
+    active_buffer.data = malloc(buffer_size);
+    flushing_buffer.data = malloc(buffer_size);
+    if (!active_buffer.data || !flushing_buffer.data)
+    {
+        log_error("Failed to allocate access log buffers");
+        free(active_buffer.data);
+        free(flushing_buffer.data);
+        active_buffer.data = NULL;
+        flushing_buffer.data = NULL;
+        close(access_fd);
+        access_fd = -1;
+        return -1;
+    }
+
+    writer_stop = false;
+    if (pthread_create(&writer_thread, NULL, access_log_writer, NULL) != 0)
+    {
+        log_error("Failed to start access log writer thread");
+        free(active_buffer.data);
+        free(flushing_buffer.data);
+        active_buffer.data = NULL;
+        flushing_buffer.data = NULL;
+        close(access_fd);
+        access_fd = -1;
+        return -1;
+    }
+
+    access_enabled = true;
+    if (sample_every > 1)
+        log_info("Access log enabled in %s (1 in %d requests)", access_path, sample_every);
+    else
+        log_info("Access log enabled in %s", access_path);
+    return 0;
+}
+
+void access_log_close(void)
+{
+    if (!access_enabled)
+        return;
+
+    pthread_mutex_lock(&access_lock);
+    writer_stop = true;
+    pthread_cond_signal(&access_cond);
+    pthread_mutex_unlock(&access_lock);
+
+    // The writer writes out whatever is still buffered before it exits
+    pthread_join(writer_thread, NULL);
+    access_enabled = false;
+
+    if (access_fd >= 0)
+    {
+        close(access_fd);
+        access_fd = -1;
+    }
+
+    free(active_buffer.data);
+    free(flushing_buffer.data);
+    memset(&active_buffer, 0, sizeof(active_buffer));
+    memset(&flushing_buffer, 0, sizeof(flushing_buffer));
+}
+
+// Reopen the file on the writer thread, e.g. after SIGHUP
+void access_log_reopen(void)
+{
+    if (!access_enabled)
+        return;
+
+    pthread_mutex_lock(&access_lock);
+    reopen_requested = true;
+    pthread_cond_signal(&access_cond);
+    pthread_mutex_unlock(&access_lock);
+}
+
+bool access_log_enabled(void)
+{
+    return access_enabled;
+}
+
+// Copy one field for a quoted log column, escaping quotes, backslashes and
+// control bytes as \xHH like other servers do; "-" when absent
+static size_t append_field(char *out, size_t size, const char *field, size_t length)
+{
+    if (length == 0)
+        return (size_t)snprintf(out, size, "-");
+
+    size_t used = 0;
+    for (size_t i = 0; i < length && used + 5 < size; i++)
+    {
+        unsigned char c = (unsigned char)field[i];
+        if (c == '"' || c == '\\' || c < 0x20 || c >= 0x7f)
+            used += (size_t)snprintf(out + used, size - used, "\\x%02X", c);
+        else
+            out[used++] = (char)c;
+    }
+    out[used] = '\0';
+    return used;
+}
+
+static size_t copy_field(char *out, const char *value, size_t length)
+{
+    if (!value)
+        return 0;
+    if (length > ACCESS_LOG_FIELD_MAX)
+        length = ACCESS_LOG_FIELD_MAX;
+    memcpy(out, value, length);
+    return length;
+}
+
+// Value of a request header, or NULL; headers ends at the blank line
+static const char *find_header(const char *headers, const char *end, const char *name, size_t *length)
+{
+    size_t name_length = strlen(name);
+    const char *line = headers;
+    while (line < end)
+    {
+        const char *next = memchr(line, '\n', (size_t)(end - line));
+        if (!next)
+            next = end;
+
+        if ((size_t)(next - line) > name_length && line[name_length] == ':' &&
+            strncasecmp(line, name, name_length) == 0)
+        {
+            const char *value = line + name_length + 1;
+            while (value < next && (*value == ' ' || *value == '\t'))
+                value++;
+            const char *value_end = next;
+            while (value_end > value && (value_end[-1] == '\r' || value_end[-1] == ' '))
+                value_end--;
+            *length = (size_t)(value_end - value);
+            return value;
+        }
+        line = next + 1;
+    }
+    return NULL;
+}
+
+// Take the request line and the headers the combined format shows while
+// the complete request head is still in the read buffer
+void access_log_begin(const Connection *conn, AccessLogRequest *request)
+{
+    request->request_length = 0;
+    request->referer_length = 0;
+    request->agent_length = 0;
+    if (!access_enabled)
+        return;
+
+    const char *data = conn->read_buffer;
+    const char *end = data + conn->read_buffer_used;
+    const char *line_end = memchr(data, '\n', conn->read_buffer_used);
+    if (!line_end)
+        line_end = end;
+    const char *headers_end = memmem(data, conn->read_buffer_used, "\r\n\r\n", 4);
+    if (!headers_end)
+        headers_end = end;
+
+    size_t length = (size_t)(line_end - data);
+    if (length > 0 && data[length - 1] == '\r')
+        length--;
+    request->request_length = copy_field(request->request, data, length);
+
+    const char *headers = line_end < end ? line_end + 1 : end;
+    const char *value = find_header(headers, headers_end, "Referer", &length);
+    request->referer_length = copy_field(request->referer, value, length);
+    value = find_header(headers, headers_end, "User-Agent", &length);
+    request->agent_length = copy_field(request->agent, value, length);
+}
+
+// Record the request just answered on conn, whose response head is at the
+// start of the write buffer. Called on the connection's event loop right
+// after the handler ran, before any of it is sent.
+void access_log_finish(const Connection *conn, const AccessLogRequest *request)
+{
+    if (!access_enabled)
+        return;
+
+    int status;
+    size_t body_bytes = 0;
+    if (conn->write_buffer && conn->write_buffer_used >= 12 && strncmp(conn->write_buffer, "HTTP/1.", 7) == 0)
+    {
+        status = atoi(conn->write_buffer + 9);
+
+        // Body bytes, as %b in the combined format
+        const char *head_end = memmem(conn->write_buffer, conn->write_buffer_used, "\r\n\r\n", 4);
+        if (head_end)
+            body_bytes = conn->write_buffer_used - (size_t)(head_end + 4 - conn->write_buffer);
+    }
+    else if (conn->protocol == PROTOCOL_SSE)
+    {
+        status = 200; // Stream opened by the shard it was handed to
+    }
+    else
+    {
+        return; // Nothing answered yet, e.g. an incomplete upgrade
+    }
+
+    // Sampling thins out successful requests only; errors are always kept
+    if (status < 400 && sample_every > 1 && sample_counter++ % (unsigned long)sample_every != 0)
+        return;
+
+    long long latency_us = conn->request_started_us > 0 ? clock_precise_us() - conn->request_started_us : 0;
+
+    char request_field[ACCESS_LOG_FIELD_MAX * 4 + 8];
+    char referer_field[ACCESS_LOG_FIELD_MAX * 4 + 8];
+    char agent_field[ACCESS_LOG_FIELD_MAX * 4 + 8];
+    append_field(request_field, sizeof(request_field), request->request, request->request_length);
+    append_field(referer_field, sizeof(referer_field), request->referer, request->referer_length);
+    append_field(agent_field, sizeof(agent_field), request->agent, request->agent_length);
+
+    char line[ACCESS_LOG_FIELD_MAX * 12 + 256];
+    int length = snprintf(line, sizeof(line), "%s - - [%s] \"%s\" %d %zu \"%s\" \"%s\" %lld\n",
+                          conn->ip, clock_access_date(), request_field, status, body_bytes,
+                          referer_field, agent_field, latency_us);
+    if (length <= 0)
+        return;
+    if ((size_t)length >= sizeof(line))
+        length = sizeof(line) - 1;
+
+    pthread_mutex_lock(&access_lock);
+    if (active_buffer.used + (size_t)length > buffer_size)
+    {
+        // Writer is behind; never block the event loop on disk
+        dropped_lines++;
+        flush_requested = true;
+        pthread_cond_signal(&access_cond);
+        pthread_mutex_unlock(&access_lock);
+        return;
+    }
+
+    memcpy(active_buffer.data + active_buffer.used, line, (size_t)length);
+    active_buffer.used += (size_t)length;
+    if (active_buffer.used > buffer_size / 2 && !flush_requested)
+    {
+        flush_requested = true;
+        pthread_cond_signal(&access_cond);
+    }
+    pthread_mutex_unlock(&access_lock);
+}
@@ -0,0 +1,381 @@
+#include "acl.h"
+#include "logging.h"
+
+AccessList *acl_create(void)
+{
+    AccessList *acl = calloc(1, sizeof(AccessList));
+    if (!acl)
+    {
+        log_error("Failed to allocate access list");
+        return NULL;
+    }
+
+    acl->node_capacity = 64;
+    acl->nodes = calloc(acl->node_capacity, sizeof(AclNode));
+    if (!acl->nodes)
+    {
+        log_error("Failed to allocate access list nodes");
+        free(acl);
+        return NULL;
+    }
+    acl->node_count = 1; // Index 0 is reserved
+    return acl;
+}
+
+void acl_destroy(AccessList *acl)
+{
+    if (!acl)
+        return;
+
+    free(acl->nodes);
+    free(acl->ipv4_jump);
+    free(acl);
+}
+
+static int key_bit(const uint8_t *key, int bit)
+{
+    return (key[bit >> 3] >> (7 - (bit & 7))) & 1;
+}
+
+// Number of leading bits two keys share, up to limit
+static int common_prefix(const uint8_t *a, const uint8_t *b, int limit)
+{
+    int bits = 0;
+    for (int i = 0; i < 16 && bits < limit; i++)
+    {
+        uint8_t diff = a[i] ^ b[i];
+        if (diff)
+        {
+            bits += __builtin_clz((unsigned int)diff) - 24;
+            break;
+        }
+        bits += 8;
+    }
+    return bits < limit ? bits : limit;
+}
+
+static bool prefix_matches(const uint8_t *prefix, const uint8_t *addr, int length)
+{
+    int bytes = length >> 3;
+    if (memcmp(prefix, addr, bytes) != 0)
+        return false;
+
+    int rest = length & 7;
+    if (rest == 0)
+        return true;
+
+    uint8_t mask = (uint8_t)(0xFF << (8 - rest));
+    return (addr[bytes] & mask) == prefix[bytes];
+}
+
+static void mask_key(uint8_t *key, int length)
+{
+    for (int bit = length; bit < 128; bit++)
+    {
+        key[bit >> 3] &= (uint8_t) ~(0x80 >> (bit & 7));
+    }
+}
+
+static uint32_t new_node(AccessList *acl, const uint8_t *key, int length, int action)
+{
+    if (acl->node_count == acl->node_capacity)
+    {
+        if (acl->node_capacity >= 0x3FFFFFFF / 2)
+            return 0;
+
+        uint32_t capacity = acl->node_capacity * 2;
+        AclNode *nodes = realloc(acl->nodes, capacity * sizeof(AclNode));
+        if (!nodes)
+            return 0;
+        acl->nodes = nodes;
+        acl->node_capacity = capacity;
+    }
+
+    uint32_t index = acl->node_count++;
+    AclNode *node = &acl->nodes[index];
+    memcpy(node->key, key, 16);
+    mask_key(node->key, length);
+    node->prefix_length = (uint8_t)length;
+    node->action = (int8_t)action;
+    node->child[0] = 0;
+    node->child[1] = 0;
+    return index;
+}
+
+// Convert an address to the 128-bit key space (IPv4 as ::ffff:a.b.c.d)
+static void ipv4_key(const struct in_addr *addr, uint8_t *key)
+{
+    memset(key, 0, 10);
+    key[10] = 0xFF;
+    key[11] = 0xFF;
+    memcpy(key + 12, &addr->s_addr, 4);
+}
+
+static int insert(AccessList *acl, const uint8_t *key, int length, int action)
+{
+    uint32_t parent = 0; // Node whose child[side] links to the current one
+    int side = 0;
+
+    // Links are re-derived after every allocation, which may move the array
+    for (;;)
+    {
+        uint32_t index = parent ? acl->nodes[parent].child[side] : acl->root;
+
+        if (index == 0)
+        {
+            uint32_t leaf = new_node(acl, key, length, action);
+            if (!leaf)
+                return -1;
+            *(parent ? &acl->nodes[parent].child[side] : &acl->root) = leaf;
+            return 0;
+        }
+
+        AclNode *node = &acl->nodes[index];
+        int node_length = node->prefix_length;
+        int common = common_prefix(node->key, key, node_length < length ? node_length : length);
+
+        if (common == node_length)
+        {
+            if (node_length == length)
+            {
+                // Same prefix again: the later rule wins
+                node->action = (int8_t)action;
+                return 0;
+            }
+
+            parent = index;
+            side = key_bit(key, node_length);
+            continue;
+        }
+
+        // The new prefix diverges inside this node's prefix: split it
+        uint32_t existing = index;
+        int existing_side = key_bit(node->key, common);
+        uint32_t split;
+
+        if (common == length)
+        {
+            // The new rule covers the existing node
+            split = new_node(acl, key, length, action);
+            if (!split)
+                return -1;
+        }
+        else
+        {
+            split = new_node(acl, key, common, -1);
+            uint32_t leaf = split ? new_node(acl, key, length, action) : 0;
+            if (!leaf)
+                return -1;
+            acl->nodes[split].child[!existing_side] = leaf;
+        }
+
+        acl->nodes[split].child[existing_side] = existing;
+        *(parent ? &acl->nodes[parent].child[side] : &acl->root) = split;
+        return 0;
+    }
+}
+
+// Add one "address[/prefix]" rule, IPv4 or IPv6
+int acl_add_rule(AccessList *acl, const char *cidr, int action)
+{
+    char address[INET6_ADDRSTRLEN];
+    const char *slash = strchr(cidr, '/');
+    size_t address_length = slash ? (size_t)(slash - cidr) : strlen(cidr);
+    if (address_length == 0 || address_length >= sizeof(address))
+        return -1;
+
+    memcpy(address, cidr, address_length);
+    address[address_length] = '\0';
+
+    uint8_t key[16];
+    int max_length;
+    int offset;
+    struct in_addr addr4;
+
+    if (inet_pton(AF_INET, address, &addr4) == 1)
+    {
+        ipv4_key(&addr4, key);
+        max_length = 32;
+        offset = 96;
+    }
+    else if (inet_pton(AF_INET6, address, key) == 1)
+    {
+        max_length = 128;
+        offset = 0;
+    }
+    else
+    {
+        return -1;
+    }
+
+    int length = max_length;
+    if (slash)
+    {
+        char *end;
+        long value = strtol(slash + 1, &end, 10);
+        if (end == slash + 1 || *end != '\0' || value < 0 || value > max_length)
+            return -1;
+        length = (int)value;
+    }
+
+    if (insert(acl, key, offset + length, action) < 0)
+        return -1;
+
+    if (action == ACL_ALLOW)
+        acl->allow_rules++;
+    else
+        acl->deny_rules++;
+    return 0;
+}
+
+// Add a comma-separated list of rules
+int acl_add_list(AccessList *acl, const char *list, int action)
+{
+    char *copy = strdup(list);
+    if (!copy)
+        return -1;
+
+    int result = 0;
+    char *saveptr;
+    for (char *token = strtok_r(copy, ", \t", &saveptr); token; token = strtok_r(NULL, ", \t", &saveptr))
+    {
+        if (acl_add_rule(acl, token, action) < 0)
+        {
+            log_error("Invalid access rule: %s", token);
+            result = -1;
+            break;
+        }
+    }
+
+    free(copy);
+    return result;
+}
+
+// Load "allow <cidr>" / "deny <cidr>" lines; '#' starts a comment
+int acl_load_file(AccessList *acl, const char *path)
+{
+    FILE *file = fopen(path, "r");
+    if (!file)
+    {
+        log_error("Cannot open access list %s: %s", path, strerror(errno));
+        return -1;
+    }
+
+    char line[256];
+    int line_number = 0;
+    int result = 0;
+
+    while (fgets(line, sizeof(line), file))
+    {
+        line_number++;
+
+        char *comment = strchr(line, '#');
+        if (comment)
+            *comment = '\0';
+
+        char verb[16];
+        char cidr[INET6_ADDRSTRLEN + 8];
+        int fields = sscanf(line, "%15s %51s", verb, cidr);
+        if (fields <= 0)
+            continue;
+
+        int action = strcasecmp(verb, "allow") == 0 ? ACL_ALLOW
+                     : strcasecmp(verb, "deny") == 0 ? ACL_DENY
+                                                     : -1;
+        if (fields != 2 || action < 0 || acl_add_rule(acl, cidr, action) < 0)
+        {
+            log_error("Invalid access rule at %s:%d", path, line_number);
+            result = -1;
+            break;
+        }
+    }
+
+    fclose(file);
+    return result;
+}
+
+// Walk the tree for key from node index, stopping in front of the first
+// node with a prefix of stop_length bits or more. Updates the decision
+// and returns where the walk stopped (0 when no further node can match).
+static uint32_t walk(const AccessList *acl, uint32_t index, const uint8_t *key, int stop_length, int *decision)
+{
+    while (index)
+    {
+        const AclNode *node = &acl->nodes[index];
+        if (node->prefix_length >= stop_length)
+            return index;
+        if (!prefix_matches(node->key, key, node->prefix_length))
+            return 0;
+
+        if (node->action >= 0)
+            *decision = node->action;
+        if (node->prefix_length == 128)
+            return 0;
+
+        index = node->child[key_bit(key, node->prefix_length)];
+    }
+    return 0;
+}
+
+// Precompute the walk for every /16 of the IPv4 space; call once all
+// rules are loaded (rules added later invalidate the table)
+int acl_build_index(AccessList *acl)
+{
+    size_t entries = (size_t)1 << ACL_IPV4_JUMP_BITS;
+    uint32_t *jump = realloc(acl->ipv4_jump, entries * sizeof(uint32_t));
+    if (!jump)
+        return -1;
+
+    for (size_t prefix = 0; prefix < entries; prefix++)
+    {
+        struct in_addr addr = {htonl((uint32_t)prefix << (32 - ACL_IPV4_JUMP_BITS))};
+        uint8_t key[16];
+        ipv4_key(&addr, key);
+
+        int decision = -1;
+        uint32_t resume = walk(acl, acl->root, key, 96 + ACL_IPV4_JUMP_BITS, &decision);
+        jump[prefix] = resume | (uint32_t)(decision + 1) << 30;
+    }
+
+    acl->ipv4_jump = jump;
+    return 0;
+}
+
+// Longest matching prefix decides. Addresses no rule covers are allowed
+// unless there are allow rules, which turn the list into a whitelist.
+bool acl_allows(const AccessList *acl, const struct sockaddr *addr)
+{
+    if (!acl)
+        return true;
+
+    uint8_t key[16];
+    int decision = -1;
+    uint32_t index = acl->root;
+
+    if (addr->sa_family == AF_INET)
+    {
+        const struct in_addr *addr4 = &((const struct sockaddr_in *)addr)->sin_addr;
+        ipv4_key(addr4, key);
+
+        if (acl->ipv4_jump)
+        {
+            uint32_t entry = acl->ipv4_jump[ntohl(addr4->s_addr) >> (32 - ACL_IPV4_JUMP_BITS)];
+            decision = (int)(entry >> 30) - 1;
+            index = entry & 0x3FFFFFFF;
+        }
+    }
+    else if (addr->sa_family == AF_INET6)
+    {
+        memcpy(key, &((const struct sockaddr_in6 *)addr)->sin6_addr, 16);
+    }
+    else
+    {
+        return acl->allow_rules == 0;
+    }
+
+    walk(acl, index, key, INT_MAX, &decision);
+
+    if (decision < 0)
+        return acl->allow_rules == 0;
+    return decision == ACL_ALLOW;
+}
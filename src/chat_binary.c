@@ -0,0 +1,77 @@
+#include "chat_binary.h"
+
+void chat_binary_encode_header(unsigned char *header, ChatOpcode opcode, size_t body_length)
+{
+    uint32_t length = (uint32_t)body_length + 1;
+    header[0] = (unsigned char)(length >> 24);
+    header[1] = (unsigned char)(length >> 16);
+    header[2] = (unsigned char)(length >> 8);
+    header[3] = (unsigned char)length;
+    header[4] = (unsigned char)opcode;
+}
+
+// Queue the header and body together or not at all: a header without its
+// body would desynchronise the length-prefixed stream for good, so a frame
+// that does not fit closes the connection instead
+int chat_binary_queue_frame(Connection *conn, ChatOpcode opcode, const char *body, size_t length)
+{
+    unsigned char header[CHAT_BINARY_HEADER_SIZE];
+    chat_binary_encode_header(header, opcode, length);
+
+    if (connection_reserve_write(conn, sizeof(header) + length) < 0)
+    {
+        conn->state = CONN_STATE_CLOSING;
+        return -1;
+    }
+
+    connection_queue_raw(conn, (const char *)header, sizeof(header));
+    if (length > 0)
+        connection_queue_raw(conn, body, length);
+    return 0;
+}
+
+// Frame one newline-terminated chat line; the newline itself is not sent
+int chat_binary_queue_line(Connection *conn, ChatOpcode opcode, const char *line, size_t length)
+{
+    if (length > 0 && line[length - 1] == '\n')
+        length--;
+    return chat_binary_queue_frame(conn, opcode, line, length);
+}
+
+int chat_binary_queue_status(Connection *conn, ChatOpcode request, ChatStatus status)
+{
+    char body[3];
+    body[0] = (char)request;
+    body[1] = (char)((status >> 8) & 0xff);
+    body[2] = (char)(status & 0xff);
+    return chat_binary_queue_frame(conn, CHAT_OP_STATUS, body, sizeof(body));
+}
+
+// Take the next complete frame out of the read buffer, consuming it the
+// same way line framing does. Returns 1 for a frame, 0 when more bytes
+// are needed and -1 for a frame that can never fit the read buffer.
+int chat_binary_next_frame(Connection *conn, ChatOpcode *opcode, char **body, size_t *length)
+{
+    size_t start = conn->read_line_start;
+    size_t available = conn->read_buffer_used - start;
+    if (available < CHAT_BINARY_HEADER_SIZE)
+        return 0;
+
+    const unsigned char *header = (const unsigned char *)conn->read_buffer + start;
+    uint32_t frame_length = ((uint32_t)header[0] << 24) | ((uint32_t)header[1] << 16) |
+                            ((uint32_t)header[2] << 8) | header[3];
+
+    *opcode = (ChatOpcode)header[4];
+    if (frame_length == 0 || frame_length - 1 > CHAT_BINARY_MAX_BODY)
+        return -1;
+
+    if (available < 4 + frame_length)
+        return 0;
+
+    *body = conn->read_buffer + start + CHAT_BINARY_HEADER_SIZE;
+    *length = frame_length - 1;
+
+    conn->read_line_start = start + 4 + frame_length;
+    conn->read_scan_offset = conn->read_line_start;
+    return 1;
+}
@@ -0,0 +1,492 @@
+#define LOG_MODULE LOG_MODULE_CHAT
+
+#include "chat_log.h"
+#include "logging.h"
+#include <dirent.h>
+#include <stddef.h>
+
+// Growable byte buffer holding encoded records
+typedef struct
+{
+    char *data;
+    size_t used;
+    size_t size;
+} ChatLogBuffer;
+
+// Writer state: the event loop appends to active_buffer under log_lock,
+// the writer thread swaps it out and does all write()/fdatasync() calls
+static bool log_enabled = false;
+static char log_directory[PATH_MAX];
+static size_t segment_limit = 0;
+static int fsync_interval_ms = 1000;
+
+static int segment_fd = -1;
+static unsigned int segment_index = 0;
+static size_t segment_used = 0;
+
+static ChatLogBuffer active_buffer;
+static ChatLogBuffer flushing_buffer;
+static unsigned long dropped_records = 0;
+
+static pthread_t writer_thread;
+static pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t log_cond = PTHREAD_COND_INITIALIZER;
+static bool flush_requested = false;
+static bool writer_stop = false;
+
+static uint32_t crc_table[256];
+
+static void crc32_init(void)
+{
+    for (uint32_t i = 0; i < 256; i++)
+    {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++)
+        {
+            c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        }
+        crc_table[i] = c;
+    }
+}
+
+static uint32_t crc32_update(uint32_t crc, const void *data, size_t length)
+{
+    const unsigned char *p = data;
+    crc = ~crc;
+    while (length--)
+    {
+        crc = crc_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+static uint32_t record_crc(const ChatLogRecordHeader *header, const char *room, const char *data)
+{
+    const char *fields = (const char *)header + offsetof(ChatLogRecordHeader, timestamp);
+    size_t fields_length = sizeof(ChatLogRecordHeader) - offsetof(ChatLogRecordHeader, timestamp);
+
+    uint32_t crc = crc32_update(0, fields, fields_length);
+    crc = crc32_update(crc, room, header->room_length);
+    return crc32_update(crc, data, header->payload_length);
+}
+
+static int make_directory(const char *path)
+{
+    char buffer[PATH_MAX];
+    snprintf(buffer, sizeof(buffer), "%s", path);
+
+    // Create every missing component, like mkdir -p
+    for (char *p = buffer + 1; *p; p++)
+    {
+        if (*p == '/')
+        {
+            *p = '\0';
+            if (mkdir(buffer, 0755) != 0 && errno != EEXIST)
+                return -1;
+            *p = '/';
+        }
+    }
+
+    if (mkdir(buffer, 0755) != 0 && errno != EEXIST)
+        return -1;
+    return 0;
+}
+
+static int segment_filter(const struct dirent *entry)
+{
+    unsigned int index;
+    char suffix[8];
+    return sscanf(entry->d_name, "chat-%8u.%4s", &index, suffix) == 2 &&
+           strcmp(suffix, "log") == 0;
+}
+
+static int open_segment(unsigned int index)
+{
+    char path[PATH_MAX + 32];
+    snprintf(path, sizeof(path), "%s/chat-%08u.log", log_directory, index);
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        log_error("Failed to open chat log segment %s: %s", path, strerror(errno));
+        return -1;
+    }
+
+    struct stat st;
+    segment_used = fstat(fd, &st) == 0 ? (size_t)st.st_size : 0;
+    segment_index = index;
+    segment_fd = fd;
+    return 0;
+}
+
+// Read the valid records of a segment, passing each to callback if set.
+// valid_end receives the offset just past the last valid record.
+static int replay_segment(const char *path, ChatLogReplayFunc callback, void *context, long *valid_end)
+{
+    *valid_end = 0;
+
+    FILE *file = fopen(path, "rb");
+    if (!file)
+    {
+        log_warn("Failed to open chat log segment %s: %s", path, strerror(errno));
+        return 0;
+    }
+
+    int records = 0;
+    char room[256];
+    char *data = NULL;
+    size_t data_size = 0;
+    ChatLogRecordHeader header;
+
+    while (fread(&header, sizeof(header), 1, file) == 1)
+    {
+        // Bound the length before allocating; append never writes more
+        if (header.magic != CHAT_LOG_MAGIC || header.room_length >= sizeof(room) ||
+            header.payload_length > CHAT_LOG_MAX_PENDING - sizeof(header) - header.room_length)
+        {
+            log_warn("Corrupt record in chat log %s, skipping rest of segment", path);
+            break;
+        }
+
+        if (header.payload_length > data_size)
+        {
+            char *new_data = realloc(data, header.payload_length);
+            if (!new_data)
+                break;
+            data = new_data;
+            data_size = header.payload_length;
+        }
+
+        if (fread(room, 1, header.room_length, file) != header.room_length ||
+            fread(data, 1, header.payload_length, file) != header.payload_length)
+        {
+            // Torn tail from a crash between write and fdatasync
+            log_warn("Truncated record at end of chat log %s", path);
+            break;
+        }
+
+        if (record_crc(&header, room, data) != header.crc)
+        {
+            log_warn("Checksum mismatch in chat log %s, skipping rest of segment", path);
+            break;
+        }
+
+        room[header.room_length] = '\0';
+        if (callback)
+            callback(room, data, header.payload_length, (time_t)header.timestamp, context);
+        records++;
+        *valid_end = ftell(file);
+    }
+
+    free(data);
+    fclose(file);
+    return records;
+}
+
+// A crash can leave a torn or corrupt tail on the newest segment. Cut it
+// back to the last valid record so that appends after it stay readable.
+static void repair_segment(unsigned int index)
+{
+    char path[PATH_MAX + 32];
+    snprintf(path, sizeof(path), "%s/chat-%08u.log", log_directory, index);
+
+    struct stat st;
+    long valid_end = 0;
+    if (stat(path, &st) != 0)
+        return;
+    replay_segment(path, NULL, NULL, &valid_end);
+    if (valid_end >= st.st_size)
+        return;
+
+    if (truncate(path, valid_end) != 0)
+    {
+        log_error("Failed to truncate chat log %s: %s", path, strerror(errno));
+        return;
+    }
+    log_warn("Truncated chat log %s from %lld to %ld bytes", path, (long long)st.st_size, valid_end);
+}
+
+static int write_fully(int fd, const char *data, size_t length)
+{
+    while (length > 0)
+    {
+        ssize_t written = write(fd, data, length);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        data += written;
+        length -= written;
+    }
+    return 0;
+}
+
+// Write one swapped-out buffer, rolling segments on record boundaries,
+// then commit the whole group with a single fdatasync()
+static void write_buffer(ChatLogBuffer *buffer)
+{
+    size_t offset = 0;
+    size_t chunk_start = 0;
+
+    while (offset < buffer->used)
+    {
+        ChatLogRecordHeader header;
+        memcpy(&header, buffer->data + offset, sizeof(header));
+        size_t record_length = sizeof(header) + header.room_length + header.payload_length;
+
+        size_t segment_pending = segment_used + (offset - chunk_start);
+        if (segment_pending > 0 && segment_pending + record_length > segment_limit)
+        {
+            // Current segment is full: finish it and continue in a new one
+            if (segment_fd >= 0)
+            {
+                if (write_fully(segment_fd, buffer->data + chunk_start, offset - chunk_start) < 0)
+                {
+                    log_error("Chat log write failed: %s", strerror(errno));
+                }
+                fdatasync(segment_fd);
+                close(segment_fd);
+                segment_fd = -1;
+            }
+            chunk_start = offset;
+            if (open_segment(segment_index + 1) < 0)
+            {
+                return;
+            }
+        }
+
+        offset += record_length;
+    }
+
+    if (segment_fd >= 0 && offset > chunk_start)
+    {
+        if (write_fully(segment_fd, buffer->data + chunk_start, offset - chunk_start) < 0)
+        {
+            log_error("Chat log write failed: %s", strerror(errno));
+        }
+        segment_used += offset - chunk_start;
+        fdatasync(segment_fd);
+    }
+}
+
+static void *chat_log_writer(void *arg)
+{
+    (void)arg;
+
+    pthread_mutex_lock(&log_lock);
+    for (;;)
+    {
+        // Group commit: sleep for the interval unless asked to flush early
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += fsync_interval_ms / 1000;
+        deadline.tv_nsec += (long)(fsync_interval_ms % 1000) * 1000000;
+        if (deadline.tv_nsec >= 1000000000)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+
+        while (!writer_stop && !flush_requested)
+        {
+            if (pthread_cond_timedwait(&log_cond, &log_lock, &deadline) == ETIMEDOUT)
+                break;
+        }
+
+        ChatLogBuffer swap = flushing_buffer;
+        flushing_buffer = active_buffer;
+        active_buffer = swap;
+        active_buffer.used = 0;
+        flush_requested = false;
+        bool stopping = writer_stop;
+        pthread_mutex_unlock(&log_lock);
+
+        if (flushing_buffer.used > 0)
+        {
+            write_buffer(&flushing_buffer);
+            flushing_buffer.used = 0;
+        }
+
+        if (stopping)
+            return NULL;
+
+        pthread_mutex_lock(&log_lock);
+    }
+}
+
+int chat_log_open(const ServerConfig *config)
+{
+    if (!config || !config->chat_persist)
+        return 0;
+
+    crc32_init();
+    snprintf(log_directory, sizeof(log_directory), "%s", config->chat_persist_dir);
+    segment_limit = (size_t)config->chat_segment_size_mb * 1024 * 1024;
+    fsync_interval_ms = config->chat_fsync_interval_ms;
+
+    if (make_directory(log_directory) < 0)
+    {
+        log_error("Failed to create chat log directory %s: %s", log_directory, strerror(errno));
+        return -1;
+    }
+
+    // Continue appending to the newest existing segment
+    struct dirent **entries;
+    int count = scandir(log_directory, &entries, segment_filter, alphasort);
+    unsigned int index = 1;
+    if (count > 0)
+    {
+        sscanf(entries[count - 1]->d_name, "chat-%8u", &index);
+        for (int i = 0; i < count; i++)
+        {
+            free(entries[i]);
+        }
+        free(entries);
+    }
+
+    repair_segment(index);
+    if (open_segment(index) < 0)
+        return -1;
+
+    writer_stop = false;
+    if (pthread_create(&writer_thread, NULL, chat_log_writer, NULL) != 0)
+    {
+        log_error("Failed to start chat log writer thread");
+        close(segment_fd);
+        segment_fd = -1;
+        return -1;
+    }
+
+    log_enabled = true;
+    log_info("Chat log enabled in %s (segment %u, fsync every %d ms)",
+             log_directory, segment_index, fsync_interval_ms);
+    return 0;
+}
+
+void chat_log_close(void)
+{
+    if (!log_enabled)
+        return;
+
+    pthread_mutex_lock(&log_lock);
+    writer_stop = true;
+    pthread_cond_signal(&log_cond);
+    pthread_mutex_unlock(&log_lock);
+
+    // The writer commits whatever is still pending before it exits
+    pthread_join(writer_thread, NULL);
+    log_enabled = false;
+
+    if (segment_fd >= 0)
+    {
+        close(segment_fd);
+        segment_fd = -1;
+    }
+
+    free(active_buffer.data);
+    free(flushing_buffer.data);
+    memset(&active_buffer, 0, sizeof(active_buffer));
+    memset(&flushing_buffer, 0, sizeof(flushing_buffer));
+
+    if (dropped_records > 0)
+    {
+        log_warn("Chat log dropped %lu records due to backlog", dropped_records);
+    }
+}
+
+bool chat_log_enabled(void)
+{
+    return log_enabled;
+}
+
+void chat_log_append(const char *room, const char *data, size_t length, time_t timestamp)
+{
+    if (!log_enabled)
+        return;
+
+    ChatLogRecordHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = CHAT_LOG_MAGIC;
+    header.timestamp = timestamp;
+    header.room_length = strlen(room);
+    header.payload_length = length;
+    header.crc = record_crc(&header, room, data);
+
+    size_t record_length = sizeof(header) + header.room_length + length;
+
+    pthread_mutex_lock(&log_lock);
+
+    if (active_buffer.used + record_length > CHAT_LOG_MAX_PENDING)
+    {
+        // Writer is behind; never block the event loop on disk
+        dropped_records++;
+        pthread_mutex_unlock(&log_lock);
+        return;
+    }
+
+    if (active_buffer.used + record_length > active_buffer.size)
+    {
+        size_t new_size = active_buffer.size ? active_buffer.size : 65536;
+        while (new_size < active_buffer.used + record_length)
+        {
+            new_size *= 2;
+        }
+
+        char *new_data = realloc(active_buffer.data, new_size);
+        if (!new_data)
+        {
+            dropped_records++;
+            pthread_mutex_unlock(&log_lock);
+            return;
+        }
+        active_buffer.data = new_data;
+        active_buffer.size = new_size;
+    }
+
+    char *out = active_buffer.data + active_buffer.used;
+    memcpy(out, &header, sizeof(header));
+    memcpy(out + sizeof(header), room, header.room_length);
+    memcpy(out + sizeof(header) + header.room_length, data, length);
+    active_buffer.used += record_length;
+
+    // Wake the writer early when the backlog grows large
+    if (active_buffer.used > CHAT_LOG_MAX_PENDING / 2 && !flush_requested)
+    {
+        flush_requested = true;
+        pthread_cond_signal(&log_cond);
+    }
+
+    pthread_mutex_unlock(&log_lock);
+}
+
+int chat_log_replay(const char *directory, ChatLogReplayFunc callback, void *context)
+{
+    if (!directory || !callback)
+        return -1;
+
+    crc32_init();
+
+    struct dirent **entries;
+    int count = scandir(directory, &entries, segment_filter, alphasort);
+    if (count < 0)
+    {
+        // No log yet, nothing to rebuild
+        return 0;
+    }
+
+    int records = 0;
+    for (int i = 0; i < count; i++)
+    {
+        char path[PATH_MAX + 256];
+        snprintf(path, sizeof(path), "%s/%s", directory, entries[i]->d_name);
+        long valid_end;
+        records += replay_segment(path, callback, context, &valid_end);
+        free(entries[i]);
+    }
+    free(entries);
+
+    log_info("Replayed %d chat log records from %d segments", records, count);
+    return records;
+}
@@ -0,0 +1,596 @@
+#define LOG_MODULE LOG_MODULE_CHAT
+
+#include "chat_shard.h"
+#include "clock.h"
+#include "flight_recorder.h"
+#include "logging.h"
+#include "loop_profile.h"
+#include <stdint.h>
+#include <sys/eventfd.h>
+
+// All shards; shard 0 is served by the main event loop, the others by
+// their own worker threads
+static ChatShard *shards = NULL;
+static int shard_count = 0;
+
+// Set once teardown starts; later posts are dropped
+static bool shards_stopped = false;
+
+// Slow-iteration report threshold for the worker loops, as in server_run
+static int slow_loop_ms = 0;
+
+// Shard served by the calling thread
+static __thread int current_shard = 0;
+
+static void queue_init(ChatShardQueue *queue)
+{
+    queue->stub.next = NULL;
+    queue->head = &queue->stub;
+    queue->tail = &queue->stub;
+}
+
+static void queue_push(ChatShardQueue *queue, ChatShardMessage *message)
+{
+    message->next = NULL;
+    ChatShardMessage *prev = __atomic_exchange_n(&queue->head, message, __ATOMIC_ACQ_REL);
+    __atomic_store_n(&prev->next, message, __ATOMIC_RELEASE);
+}
+
+// Single consumer only. Returns NULL when empty or when a producer is
+// between its swap and its link; that producer wakes the shard afterwards.
+static ChatShardMessage *queue_pop(ChatShardQueue *queue)
+{
+    ChatShardMessage *tail = queue->tail;
+    ChatShardMessage *next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+
+    if (tail == &queue->stub)
+    {
+        if (!next)
+            return NULL;
+        queue->tail = next;
+        tail = next;
+        next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+    }
+
+    if (next)
+    {
+        queue->tail = next;
+        return tail;
+    }
+
+    if (tail != __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE))
+        return NULL;
+
+    queue_push(queue, &queue->stub);
+    next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+    if (next)
+    {
+        queue->tail = next;
+        return tail;
+    }
+    return NULL;
+}
+
+static unsigned int hash_string(const char *s)
+{
+    // FNV-1a
+    unsigned int hash = 2166136261u;
+    while (*s)
+    {
+        hash ^= (unsigned char)*s++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static void dispatch_message(ChatShardMessage *message)
+{
+    chat_handle_shard_message(shards[current_shard].server, message);
+    free(message);
+}
+
+// Drop undelivered messages at shutdown, releasing anything they own
+static void discard_inbox(ChatShard *shard)
+{
+    ChatShardMessage *message;
+    while ((message = queue_pop(&shard->inbox)))
+    {
+        if (message->type == SHARD_MSG_ADOPT && message->connection)
+        {
+            connection_destroy(message->connection);
+        }
+        free(message);
+    }
+}
+
+static void flush_pool(ChatShard *shard, LoopProfile *profile)
+{
+    ConnectionPool *pool = shard->pool;
+
+    for (int i = 0; i < pool->max_connections; i++)
+    {
+        Connection *conn = pool->connections[i];
+        if (!conn)
+            continue;
+
+        if (conn->state == CONN_STATE_HANDOFF)
+        {
+            flight_record(&conn->flight, FLIGHT_HANDOFF, 0, shard->index);
+            loop_profile_handler_begin(profile);
+            connection_pool_detach(pool, conn);
+            chat_handoff_connection(conn);
+            loop_profile_handler_end(profile, LOOP_STAGE_HANDOFF, NULL);
+            continue;
+        }
+
+        if (conn->has_data_to_send)
+        {
+            loop_profile_handler_begin(profile);
+            if (connection_write(conn) < 0)
+            {
+                conn->state = CONN_STATE_CLOSING;
+            }
+            loop_profile_handler_end(profile, LOOP_STAGE_WRITE, conn);
+        }
+
+        if (conn->state == CONN_STATE_CLOSING)
+        {
+            connection_pool_remove(pool, conn);
+        }
+    }
+}
+
+// Event loop of a worker shard: chat connections only, plus the inbox
+static void *chat_shard_main(void *arg)
+{
+    ChatShard *shard = arg;
+    current_shard = shard->index;
+    chat_set_current_server(shard->server);
+
+    log_info("Chat shard %d started", shard->index);
+
+    fd_set read_fds, write_fds;
+    struct timeval timeout;
+
+    char name[16];
+    snprintf(name, sizeof(name), "shard %d", shard->index);
+    LoopProfile profile;
+    loop_profile_init(&profile, name, slow_loop_ms);
+    flight_recorder_attach(name);
+
+    while (running)
+    {
+        clock_update();
+        loop_profile_begin(&profile);
+
+        FD_ZERO(&read_fds);
+        FD_ZERO(&write_fds);
+        FD_SET(shard->wake_fd, &read_fds);
+        int max_fd = shard->wake_fd;
+
+        for (int i = 0; i < shard->pool->max_connections; i++)
+        {
+            Connection *conn = shard->pool->connections[i];
+            if (!conn)
+                continue;
+
+            if (conn->state != CONN_STATE_CLOSING && !chat_connection_paused(conn))
+                FD_SET(conn->fd, &read_fds);
+            if (conn->has_data_to_send)
+                FD_SET(conn->fd, &write_fds);
+            if (conn->fd > max_fd)
+                max_fd = conn->fd;
+        }
+
+        timeout.tv_sec = 1;
+        timeout.tv_usec = 0;
+
+        int chat_timeout = chat_next_timeout_ms(shard->server);
+        if (chat_timeout >= 0 && chat_timeout < 1000)
+        {
+            timeout.tv_sec = 0;
+            timeout.tv_usec = chat_timeout * 1000;
+        }
+
+        loop_profile_wait_begin(&profile);
+        int activity = select(max_fd + 1, &read_fds, &write_fds, NULL, &timeout);
+        loop_profile_wait_end(&profile, activity > 0 ? activity : 0);
+        if (activity < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            log_error("Chat shard %d select error: %s", shard->index, strerror(errno));
+            break;
+        }
+
+        clock_update();
+
+        if (FD_ISSET(shard->wake_fd, &read_fds))
+        {
+            loop_profile_handler_begin(&profile);
+            chat_shard_process_inbox();
+            loop_profile_handler_end(&profile, LOOP_STAGE_INBOX, NULL);
+        }
+
+        for (int i = 0; i < shard->pool->max_connections; i++)
+        {
+            Connection *conn = shard->pool->connections[i];
+            if (!conn || conn->state == CONN_STATE_HANDOFF || !FD_ISSET(conn->fd, &read_fds))
+                continue;
+
+            loop_profile_handler_begin(&profile);
+            int bytes_read = connection_read(conn);
+            if (bytes_read < 0 ||
+                (bytes_read > 0 && enhanced_chat_handler(shard->server, conn) < 0))
+            {
+                flight_record_close(&conn->flight, FLIGHT_CLOSE_HANDLER);
+                conn->state = CONN_STATE_CLOSING;
+            }
+            loop_profile_handler_end(&profile, LOOP_STAGE_READ, conn);
+        }
+
+        loop_profile_handler_begin(&profile);
+        chat_flush_batches(shard->server, false);
+        chat_send_heartbeats(shard->server);
+        chat_release_delayed(shard->server);
+        loop_profile_handler_end(&profile, LOOP_STAGE_TIMERS, NULL);
+
+        loop_profile_handler_begin(&profile);
+        connection_pool_expire(shard->pool);
+        loop_profile_handler_end(&profile, LOOP_STAGE_EXPIRE, NULL);
+
+        flush_pool(shard, &profile);
+        flight_recorder_poll(shard->pool);
+        loop_profile_end(&profile);
+    }
+
+    // Connections of this shard are torn down on its own thread
+    chat_flush_batches(shard->server, true);
+    flush_pool(shard, &profile);
+    connection_pool_destroy(shard->pool);
+    shard->pool = NULL;
+
+    log_info("Chat shard %d stopped", shard->index);
+    return NULL;
+}
+
+int chat_shards_init(const ServerConfig *config)
+{
+    int count = config ? config->chat_shards : 1;
+    slow_loop_ms = config ? config->slow_loop_ms : 0;
+
+    shards = calloc(count, sizeof(ChatShard));
+    if (!shards)
+    {
+        log_error("Failed to allocate chat shards");
+        return -1;
+    }
+
+    shard_count = count;
+
+    for (int i = 0; i < count; i++)
+    {
+        ChatShard *shard = &shards[i];
+        shard->index = i;
+        queue_init(&shard->inbox);
+
+        shard->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (shard->wake_fd < 0)
+        {
+            log_error("Failed to create wakeup fd for chat shard %d: %s", i, strerror(errno));
+            return -1;
+        }
+
+        shard->server = chat_server_create();
+        if (!shard->server)
+            return -1;
+    }
+
+    log_info("Chat engine split into %d shard%s", count, count == 1 ? "" : "s");
+    return 0;
+}
+
+int chat_shards_start(ConnectionPool *main_pool)
+{
+    if (!shards)
+        return -1;
+
+    // Shard 0 shares the main event loop and its connection pool
+    shards[0].pool = main_pool;
+
+    // Signals are handled by the main thread only
+    sigset_t all_signals, previous;
+    sigfillset(&all_signals);
+    pthread_sigmask(SIG_BLOCK, &all_signals, &previous);
+
+    int result = 0;
+    for (int i = 1; i < shard_count; i++)
+    {
+        ChatShard *shard = &shards[i];
+
+        shard->pool = connection_pool_create(main_pool->max_connections);
+        if (shard->pool)
+        {
+            // Same deadlines as the main loop
+            memcpy(shard->pool->deadline_ms, main_pool->deadline_ms, sizeof(main_pool->deadline_ms));
+        }
+        if (!shard->pool ||
+            pthread_create(&shard->thread, NULL, chat_shard_main, shard) != 0)
+        {
+            log_error("Failed to start chat shard %d", i);
+            result = -1;
+            break;
+        }
+        shard->thread_started = true;
+    }
+
+    pthread_sigmask(SIG_SETMASK, &previous, NULL);
+    return result;
+}
+
+void chat_shards_stop(void)
+{
+    if (!shards)
+        return;
+
+    for (int i = 1; i < shard_count; i++)
+    {
+        if (!shards[i].thread_started)
+            continue;
+
+        uint64_t one = 1;
+        if (write(shards[i].wake_fd, &one, sizeof(one)) < 0)
+        {
+            log_warn("Failed to wake chat shard %d: %s", i, strerror(errno));
+        }
+        pthread_join(shards[i].thread, NULL);
+        shards[i].thread_started = false;
+    }
+}
+
+void chat_shards_destroy(void)
+{
+    if (!shards)
+        return;
+
+    shards_stopped = true;
+
+    for (int i = 0; i < shard_count; i++)
+    {
+        ChatShard *shard = &shards[i];
+
+        current_shard = i;
+        chat_set_current_server(shard->server);
+        discard_inbox(shard);
+
+        if (i > 0 && shard->pool)
+        {
+            connection_pool_destroy(shard->pool);
+        }
+
+        chat_server_destroy(shard->server);
+        close(shard->wake_fd);
+
+        for (int b = 0; b < CHAT_NICK_BUCKETS; b++)
+        {
+            ChatNickEntry *entry = shard->nicks[b];
+            while (entry)
+            {
+                ChatNickEntry *next = entry->next;
+                free(entry);
+                entry = next;
+            }
+        }
+    }
+
+    current_shard = 0;
+    chat_set_current_server(NULL);
+    free(shards);
+    shards = NULL;
+    shard_count = 0;
+    shards_stopped = false;
+}
+
+int chat_shard_count(void)
+{
+    return shard_count;
+}
+
+int chat_shard_current(void)
+{
+    return current_shard;
+}
+
+ChatServer *chat_shard_server(int index)
+{
+    if (!shards || index < 0 || index >= shard_count)
+        return NULL;
+    return shards[index].server;
+}
+
+ConnectionPool *chat_shard_pool(void)
+{
+    return shards ? shards[current_shard].pool : NULL;
+}
+
+int chat_shard_for_name(const char *name)
+{
+    if (shard_count <= 1)
+        return 0;
+    return hash_string(name) % shard_count;
+}
+
+int chat_shard_wake_fd(void)
+{
+    return shards ? shards[current_shard].wake_fd : -1;
+}
+
+// Threads that serve no shard (federation) always post through the inbox
+void chat_shard_set_external(void)
+{
+    current_shard = -1;
+}
+
+ChatShardMessage *chat_shard_message_create(ChatShardMessageType type, const char *text)
+{
+    size_t text_length = text ? strlen(text) : 0;
+    ChatShardMessage *message = calloc(1, sizeof(ChatShardMessage) + text_length + 1);
+    if (!message)
+    {
+        log_error("Failed to allocate chat shard message");
+        return NULL;
+    }
+
+    message->type = type;
+    if (text)
+    {
+        memcpy(message->text, text, text_length + 1);
+    }
+    return message;
+}
+
+void chat_shard_post(int shard, ChatShardMessage *message)
+{
+    if (!message)
+        return;
+
+    message->origin = current_shard;
+
+    if (shards_stopped)
+    {
+        free(message);
+        return;
+    }
+
+    // Local operations run inline, which is the only path with one shard
+    if (shard == current_shard || !shards)
+    {
+        dispatch_message(message);
+        return;
+    }
+
+    ChatShard *target = &shards[shard];
+    queue_push(&target->inbox, message);
+
+    // One eventfd write per wakeup, however many messages are queued
+    if (__atomic_exchange_n(&target->wake_pending, 1, __ATOMIC_ACQ_REL) == 0)
+    {
+        uint64_t one = 1;
+        if (write(target->wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+        {
+            log_warn("Failed to wake chat shard %d: %s", shard, strerror(errno));
+        }
+    }
+}
+
+void chat_shard_process_inbox(void)
+{
+    if (!shards)
+        return;
+
+    ChatShard *shard = &shards[current_shard];
+
+    uint64_t value;
+    if (read(shard->wake_fd, &value, sizeof(value)) < 0 && errno != EAGAIN)
+    {
+        log_warn("Failed to read wakeup fd of chat shard %d: %s", shard->index, strerror(errno));
+    }
+
+    // Re-arm before draining so later posts trigger a new wakeup
+    __atomic_store_n(&shard->wake_pending, 0, __ATOMIC_RELEASE);
+
+    ChatShardMessage *message;
+    while ((message = queue_pop(&shard->inbox)))
+    {
+        dispatch_message(message);
+    }
+}
+
+int chat_shard_assign(Connection *conn)
+{
+    if (shard_count <= 1)
+        return 0;
+
+    char key[INET6_ADDRSTRLEN + 16];
+    snprintf(key, sizeof(key), "%s:%d", conn->ip, conn->port);
+    int target = hash_string(key) % shard_count;
+    if (target == current_shard)
+        return 0;
+
+    ChatShardMessage *message = chat_shard_message_create(SHARD_MSG_ADOPT, NULL);
+    if (!message)
+        return 0;
+
+    message->connection = conn;
+    chat_shard_post(target, message);
+    return 1;
+}
+
+bool chat_nick_claim(const char *nick, int shard)
+{
+    ChatShard *owner = &shards[current_shard];
+    unsigned int bucket = hash_string(nick) % CHAT_NICK_BUCKETS;
+
+    for (ChatNickEntry *entry = owner->nicks[bucket]; entry; entry = entry->next)
+    {
+        if (strcmp(entry->nick, nick) == 0)
+            return false;
+    }
+
+    ChatNickEntry *entry = malloc(sizeof(ChatNickEntry));
+    if (!entry)
+        return false;
+
+    snprintf(entry->nick, sizeof(entry->nick), "%s", nick);
+    entry->shard = shard;
+    entry->next = owner->nicks[bucket];
+    owner->nicks[bucket] = entry;
+    return true;
+}
+
+void chat_nick_release(const char *nick)
+{
+    ChatShard *owner = &shards[current_shard];
+    unsigned int bucket = hash_string(nick) % CHAT_NICK_BUCKETS;
+
+    for (ChatNickEntry **link = &owner->nicks[bucket]; *link; link = &(*link)->next)
+    {
+        if (strcmp((*link)->nick, nick) == 0)
+        {
+            ChatNickEntry *entry = *link;
+            *link = entry->next;
+            free(entry);
+            return;
+        }
+    }
+}
+
+void chat_nick_move(const char *nick, int shard)
+{
+    ChatShard *owner = &shards[current_shard];
+    unsigned int bucket = hash_string(nick) % CHAT_NICK_BUCKETS;
+
+    for (ChatNickEntry *entry = owner->nicks[bucket]; entry; entry = entry->next)
+    {
+        if (strcmp(entry->nick, nick) == 0)
+        {
+            entry->shard = shard;
+            return;
+        }
+    }
+
+    chat_nick_claim(nick, shard);
+}
+
+int chat_nick_lookup(const char *nick)
+{
+    ChatShard *owner = &shards[current_shard];
+    unsigned int bucket = hash_string(nick) % CHAT_NICK_BUCKETS;
+
+    for (ChatNickEntry *entry = owner->nicks[bucket]; entry; entry = entry->next)
+    {
+        if (strcmp(entry->nick, nick) == 0)
+            return entry->shard;
+    }
+    return -1;
+}
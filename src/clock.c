@@ -0,0 +1,106 @@
+#include "clock.h"
+
+// Loop-owned coarse clock, refreshed by the event loop so hot paths read
+// cached values instead of calling time()/localtime() per message; each
+// loop thread (main loop and chat shards) keeps its own copy. Threads
+// without a loop refresh on every read, which still only re-renders the
+// strings when the second changes.
+static __thread time_t cached_sec = 0;
+static __thread long long cached_ms = 0;
+static __thread char chat_prefix[CLOCK_CHAT_PREFIX_LENGTH + 1] = "[00:00:00] ";
+static __thread char log_timestamp[CLOCK_LOG_TIMESTAMP_LENGTH + 1] = "1970-01-01 00:00:00";
+static __thread char http_date[CLOCK_HTTP_DATE_LENGTH + 1] = "Thu, 01 Jan 1970 00:00:00 GMT";
+static __thread char access_date[CLOCK_ACCESS_DATE_LENGTH + 1] = "01/Jan/1970:00:00:00 +0000";
+static __thread bool clock_initialized = false;
+static __thread bool loop_driven = false;
+
+static void refresh(void)
+{
+    struct timespec mono;
+    clock_gettime(CLOCK_MONOTONIC, &mono);
+    cached_ms = (long long)mono.tv_sec * 1000 + mono.tv_nsec / 1000000;
+
+    time_t now = time(NULL);
+    if (now != cached_sec || !clock_initialized)
+    {
+        // Re-render the wall clock strings once per second
+        struct tm tm_info;
+        localtime_r(&now, &tm_info);
+        strftime(chat_prefix, sizeof(chat_prefix), "[%H:%M:%S] ", &tm_info);
+        strftime(log_timestamp, sizeof(log_timestamp), "%Y-%m-%d %H:%M:%S", &tm_info);
+        strftime(access_date, sizeof(access_date), "%d/%b/%Y:%H:%M:%S %z", &tm_info);
+
+        // HTTP dates are GMT; the server never calls setlocale, so the
+        // names stay in English
+        gmtime_r(&now, &tm_info);
+        strftime(http_date, sizeof(http_date), "%a, %d %b %Y %H:%M:%S GMT", &tm_info);
+        cached_sec = now;
+    }
+
+    clock_initialized = true;
+}
+
+// Called by event loops once per iteration
+void clock_update(void)
+{
+    loop_driven = true;
+    refresh();
+}
+
+static void ensure_current(void)
+{
+    if (!loop_driven)
+        refresh();
+}
+
+time_t clock_now_sec(void)
+{
+    ensure_current();
+    return cached_sec;
+}
+
+long long clock_now_ms(void)
+{
+    ensure_current();
+    return cached_ms;
+}
+
+const char *clock_chat_prefix(void)
+{
+    ensure_current();
+    return chat_prefix;
+}
+
+const char *clock_log_timestamp(void)
+{
+    ensure_current();
+    return log_timestamp;
+}
+
+const char *clock_http_date(void)
+{
+    ensure_current();
+    return http_date;
+}
+
+const char *clock_access_date(void)
+{
+    ensure_current();
+    return access_date;
+}
+
+// Uncached monotonic microseconds, for measuring latencies
+long long clock_precise_us(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+// Same clock in nanoseconds, for latency histograms; a vDSO read, no syscall
+long long clock_precise_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000000000 + now.tv_nsec;
+}
@@ -1,3 +1,5 @@
+#define LOG_MODULE LOG_MODULE_CONFIG
+
 #include "config.h"
 #include "logging.h"
 
@@ -11,27 +13,93 @@ void config_set_defaults(ServerConfig *config)
     config->chat_port = 8081;
     config->max_connections = 1000;
     strncpy(config->document_root, "./www", sizeof(config->document_root) - 1);
+    config->header_timeout = 10;
+    config->write_timeout = 30;
+    config->slow_loop_ms = 0; // Disabled
 
     // Logging settings
     config->log_level = LOG_INFO;
+    for (int i = 0; i < LOG_MODULE_COUNT; i++)
+    {
+        config->log_module_levels[i] = -1;
+    }
     strncpy(config->log_file, "./logs/multiserver.log", sizeof(config->log_file) - 1);
     config->log_to_console = true;
     config->log_to_file = true;
+    config->log_async = false;
+    config->log_buffer_kb = 256;
+    config->log_overflow = LOG_OVERFLOW_BLOCK; // Never lose lines unless asked to
+    config->log_file_format = LOG_FILE_TEXT;
+    config->log_rotate_size_mb = 0;
+    config->log_rotate_interval = 0;
+    config->log_rotate_keep = 7;
+    config->log_rotate_compress = false;
+    config->access_log_file[0] = '\0';
+    config->access_log_sample = 1;
+    config->access_log_buffer_kb = 256;
+    config->flight_recorder = true;
+    strncpy(config->flight_file, "./logs/flight.log", sizeof(config->flight_file) - 1);
 
     // HTTP settings
     strncpy(config->default_page, "index.html", sizeof(config->default_page) - 1);
     config->directory_listing = false;
     config->gzip_compression = false;
+    config->http_metrics = false;
 
     // Chat settings
     config->max_rooms = 100;
     config->max_users_per_room = 50;
     config->idle_timeout = 300; // 5 minutes
+    config->max_line_length = 1024;
+    config->broadcast_batch_ms = 0; // Disabled
+    config->history_size = 50;
+    config->history_replay = 10;
+    config->chat_persist = false;
+    strncpy(config->chat_persist_dir, "./data/chatlog", sizeof(config->chat_persist_dir) - 1);
+    config->chat_segment_size_mb = 16;
+    config->chat_fsync_interval_ms = 1000;
+    config->chat_shards = 1;
+    config->flood_user_rate = 0; // Unlimited
+    config->flood_user_burst = 10;
+    config->flood_room_rate = 0;
+    config->flood_room_burst = 100;
+    config->flood_action = FLOOD_ACTION_DROP;
+
+    // Federation settings
+    config->federation_enabled = false;
+    strncpy(config->federation_node, "node1", sizeof(config->federation_node) - 1);
+    config->federation_port = 0; // Dial out only
+    strncpy(config->federation_bind, "127.0.0.1", sizeof(config->federation_bind) - 1);
+    config->federation_peers[0] = '\0';
+    config->federation_reconnect_ms = 2000;
 
     // Security settings
-    config->rate_limit_requests = 100;
+    config->rate_limit_requests = 0; // Off unless configured
     config->rate_limit_window = 60; // 1 minute
     config->enable_access_control = false;
+    config->access_allow[0] = '\0';
+    config->access_deny[0] = '\0';
+    config->access_file[0] = '\0';
+}
+
+static LogOverflow parse_log_overflow(const char *policy)
+{
+    if (strcasecmp(policy, "drop") == 0)
+        return LOG_OVERFLOW_DROP;
+    if (strcasecmp(policy, "block") != 0)
+        fprintf(stderr, "Unknown log overflow policy '%s', using block\n", policy);
+    return LOG_OVERFLOW_BLOCK;
+}
+
+static FloodAction parse_flood_action(const char *action)
+{
+    if (strcasecmp(action, "delay") == 0)
+        return FLOOD_ACTION_DELAY;
+    if (strcasecmp(action, "disconnect") == 0)
+        return FLOOD_ACTION_DISCONNECT;
+    if (strcasecmp(action, "drop") != 0)
+        fprintf(stderr, "Unknown flood action '%s', using drop\n", action);
+    return FLOOD_ACTION_DROP;
 }
 
 static LogLevel parse_log_level(const char *level_str)
@@ -87,6 +155,32 @@ static void trim_whitespace(char *str)
     memmove(str, start, strlen(start) + 1);
 }
 
+// Make a relative path absolute against the launch directory, since a
+// daemon changes to / before it opens anything
+static void absolute_path(char *path, size_t size)
+{
+    if (path[0] == '\0' || path[0] == '/')
+        return;
+
+    char cwd[PATH_MAX];
+    if (!getcwd(cwd, sizeof(cwd)))
+        return;
+
+    const char *relative = strncmp(path, "./", 2) == 0 ? path + 2 : path;
+    char resolved[PATH_MAX];
+    int length = snprintf(resolved, sizeof(resolved), "%s/%s", strcmp(cwd, "/") ? cwd : "", relative);
+    if (length > 0 && (size_t)length < size)
+        memcpy(path, resolved, length + 1);
+}
+
+static void resolve_paths(ServerConfig *config)
+{
+    absolute_path(config->log_file, sizeof(config->log_file));
+    absolute_path(config->access_log_file, sizeof(config->access_log_file));
+    absolute_path(config->flight_file, sizeof(config->flight_file));
+    absolute_path(config->chat_persist_dir, sizeof(config->chat_persist_dir));
+}
+
 int config_load(const char *filename, ServerConfig *config)
 {
     FILE *file;
@@ -106,6 +200,7 @@ int config_load(const char *filename, ServerConfig *config)
     if (!file)
     {
         fprintf(stderr, "Warning: Could not open config file '%s', using defaults\n", filename);
+        resolve_paths(config);
         return 0; // Not fatal, we have defaults
     }
 
@@ -172,6 +267,18 @@ int config_load(const char *filename, ServerConfig *config)
             {
                 strncpy(config->document_root, value, sizeof(config->document_root) - 1);
             }
+            else if (strcmp(key, "header_timeout") == 0)
+            {
+                config->header_timeout = atoi(value);
+            }
+            else if (strcmp(key, "write_timeout") == 0)
+            {
+                config->write_timeout = atoi(value);
+            }
+            else if (strcmp(key, "slow_loop_ms") == 0)
+            {
+                config->slow_loop_ms = atoi(value);
+            }
         }
         else if (strcmp(section, "logging") == 0)
         {
@@ -179,6 +286,21 @@ int config_load(const char *filename, ServerConfig *config)
             {
                 config->log_level = parse_log_level(value);
             }
+            else if (strlen(key) > 6 && strcmp(key + strlen(key) - 6, "_level") == 0)
+            {
+                // Per-module override, e.g. chat_level = DEBUG
+                int module = 0;
+                while (module < LOG_MODULE_COUNT &&
+                       (strncmp(key, log_module_names[module], strlen(key) - 6) != 0 ||
+                        log_module_names[module][strlen(key) - 6] != '\0'))
+                {
+                    module++;
+                }
+                if (module < LOG_MODULE_COUNT)
+                    config->log_module_levels[module] = parse_log_level(value);
+                else
+                    fprintf(stderr, "Unknown log module in '%s'\n", key);
+            }
             else if (strcmp(key, "file") == 0)
             {
                 strncpy(config->log_file, value, sizeof(config->log_file) - 1);
@@ -191,6 +313,63 @@ int config_load(const char *filename, ServerConfig *config)
             {
                 config->log_to_file = parse_bool(value);
             }
+            else if (strcmp(key, "async") == 0)
+            {
+                config->log_async = parse_bool(value);
+            }
+            else if (strcmp(key, "buffer_kb") == 0)
+            {
+                config->log_buffer_kb = atoi(value);
+            }
+            else if (strcmp(key, "overflow") == 0)
+            {
+                config->log_overflow = parse_log_overflow(value);
+            }
+            else if (strcmp(key, "format") == 0)
+            {
+                if (strcasecmp(value, "binary") == 0)
+                    config->log_file_format = LOG_FILE_BINARY;
+                else if (strcasecmp(value, "text") == 0)
+                    config->log_file_format = LOG_FILE_TEXT;
+                else
+                    fprintf(stderr, "Unknown log format '%s', using text\n", value);
+            }
+            else if (strcmp(key, "rotate_size_mb") == 0)
+            {
+                config->log_rotate_size_mb = atoi(value);
+            }
+            else if (strcmp(key, "rotate_interval") == 0)
+            {
+                config->log_rotate_interval = atoi(value);
+            }
+            else if (strcmp(key, "rotate_keep") == 0)
+            {
+                config->log_rotate_keep = atoi(value);
+            }
+            else if (strcmp(key, "rotate_compress") == 0)
+            {
+                config->log_rotate_compress = parse_bool(value);
+            }
+            else if (strcmp(key, "access_log") == 0)
+            {
+                strncpy(config->access_log_file, value, sizeof(config->access_log_file) - 1);
+            }
+            else if (strcmp(key, "access_log_sample") == 0)
+            {
+                config->access_log_sample = atoi(value);
+            }
+            else if (strcmp(key, "access_log_buffer_kb") == 0)
+            {
+                config->access_log_buffer_kb = atoi(value);
+            }
+            else if (strcmp(key, "flight_recorder") == 0)
+            {
+                config->flight_recorder = parse_bool(value);
+            }
+            else if (strcmp(key, "flight_file") == 0)
+            {
+                strncpy(config->flight_file, value, sizeof(config->flight_file) - 1);
+            }
         }
         else if (strcmp(section, "http") == 0)
         {
@@ -206,6 +385,10 @@ int config_load(const char *filename, ServerConfig *config)
             {
                 config->gzip_compression = parse_bool(value);
             }
+            else if (strcmp(key, "metrics") == 0)
+            {
+                config->http_metrics = parse_bool(value);
+            }
         }
         else if (strcmp(section, "chat") == 0)
         {
@@ -221,6 +404,89 @@ int config_load(const char *filename, ServerConfig *config)
             {
                 config->idle_timeout = atoi(value);
             }
+            else if (strcmp(key, "max_line_length") == 0)
+            {
+                config->max_line_length = atoi(value);
+            }
+            else if (strcmp(key, "broadcast_batch_ms") == 0)
+            {
+                config->broadcast_batch_ms = atoi(value);
+            }
+            else if (strcmp(key, "history_size") == 0)
+            {
+                config->history_size = atoi(value);
+            }
+            else if (strcmp(key, "history_replay") == 0)
+            {
+                config->history_replay = atoi(value);
+            }
+            else if (strcmp(key, "shards") == 0)
+            {
+                config->chat_shards = atoi(value);
+            }
+            else if (strcmp(key, "persist") == 0)
+            {
+                config->chat_persist = parse_bool(value);
+            }
+            else if (strcmp(key, "persist_dir") == 0)
+            {
+                strncpy(config->chat_persist_dir, value, sizeof(config->chat_persist_dir) - 1);
+            }
+            else if (strcmp(key, "persist_segment_mb") == 0)
+            {
+                config->chat_segment_size_mb = atoi(value);
+            }
+            else if (strcmp(key, "persist_fsync_ms") == 0)
+            {
+                config->chat_fsync_interval_ms = atoi(value);
+            }
+            else if (strcmp(key, "flood_user_rate") == 0)
+            {
+                config->flood_user_rate = atoi(value);
+            }
+            else if (strcmp(key, "flood_user_burst") == 0)
+            {
+                config->flood_user_burst = atoi(value);
+            }
+            else if (strcmp(key, "flood_room_rate") == 0)
+            {
+                config->flood_room_rate = atoi(value);
+            }
+            else if (strcmp(key, "flood_room_burst") == 0)
+            {
+                config->flood_room_burst = atoi(value);
+            }
+            else if (strcmp(key, "flood_action") == 0)
+            {
+                config->flood_action = parse_flood_action(value);
+            }
+        }
+        else if (strcmp(section, "federation") == 0)
+        {
+            if (strcmp(key, "enabled") == 0)
+            {
+                config->federation_enabled = parse_bool(value);
+            }
+            else if (strcmp(key, "node_name") == 0)
+            {
+                strncpy(config->federation_node, value, sizeof(config->federation_node) - 1);
+            }
+            else if (strcmp(key, "port") == 0)
+            {
+                config->federation_port = atoi(value);
+            }
+            else if (strcmp(key, "bind") == 0)
+            {
+                strncpy(config->federation_bind, value, sizeof(config->federation_bind) - 1);
+            }
+            else if (strcmp(key, "peers") == 0)
+            {
+                strncpy(config->federation_peers, value, sizeof(config->federation_peers) - 1);
+            }
+            else if (strcmp(key, "reconnect_ms") == 0)
+            {
+                config->federation_reconnect_ms = atoi(value);
+            }
         }
         else if (strcmp(section, "security") == 0)
         {
@@ -236,10 +502,23 @@ int config_load(const char *filename, ServerConfig *config)
             {
                 config->enable_access_control = parse_bool(value);
             }
+            else if (strcmp(key, "allow") == 0)
+            {
+                strncpy(config->access_allow, value, sizeof(config->access_allow) - 1);
+            }
+            else if (strcmp(key, "deny") == 0)
+            {
+                strncpy(config->access_deny, value, sizeof(config->access_deny) - 1);
+            }
+            else if (strcmp(key, "acl_file") == 0)
+            {
+                strncpy(config->access_file, value, sizeof(config->access_file) - 1);
+            }
         }
     }
 
     fclose(file);
+    resolve_paths(config);
     return 0;
 }
 
@@ -274,6 +553,177 @@ int config_validate(const ServerConfig *config)
         return -1;
     }
 
+    if (config->log_async && (config->log_buffer_kb < 16 || config->log_buffer_kb > 65536))
+    {
+        fprintf(stderr, "Invalid log buffer size: %d KB (must be 16-65536)\n", config->log_buffer_kb);
+        return -1;
+    }
+
+    // Log rotation
+    if (config->log_rotate_size_mb < 0 || config->log_rotate_size_mb > 65536)
+    {
+        fprintf(stderr, "Invalid log rotate size: %d MB (must be 0-65536)\n", config->log_rotate_size_mb);
+        return -1;
+    }
+    if (config->log_rotate_interval != 0 &&
+        (config->log_rotate_interval < 60 || config->log_rotate_interval > 31 * 86400))
+    {
+        fprintf(stderr, "Invalid log rotate interval: %d seconds (must be 0 or 60-2678400)\n",
+                config->log_rotate_interval);
+        return -1;
+    }
+    if (config->log_rotate_keep < 0 || config->log_rotate_keep > 10000)
+    {
+        fprintf(stderr, "Invalid log rotate keep count: %d (must be 0-10000)\n", config->log_rotate_keep);
+        return -1;
+    }
+
+    // Access log
+    if (config->access_log_sample < 1 || config->access_log_sample > 1000000)
+    {
+        fprintf(stderr, "Invalid access log sample rate: %d (must be 1-1000000)\n", config->access_log_sample);
+        return -1;
+    }
+    if (config->access_log_buffer_kb < 16 || config->access_log_buffer_kb > 65536)
+    {
+        fprintf(stderr, "Invalid access log buffer size: %d KB (must be 16-65536)\n",
+                config->access_log_buffer_kb);
+        return -1;
+    }
+
+    // Connection deadlines
+    if (config->idle_timeout < 1 || config->idle_timeout > 86400)
+    {
+        fprintf(stderr, "Invalid idle timeout: %d seconds (must be 1-86400)\n", config->idle_timeout);
+        return -1;
+    }
+
+    if (config->header_timeout < 1 || config->header_timeout > 300)
+    {
+        fprintf(stderr, "Invalid header timeout: %d seconds (must be 1-300)\n", config->header_timeout);
+        return -1;
+    }
+
+    if (config->write_timeout < 1 || config->write_timeout > 3600)
+    {
+        fprintf(stderr, "Invalid write timeout: %d seconds (must be 1-3600)\n", config->write_timeout);
+        return -1;
+    }
+
+    if (config->slow_loop_ms < 0 || config->slow_loop_ms > 60000)
+    {
+        fprintf(stderr, "Invalid slow loop threshold: %d ms (must be 0-60000)\n", config->slow_loop_ms);
+        return -1;
+    }
+
+    // Chat lines must fit in the read buffer together with the terminator
+    if (config->max_line_length < 16 || config->max_line_length > BUFFER_SIZE - 2)
+    {
+        fprintf(stderr, "Invalid max line length: %d (must be 16-%d)\n",
+                config->max_line_length, BUFFER_SIZE - 2);
+        return -1;
+    }
+
+    if (config->broadcast_batch_ms < 0 || config->broadcast_batch_ms > 100)
+    {
+        fprintf(stderr, "Invalid broadcast batch window: %d ms (must be 0-100)\n",
+                config->broadcast_batch_ms);
+        return -1;
+    }
+
+    if (config->history_size < 0 || config->history_size > 1000)
+    {
+        fprintf(stderr, "Invalid history size: %d (must be 0-1000)\n", config->history_size);
+        return -1;
+    }
+
+    // Replay has nothing to send with history off, so it is not checked then
+    if (config->history_replay < 0 ||
+        (config->history_size > 0 && config->history_replay > config->history_size))
+    {
+        fprintf(stderr, "Invalid history replay: %d (must be 0-%d)\n",
+                config->history_replay, config->history_size);
+        return -1;
+    }
+
+    if (config->chat_shards < 1 || config->chat_shards > 64)
+    {
+        fprintf(stderr, "Invalid chat shard count: %d (must be 1-64)\n", config->chat_shards);
+        return -1;
+    }
+
+    if (config->flood_user_rate < 0 || config->flood_user_rate > 10000 ||
+        (config->flood_user_rate > 0 && (config->flood_user_burst < 1 || config->flood_user_burst > 10000)))
+    {
+        fprintf(stderr, "Invalid user flood limit: %d/s, burst %d (rate 0-10000, burst 1-10000)\n",
+                config->flood_user_rate, config->flood_user_burst);
+        return -1;
+    }
+
+    if (config->flood_room_rate < 0 || config->flood_room_rate > 100000 ||
+        (config->flood_room_rate > 0 && (config->flood_room_burst < 1 || config->flood_room_burst > 100000)))
+    {
+        fprintf(stderr, "Invalid room flood limit: %d/s, burst %d (rate 0-100000, burst 1-100000)\n",
+                config->flood_room_rate, config->flood_room_burst);
+        return -1;
+    }
+
+    if (config->chat_persist &&
+        (config->chat_segment_size_mb < 1 || config->chat_segment_size_mb > 1024))
+    {
+        fprintf(stderr, "Invalid chat log segment size: %d MB (must be 1-1024)\n",
+                config->chat_segment_size_mb);
+        return -1;
+    }
+
+    if (config->chat_persist &&
+        (config->chat_fsync_interval_ms < 10 || config->chat_fsync_interval_ms > 60000))
+    {
+        fprintf(stderr, "Invalid chat log fsync interval: %d ms (must be 10-60000)\n",
+                config->chat_fsync_interval_ms);
+        return -1;
+    }
+
+    if (config->federation_enabled)
+    {
+        if (config->federation_port < 0 || config->federation_port > 65535 ||
+            config->federation_port == config->http_port ||
+            config->federation_port == config->chat_port)
+        {
+            fprintf(stderr, "Invalid federation port: %d\n", config->federation_port);
+            return -1;
+        }
+
+        struct in_addr bind_addr;
+        if (inet_pton(AF_INET, config->federation_bind, &bind_addr) != 1)
+        {
+            fprintf(stderr, "Invalid federation bind address: '%s'\n", config->federation_bind);
+            return -1;
+        }
+
+        // Node names travel in single-word protocol lines
+        if (config->federation_node[0] == '\0' || strpbrk(config->federation_node, " \t"))
+        {
+            fprintf(stderr, "Invalid federation node name: '%s'\n", config->federation_node);
+            return -1;
+        }
+
+        if (config->federation_reconnect_ms < 100 || config->federation_reconnect_ms > 60000)
+        {
+            fprintf(stderr, "Invalid federation reconnect interval: %d ms (must be 100-60000)\n",
+                    config->federation_reconnect_ms);
+            return -1;
+        }
+    }
+
+    if (config->rate_limit_requests < 0 || config->rate_limit_requests > 1000000 ||
+        config->rate_limit_window < 1 || config->rate_limit_window > 86400)
+    {
+        fprintf(stderr, "Invalid rate limit: %d requests per %d seconds (0-1000000 per 1-86400)\n",
+                config->rate_limit_requests, config->rate_limit_window);
+        return -1;
+    }
+
     // Validate document root
     struct stat st;
     if (stat(config->document_root, &st) != 0 || !S_ISDIR(st.st_mode))
@@ -295,15 +745,100 @@ void config_print(const ServerConfig *config)
     printf("Chat Port: %d\n", config->chat_port);
     printf("Max Connections: %d\n", config->max_connections);
     printf("Document Root: %s\n", config->document_root);
+    printf("Header Timeout: %d seconds\n", config->header_timeout);
+    printf("Write Timeout: %d seconds\n", config->write_timeout);
+    if (config->slow_loop_ms > 0)
+        printf("Slow Loop Report: over %d ms\n", config->slow_loop_ms);
+    else
+        printf("Slow Loop Report: disabled\n");
     printf("Log Level: %d\n", config->log_level);
+    for (int i = 0; i < LOG_MODULE_COUNT; i++)
+    {
+        if (config->log_module_levels[i] >= 0)
+            printf("Log Level (%s): %d\n", log_module_names[i], config->log_module_levels[i]);
+    }
     printf("Log File: %s\n", config->log_file);
     printf("Log to Console: %s\n", config->log_to_console ? "yes" : "no");
-    printf("Log to File: %s\n", config->log_to_file ? "yes" : "no");
+    printf("Log to File: %s (%s)\n", config->log_to_file ? "yes" : "no",
+           config->log_file_format == LOG_FILE_BINARY ? "binary" : "text");
+    if (config->log_async)
+    {
+        printf("Async Logging: %d KB per thread, %s when full\n", config->log_buffer_kb,
+               config->log_overflow == LOG_OVERFLOW_BLOCK ? "block" : "drop");
+    }
+    else
+    {
+        printf("Async Logging: disabled\n");
+    }
+    if (config->log_rotate_size_mb > 0 || config->log_rotate_interval > 0)
+    {
+        printf("Log Rotation: %d MB, every %d s, keep %d%s\n", config->log_rotate_size_mb,
+               config->log_rotate_interval, config->log_rotate_keep,
+               config->log_rotate_compress ? ", compressed" : "");
+    }
+    else
+    {
+        printf("Log Rotation: disabled\n");
+    }
+    if (config->access_log_file[0])
+    {
+        printf("Access Log: %s (1 in %d, %d KB buffer)\n", config->access_log_file,
+               config->access_log_sample, config->access_log_buffer_kb);
+    }
+    else
+    {
+        printf("Access Log: disabled\n");
+    }
+    if (config->flight_recorder && config->flight_file[0])
+        printf("Flight Recorder: dumps to %s on SIGUSR1\n", config->flight_file);
+    else
+        printf("Flight Recorder: disabled\n");
     printf("Default Page: %s\n", config->default_page);
     printf("Directory Listing: %s\n", config->directory_listing ? "yes" : "no");
+    printf("Metrics Endpoint: %s\n", config->http_metrics ? "/metrics" : "disabled");
     printf("Max Rooms: %d\n", config->max_rooms);
     printf("Max Users per Room: %d\n", config->max_users_per_room);
     printf("Idle Timeout: %d seconds\n", config->idle_timeout);
+    printf("Max Line Length: %d bytes\n", config->max_line_length);
+    printf("Broadcast Batch Window: %d ms\n", config->broadcast_batch_ms);
+    printf("History Size: %d messages per room\n", config->history_size);
+    printf("History Replay on Join: %d messages\n", config->history_size > 0 ? config->history_replay : 0);
+    printf("Chat Shards: %d\n", config->chat_shards);
+    printf("Flood Limits: user %d/s (burst %d), room %d/s (burst %d), action %s\n",
+           config->flood_user_rate, config->flood_user_burst,
+           config->flood_room_rate, config->flood_room_burst,
+           config->flood_action == FLOOD_ACTION_DELAY        ? "delay"
+           : config->flood_action == FLOOD_ACTION_DISCONNECT ? "disconnect"
+                                                             : "drop");
+    printf("Chat Log: %s\n", config->chat_persist ? config->chat_persist_dir : "disabled");
+    if (config->federation_enabled)
+    {
+        printf("Federation: node %s, port %d on %s, peers %s\n", config->federation_node,
+               config->federation_port, config->federation_bind,
+               config->federation_peers[0] ? config->federation_peers : "(none)");
+    }
+    else
+    {
+        printf("Federation: disabled\n");
+    }
+    if (config->rate_limit_requests > 0)
+    {
+        printf("Rate Limit: %d requests per %d seconds per address\n",
+               config->rate_limit_requests, config->rate_limit_window);
+    }
+    else
+    {
+        printf("Rate Limit: disabled\n");
+    }
+    if (config->enable_access_control)
+    {
+        printf("Access Control: allow [%s], deny [%s]%s%s\n", config->access_allow,
+               config->access_deny, config->access_file[0] ? ", file " : "", config->access_file);
+    }
+    else
+    {
+        printf("Access Control: disabled\n");
+    }
     printf("=============================\n");
 }
 
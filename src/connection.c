@@ -1,5 +1,16 @@
+#define LOG_MODULE LOG_MODULE_CONNECTION
+
 #include "connection.h"
+#include "clock.h"
 #include "logging.h"
+#include "metrics.h"
+#include "websocket.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+static void connection_deadline_expired(Timer *timer);
 
 ConnectionPool *connection_pool_create(int max_connections)
 {
@@ -22,6 +33,9 @@ ConnectionPool *connection_pool_create(int max_connections)
     pool->active_connections = 0;
     pool->total_connections = 0;
 
+    timer_wheel_init(&pool->timers, clock_now_ms());
+    connection_pool_set_timeouts(pool, 300, 10, 30);
+
     log_info("Connection pool created with max %d connections", max_connections);
     return pool;
 }
@@ -57,12 +71,15 @@ Connection *connection_create(int fd, struct sockaddr_in *client_addr)
     memset(conn, 0, sizeof(Connection));
 
     conn->fd = fd;
-    conn->connected_at = time(NULL);
+    conn->connected_at = clock_now_sec();
+    conn->accepted_ns = clock_precise_ns();
+    flight_record(&conn->flight, FLIGHT_ACCEPT, PROTOCOL_UNKNOWN, fd);
     conn->last_activity = conn->connected_at;
     conn->protocol = PROTOCOL_UNKNOWN;
     conn->state = CONN_STATE_NEW;
 
     // Convert client address to string
+    conn->addr = client_addr->sin_addr;
     inet_ntop(AF_INET, &client_addr->sin_addr, conn->ip, sizeof(conn->ip));
     conn->port = ntohs(client_addr->sin_port);
 
@@ -89,6 +106,13 @@ Connection *connection_create(int fd, struct sockaddr_in *client_addr)
     conn->keep_alive = false;
     conn->has_data_to_send = false;
 
+    for (int i = 0; i < CONN_DEADLINE_COUNT; i++)
+    {
+        timer_init(&conn->deadlines[i], connection_deadline_expired, conn);
+    }
+
+    metrics_add(METRIC_CONNECTIONS_ACTIVE, 1);
+
     log_debug("Connection created for %s:%d (fd=%d)", conn->ip, conn->port, conn->fd);
     return conn;
 }
@@ -100,6 +124,14 @@ void connection_destroy(Connection *conn)
 
     log_debug("Destroying connection %s:%d (fd=%d)", conn->ip, conn->port, conn->fd);
 
+    for (int i = 0; i < CONN_DEADLINE_COUNT; i++)
+    {
+        connection_cancel_deadline(conn, (ConnectionDeadline)i);
+    }
+
+    metrics_add(METRIC_CONNECTIONS_ACTIVE, -1);
+    flight_record_loop(FLIGHT_CLOSE, conn->flight.close_reason, conn->fd);
+
     // Close socket
     if (conn->fd >= 0)
     {
@@ -115,6 +147,7 @@ void connection_destroy(Connection *conn)
     // Free buffers
     free(conn->read_buffer);
     free(conn->write_buffer);
+    free(conn->ws_message);
 
     free(conn);
 }
@@ -140,6 +173,14 @@ int connection_pool_add(ConnectionPool *pool, Connection *conn)
             pool->active_connections++;
             pool->total_connections++;
 
+            // Deadlines live on the wheel of the loop that owns the connection
+            conn->pool = pool;
+            connection_arm_deadline(conn, CONN_DEADLINE_IDLE);
+            if (conn->protocol == PROTOCOL_HTTP)
+                connection_arm_deadline(conn, CONN_DEADLINE_HEADER);
+            if (conn->has_data_to_send)
+                connection_arm_deadline(conn, CONN_DEADLINE_WRITE);
+
             log_debug("Connection added to pool at slot %d (%s:%d)",
                       i, conn->ip, conn->port);
             return i;
@@ -173,6 +214,35 @@ void connection_pool_remove(ConnectionPool *pool, Connection *conn)
     log_warn("Connection not found in pool for removal");
 }
 
+void connection_pool_detach(ConnectionPool *pool, Connection *conn)
+{
+    if (!pool || !conn)
+        return;
+
+    // Like connection_pool_remove, but ownership passes to the caller
+    for (int i = 0; i < pool->max_connections; i++)
+    {
+        if (pool->connections[i] == conn)
+        {
+            pool->connections[i] = NULL;
+            pool->active_connections--;
+
+            // The adopting pool arms fresh deadlines on its own wheel
+            for (int d = 0; d < CONN_DEADLINE_COUNT; d++)
+            {
+                connection_cancel_deadline(conn, (ConnectionDeadline)d);
+            }
+            conn->pool = NULL;
+
+            log_debug("Connection detached from pool slot %d (%s:%d)",
+                      i, conn->ip, conn->port);
+            return;
+        }
+    }
+
+    log_warn("Connection not found in pool for detach");
+}
+
 Connection *connection_pool_find_by_fd(ConnectionPool *pool, int fd)
 {
     if (!pool)
@@ -189,29 +259,74 @@ Connection *connection_pool_find_by_fd(ConnectionPool *pool, int fd)
     return NULL;
 }
 
-void connection_pool_cleanup_idle(ConnectionPool *pool, int timeout)
+void connection_pool_set_timeouts(ConnectionPool *pool, int idle_timeout, int header_timeout, int write_timeout)
 {
     if (!pool)
         return;
 
-    time_t now = time(NULL);
-    int cleaned = 0;
+    pool->deadline_ms[CONN_DEADLINE_IDLE] = idle_timeout * 1000;
+    pool->deadline_ms[CONN_DEADLINE_HEADER] = header_timeout * 1000;
+    pool->deadline_ms[CONN_DEADLINE_WRITE] = write_timeout * 1000;
+}
 
-    for (int i = 0; i < pool->max_connections; i++)
-    {
-        Connection *conn = pool->connections[i];
-        if (conn && (now - conn->last_activity) > timeout)
-        {
-            log_debug("Cleaning up idle connection %s:%d", conn->ip, conn->port);
-            connection_pool_remove(pool, conn);
-            cleaned++;
-        }
-    }
+// Run the deadlines that came due since the last call. Expired connections
+// are only marked closing; the loop's flush pass removes them.
+int connection_pool_expire(ConnectionPool *pool)
+{
+    if (!pool)
+        return 0;
+
+    return timer_wheel_advance(&pool->timers, clock_now_ms());
+}
+
+void connection_arm_deadline(Connection *conn, ConnectionDeadline deadline)
+{
+    if (!conn || !conn->pool)
+        return;
 
-    if (cleaned > 0)
+    ConnectionPool *pool = conn->pool;
+    timer_wheel_schedule(&pool->timers, &conn->deadlines[deadline],
+                         clock_now_ms() + pool->deadline_ms[deadline]);
+}
+
+void connection_cancel_deadline(Connection *conn, ConnectionDeadline deadline)
+{
+    if (!conn || !conn->pool)
+        return;
+
+    timer_wheel_cancel(&conn->pool->timers, &conn->deadlines[deadline]);
+}
+
+static void connection_deadline_expired(Timer *timer)
+{
+    Connection *conn = timer->data;
+    ConnectionDeadline deadline = (ConnectionDeadline)(timer - conn->deadlines);
+
+    // Connections already on their way out, or to another loop, are left alone
+    if (conn->state == CONN_STATE_CLOSING || conn->state == CONN_STATE_HANDOFF)
+        return;
+
+    int seconds = conn->pool->deadline_ms[deadline] / 1000;
+    switch (deadline)
     {
-        log_info("Cleaned up %d idle connections", cleaned);
+    case CONN_DEADLINE_IDLE:
+        log_debug("Closing idle connection %s:%d", conn->ip, conn->port);
+        flight_record_close(&conn->flight, FLIGHT_CLOSE_IDLE);
+        break;
+    case CONN_DEADLINE_HEADER:
+        log_info("Closing %s:%d: request headers incomplete after %d seconds",
+                 conn->ip, conn->port, seconds);
+        flight_record_close(&conn->flight, FLIGHT_CLOSE_HEADER_TIMEOUT);
+        break;
+    default:
+        log_info("Closing %s:%d: no write progress for %d seconds",
+                 conn->ip, conn->port, seconds);
+        flight_record_close(&conn->flight, FLIGHT_CLOSE_WRITE_TIMEOUT);
+        break;
     }
+
+    metrics_add(METRIC_CONNECTION_TIMEOUTS, 1);
+    conn->state = CONN_STATE_CLOSING;
 }
 
 int connection_read(Connection *conn)
@@ -219,6 +334,12 @@ int connection_read(Connection *conn)
     if (!conn)
         return -1;
 
+    // Reclaim space held by lines that were already consumed
+    if (conn->read_buffer_used >= conn->read_buffer_size - 1 && conn->read_line_start > 0)
+    {
+        connection_compact_read_buffer(conn);
+    }
+
     // Ensure we have space in the buffer
     if (conn->read_buffer_used >= conn->read_buffer_size - 1)
     {
@@ -235,8 +356,11 @@ int connection_read(Connection *conn)
     if (bytes_read > 0)
     {
         conn->read_buffer_used += bytes_read;
+        metrics_add(METRIC_BYTES_RECEIVED, bytes_read);
+        flight_record(&conn->flight, FLIGHT_READ, 0, (int)bytes_read);
         conn->read_buffer[conn->read_buffer_used] = '\0'; // Null terminate
-        conn->last_activity = time(NULL);
+        conn->last_activity = clock_now_sec();
+        connection_arm_deadline(conn, CONN_DEADLINE_IDLE);
 
         log_debug("Read %zd bytes from %s:%d", bytes_read, conn->ip, conn->port);
         return bytes_read;
@@ -245,18 +369,21 @@ int connection_read(Connection *conn)
     {
         // Connection closed by client
         log_debug("Connection closed by client %s:%d", conn->ip, conn->port);
-        return 0;
+        flight_record_close(&conn->flight, FLIGHT_CLOSE_PEER);
+        return -1;
     }
     else
     {
         if (errno == EAGAIN || errno == EWOULDBLOCK)
         {
             // No data available right now
+            flight_record(&conn->flight, FLIGHT_READ_EAGAIN, 0, 0);
             return 0;
         }
         else
         {
             log_error("Read error from %s:%d: %s", conn->ip, conn->port, strerror(errno));
+            flight_record_close(&conn->flight, FLIGHT_CLOSE_READ_ERROR);
             return -1;
         }
     }
@@ -282,7 +409,15 @@ int connection_write(Connection *conn)
     if (bytes_sent > 0)
     {
         conn->write_buffer_sent += bytes_sent;
-        conn->last_activity = time(NULL);
+        metrics_add(METRIC_BYTES_SENT, bytes_sent);
+        flight_record(&conn->flight, FLIGHT_WRITE, 0, (int)bytes_sent);
+        if (conn->accepted_ns > 0)
+        {
+            metrics_observe(HISTOGRAM_FIRST_BYTE, clock_precise_ns() - conn->accepted_ns);
+            conn->accepted_ns = 0;
+        }
+        conn->last_activity = clock_now_sec();
+        connection_arm_deadline(conn, CONN_DEADLINE_IDLE);
 
         log_debug("Sent %zd bytes to %s:%d", bytes_sent, conn->ip, conn->port);
 
@@ -292,6 +427,11 @@ int connection_write(Connection *conn)
             conn->has_data_to_send = false;
             conn->write_buffer_used = 0;
             conn->write_buffer_sent = 0;
+            connection_cancel_deadline(conn, CONN_DEADLINE_WRITE);
+        }
+        else
+        {
+            connection_arm_deadline(conn, CONN_DEADLINE_WRITE);
         }
 
         return bytes_sent;
@@ -306,16 +446,37 @@ int connection_write(Connection *conn)
         if (errno == EAGAIN || errno == EWOULDBLOCK)
         {
             // Socket buffer full, try again later
+            flight_record(&conn->flight, FLIGHT_WRITE_EAGAIN, 0, (int)remaining);
             return 0;
         }
         else
         {
             log_error("Write error to %s:%d: %s", conn->ip, conn->port, strerror(errno));
+            flight_record_close(&conn->flight, FLIGHT_CLOSE_WRITE_ERROR);
             return -1;
         }
     }
 }
 
+const char *connection_protocol_name(ProtocolType protocol)
+{
+    switch (protocol)
+    {
+    case PROTOCOL_HTTP:
+        return "HTTP";
+    case PROTOCOL_CHAT:
+        return "CHAT";
+    case PROTOCOL_HTTPS:
+        return "HTTPS";
+    case PROTOCOL_WEBSOCKET:
+        return "WEBSOCKET";
+    case PROTOCOL_SSE:
+        return "SSE";
+    default:
+        return "UNKNOWN";
+    }
+}
+
 void connection_set_protocol_data(Connection *conn, void *data, void (*cleanup)(void *))
 {
     if (!conn)
@@ -358,6 +519,184 @@ void connection_prepare_response(Connection *conn, const char *data, size_t leng
     memcpy(conn->write_buffer, data, length);
     conn->write_buffer_used = length;
     conn->has_data_to_send = true;
+    connection_arm_deadline(conn, CONN_DEADLINE_WRITE);
 
     log_debug("Prepared %zu bytes for sending to %s:%d", length, conn->ip, conn->port);
 }
+
+int connection_queue_data(Connection *conn, const char *data, size_t length)
+{
+    if (!conn || !data || length == 0)
+        return 0;
+
+    // WebSocket peers get each chunk of chat output as one text frame
+    if (conn->protocol == PROTOCOL_WEBSOCKET)
+        return websocket_queue_frame(conn, WS_OP_TEXT, data, length);
+
+    return connection_queue_raw(conn, data, length);
+}
+
+// Make room for length more bytes of output, so that the parts of one
+// frame can be queued knowing that none of them will be refused
+int connection_reserve_write(Connection *conn, size_t length)
+{
+    // Reclaim space held by bytes that were already sent
+    if (conn->write_buffer_sent > 0 &&
+        conn->write_buffer_used + length > conn->write_buffer_size)
+    {
+        size_t pending = conn->write_buffer_used - conn->write_buffer_sent;
+        memmove(conn->write_buffer, conn->write_buffer + conn->write_buffer_sent, pending);
+        conn->write_buffer_used = pending;
+        conn->write_buffer_sent = 0;
+    }
+
+    size_t needed = conn->write_buffer_used + length;
+    if (needed > conn->write_buffer_size)
+    {
+        if (needed > MAX_WRITE_BUFFER)
+        {
+            log_warn("Write buffer limit reached for %s:%d, dropping %zu bytes",
+                     conn->ip, conn->port, length);
+            return -1;
+        }
+
+        size_t new_size = conn->write_buffer_size;
+        while (new_size < needed)
+        {
+            new_size *= 2;
+        }
+        if (new_size > MAX_WRITE_BUFFER)
+        {
+            new_size = MAX_WRITE_BUFFER;
+        }
+
+        char *new_buffer = realloc(conn->write_buffer, new_size);
+        if (!new_buffer)
+        {
+            log_error("Failed to expand write buffer for %s:%d", conn->ip, conn->port);
+            return -1;
+        }
+        conn->write_buffer = new_buffer;
+        conn->write_buffer_size = new_size;
+    }
+    return 0;
+}
+
+// Append bytes to the write buffer exactly as given, bypassing any framing
+int connection_queue_raw(Connection *conn, const char *data, size_t length)
+{
+    if (!conn || !data || length == 0)
+        return 0;
+
+    if (connection_reserve_write(conn, length) < 0)
+        return -1;
+
+    // Append behind any pending output; the event loop flushes it once per iteration
+    memcpy(conn->write_buffer + conn->write_buffer_used, data, length);
+    conn->write_buffer_used += length;
+
+    // The stall deadline runs from the first unsent byte, not the latest one
+    if (!conn->has_data_to_send)
+    {
+        conn->has_data_to_send = true;
+        connection_arm_deadline(conn, CONN_DEADLINE_WRITE);
+    }
+
+    return 0;
+}
+
+const char *connection_scan_newline(const char *data, size_t length)
+{
+#ifdef __SSE2__
+    // Compare 16 bytes per step and pick the first match from the mask
+    const __m128i newline = _mm_set1_epi8('\n');
+    while (length >= 16)
+    {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)data);
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, newline));
+        if (mask)
+        {
+            return data + __builtin_ctz(mask);
+        }
+        data += 16;
+        length -= 16;
+    }
+#endif
+    return memchr(data, '\n', length);
+}
+
+int connection_next_line(Connection *conn, size_t max_line_length, char **line, size_t *line_length)
+{
+    if (!conn || !line || !line_length)
+        return 0;
+
+    for (;;)
+    {
+        size_t start = conn->read_line_start;
+        size_t scan_from = conn->read_scan_offset > start ? conn->read_scan_offset : start;
+        const char *newline = connection_scan_newline(conn->read_buffer + scan_from,
+                                                      conn->read_buffer_used - scan_from);
+
+        if (!newline)
+        {
+            // Remember how far we got so the next read only scans new bytes
+            conn->read_scan_offset = conn->read_buffer_used;
+
+            if (conn->read_buffer_used - start > max_line_length)
+            {
+                // Partial line already exceeds the limit, drop it and skip to the next newline
+                bool report = !conn->discarding_line;
+                conn->read_line_start = conn->read_buffer_used;
+                conn->discarding_line = true;
+                return report ? -1 : 0;
+            }
+            return 0;
+        }
+
+        char *buffer = conn->read_buffer + start;
+        size_t length = newline - buffer;
+
+        conn->read_line_start = start + length + 1;
+        conn->read_scan_offset = conn->read_line_start;
+
+        if (conn->discarding_line)
+        {
+            // Tail of an overlong line that was already reported
+            conn->discarding_line = false;
+            continue;
+        }
+
+        if (length > max_line_length)
+        {
+            return -1;
+        }
+
+        // Strip trailing carriage return from CRLF clients
+        if (length > 0 && buffer[length - 1] == '\r')
+        {
+            length--;
+        }
+        buffer[length] = '\0';
+
+        *line = buffer;
+        *line_length = length;
+        return 1;
+    }
+}
+
+void connection_compact_read_buffer(Connection *conn)
+{
+    if (!conn || conn->read_line_start == 0)
+        return;
+
+    size_t pending = conn->read_buffer_used - conn->read_line_start;
+    if (pending > 0)
+    {
+        memmove(conn->read_buffer, conn->read_buffer + conn->read_line_start, pending);
+    }
+
+    conn->read_scan_offset -= conn->read_line_start;
+    conn->read_buffer_used = pending;
+    conn->read_line_start = 0;
+    conn->read_buffer[pending] = '\0';
+}
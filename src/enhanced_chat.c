@@ -1,8 +1,162 @@
+#define LOG_MODULE LOG_MODULE_CHAT
+
 #include "enhanced_chat.h"
+#include "chat_binary.h"
+#include "chat_log.h"
+#include "chat_shard.h"
+#include "clock.h"
+#include "federation.h"
 #include "logging.h"
+#include "metrics.h"
+#include "sse.h"
+#include "token_bucket.h"
+#include "websocket.h"
+
+// Chat server of the shard served by the calling thread
+static __thread ChatServer *current_chat_server = NULL;
+
+// Source of user ids, unique across shards
+static unsigned long next_user_id = 0;
+
+// Connected users across all shards
+static int active_users = 0;
+static int peak_users = 0;
+
+static void chat_detach_user(ChatServer *server, ChatUser *user)
+{
+    for (int i = 0; i < server->user_count; i++)
+    {
+        if (server->users[i] == user)
+        {
+            server->users[i] = server->users[server->user_count - 1];
+            server->users[server->user_count - 1] = NULL;
+            server->user_count--;
+            return;
+        }
+    }
+}
+
+// Register, move or drop a nickname on the shard that owns it
+static void chat_post_nick(ChatShardMessageType type, const char *nick)
+{
+    ChatShardMessage *message = chat_shard_message_create(type, NULL);
+    if (!message)
+        return;
+
+    snprintf(message->nick, sizeof(message->nick), "%s", nick);
+    message->shard = chat_shard_current();
+    chat_shard_post(chat_shard_for_name(nick), message);
+}
+
+// Input stays buffered while a nickname claim or a delayed message is pending
+static bool chat_input_held(const ChatUser *user)
+{
+    return user->nick_pending || user->flood_held;
+}
+
+// O(1) flood gate for one room message: takes a token from both the
+// sender's and the room's bucket, or from neither. On refusal *wait_ms
+// tells when both buckets will have a token again.
+static bool chat_flood_allow(ChatServer *server, ChatUser *user, ChatRoom *room, long long *wait_ms)
+{
+    long long now = clock_now_ms();
+    bool allowed = true;
+    *wait_ms = 0;
+
+    if (server->flood_user_rate > 0)
+    {
+        token_bucket_refill(&user->flood_bucket, server->flood_user_rate, server->flood_user_burst, now);
+        if (!token_bucket_available(&user->flood_bucket))
+        {
+            allowed = false;
+            *wait_ms = token_bucket_wait_ms(&user->flood_bucket, server->flood_user_rate);
+        }
+    }
+
+    if (server->flood_room_rate > 0)
+    {
+        token_bucket_refill(&room->flood_bucket, server->flood_room_rate, server->flood_room_burst, now);
+        if (!token_bucket_available(&room->flood_bucket))
+        {
+            long long room_wait = token_bucket_wait_ms(&room->flood_bucket, server->flood_room_rate);
+            allowed = false;
+            if (room_wait > *wait_ms)
+                *wait_ms = room_wait;
+        }
+    }
+
+    if (!allowed)
+        return false;
+
+    if (server->flood_user_rate > 0)
+        token_bucket_take(&user->flood_bucket);
+    if (server->flood_room_rate > 0)
+        token_bucket_take(&room->flood_bucket);
+    return true;
+}
+
+// Apply the configured action to a message over the limit. Returns -1 to
+// disconnect, 0 when the message was dropped and 1 when it is held back
+// (with the rest of the sender's input) until the buckets refill.
+static int chat_flood_limit(ChatServer *server, ChatUser *user, const char *text, long long wait_ms)
+{
+    switch (server->flood_action)
+    {
+    case FLOOD_ACTION_DELAY:
+        user->flood_held = strdup(text);
+        if (!user->flood_held)
+            return 0;
+        user->flood_resume_ms = clock_now_ms() + wait_ms;
+        server->delayed_users++;
+        return 1;
+
+    case FLOOD_ACTION_DISCONNECT:
+        chat_send_system_message(user, "Disconnected for flooding");
+        log_warn("Disconnecting %s (%s:%d) for flooding", user->nickname,
+                 user->connection->ip, user->connection->port);
+        return -1;
+
+    default:
+        chat_send_system_message(user, "You are sending messages too fast; message dropped");
+        log_debug("Dropped message from %s over the flood limit", user->nickname);
+        return 0;
+    }
+}
+
+// Connection cleanup hook: detach the user once its socket is gone so no
+// output is ever queued on a freed connection
+static void chat_connection_closed(void *data)
+{
+    ChatUser *user = data;
+    ChatServer *server = current_chat_server;
+
+    if (server)
+    {
+        chat_detach_user(server, user);
+        if (user->flood_held)
+        {
+            server->delayed_users--;
+        }
+    }
+
+    chat_post_nick(SHARD_MSG_NICK_RELEASE, user->nickname);
+    __atomic_sub_fetch(&active_users, 1, __ATOMIC_RELAXED);
+
+    user->connection = NULL;
+    chat_user_destroy(user);
+}
+
+// A sender with a message held by the flood limit is not read from until
+// chat_release_delayed lets it go; reading on would only fill the read
+// buffer and get the connection closed
+bool chat_connection_paused(const Connection *conn)
+{
+    if (conn->cleanup_func != chat_connection_closed || !conn->protocol_data)
+        return false;
 
-// Global chat server instance
-static ChatServer *global_chat_server = NULL;
+    const ChatUser *user = conn->protocol_data;
+    return user->flood_held != NULL;
+}
 
 ChatServer *chat_server_create(void)
 {
@@ -15,20 +169,24 @@ ChatServer *chat_server_create(void)
 
     memset(server, 0, sizeof(ChatServer));
     server->start_time = time(NULL);
+    server->max_line_length = MAX_MESSAGE_LENGTH;
 
-    // Create default lobby room
-    ChatRoom *lobby = chat_room_create("lobby");
-    if (lobby)
-    {
-        strcpy(lobby->topic, "Welcome to MultiServer Chat! Type /help for commands.");
-        server->rooms[0] = lobby;
-        server->room_count = 1;
-    }
-
-    log_info("Enhanced chat server created with lobby room");
+    log_info("Enhanced chat server created");
     return server;
 }
 
+int chat_server_add_room(ChatServer *server, ChatRoom *room)
+{
+    if (server->room_count >= MAX_ROOMS)
+        return -1;
+
+    // Other shards read the room list for /list rooms; publish the slot
+    // before the count that makes it visible
+    server->rooms[server->room_count] = room;
+    __atomic_store_n(&server->room_count, server->room_count + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
 void chat_server_destroy(ChatServer *server)
 {
     if (!server)
@@ -56,6 +214,34 @@ void chat_server_destroy(ChatServer *server)
     log_info("Chat server destroyed");
 }
 
+ChatPayload *chat_payload_create(const char *data, size_t length)
+{
+    ChatPayload *payload = malloc(sizeof(ChatPayload) + length);
+    if (!payload)
+    {
+        log_error("Failed to allocate chat payload");
+        return NULL;
+    }
+
+    payload->refcount = 1;
+    payload->length = length;
+    memcpy(payload->data, data, length);
+    return payload;
+}
+
+ChatPayload *chat_payload_ref(ChatPayload *payload)
+{
+    if (payload)
+        payload->refcount++;
+    return payload;
+}
+
+void chat_payload_unref(ChatPayload *payload)
+{
+    if (payload && --payload->refcount == 0)
+        free(payload);
+}
+
 ChatUser *chat_user_create(Connection *conn)
 {
     ChatUser *user = malloc(sizeof(ChatUser));
@@ -66,15 +252,16 @@ ChatUser *chat_user_create(Connection *conn)
     }
 
     memset(user, 0, sizeof(ChatUser));
+    user->id = __atomic_add_fetch(&next_user_id, 1, __ATOMIC_RELAXED);
     user->connection = conn;
-    user->join_time = time(NULL);
+    user->join_time = clock_now_sec();
     user->last_activity = user->join_time;
     user->authenticated = false;
     user->is_admin = false;
     user->current_room = NULL;
 
-    // Generate default nickname
-    snprintf(user->nickname, sizeof(user->nickname), "User%d", (int)(user->join_time % 10000));
+    // Generate default nickname, unique because the id is
+    snprintf(user->nickname, sizeof(user->nickname), "User%lu", user->id);
 
     return user;
 }
@@ -84,6 +271,8 @@ void chat_user_destroy(ChatUser *user)
     if (!user)
         return;
 
+    free(user->flood_held);
+
     // Leave current room if in one
     if (user->current_room)
     {
@@ -104,7 +293,7 @@ ChatRoom *chat_room_create(const char *name)
 
     memset(room, 0, sizeof(ChatRoom));
     strncpy(room->name, name, sizeof(room->name) - 1);
-    room->created_at = time(NULL);
+    room->created_at = clock_now_sec();
     room->password_protected = false;
     room->private_room = false;
 
@@ -127,6 +316,16 @@ void chat_room_destroy(ChatRoom *room)
     }
 
     log_info("Destroyed chat room: %s", room->name);
+    if (room->history)
+    {
+        for (int i = 0; i < room->history_capacity; i++)
+        {
+            chat_payload_unref(room->history[i]);
+        }
+        free(room->history);
+    }
+    free(room->batch);
+    free(room->watchers);
     free(room);
 }
 
@@ -154,6 +353,34 @@ ChatUser *chat_find_user_by_connection(ChatServer *server, Connection *conn)
     return NULL;
 }
 
+ChatUser *chat_find_user_by_id(ChatServer *server, unsigned long id)
+{
+    for (int i = 0; i < server->user_count; i++)
+    {
+        if (server->users[i] && server->users[i]->id == id)
+        {
+            return server->users[i];
+        }
+    }
+    return NULL;
+}
+
+// Room names are what /join accepts: one printable word that fits the room
+bool chat_room_name_valid(const char *name)
+{
+    size_t length = strlen(name);
+    if (length == 0 || length >= MAX_ROOM_NAME_LENGTH)
+        return false;
+
+    for (size_t i = 0; i < length; i++)
+    {
+        unsigned char c = name[i];
+        if (c <= ' ' || c == 0x7f)
+            return false;
+    }
+    return true;
+}
+
 ChatRoom *chat_find_room(ChatServer *server, const char *name)
 {
     for (int i = 0; i < server->room_count; i++)
@@ -168,6 +395,23 @@ ChatRoom *chat_find_room(ChatServer *server, const char *name)
 
 int chat_join_room(ChatServer *server, ChatUser *user, const char *room_name, const char *password)
 {
+    // Rooms live on the shard their name hashes to; move the user there
+    // and let that shard complete the join
+    int owner = chat_shard_for_name(room_name);
+    if (owner != chat_shard_current() && user->connection)
+    {
+        if (user->current_room)
+        {
+            chat_leave_room(user);
+        }
+
+        user->pending_shard = owner;
+        snprintf(user->pending_room, sizeof(user->pending_room), "%s", room_name);
+        snprintf(user->pending_password, sizeof(user->pending_password), "%s", password ? password : "");
+        user->connection->state = CONN_STATE_HANDOFF;
+        return 0;
+    }
+
     ChatRoom *room = chat_find_room(server, room_name);
 
     // Create room if it doesn't exist
@@ -176,31 +420,31 @@ int chat_join_room(ChatServer *server, ChatUser *user, const char *room_name, co
         if (server->room_count >= MAX_ROOMS)
         {
             chat_send_system_message(user, "Cannot create room: Maximum rooms reached");
-            return -1;
+            return -CHAT_STATUS_ROOM_LIMIT;
         }
 
         room = chat_room_create(room_name);
         if (!room)
         {
             chat_send_system_message(user, "Failed to create room");
-            return -1;
+            return -CHAT_STATUS_SERVER_ERROR;
         }
 
-        server->rooms[server->room_count++] = room;
+        chat_server_add_room(server, room);
     }
 
     // Check password if room is protected
     if (room->password_protected && password && strcmp(room->password, password) != 0)
     {
         chat_send_system_message(user, "Incorrect room password");
-        return -1;
+        return -CHAT_STATUS_BAD_PASSWORD;
     }
 
     // Check room capacity
     if (room->user_count >= MAX_USERS_PER_ROOM)
     {
         chat_send_system_message(user, "Room is full");
-        return -1;
+        return -CHAT_STATUS_ROOM_FULL;
     }
 
     // Leave current room if in one
@@ -213,6 +457,12 @@ int chat_join_room(ChatServer *server, ChatUser *user, const char *room_name, co
     room->users[room->user_count++] = user;
     user->current_room = room;
 
+    // First local member: ask federated nodes for this room's traffic
+    if (room->user_count == 1 && room->watcher_count == 0)
+    {
+        federation_subscribe(room->name, true);
+    }
+
     // Send welcome messages
     char message[512];
     snprintf(message, sizeof(message), "*** %s joined the room", user->nickname);
@@ -223,6 +473,12 @@ int chat_join_room(ChatServer *server, ChatUser *user, const char *room_name, co
              room->name, room->topic, room->user_count);
     chat_send_system_message(user, message);
 
+    // Let the user catch up on what was said before joining
+    if (server->history_replay > 0)
+    {
+        chat_send_history(room, user, server->history_replay);
+    }
+
     log_info("User %s joined room %s", user->nickname, room->name);
     return 0;
 }
@@ -252,6 +508,23 @@ int chat_leave_room(ChatUser *user)
         }
     }
 
+    if (room->user_count == 0 && room->watcher_count == 0)
+    {
+        federation_subscribe(room->name, false);
+    }
+
+    // Pending batch entries must not keep pointing at this user
+    if (room->batch)
+    {
+        for (int i = 0; i < room->batch->count; i++)
+        {
+            if (room->batch->entries[i].sender == user)
+            {
+                room->batch->entries[i].sender = NULL;
+            }
+        }
+    }
+
     // Announce departure
     char message[256];
     snprintf(message, sizeof(message), "*** %s left the room", user->nickname);
@@ -266,439 +539,1774 @@ int chat_leave_room(ChatUser *user)
 
 void chat_send_system_message(ChatUser *user, const char *message)
 {
+    // Binary clients get status codes instead of banners
+    if (!user->connection || user->binary)
+        return;
+
     char response[BUFFER_SIZE];
     snprintf(response, sizeof(response), "*** %s\n", message);
-    connection_prepare_response(user->connection, response, strlen(response));
-    connection_write(user->connection);
+    connection_queue_data(user->connection, response, strlen(response));
 }
 
-void chat_broadcast_to_room(ChatRoom *room, const char *message, ChatUser *sender)
+// Interactive prompt, only for plain text terminals
+static void chat_queue_prompt(ChatUser *user)
 {
-    if (!room || !sender)
+    if (!user->connection || user->binary || user->connection->protocol == PROTOCOL_WEBSOCKET)
         return;
 
-    char formatted_message[BUFFER_SIZE];
-    time_t now = time(NULL);
-    struct tm *tm_info = localtime(&now);
+    const char *prompt = ">>> ";
+    connection_queue_data(user->connection, prompt, strlen(prompt));
+}
+
+// Queue a room line to every event stream watcher, encoded only once
+static void chat_room_notify_watchers(ChatRoom *room, const char *data, size_t length)
+{
+    if (room->watcher_count == 0)
+        return;
 
-    strftime(formatted_message, sizeof(formatted_message), "[%H:%M:%S] ", tm_info);
-    snprintf(formatted_message + strlen(formatted_message),
-             sizeof(formatted_message) - strlen(formatted_message),
-             "<%s> %s\n", sender->nickname, message);
+    size_t event_length;
+    char *event = sse_encode_event(data, length, &event_length);
+    if (!event)
+        return;
 
-    // Send to all users in room except sender
-    for (int i = 0; i < room->user_count; i++)
+    for (int i = 0; i < room->watcher_count; i++)
     {
-        if (room->users[i] && room->users[i] != sender)
+        Connection *conn = room->watchers[i];
+
+        // Watchers that stop reading are dropped instead of buffered forever
+        if (conn->state != CONN_STATE_CLOSING &&
+            connection_queue_data(conn, event, event_length) < 0)
         {
-            connection_prepare_response(room->users[i]->connection,
-                                        formatted_message, strlen(formatted_message));
+            conn->state = CONN_STATE_CLOSING;
         }
     }
-
-    // Send confirmation to sender
-    snprintf(formatted_message, sizeof(formatted_message), "Message sent to #%s\n", room->name);
-    connection_prepare_response(sender->connection, formatted_message, strlen(formatted_message));
+    free(event);
 }
 
-void chat_announce_to_room(ChatRoom *room, const char *message)
+// Connection cleanup hook of an event stream
+static void chat_watcher_closed(void *data)
 {
-    if (!room)
-        return;
-
-    char formatted_message[BUFFER_SIZE];
-    snprintf(formatted_message, sizeof(formatted_message), "%s\n", message);
+    ChatWatcher *watcher = data;
+    ChatRoom *room = current_chat_server ? chat_find_room(current_chat_server, watcher->room) : NULL;
 
-    for (int i = 0; i < room->user_count; i++)
+    for (int i = 0; room && i < room->watcher_count; i++)
     {
-        if (room->users[i])
+        if (room->watchers[i] == watcher->connection)
         {
-            connection_prepare_response(room->users[i]->connection,
-                                        formatted_message, strlen(formatted_message));
+            room->watchers[i] = room->watchers[--room->watcher_count];
+            if (room->watcher_count == 0 && room->user_count == 0)
+            {
+                federation_subscribe(room->name, false);
+            }
+            log_debug("Event stream %s:%d left #%s", watcher->connection->ip,
+                      watcher->connection->port, room->name);
+            break;
         }
     }
+    free(watcher);
 }
 
-void chat_handle_help_command(ChatUser *user)
+// Answer an event stream request that will not be served and close it
+static void chat_refuse_watcher(Connection *conn, const char *status, const char *body)
 {
-    const char *help_text =
-        "=== MultiServer Chat Commands ===\n"
-        "/join <room> [password] - Join or create a room\n"
-        "/leave                  - Leave current room\n"
-        "/list rooms            - List available rooms\n"
-        "/list users            - List users in current room\n"
-        "/msg <user> <message>  - Send private message\n"
-        "/nick <nickname>       - Change your nickname\n"
-        "/stats                 - Show server statistics\n"
-        "/time                  - Show current time\n"
-        "/clear                 - Clear the screen\n"
-        "/help                  - Show this help\n"
-        "/quit                  - Disconnect\n"
-        "\nTo chat, just type your message (must be in a room)\n"
-        "================================\n";
-
-    connection_prepare_response(user->connection, help_text, strlen(help_text));
-    connection_write(user->connection);
+    char response[256];
+    int length = snprintf(response, sizeof(response),
+                          "HTTP/1.1 %s\r\n"
+                          "Content-Type: text/plain\r\n"
+                          "Content-Length: %zu\r\n"
+                          "Connection: close\r\n"
+                          "\r\n"
+                          "%s",
+                          status, strlen(body), body);
+    connection_queue_data(conn, response, length);
+    conn->state = CONN_STATE_CLOSING;
 }
 
-int chat_process_command(ChatServer *server, ChatUser *user, const char *input)
+// Subscribe a connection to its room on the shard owning the room. Only
+// existing rooms can be watched, and never password-protected ones, since
+// watchers bypass the checks of /join.
+static void chat_attach_watcher(ChatServer *server, Connection *conn)
 {
-    char *input_copy = strdup(input);
-    
-    // Strip trailing newline from input
-    size_t len = strlen(input_copy);
-    if (len > 0 && (input_copy[len - 1] == '\n' || input_copy[len - 1] == '\r')) {
-        input_copy[len - 1] = '\0';
-        len--;
-    }
-    // Handle \r\n case
-    if (len > 0 && input_copy[len - 1] == '\r') {
-        input_copy[len - 1] = '\0';
-    }
-    
-    char *command = strtok(input_copy, " ");
-    char *args = strtok(NULL, "");
+    ChatWatcher *watcher = conn->protocol_data;
+    ChatRoom *room = chat_find_room(server, watcher->room);
 
-    if (!command)
+    if (!room)
     {
-        free(input_copy);
-        return 0;
+        chat_refuse_watcher(conn, "404 Not Found", "Unknown stream\n");
+        return;
     }
-
-    user->last_activity = time(NULL);
-
-    if (command[0] == '/')
+    if (room->password_protected)
     {
-        // Handle commands
-        if (strcmp(command, "/help") == 0)
-        {
-            chat_handle_help_command(user);
-        }
-        else if (strcmp(command, "/join") == 0)
-        {
-            chat_handle_join_command(server, user, args);
-        }
-        else if (strcmp(command, "/leave") == 0)
-        {
-            chat_leave_room(user);
-        }
-        else if (strcmp(command, "/nick") == 0)
-        {
-            chat_handle_nick_command(server, user, args);
-        }
-        else if (strcmp(command, "/list") == 0)
-        {
-            chat_handle_list_command(server, user, args);
-        }
-        else if (strcmp(command, "/stats") == 0)
-        {
-            chat_handle_stats_command(server, user);
-        }
-        else if (strcmp(command, "/time") == 0)
-        {
-            time_t now = time(NULL);
-            char time_msg[128];
-            snprintf(time_msg, sizeof(time_msg), "Server time: %s", ctime(&now));
-            chat_send_system_message(user, time_msg);
-        }
-        else if (strcmp(command, "/clear") == 0)
-        {
-            // Send ANSI escape sequence to clear screen
-            const char *clear_screen = "\033[2J\033[H";
-            connection_prepare_response(user->connection, clear_screen, strlen(clear_screen));
-            connection_write(user->connection);
-        }
-        else if (strcmp(command, "/quit") == 0)
-        {
-            chat_send_system_message(user, "Goodbye!");
-            free(input_copy);
-            return -1; // Signal to close connection
-        }
-        else
-        {
-            chat_send_system_message(user, "Unknown command. Type /help for available commands.");
-        }
+        log_info("Event stream %s:%d refused for protected room #%s", conn->ip, conn->port, room->name);
+        chat_refuse_watcher(conn, "403 Forbidden", "Room is password protected\n");
+        return;
     }
-    else
+
+    if (room->watcher_count == room->watcher_capacity)
     {
-        // Regular chat message
-        if (user->current_room)
+        int capacity = room->watcher_capacity ? room->watcher_capacity * 2 : 16;
+        Connection **watchers = realloc(room->watchers, capacity * sizeof(Connection *));
+        if (!watchers)
         {
-            chat_broadcast_to_room(user->current_room, input, user);
-            server->total_messages++;
+            room = NULL;
         }
         else
         {
-            chat_send_system_message(user, "You must join a room to chat. Type /join lobby");
+            room->watchers = watchers;
+            room->watcher_capacity = capacity;
         }
     }
 
-    free(input_copy);
-    return 0;
-}
+    if (!room)
+    {
+        chat_refuse_watcher(conn, "503 Service Unavailable", "");
+        return;
+    }
+
+    room->watchers[room->watcher_count++] = conn;
+    if (room->watcher_count == 1 && room->user_count == 0)
+    {
+        federation_subscribe(room->name, true);
+    }
+
+    sse_accept(conn);
+    log_info("Event stream %s:%d watching #%s (%d watchers)",
+             conn->ip, conn->port, room->name, room->watcher_count);
+}
+
+// Turn an HTTP connection into a read-only event stream of a room
+int chat_watch_room(Connection *conn, const char *room_name)
+{
+    ChatWatcher *watcher = calloc(1, sizeof(ChatWatcher));
+    if (!watcher)
+        return -1;
+
+    watcher->connection = conn;
+    snprintf(watcher->room, sizeof(watcher->room), "%s", room_name);
+    connection_set_protocol_data(conn, watcher, chat_watcher_closed);
+
+    conn->protocol = PROTOCOL_SSE;
+    conn->keep_alive = true;
+    conn->read_buffer_used = 0;
+    conn->read_line_start = 0;
+    conn->read_scan_offset = 0;
+
+    if (chat_shard_for_name(room_name) != chat_shard_current())
+    {
+        // The event loop hands it over once the current pass is done
+        conn->state = CONN_STATE_HANDOFF;
+        return 1;
+    }
+
+    chat_attach_watcher(current_chat_server, conn);
+    return 1;
+}
+
+// Keep quiet event streams open
+void chat_send_heartbeats(ChatServer *server)
+{
+    time_t now = clock_now_sec();
+    if (!server || now - server->last_heartbeat < SSE_HEARTBEAT_INTERVAL)
+        return;
+
+    server->last_heartbeat = now;
+    for (int i = 0; i < server->room_count; i++)
+    {
+        ChatRoom *room = server->rooms[i];
+        for (int j = 0; room && j < room->watcher_count; j++)
+        {
+            if (sse_queue_heartbeat(room->watchers[j]) < 0)
+            {
+                room->watchers[j]->state = CONN_STATE_CLOSING;
+            }
+        }
+    }
+}
+
+// Deliver one batch to every member as a single payload, skipping the
+// messages each member sent itself
+static void chat_room_flush_batch(ChatRoom *room)
+{
+    ChatBatch *batch = room->batch;
+    if (!batch || batch->count == 0)
+        return;
+
+    long long started_ns = clock_precise_ns();
+
+    // WebSocket members that sent nothing share one frame of the batch
+    char *frame = NULL;
+    size_t frame_length = 0;
+
+    for (int i = 0; i < room->user_count; i++)
+    {
+        ChatUser *member = room->users[i];
+        if (!member || !member->connection)
+            continue;
+
+        if (member->connection->protocol == PROTOCOL_WEBSOCKET)
+        {
+            bool sent_any = false;
+            for (int j = 0; j < batch->count && !sent_any; j++)
+            {
+                sent_any = batch->entries[j].sender == member;
+            }
+
+            if (!sent_any)
+            {
+                if (!frame)
+                    frame = websocket_encode_frame(WS_OP_TEXT, batch->data, batch->used, &frame_length);
+                if (frame)
+                {
+                    connection_queue_raw(member->connection, frame, frame_length);
+                    continue;
+                }
+            }
+        }
+
+        if (member->binary)
+        {
+            for (int j = 0; j < batch->count; j++)
+            {
+                ChatBatchEntry *entry = &batch->entries[j];
+                if (entry->sender != member)
+                {
+                    chat_binary_queue_line(member->connection, CHAT_OP_ROOM_MESSAGE,
+                                           batch->data + entry->offset, entry->length);
+                }
+            }
+            continue;
+        }
+
+        // Queue contiguous runs of entries this member should receive
+        size_t run_start = 0;
+        size_t run_length = 0;
+        for (int j = 0; j < batch->count; j++)
+        {
+            ChatBatchEntry *entry = &batch->entries[j];
+            if (entry->sender == member)
+            {
+                if (run_length > 0)
+                {
+                    connection_queue_data(member->connection, batch->data + run_start, run_length);
+                    run_length = 0;
+                }
+                continue;
+            }
+            if (run_length == 0)
+            {
+                run_start = entry->offset;
+            }
+            run_length += entry->length;
+        }
+
+        if (run_length > 0)
+        {
+            connection_queue_data(member->connection, batch->data + run_start, run_length);
+        }
+    }
+
+    free(frame);
+    batch->used = 0;
+    batch->count = 0;
+    metrics_observe(HISTOGRAM_CHAT_FANOUT, clock_precise_ns() - started_ns);
+}
+
+// Hold a formatted message in the room's batching window
+static int chat_room_batch_append(ChatServer *server, ChatRoom *room,
+                                  const char *data, size_t length, ChatUser *sender)
+{
+    if (length > CHAT_BATCH_BYTES)
+        return -1;
+
+    if (!room->batch)
+    {
+        room->batch = calloc(1, sizeof(ChatBatch));
+        if (!room->batch)
+            return -1;
+    }
+
+    ChatBatch *batch = room->batch;
+    if (batch->count == CHAT_BATCH_ENTRIES || batch->used + length > CHAT_BATCH_BYTES)
+    {
+        chat_room_flush_batch(room);
+    }
+
+    if (batch->count == 0)
+    {
+        batch->deadline_ms = clock_now_ms() + server->broadcast_batch_ms;
+    }
+
+    memcpy(batch->data + batch->used, data, length);
+    batch->entries[batch->count].sender = sender;
+    batch->entries[batch->count].offset = batch->used;
+    batch->entries[batch->count].length = length;
+    batch->used += length;
+    batch->count++;
+    return 0;
+}
+
+// Fan a formatted message out to the room, batched when a window is configured
+static void chat_room_dispatch(ChatRoom *room, const char *data, size_t length, ChatUser *sender)
+{
+    chat_room_notify_watchers(room, data, length);
+
+    ChatServer *server = current_chat_server;
+    if (server && server->broadcast_batch_ms > 0 &&
+        chat_room_batch_append(server, room, data, length, sender) == 0)
+    {
+        return;
+    }
+
+    // Keep ordering with anything still held in the window
+    chat_room_flush_batch(room);
+
+    long long started_ns = clock_precise_ns();
+
+    // Framed once for every WebSocket member
+    char *frame = NULL;
+    size_t frame_length = 0;
+
+    for (int i = 0; i < room->user_count; i++)
+    {
+        ChatUser *member = room->users[i];
+        if (!member || member == sender)
+            continue;
+
+        if (member->binary)
+        {
+            chat_binary_queue_line(member->connection, CHAT_OP_ROOM_MESSAGE, data, length);
+        }
+        else if (member->connection->protocol == PROTOCOL_WEBSOCKET &&
+                 (frame || (frame = websocket_encode_frame(WS_OP_TEXT, data, length, &frame_length))))
+        {
+            connection_queue_raw(member->connection, frame, frame_length);
+        }
+        else
+        {
+            connection_queue_data(member->connection, data, length);
+        }
+    }
+
+    free(frame);
+    metrics_observe(HISTOGRAM_CHAT_FANOUT, clock_precise_ns() - started_ns);
+}
+
+void chat_flush_batches(ChatServer *server, bool force)
+{
+    if (!server || server->broadcast_batch_ms <= 0)
+        return;
+
+    long long now = clock_now_ms();
+    for (int i = 0; i < server->room_count; i++)
+    {
+        ChatRoom *room = server->rooms[i];
+        if (room && room->batch && room->batch->count > 0 &&
+            (force || now >= room->batch->deadline_ms))
+        {
+            chat_room_flush_batch(room);
+        }
+    }
+}
+
+// Send messages held back by the flood limit once their senders have
+// tokens again, then resume the input that queued up behind them
+void chat_release_delayed(ChatServer *server)
+{
+    if (!server || server->delayed_users == 0)
+        return;
+
+    long long now = clock_now_ms();
+    for (int i = 0; i < server->user_count; i++)
+    {
+        ChatUser *user = server->users[i];
+        if (!user || !user->flood_held || now < user->flood_resume_ms)
+            continue;
+
+        ChatRoom *room = user->current_room;
+        long long wait_ms;
+        if (room && !chat_flood_allow(server, user, room, &wait_ms))
+        {
+            user->flood_resume_ms = now + wait_ms;
+            continue;
+        }
+
+        char *text = user->flood_held;
+        user->flood_held = NULL;
+        server->delayed_users--;
+
+        if (room)
+        {
+            chat_broadcast_to_room(room, text, user);
+            server->total_messages++;
+            metrics_add(METRIC_CHAT_MESSAGES, 1);
+        }
+        free(text);
+
+        if (user->binary)
+        {
+            chat_binary_queue_status(user->connection, CHAT_OP_MESSAGE,
+                                     room ? CHAT_STATUS_OK : CHAT_STATUS_NOT_IN_ROOM);
+        }
+        else
+        {
+            chat_queue_prompt(user);
+        }
+
+        if (enhanced_chat_handler(server, user->connection) < 0)
+        {
+            user->connection->state = CONN_STATE_CLOSING;
+        }
+    }
+}
+
+// Time until the next batch window closes or a delayed sender may resume
+int chat_next_timeout_ms(ChatServer *server)
+{
+    if (!server)
+        return -1;
+
+    long long now = clock_now_ms();
+    long long earliest = -1;
+    for (int i = 0; server->broadcast_batch_ms > 0 && i < server->room_count; i++)
+    {
+        ChatRoom *room = server->rooms[i];
+        if (room && room->batch && room->batch->count > 0 &&
+            (earliest < 0 || room->batch->deadline_ms < earliest))
+        {
+            earliest = room->batch->deadline_ms;
+        }
+    }
+
+    for (int i = 0; server->delayed_users > 0 && i < server->user_count; i++)
+    {
+        ChatUser *user = server->users[i];
+        if (user && user->flood_held && (earliest < 0 || user->flood_resume_ms < earliest))
+        {
+            earliest = user->flood_resume_ms;
+        }
+    }
+
+    if (earliest < 0)
+        return -1;
+    return earliest > now ? (int)(earliest - now) : 0;
+}
+
+// Keep a reference to the payload in the room's bounded history ring
+static void chat_room_history_push(ChatRoom *room, ChatPayload *payload)
+{
+    ChatServer *server = current_chat_server;
+    if (!server || server->history_size <= 0)
+        return;
+
+    if (!room->history)
+    {
+        room->history = calloc(server->history_size, sizeof(ChatPayload *));
+        if (!room->history)
+            return;
+        room->history_capacity = server->history_size;
+    }
+
+    // Overwrite the oldest entry once the ring is full
+    chat_payload_unref(room->history[room->history_head]);
+    room->history[room->history_head] = chat_payload_ref(payload);
+    room->history_head = (room->history_head + 1) % room->history_capacity;
+    if (room->history_count < room->history_capacity)
+    {
+        room->history_count++;
+    }
+}
+
+void chat_send_history(ChatRoom *room, ChatUser *user, int count)
+{
+    if (!room || !user->connection || room->history_count == 0 || count <= 0)
+        return;
+
+    if (count > room->history_count)
+    {
+        count = room->history_count;
+    }
+
+    // Oldest first, starting count entries behind the write head
+    int slot = (room->history_head - count + room->history_capacity) % room->history_capacity;
+
+    if (user->binary)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            ChatPayload *payload = room->history[slot];
+            chat_binary_queue_line(user->connection, CHAT_OP_ROOM_MESSAGE, payload->data, payload->length);
+            slot = (slot + 1) % room->history_capacity;
+        }
+        return;
+    }
+
+    char header[128];
+    snprintf(header, sizeof(header), "*** Last %d message%s in #%s:\n",
+             count, count == 1 ? "" : "s", room->name);
+    connection_queue_data(user->connection, header, strlen(header));
+
+    for (int i = 0; i < count; i++)
+    {
+        ChatPayload *payload = room->history[slot];
+        connection_queue_data(user->connection, payload->data, payload->length);
+        slot = (slot + 1) % room->history_capacity;
+    }
+
+    const char *footer = "*** End of history\n";
+    connection_queue_data(user->connection, footer, strlen(footer));
+}
+
+void chat_broadcast_to_room(ChatRoom *room, const char *message, ChatUser *sender)
+{
+    if (!room || !sender)
+        return;
+
+    // "[HH:MM:SS] <nick> message\n" assembled from the cached clock prefix
+    char formatted_message[BUFFER_SIZE];
+    size_t nick_length = strlen(sender->nickname);
+    size_t message_length = strlen(message);
+    size_t max_message = sizeof(formatted_message) - CLOCK_CHAT_PREFIX_LENGTH - nick_length - 4;
+    if (message_length > max_message)
+    {
+        message_length = max_message;
+    }
+
+    char *out = formatted_message;
+    memcpy(out, clock_chat_prefix(), CLOCK_CHAT_PREFIX_LENGTH);
+    out += CLOCK_CHAT_PREFIX_LENGTH;
+    *out++ = '<';
+    memcpy(out, sender->nickname, nick_length);
+    out += nick_length;
+    *out++ = '>';
+    *out++ = ' ';
+    memcpy(out, message, message_length);
+    out += message_length;
+    *out++ = '\n';
+
+    // One shared payload feeds the history ring and the fan-out
+    ChatPayload *payload = chat_payload_create(formatted_message, out - formatted_message);
+    if (payload)
+    {
+        chat_room_history_push(room, payload);
+        chat_log_append(room->name, payload->data, payload->length, clock_now_sec());
+        chat_room_dispatch(room, payload->data, payload->length, sender);
+        federation_publish(room->name, payload->data, payload->length);
+        chat_payload_unref(payload);
+    }
+
+    // Send confirmation to sender; binary clients get a status frame
+    if (sender->binary)
+        return;
+
+    snprintf(formatted_message, sizeof(formatted_message), "Message sent to #%s\n", room->name);
+    connection_queue_data(sender->connection, formatted_message, strlen(formatted_message));
+}
+
+void chat_announce_to_room(ChatRoom *room, const char *message)
+{
+    if (!room)
+        return;
+
+    char formatted_message[BUFFER_SIZE];
+    snprintf(formatted_message, sizeof(formatted_message), "%s\n", message);
+
+    chat_room_dispatch(room, formatted_message, strlen(formatted_message), NULL);
+}
+
+void chat_handle_help_command(ChatUser *user)
+{
+    const char *help_text =
+        "=== MultiServer Chat Commands ===\n"
+        "/join <room> [password] - Join or create a room\n"
+        "/leave                  - Leave current room\n"
+        "/list rooms            - List available rooms\n"
+        "/list users            - List users in current room\n"
+        "/msg <user> <message>  - Send private message\n"
+        "/nick <nickname>       - Change your nickname\n"
+        "/stats                 - Show server statistics\n"
+        "/history [n]           - Show recent messages in this room\n"
+        "/time                  - Show current time\n"
+        "/clear                 - Clear the screen\n"
+        "/help                  - Show this help\n"
+        "/quit                  - Disconnect\n"
+        "\nTo chat, just type your message (must be in a room)\n"
+        "================================\n";
+
+    connection_queue_data(user->connection, help_text, strlen(help_text));
+}
+
+int chat_process_command(ChatServer *server, ChatUser *user, const char *input)
+{
+    char *input_copy = strdup(input);
+    
+    // Strip trailing newline from input
+    size_t len = strlen(input_copy);
+    if (len > 0 && (input_copy[len - 1] == '\n' || input_copy[len - 1] == '\r')) {
+        input_copy[len - 1] = '\0';
+        len--;
+    }
+    // Handle \r\n case
+    if (len > 0 && input_copy[len - 1] == '\r') {
+        input_copy[len - 1] = '\0';
+    }
+    
+    char *command = strtok(input_copy, " ");
+    char *args = strtok(NULL, "");
+
+    if (!command)
+    {
+        free(input_copy);
+        return 0;
+    }
+
+    user->last_activity = clock_now_sec();
+
+    long long started_ns = clock_precise_ns();
+    Histogram histogram = HISTOGRAM_CHAT_MESSAGE;
+    int result = 0;
+
+    if (command[0] == '/')
+    {
+        // Handle commands
+        if (strcmp(command, "/help") == 0)
+        {
+            histogram = HISTOGRAM_CHAT_HELP;
+            chat_handle_help_command(user);
+        }
+        else if (strcmp(command, "/join") == 0)
+        {
+            histogram = HISTOGRAM_CHAT_JOIN;
+            chat_handle_join_command(server, user, args);
+        }
+        else if (strcmp(command, "/leave") == 0)
+        {
+            histogram = HISTOGRAM_CHAT_LEAVE;
+            chat_leave_room(user);
+        }
+        else if (strcmp(command, "/msg") == 0)
+        {
+            histogram = HISTOGRAM_CHAT_MSG;
+            chat_handle_msg_command(server, user, args);
+        }
+        else if (strcmp(command, "/nick") == 0)
+        {
+            histogram = HISTOGRAM_CHAT_NICK;
+            chat_handle_nick_command(server, user, args);
+        }
+        else if (strcmp(command, "/list") == 0)
+        {
+            histogram = HISTOGRAM_CHAT_LIST;
+            chat_handle_list_command(server, user, args);
+        }
+        else if (strcmp(command, "/stats") == 0)
+        {
+            histogram = HISTOGRAM_CHAT_STATS;
+            chat_handle_stats_command(server, user);
+        }
+        else if (strcmp(command, "/history") == 0)
+        {
+            histogram = HISTOGRAM_CHAT_HISTORY;
+            chat_handle_history_command(server, user, args);
+        }
+        else if (strcmp(command, CHAT_BINARY_HANDSHAKE) == 0)
+        {
+            histogram = HISTOGRAM_CHAT_BINARY;
+            chat_handle_binary_command(user);
+        }
+        else if (strcmp(command, "/time") == 0)
+        {
+            histogram = HISTOGRAM_CHAT_TIME;
+            // ctime() shares one buffer between the shard threads
+            time_t now = clock_now_sec();
+            char time_text[32];
+            char time_msg[128];
+            snprintf(time_msg, sizeof(time_msg), "Server time: %s", ctime_r(&now, time_text));
+            chat_send_system_message(user, time_msg);
+        }
+        else if (strcmp(command, "/clear") == 0)
+        {
+            histogram = HISTOGRAM_CHAT_CLEAR;
+            // Send ANSI escape sequence to clear screen
+            const char *clear_screen = "\033[2J\033[H";
+            connection_queue_data(user->connection, clear_screen, strlen(clear_screen));
+        }
+        else if (strcmp(command, "/quit") == 0)
+        {
+            histogram = HISTOGRAM_CHAT_QUIT;
+            chat_send_system_message(user, "Goodbye!");
+            result = -1; // Signal to close connection
+        }
+        else
+        {
+            histogram = HISTOGRAM_CHAT_UNKNOWN;
+            chat_send_system_message(user, "Unknown command. Type /help for available commands.");
+        }
+    }
+    else
+    {
+        // Regular chat message
+        long long wait_ms;
+        if (!user->current_room)
+        {
+            chat_send_system_message(user, "You must join a room to chat. Type /join lobby");
+        }
+        else if (chat_flood_allow(server, user, user->current_room, &wait_ms))
+        {
+            chat_broadcast_to_room(user->current_room, input, user);
+            server->total_messages++;
+            metrics_add(METRIC_CHAT_MESSAGES, 1);
+        }
+        else if (chat_flood_limit(server, user, input, wait_ms) < 0)
+        {
+            result = -1;
+        }
+    }
+
+    metrics_observe(histogram, clock_precise_ns() - started_ns);
+    flight_record(&user->connection->flight, FLIGHT_COMMAND, histogram, 0);
+    free(input_copy);
+    return result;
+}
 
 void chat_handle_join_command(ChatServer *server, ChatUser *user, const char *args)
 {
-    if (!args)
+    if (!args)
+    {
+        chat_send_system_message(user, "Usage: /join <room> [password]");
+        return;
+    }
+
+    char *args_copy = strdup(args);
+    char *room_name = strtok(args_copy, " ");
+    char *password = strtok(NULL, " ");
+
+    if (room_name && strlen(room_name) >= MAX_ROOM_NAME_LENGTH)
+    {
+        // Checked before hashing, or the owner shard would be picked from
+        // a name longer than the room keeps
+        chat_send_system_message(user, "Room name too long");
+    }
+    else if (room_name && !chat_room_name_valid(room_name))
+    {
+        chat_send_system_message(user, "Invalid room name");
+    }
+    else if (room_name)
+    {
+        chat_join_room(server, user, room_name, password);
+    }
+    else
+    {
+        chat_send_system_message(user, "Usage: /join <room> [password]");
+    }
+
+    free(args_copy);
+}
+
+// Uniqueness is decided by the shard owning the new nickname; the rename
+// completes when its answer comes back
+static void chat_request_nick(ChatUser *user, const char *nickname)
+{
+    ChatShardMessage *claim = chat_shard_message_create(SHARD_MSG_NICK_CLAIM, NULL);
+    if (!claim)
+        return;
+
+    // Later commands wait for the answer, so a /join cannot move the user
+    // away from the shard the answer is sent to. Set before posting: with
+    // a local owner the answer arrives inline.
+    user->nick_pending = true;
+
+    snprintf(claim->nick, sizeof(claim->nick), "%s", nickname);
+    snprintf(claim->target, sizeof(claim->target), "%s", user->nickname);
+    claim->user_id = user->id;
+    claim->shard = chat_shard_current();
+    chat_shard_post(chat_shard_for_name(nickname), claim);
+}
+
+// Routed through the shard owning the recipient's nickname
+static void chat_request_private_message(ChatUser *user, const char *recipient, const char *text)
+{
+    ChatShardMessage *message = chat_shard_message_create(SHARD_MSG_PRIVMSG, text);
+    if (!message)
+        return;
+
+    snprintf(message->nick, sizeof(message->nick), "%s", user->nickname);
+    snprintf(message->target, sizeof(message->target), "%s", recipient);
+    message->user_id = user->id;
+    message->shard = chat_shard_current();
+    chat_shard_post(chat_shard_for_name(recipient), message);
+}
+
+void chat_handle_nick_command(ChatServer *server, ChatUser *user, const char *args)
+{
+    if (!args || strlen(args) == 0)
+    {
+        chat_send_system_message(user, "Usage: /nick <new_nickname>");
+        return;
+    }
+
+    if (strlen(args) >= MAX_NICKNAME_LENGTH)
+    {
+        chat_send_system_message(user, "Nickname too long");
+        return;
+    }
+
+    (void)server;
+
+    if (strcmp(args, user->nickname) == 0)
+    {
+        chat_send_system_message(user, "That is already your nickname");
+        return;
+    }
+
+    chat_request_nick(user, args);
+}
+
+void chat_handle_msg_command(ChatServer *server, ChatUser *user, const char *args)
+{
+    (void)server;
+
+    char *args_copy = args ? strdup(args) : NULL;
+    char *recipient = args_copy ? strtok(args_copy, " ") : NULL;
+    char *text = recipient ? strtok(NULL, "") : NULL;
+
+    if (!recipient || !text)
+    {
+        chat_send_system_message(user, "Usage: /msg <user> <message>");
+        free(args_copy);
+        return;
+    }
+
+    if (strlen(recipient) >= MAX_NICKNAME_LENGTH)
+    {
+        chat_send_system_message(user, "No such user");
+        free(args_copy);
+        return;
+    }
+
+    chat_request_private_message(user, recipient, text);
+    free(args_copy);
+}
+
+static void chat_apply_nick(ChatUser *user, const char *nickname)
+{
+    char old_nick[MAX_NICKNAME_LENGTH];
+    strcpy(old_nick, user->nickname);
+    snprintf(user->nickname, sizeof(user->nickname), "%s", nickname);
+
+    chat_post_nick(SHARD_MSG_NICK_RELEASE, old_nick);
+
+    char message[256];
+    snprintf(message, sizeof(message), "Your nickname changed from %s to %s", old_nick, user->nickname);
+    chat_send_system_message(user, message);
+
+    // Announce to current room
+    if (user->current_room)
+    {
+        snprintf(message, sizeof(message), "*** %s is now known as %s", old_nick, user->nickname);
+        chat_announce_to_room(user->current_room, message);
+    }
+}
+
+void chat_handle_list_command(ChatServer *server, ChatUser *user, const char *args)
+{
+    (void)server;
+
+    if (!args || strcmp(args, "rooms") == 0)
+    {
+        // List rooms of every shard; rooms are never freed while running,
+        // so reading the published slots of other shards is safe
+        char response[BUFFER_SIZE] = "=== Available Rooms ===\n";
+        for (int s = 0; s < chat_shard_count(); s++)
+        {
+            ChatServer *shard_server = chat_shard_server(s);
+            int room_count = __atomic_load_n(&shard_server->room_count, __ATOMIC_ACQUIRE);
+
+            for (int i = 0; i < room_count; i++)
+            {
+                ChatRoom *room = shard_server->rooms[i];
+                char room_info[512]; // Increased buffer size
+                snprintf(room_info, sizeof(room_info), "#%s (%d users) - %.100s\n",
+                         room->name,
+                         __atomic_load_n(&room->user_count, __ATOMIC_RELAXED),
+                         room->topic);
+                if (strlen(response) + strlen(room_info) < BUFFER_SIZE - 1)
+                {
+                    strcat(response, room_info);
+                }
+            }
+        }
+        strcat(response, "=======================\n");
+        connection_queue_data(user->connection, response, strlen(response));
+    }
+    else if (strcmp(args, "users") == 0)
+    {
+        // List users in current room
+        if (!user->current_room)
+        {
+            chat_send_system_message(user, "You are not in a room");
+            return;
+        }
+
+        char response[BUFFER_SIZE];
+        snprintf(response, sizeof(response), "=== Users in #%s ===\n", user->current_room->name);
+
+        for (int i = 0; i < user->current_room->user_count; i++)
+        {
+            if (user->current_room->users[i])
+            {
+                char user_info[128];
+                snprintf(user_info, sizeof(user_info), "%s\n", user->current_room->users[i]->nickname);
+                strcat(response, user_info);
+            }
+        }
+        strcat(response, "===================\n");
+        connection_queue_data(user->connection, response, strlen(response));
+    }
+    else
+    {
+        chat_send_system_message(user, "Usage: /list [rooms|users]");
+    }
+}
+
+void chat_handle_stats_command(ChatServer *server, ChatUser *user)
+{
+    time_t uptime = clock_now_sec() - server->start_time;
+    char response[BUFFER_SIZE];
+
+    // Totals over every shard, read without stopping them
+    int rooms = 0;
+    int messages = 0;
+    int served = 0;
+    for (int s = 0; s < chat_shard_count(); s++)
+    {
+        ChatServer *shard_server = chat_shard_server(s);
+        rooms += __atomic_load_n(&shard_server->room_count, __ATOMIC_RELAXED);
+        messages += __atomic_load_n(&shard_server->total_messages, __ATOMIC_RELAXED);
+        served += __atomic_load_n(&shard_server->total_users_served, __ATOMIC_RELAXED);
+    }
+
+    snprintf(response, sizeof(response),
+             "=== Server Statistics ===\n"
+             "Uptime: %ld seconds\n"
+             "Total rooms: %d\n"
+             "Active users: %d\n"
+             "Total messages: %d\n"
+             "Total users served: %d\n"
+             "Peak concurrent users: %d\n",
+             uptime, rooms, __atomic_load_n(&active_users, __ATOMIC_RELAXED),
+             messages, served, __atomic_load_n(&peak_users, __ATOMIC_RELAXED));
+
+    // Chat latencies in microseconds, merged over every thread
+    size_t used = strlen(response);
+    for (int i = HISTOGRAM_CHAT_FANOUT; i < HISTOGRAM_COUNT && used < sizeof(response); i++)
+    {
+        HistogramSummary summary;
+        if (!metrics_summarize((Histogram)i, &summary))
+            continue;
+        used += snprintf(response + used, sizeof(response) - used,
+                         "Latency %s: p50 %.1f, p99 %.1f, p99.9 %.1f us (%lu)\n",
+                         metrics_histogram_name((Histogram)i), summary.p50_ns / 1000.0,
+                         summary.p99_ns / 1000.0, summary.p999_ns / 1000.0, summary.count);
+    }
+    if (used < sizeof(response))
+        snprintf(response + used, sizeof(response) - used, "========================\n");
+
+    connection_queue_data(user->connection, response, strlen(response));
+}
+
+void chat_handle_history_command(ChatServer *server, ChatUser *user, const char *args)
+{
+    if (!user->current_room)
+    {
+        chat_send_system_message(user, "You are not in a room");
+        return;
+    }
+
+    if (server->history_size <= 0)
+    {
+        chat_send_system_message(user, "Message history is disabled");
+        return;
+    }
+
+    int count = args ? atoi(args) : 20;
+    if (count <= 0)
+    {
+        chat_send_system_message(user, "Usage: /history [n]");
+        return;
+    }
+
+    if (user->current_room->history_count == 0)
+    {
+        chat_send_system_message(user, "No messages in this room yet");
+        return;
+    }
+
+    chat_send_history(user->current_room, user, count);
+}
+
+void chat_handle_binary_command(ChatUser *user)
+{
+    // WebSocket already frames every message
+    if (user->connection->protocol == PROTOCOL_WEBSOCKET)
+    {
+        chat_send_system_message(user, "Binary framing is not available over WebSocket");
+        return;
+    }
+
+    user->binary = true;
+    chat_binary_queue_status(user->connection, CHAT_OP_HANDSHAKE, CHAT_STATUS_OK);
+    log_debug("User %s switched to binary framing", user->nickname);
+}
+
+// Run one binary request. Returns the status to answer with, or -1 when
+// the answer comes later (other shard, nickname owner, recipient).
+static int chat_binary_execute(ChatServer *server, ChatUser *user, ChatOpcode opcode,
+                               const char *body, size_t length)
+{
+    size_t first_length = strlen(body); // Up to the first NUL separator
+
+    switch (opcode)
+    {
+    case CHAT_OP_JOIN:
+    {
+        if (!chat_room_name_valid(body))
+            return CHAT_STATUS_BAD_REQUEST;
+
+        const char *password = first_length < length ? body + first_length + 1 : NULL;
+        int result = chat_join_room(server, user, body, password && *password ? password : NULL);
+        if (user->connection->state == CONN_STATE_HANDOFF)
+            return -1;
+        return -result;
+    }
+
+    case CHAT_OP_LEAVE:
+        if (!user->current_room)
+            return CHAT_STATUS_NOT_IN_ROOM;
+        chat_leave_room(user);
+        return CHAT_STATUS_OK;
+
+    case CHAT_OP_MESSAGE:
+        if (first_length == 0 || first_length != length || memchr(body, '\n', length))
+            return CHAT_STATUS_BAD_REQUEST;
+        if (!user->current_room)
+            return CHAT_STATUS_NOT_IN_ROOM;
+
+        long long wait_ms;
+        if (!chat_flood_allow(server, user, user->current_room, &wait_ms))
+        {
+            int limited = chat_flood_limit(server, user, body, wait_ms);
+            if (limited > 0)
+                return -1; // Answered once the message goes out
+            if (limited < 0)
+                user->connection->state = CONN_STATE_CLOSING;
+            return CHAT_STATUS_RATE_LIMITED;
+        }
+
+        chat_broadcast_to_room(user->current_room, body, user);
+        server->total_messages++;
+        metrics_add(METRIC_CHAT_MESSAGES, 1);
+        return CHAT_STATUS_OK;
+
+    case CHAT_OP_PRIVMSG:
+    {
+        if (first_length == 0 || first_length >= length)
+            return CHAT_STATUS_BAD_REQUEST;
+        if (first_length >= MAX_NICKNAME_LENGTH)
+            return CHAT_STATUS_NO_SUCH_USER;
+
+        const char *text = body + first_length + 1;
+        size_t text_length = length - first_length - 1;
+        if (text_length == 0 || strlen(text) != text_length || memchr(text, '\n', text_length))
+            return CHAT_STATUS_BAD_REQUEST;
+
+        chat_request_private_message(user, body, text);
+        return -1;
+    }
+
+    case CHAT_OP_NICK:
+        if (first_length == 0 || first_length != length || first_length >= MAX_NICKNAME_LENGTH ||
+            strchr(body, ' '))
+            return CHAT_STATUS_BAD_REQUEST;
+        if (strcmp(body, user->nickname) == 0)
+            return CHAT_STATUS_OK;
+        chat_request_nick(user, body);
+        return -1;
+
+    case CHAT_OP_PING:
+        return CHAT_STATUS_OK;
+
+    default:
+        return CHAT_STATUS_UNKNOWN_OPCODE;
+    }
+}
+
+// Execute every complete frame in the read buffer; replies are status
+// frames only, in request order for synchronous requests
+static int chat_binary_process(ChatServer *server, ChatUser *user)
+{
+    Connection *conn = user->connection;
+    ChatOpcode opcode;
+    char *body;
+    size_t length;
+    int framed;
+
+    while (!chat_input_held(user) &&
+           (framed = chat_binary_next_frame(conn, &opcode, &body, &length)) != 0)
+    {
+        if (framed < 0)
+        {
+            // Cannot resynchronise on a frame that does not fit the buffer
+            chat_binary_queue_status(conn, opcode, CHAT_STATUS_TOO_LARGE);
+            log_warn("Dropping binary chat client %s:%d: oversized frame", conn->ip, conn->port);
+            return -1;
+        }
+
+        char text[CHAT_BINARY_MAX_BODY + 1];
+        memcpy(text, body, length);
+        text[length] = '\0';
+
+        user->last_activity = clock_now_sec();
+
+        int status = chat_binary_execute(server, user, opcode, text, length);
+
+        // The shard owning the room answers the join once it adopts us
+        if (conn->state == CONN_STATE_HANDOFF)
+            break;
+
+        if (status >= 0)
+        {
+            chat_binary_queue_status(conn, opcode, (ChatStatus)status);
+        }
+
+        // Disconnected by the flood limit, after the status went out
+        if (conn->state == CONN_STATE_CLOSING)
+            return -1;
+    }
+    return 0;
+}
+
+// Create the chat user of a new connection and greet it
+ChatUser *chat_attach_connection(ChatServer *server, Connection *conn)
+{
+    if (server->user_count >= MAX_CONNECTIONS)
+    {
+        const char *full_msg = "Server full. Try again later.\n";
+        connection_queue_data(conn, full_msg, strlen(full_msg));
+        return NULL;
+    }
+
+    ChatUser *user = chat_user_create(conn);
+    if (!user)
+        return NULL;
+
+    // Set connection to keep-alive for persistent chat sessions
+    conn->keep_alive = true;
+    connection_set_protocol_data(conn, user, chat_connection_closed);
+
+    server->users[server->user_count++] = user;
+    server->total_users_served++;
+
+    if (server->user_count > server->peak_concurrent_users)
+    {
+        server->peak_concurrent_users = server->user_count;
+    }
+
+    int active = __atomic_add_fetch(&active_users, 1, __ATOMIC_RELAXED);
+    int peak = __atomic_load_n(&peak_users, __ATOMIC_RELAXED);
+    while (active > peak &&
+           !__atomic_compare_exchange_n(&peak_users, &peak, active, false,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    {
+    }
+
+    chat_post_nick(SHARD_MSG_NICK_MOVE, user->nickname);
+
+    // Welcome new user, unless it opens with the binary handshake
+    size_t handshake_length = strlen(CHAT_BINARY_HANDSHAKE);
+    if (conn->protocol == PROTOCOL_WEBSOCKET || conn->read_buffer_used <= handshake_length ||
+        strncmp(conn->read_buffer, CHAT_BINARY_HANDSHAKE, handshake_length) != 0 ||
+        (conn->read_buffer[handshake_length] != '\n' && conn->read_buffer[handshake_length] != '\r'))
+    {
+        const char *welcome =
+            "Welcome to MultiServer Chat!\n"
+            "You are now connected in a persistent session.\n"
+            "Type /help for commands, /join lobby to start chatting, or /quit to disconnect.\n";
+        connection_queue_data(conn, welcome, strlen(welcome));
+        chat_queue_prompt(user);
+    }
+
+    log_info("New persistent chat user %s connected", user->nickname);
+    return user;
+}
+
+// Run one input line. Returns -1 to close the connection, 0 to go on with
+// the next line and 1 when the rest of the input has to wait.
+static int chat_process_line(ChatServer *server, ChatUser *user, const char *line)
+{
+    Connection *conn = user->connection;
+
+    // Check for quit command first
+    if (strcmp(line, "/quit") == 0 || strcmp(line, "quit") == 0 || strcmp(line, "QUIT") == 0)
+    {
+        const char *goodbye = "Goodbye! Thanks for using MultiServer Chat.\n";
+        connection_queue_data(conn, goodbye, strlen(goodbye));
+        if (conn->protocol == PROTOCOL_WEBSOCKET)
+        {
+            char status[2] = {(char)(WS_CLOSE_NORMAL >> 8), (char)(WS_CLOSE_NORMAL & 0xff)};
+            websocket_queue_frame(conn, WS_OP_CLOSE, status, sizeof(status));
+        }
+        return -1; // Signal to close connection
+    }
+
+    int result = chat_process_command(server, user, line);
+    if (result < 0)
+    {
+        return result;
+    }
+
+    // A /join moved the user to another shard, which picks up the
+    // remaining input once it adopts the connection
+    if (conn->state == CONN_STATE_HANDOFF)
+    {
+        return 1;
+    }
+
+    // Switched to binary framing (the rest of the buffer is frames),
+    // or waiting for a nickname claim or the flood limit
+    if (user->binary || chat_input_held(user))
+    {
+        return 1;
+    }
+
+    // Add prompt after each command for interactive feel
+    chat_queue_prompt(user);
+    return 0;
+}
+
+// Each WebSocket message carries one line of input
+static int chat_websocket_process(ChatServer *server, ChatUser *user)
+{
+    Connection *conn = user->connection;
+    char *message;
+    size_t length;
+    int framed;
+
+    while (!chat_input_held(user) &&
+           (framed = websocket_next_message(conn, server->max_line_length, &message, &length)) != 0)
+    {
+        if (framed < 0)
+        {
+            log_debug("WebSocket connection %s:%d closing", conn->ip, conn->port);
+            return -1;
+        }
+
+        user->last_activity = clock_now_sec();
+
+        while (length > 0 && (message[length - 1] == '\n' || message[length - 1] == '\r'))
+        {
+            message[--length] = '\0';
+        }
+        if (length == 0)
+            continue;
+
+        if (memchr(message, '\n', length) || strlen(message) != length)
+        {
+            chat_send_system_message(user, "Send one line per message");
+            continue;
+        }
+
+        int result = chat_process_line(server, user, message);
+        if (result != 0)
+            return result < 0 ? -1 : 0;
+    }
+    return 0;
+}
+
+int enhanced_chat_handler(ChatServer *server, Connection *conn)
+{
+    if (!server || !conn)
+        return 0;
+
+    log_debug("Chat handler called, buffer_used: %zu, buffer: '%.*s'",
+             conn->read_buffer_used, (int)conn->read_buffer_used, conn->read_buffer);
+
+    if (conn->read_buffer_used == 0)
+        return 0;
+
+    // Event stream watchers only listen; drop whatever they send
+    if (conn->protocol == PROTOCOL_SSE)
     {
-        chat_send_system_message(user, "Usage: /join <room> [password]");
-        return;
+        conn->read_buffer_used = 0;
+        conn->read_line_start = 0;
+        conn->read_scan_offset = 0;
+        return 1;
     }
 
-    char *args_copy = strdup(args);
-    char *room_name = strtok(args_copy, " ");
-    char *password = strtok(NULL, " ");
+    // Find or create user for this connection
+    ChatUser *user = chat_find_user_by_connection(server, conn);
+    if (!user)
+    {
+        user = chat_attach_connection(server, conn);
+        if (!user)
+            return -1;
+
+        // DON'T clear buffer yet - continue processing any additional commands
+        // that came with the initial connection
+    }
 
-    if (room_name)
+    if (conn->protocol == PROTOCOL_WEBSOCKET)
     {
-        chat_join_room(server, user, room_name, password);
+        if (chat_websocket_process(server, user) < 0)
+            return -1;
+
+        connection_compact_read_buffer(conn);
+        return 1;
     }
-    else
+
+    // Process every complete line; a trailing partial line stays buffered
+    char *buffer;
+    size_t line_length;
+    int framed;
+
+    while (!user->binary && !chat_input_held(user) &&
+           (framed = connection_next_line(conn, server->max_line_length, &buffer, &line_length)) != 0)
     {
-        chat_send_system_message(user, "Usage: /join <room> [password]");
+        if (framed < 0)
+        {
+            char message[128];
+            snprintf(message, sizeof(message), "Line too long (max %d bytes), ignored",
+                     server->max_line_length);
+            chat_send_system_message(user, message);
+            log_warn("Dropped overlong line from %s:%d", conn->ip, conn->port);
+            continue;
+        }
+
+        log_debug("Processing line: '%s' (length: %zu)", buffer, line_length);
+
+        if (line_length > 0)
+        {
+            int result = chat_process_line(server, user, buffer);
+            if (result < 0)
+                return result;
+            if (result > 0)
+                break;
+        }
     }
 
-    free(args_copy);
+    if (user->binary && !chat_input_held(user) && conn->state != CONN_STATE_HANDOFF &&
+        chat_binary_process(server, user) < 0)
+    {
+        return -1;
+    }
+
+    // Keep the partial line, move it to the front of the buffer
+    connection_compact_read_buffer(conn);
+    return 1;
 }
 
-void chat_handle_nick_command(ChatServer *server, ChatUser *user, const char *args)
+void chat_handoff_connection(Connection *conn)
 {
-    if (!args || strlen(args) == 0)
+    // Event streams move to the shard owning their room
+    if (conn->protocol == PROTOCOL_SSE)
     {
-        chat_send_system_message(user, "Usage: /nick <new_nickname>");
+        ChatWatcher *watcher = conn->protocol_data;
+        int owner = chat_shard_for_name(watcher->room);
+        ChatShardMessage *message = chat_shard_message_create(SHARD_MSG_ADOPT, NULL);
+        if (!message)
+        {
+            connection_destroy(conn);
+            return;
+        }
+
+        message->connection = conn;
+        snprintf(message->target, sizeof(message->target), "%s", watcher->room);
+        chat_shard_post(owner, message);
         return;
     }
 
-    if (strlen(args) >= MAX_NICKNAME_LENGTH)
+    ChatUser *user = conn->protocol_data;
+
+    if (current_chat_server)
     {
-        chat_send_system_message(user, "Nickname too long");
-        return;
+        chat_detach_user(current_chat_server, user);
     }
 
-    // Check if nickname is already taken
-    if (chat_find_user_by_nickname(server, args))
+    ChatShardMessage *message = chat_shard_message_create(SHARD_MSG_ADOPT, NULL);
+    if (!message)
     {
-        chat_send_system_message(user, "Nickname already taken");
+        connection_destroy(conn);
         return;
     }
 
-    char old_nick[MAX_NICKNAME_LENGTH];
-    strcpy(old_nick, user->nickname);
-    strcpy(user->nickname, args);
+    message->connection = conn;
+    message->user = user;
+    snprintf(message->target, sizeof(message->target), "%s", user->pending_room);
+    snprintf(message->password, sizeof(message->password), "%s", user->pending_password);
 
-    char message[256];
-    snprintf(message, sizeof(message), "Your nickname changed from %s to %s", old_nick, user->nickname);
-    chat_send_system_message(user, message);
+    log_debug("Handing %s over to chat shard %d for #%s",
+              user->nickname, user->pending_shard, user->pending_room);
+    chat_shard_post(user->pending_shard, message);
+}
 
-    // Announce to current room
-    if (user->current_room)
+// Take over a connection handed to this shard, completing its pending join
+static void chat_adopt_connection(ChatServer *server, ChatShardMessage *message)
+{
+    Connection *conn = message->connection;
+    ChatUser *user = message->user;
+
+    flight_record(&conn->flight, FLIGHT_ADOPT, 0, chat_shard_current());
+    conn->state = CONN_STATE_READING;
+    if (connection_pool_add(chat_shard_pool(), conn) < 0)
     {
-        snprintf(message, sizeof(message), "*** %s is now known as %s", old_nick, user->nickname);
-        chat_announce_to_room(user->current_room, message);
+        connection_destroy(conn);
+        return;
     }
-}
 
-void chat_handle_list_command(ChatServer *server, ChatUser *user, const char *args)
-{
-    if (!args || strcmp(args, "rooms") == 0)
+    if (conn->protocol == PROTOCOL_SSE)
     {
-        // List rooms
-        char response[BUFFER_SIZE] = "=== Available Rooms ===\n";
-        for (int i = 0; i < server->room_count; i++)
-        {
-            if (server->rooms[i])
-            {
-                char room_info[512]; // Increased buffer size
-                snprintf(room_info, sizeof(room_info), "#%s (%d users) - %.100s\n",
-                         server->rooms[i]->name,
-                         server->rooms[i]->user_count,
-                         server->rooms[i]->topic);
-                if (strlen(response) + strlen(room_info) < BUFFER_SIZE - 1)
-                {
-                    strcat(response, room_info);
-                }
-            }
-        }
-        strcat(response, "=======================\n");
-        connection_prepare_response(user->connection, response, strlen(response));
+        chat_attach_watcher(server, conn);
+        return;
     }
-    else if (strcmp(args, "users") == 0)
+
+    // Fresh connections get their user on the first line they send
+    if (!user)
+        return;
+
+    if (server->user_count >= MAX_CONNECTIONS)
     {
-        // List users in current room
-        if (!user->current_room)
-        {
-            chat_send_system_message(user, "You are not in a room");
-            return;
-        }
+        conn->state = CONN_STATE_CLOSING;
+        return;
+    }
 
-        char response[BUFFER_SIZE];
-        snprintf(response, sizeof(response), "=== Users in #%s ===\n", user->current_room->name);
+    server->users[server->user_count++] = user;
+    chat_post_nick(SHARD_MSG_NICK_MOVE, user->nickname);
 
-        for (int i = 0; i < user->current_room->user_count; i++)
-        {
-            if (user->current_room->users[i])
-            {
-                char user_info[128];
-                snprintf(user_info, sizeof(user_info), "%s\n", user->current_room->users[i]->nickname);
-                strcat(response, user_info);
-            }
-        }
-        strcat(response, "===================\n");
-        connection_prepare_response(user->connection, response, strlen(response));
+    int result = chat_join_room(server, user, message->target,
+                                message->password[0] ? message->password : NULL);
+
+    if (user->binary)
+    {
+        chat_binary_queue_status(conn, CHAT_OP_JOIN, (ChatStatus)-result);
     }
     else
     {
-        chat_send_system_message(user, "Usage: /list [rooms|users]");
+        chat_queue_prompt(user);
+    }
+
+    // Lines that arrived behind the /join are still buffered
+    if (enhanced_chat_handler(server, conn) < 0)
+    {
+        conn->state = CONN_STATE_CLOSING;
     }
 }
 
-void chat_handle_stats_command(ChatServer *server, ChatUser *user)
+// Outcome of a private message for its sender
+static void chat_notify_user(ChatShardMessage *request, ChatStatus status, const char *text)
 {
-    time_t uptime = time(NULL) - server->start_time;
-    char response[BUFFER_SIZE];
-
-    snprintf(response, sizeof(response),
-             "=== Server Statistics ===\n"
-             "Uptime: %ld seconds\n"
-             "Total rooms: %d\n"
-             "Active users: %d\n"
-             "Total messages: %d\n"
-             "Total users served: %d\n"
-             "Peak concurrent users: %d\n"
-             "========================\n",
-             uptime, server->room_count, server->user_count,
-             server->total_messages, server->total_users_served,
-             server->peak_concurrent_users);
+    ChatShardMessage *notice = chat_shard_message_create(SHARD_MSG_NOTICE, text);
+    if (!notice)
+        return;
 
-    connection_prepare_response(user->connection, response, strlen(response));
+    int shard = request->shard;
+    notice->user_id = request->user_id;
+    notice->status = status;
+    memcpy(notice->nick, request->nick, sizeof(notice->nick));
+    chat_shard_post(shard, notice);
 }
 
-int enhanced_chat_handler(ChatServer *server, Connection *conn)
+void chat_handle_shard_message(ChatServer *server, ChatShardMessage *message)
 {
-    if (!server || !conn)
-        return 0;
+    char text[BUFFER_SIZE];
 
-    log_info("Chat handler called, buffer_used: %zu, buffer: '%.*s'",
-             conn->read_buffer_used, (int)conn->read_buffer_used, conn->read_buffer);
+    switch (message->type)
+    {
+    case SHARD_MSG_ADOPT:
+        chat_adopt_connection(server, message);
+        break;
 
-    if (conn->read_buffer_used == 0)
-        return 0;
+    case SHARD_MSG_PRIVMSG:
+    {
+        // On the recipient nickname's owner: forward to the shard holding the user
+        int shard = chat_nick_lookup(message->target);
+        if (shard < 0)
+        {
+            snprintf(text, sizeof(text), "No such user: %s", message->target);
+            chat_notify_user(message, CHAT_STATUS_NO_SUCH_USER, text);
+            break;
+        }
 
-    // Find or create user for this connection
-    ChatUser *user = chat_find_user_by_connection(server, conn);
-    if (!user)
+        ChatShardMessage *deliver = chat_shard_message_create(SHARD_MSG_DELIVER, message->text);
+        if (!deliver)
+            break;
+
+        memcpy(deliver->nick, message->nick, sizeof(deliver->nick));
+        memcpy(deliver->target, message->target, sizeof(deliver->target));
+        deliver->user_id = message->user_id;
+        deliver->shard = message->shard;
+        chat_shard_post(shard, deliver);
+        break;
+    }
+
+    case SHARD_MSG_DELIVER:
     {
-        // New user
-        if (server->user_count >= MAX_CONNECTIONS)
+        ChatUser *recipient = chat_find_user_by_nickname(server, message->target);
+        if (!recipient || !recipient->connection)
         {
-            const char *full_msg = "Server full. Try again later.\n";
-            connection_prepare_response(conn, full_msg, strlen(full_msg));
-            return -1;
+            snprintf(text, sizeof(text), "No such user: %s", message->target);
+            chat_notify_user(message, CHAT_STATUS_NO_SUCH_USER, text);
+            break;
         }
 
-        user = chat_user_create(conn);
-        if (!user)
-            return -1;
+        int length = snprintf(text, sizeof(text), "%s*%s* %s\n",
+                              clock_chat_prefix(), message->nick, message->text);
+        if (length >= (int)sizeof(text))
+        {
+            length = sizeof(text) - 1;
+            text[length - 1] = '\n';
+        }
+
+        if (recipient->binary)
+        {
+            chat_binary_queue_line(recipient->connection, CHAT_OP_PRIVATE_MESSAGE, text, length);
+        }
+        else
+        {
+            connection_queue_data(recipient->connection, text, length);
+        }
 
-        // Set connection to keep-alive for persistent chat sessions
-        conn->keep_alive = true;
+        snprintf(text, sizeof(text), "Private message sent to %s", recipient->nickname);
+        chat_notify_user(message, CHAT_STATUS_OK, text);
+        break;
+    }
 
-        server->users[server->user_count++] = user;
-        server->total_users_served++;
+    case SHARD_MSG_REMOTE:
+    {
+        // Message from a federated node, for local members and watchers only
+        ChatRoom *room = chat_find_room(server, message->target);
+        if (!room || (room->user_count == 0 && room->watcher_count == 0))
+            break;
 
-        if (server->user_count > server->peak_concurrent_users)
+        ChatPayload *payload = chat_payload_create(message->text, strlen(message->text));
+        if (payload)
         {
-            server->peak_concurrent_users = server->user_count;
+            chat_room_history_push(room, payload);
+            chat_room_dispatch(room, payload->data, payload->length, NULL);
+            chat_payload_unref(payload);
         }
+        break;
+    }
 
-        // Welcome new user
-        const char *welcome =
-            "Welcome to MultiServer Chat!\n"
-            "You are now connected in a persistent session.\n"
-            "Type /help for commands, /join lobby to start chatting, or /quit to disconnect.\n"
-            ">>> ";
-        connection_prepare_response(conn, welcome, strlen(welcome));
-        connection_write(conn);
+    case SHARD_MSG_NOTICE:
+    {
+        ChatUser *user = chat_find_user_by_id(server, message->user_id);
+        if (user && user->binary)
+        {
+            chat_binary_queue_status(user->connection, CHAT_OP_PRIVMSG, message->status);
+        }
+        else if (user)
+        {
+            chat_send_system_message(user, message->text);
+        }
+        else if (message->hops < 3)
+        {
+            // The sender moved shards meanwhile; its nickname owner knows where
+            ChatShardMessage *route = chat_shard_message_create(SHARD_MSG_NOTICE_ROUTE, message->text);
+            if (route)
+            {
+                route->user_id = message->user_id;
+                route->status = message->status;
+                route->hops = message->hops + 1;
+                memcpy(route->nick, message->nick, sizeof(route->nick));
+                chat_shard_post(chat_shard_for_name(message->nick), route);
+            }
+        }
+        break;
+    }
 
-        log_info("New persistent chat user %s connected", user->nickname);
+    case SHARD_MSG_NOTICE_ROUTE:
+    {
+        int shard = chat_nick_lookup(message->nick);
+        if (shard < 0)
+            break;
 
-        // DON'T clear buffer yet - continue processing any additional commands
-        // that came with the initial connection
+        ChatShardMessage *notice = chat_shard_message_create(SHARD_MSG_NOTICE, message->text);
+        if (notice)
+        {
+            notice->user_id = message->user_id;
+            notice->status = message->status;
+            notice->hops = message->hops;
+            memcpy(notice->nick, message->nick, sizeof(notice->nick));
+            chat_shard_post(shard, notice);
+        }
+        break;
     }
 
-    // Process user input - handle multiple lines if present
-    char *buffer = conn->read_buffer;
-    size_t remaining = conn->read_buffer_used;
+    case SHARD_MSG_NICK_CLAIM:
+    {
+        ChatShardMessage *result = chat_shard_message_create(SHARD_MSG_NICK_RESULT, NULL);
+        if (!result)
+            break;
+
+        result->ok = chat_nick_claim(message->nick, message->shard);
+        result->user_id = message->user_id;
+        memcpy(result->nick, message->nick, sizeof(result->nick));
+        chat_shard_post(message->origin, result);
+        break;
+    }
 
-    while (remaining > 0)
+    case SHARD_MSG_NICK_RESULT:
     {
-        char *newline = memchr(buffer, '\n', remaining);
-        if (!newline)
+        ChatUser *user = chat_find_user_by_id(server, message->user_id);
+        if (!user)
         {
-            // No complete line yet, wait for more data
-            log_info("No complete line found, waiting for more data");
+            // User left or moved meanwhile; give the reservation back
+            if (message->ok)
+            {
+                chat_post_nick(SHARD_MSG_NICK_RELEASE, message->nick);
+            }
             break;
         }
 
-        // Process this line
-        *newline = '\0';
-        size_t line_length = newline - buffer;
+        if (message->ok)
+        {
+            chat_apply_nick(user, message->nick);
+        }
+        else
+        {
+            chat_send_system_message(user, "Nickname already taken");
+        }
 
-        log_info("Processing line: '%s' (length: %zu)", buffer, line_length);
+        user->nick_pending = false;
+        if (user->binary)
+        {
+            chat_binary_queue_status(user->connection, CHAT_OP_NICK,
+                                     message->ok ? CHAT_STATUS_OK : CHAT_STATUS_NICK_TAKEN);
+        }
 
-        if (line_length > 0)
+        // Answers from another shard resume the input held meanwhile;
+        // inline answers return to the handler that is still running
+        if (message->origin != chat_shard_current() && user->connection)
         {
-            // Check for quit command first
-            if (strcmp(buffer, "/quit") == 0 || strcmp(buffer, "quit") == 0 || strcmp(buffer, "QUIT") == 0) {
-                const char *goodbye = "Goodbye! Thanks for using MultiServer Chat.\n";
-                connection_prepare_response(conn, goodbye, strlen(goodbye));
-                connection_write(conn);
-                conn->read_buffer_used = 0;
-                return -1; // Signal to close connection
-            }
-            
-            int result = chat_process_command(server, user, buffer);
-            if (result < 0)
+            chat_queue_prompt(user);
+            if (enhanced_chat_handler(server, user->connection) < 0)
             {
-                conn->read_buffer_used = 0;
-                return result;
+                user->connection->state = CONN_STATE_CLOSING;
             }
-            
-            // Add prompt after each command for interactive feel
-            const char *prompt = ">>> ";
-            connection_prepare_response(conn, prompt, strlen(prompt));
-            connection_write(conn);
         }
+        break;
+    }
+
+    case SHARD_MSG_NICK_RELEASE:
+        chat_nick_release(message->nick);
+        break;
 
-        // Move to next line
-        buffer = newline + 1;
-        remaining -= (line_length + 1);
+    case SHARD_MSG_NICK_MOVE:
+        chat_nick_move(message->nick, message->shard);
+        break;
     }
+}
 
-    // Clear the processed data from buffer
-    conn->read_buffer_used = 0;
-    return 1;
+// Rebuild room history from one persisted record
+static void chat_restore_message(const char *room_name, const char *data, size_t length,
+                                 time_t timestamp, void *context)
+{
+    (void)timestamp;
+    (void)context;
+
+    ChatServer *server = chat_shard_server(chat_shard_for_name(room_name));
+    ChatRoom *room = chat_find_room(server, room_name);
+    if (!room)
+    {
+        room = chat_room_create(room_name);
+        if (!room)
+            return;
+
+        if (chat_server_add_room(server, room) < 0)
+        {
+            chat_room_destroy(room);
+            return;
+        }
+    }
+
+    ChatPayload *payload = chat_payload_create(data, length);
+    if (payload)
+    {
+        chat_room_history_push(room, payload);
+        chat_payload_unref(payload);
+    }
 }
 
 // Initialize global chat server
-int chat_system_init(void)
+int chat_system_init(const ServerConfig *config)
+{
+    if (!config)
+        return -1;
+
+    if (chat_shards_init(config) < 0)
+        return -1;
+
+    for (int i = 0; i < chat_shard_count(); i++)
+    {
+        ChatServer *server = chat_shard_server(i);
+        server->max_line_length = config->max_line_length;
+        server->broadcast_batch_ms = config->broadcast_batch_ms;
+        server->history_size = config->history_size;
+        server->history_replay = config->history_size > 0 ? config->history_replay : 0;
+        server->flood_user_rate = config->flood_user_rate;
+        server->flood_user_burst = config->flood_user_burst;
+        server->flood_room_rate = config->flood_room_rate;
+        server->flood_room_burst = config->flood_room_burst;
+        server->flood_action = config->flood_action;
+    }
+
+    // The main thread serves shard 0
+    current_chat_server = chat_shard_server(0);
+
+    // Create default lobby room on the shard that owns it
+    ChatRoom *lobby = chat_room_create("lobby");
+    if (lobby)
+    {
+        strcpy(lobby->topic, "Welcome to MultiServer Chat! Type /help for commands.");
+        chat_server_add_room(chat_shard_server(chat_shard_for_name("lobby")), lobby);
+    }
+
+    if (config->chat_persist && config->history_size > 0)
+    {
+        chat_log_replay(config->chat_persist_dir, chat_restore_message, NULL);
+    }
+    return 0;
+}
+
+// Start the chat threads (shards, log writer, federation) once the main
+// connection pool exists and the process will not fork again
+int chat_system_start(const ServerConfig *config, ConnectionPool *main_pool)
+{
+    if (chat_shards_start(main_pool) < 0)
+        return -1;
+
+    if (config->chat_persist && chat_log_open(config) < 0)
+        return -1;
+
+    return federation_start(config);
+}
+
+void chat_set_current_server(ChatServer *server)
 {
-    global_chat_server = chat_server_create();
-    return global_chat_server ? 0 : -1;
+    current_chat_server = server;
 }
 
-// Get global chat server
+// Get the chat server of the calling thread's shard
 ChatServer *chat_get_server(void)
 {
-    return global_chat_server;
+    return current_chat_server;
 }
 
 // Cleanup global chat server
 void chat_system_cleanup(void)
 {
-    if (global_chat_server)
-    {
-        chat_server_destroy(global_chat_server);
-        global_chat_server = NULL;
-    }
+    federation_stop();
+    chat_shards_stop();
+    chat_log_close();
+    chat_shards_destroy();
+    current_chat_server = NULL;
 }
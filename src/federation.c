@@ -0,0 +1,857 @@
+#define LOG_MODULE LOG_MODULE_CHAT
+
+#include "federation.h"
+#include "chat_shard.h"
+#include "clock.h"
+#include "logging.h"
+#include <netdb.h>
+#include <netinet/tcp.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
+
+// Work handed from the chat shards to the federation thread
+typedef enum
+{
+    FED_CMD_PUBLISH = 0,
+    FED_CMD_SUBSCRIBE,
+    FED_CMD_UNSUBSCRIBE
+} FederationCommandType;
+
+typedef struct FederationCommand
+{
+    struct FederationCommand *next;
+    FederationCommandType type;
+    char room[MAX_ROOM_NAME_LENGTH];
+    size_t length;
+    char data[];
+} FederationCommand;
+
+// Link state is owned by the federation thread; shards only touch the
+// command queue under command_lock
+static bool fed_enabled = false;
+static bool fed_stop = false;
+static char node_name[64];
+static int reconnect_ms = 2000;
+static int listen_fd = -1;
+static int wake_fd = -1;
+static pthread_t fed_thread;
+
+static FederationPeer peers[FEDERATION_MAX_LINKS];
+static int outbound_count = 0;
+
+// Rooms with members on this node, announced to every peer
+static char local_rooms[MAX_ROOMS][MAX_ROOM_NAME_LENGTH];
+static int local_room_count = 0;
+
+static pthread_mutex_t command_lock = PTHREAD_MUTEX_INITIALIZER;
+static FederationCommand *command_head = NULL;
+static FederationCommand *command_tail = NULL;
+static bool wake_pending = false;
+
+static int set_nonblocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)
+        return -1;
+    return 0;
+}
+
+static int room_index(char rooms[][MAX_ROOM_NAME_LENGTH], int count, const char *room)
+{
+    for (int i = 0; i < count; i++)
+    {
+        if (strcmp(rooms[i], room) == 0)
+            return i;
+    }
+    return -1;
+}
+
+// Returns false when a room cannot be added because the set is full
+static bool room_set_update(char rooms[][MAX_ROOM_NAME_LENGTH], int *count,
+                            const char *room, bool present)
+{
+    int index = room_index(rooms, *count, room);
+    if (present && index < 0)
+    {
+        if (*count >= MAX_ROOMS)
+            return false;
+        snprintf(rooms[(*count)++], MAX_ROOM_NAME_LENGTH, "%s", room);
+    }
+    else if (!present && index >= 0)
+    {
+        // Order does not matter, move the last entry into the hole
+        (*count)--;
+        if (index != *count)
+            memcpy(rooms[index], rooms[*count], MAX_ROOM_NAME_LENGTH);
+    }
+    return true;
+}
+
+static void peer_reset(FederationPeer *peer)
+{
+    if (peer->fd >= 0)
+        close(peer->fd);
+
+    if (peer->ready)
+        log_info("Federation link to %s closed", peer->node);
+
+    peer->fd = -1;
+    peer->connecting = false;
+    peer->ready = false;
+    peer->node[0] = '\0';
+    peer->input_used = 0;
+    peer->output_used = 0;
+    peer->room_count = 0;
+    peer->retry_at = clock_now_ms() + reconnect_ms;
+}
+
+static void peer_queue(FederationPeer *peer, const char *data, size_t length)
+{
+    if (peer->fd < 0)
+        return;
+
+    if (peer->output_used + length > peer->output_size)
+    {
+        size_t new_size = peer->output_size ? peer->output_size : BUFFER_SIZE;
+        while (new_size < peer->output_used + length)
+            new_size *= 2;
+
+        // A peer that cannot keep up is dropped and resynchronised later
+        if (new_size > FEDERATION_MAX_OUTPUT)
+        {
+            log_warn("Federation peer %s is too slow, dropping link",
+                     peer->node[0] ? peer->node : peer->host);
+            peer_reset(peer);
+            return;
+        }
+
+        char *output = realloc(peer->output, new_size);
+        if (!output)
+        {
+            peer_reset(peer);
+            return;
+        }
+        peer->output = output;
+        peer->output_size = new_size;
+    }
+
+    memcpy(peer->output + peer->output_used, data, length);
+    peer->output_used += length;
+}
+
+static void peer_queue_line(FederationPeer *peer, const char *verb, const char *argument)
+{
+    char line[128];
+    int length = snprintf(line, sizeof(line), "%s %s\n", verb, argument);
+    if (length > 0 && (size_t)length < sizeof(line))
+        peer_queue(peer, line, length);
+}
+
+// Greeting plus the rooms this node wants traffic for
+static void peer_greet(FederationPeer *peer)
+{
+    peer_queue_line(peer, "HELLO", node_name);
+    for (int i = 0; i < local_room_count; i++)
+    {
+        peer_queue_line(peer, "SUB", local_rooms[i]);
+    }
+}
+
+// Keep the IPv4 addresses a peer's host resolved to, so that inbound
+// links can be matched against the peer list without a lookup
+static void peer_remember_addresses(FederationPeer *peer, const struct addrinfo *result)
+{
+    int count = 0;
+    for (const struct addrinfo *entry = result; entry && count < FEDERATION_MAX_ADDRESSES;
+         entry = entry->ai_next)
+    {
+        if (entry->ai_family == AF_INET)
+            peer->addresses[count++] = ((const struct sockaddr_in *)entry->ai_addr)->sin_addr;
+    }
+
+    if (count > 0)
+        peer->address_count = count;
+}
+
+static void peer_connect(FederationPeer *peer)
+{
+    char port[16];
+    snprintf(port, sizeof(port), "%d", peer->port);
+
+    struct addrinfo hints = {0};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    struct addrinfo *result = NULL;
+    if (getaddrinfo(peer->host, port, &hints, &result) != 0 || !result)
+    {
+        log_warn("Failed to resolve federation peer %s", peer->host);
+        peer->retry_at = clock_now_ms() + reconnect_ms;
+        return;
+    }
+    peer_remember_addresses(peer, result);
+
+    int fd = socket(result->ai_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || set_nonblocking(fd) < 0)
+    {
+        if (fd >= 0)
+            close(fd);
+        freeaddrinfo(result);
+        peer->retry_at = clock_now_ms() + reconnect_ms;
+        return;
+    }
+
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    int rc = connect(fd, result->ai_addr, result->ai_addrlen);
+    freeaddrinfo(result);
+
+    if (rc < 0 && errno != EINPROGRESS)
+    {
+        close(fd);
+        peer->retry_at = clock_now_ms() + reconnect_ms;
+        return;
+    }
+
+    peer->fd = fd;
+    peer->connecting = rc < 0;
+    if (!peer->connecting)
+        peer_greet(peer);
+}
+
+// Inbound links are only taken from the hosts in the peer list. Names are
+// resolved at startup and again whenever a peer is dialed, never here, so
+// a slow lookup cannot stall the federation thread on every accept.
+static bool peer_address_allowed(const struct sockaddr_in *addr)
+{
+    for (int i = 0; i < outbound_count; i++)
+    {
+        for (int j = 0; j < peers[i].address_count; j++)
+        {
+            if (peers[i].addresses[j].s_addr == addr->sin_addr.s_addr)
+                return true;
+        }
+    }
+    return false;
+}
+
+static void peer_accept(void)
+{
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    int fd = accept(listen_fd, (struct sockaddr *)&addr, &addr_len);
+    if (fd < 0)
+        return;
+
+    if (!peer_address_allowed(&addr))
+    {
+        char ip[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &addr.sin_addr, ip, sizeof(ip));
+        log_warn("Rejecting federation link from %s: not a configured peer", ip);
+        close(fd);
+        return;
+    }
+
+    FederationPeer *peer = NULL;
+    for (int i = outbound_count; i < FEDERATION_MAX_LINKS; i++)
+    {
+        if (peers[i].fd < 0)
+        {
+            peer = &peers[i];
+            break;
+        }
+    }
+
+    if (!peer || set_nonblocking(fd) < 0)
+    {
+        log_warn("Rejecting federation link: no free peer slot");
+        close(fd);
+        return;
+    }
+
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    peer->fd = fd;
+    peer->connecting = false;
+    peer_greet(peer);
+}
+
+// Two nodes that both list each other end up with two links; both sides
+// keep the one dialed by the node with the smaller name. Returns true
+// when the given link is the one to drop.
+static bool peer_is_duplicate(FederationPeer *peer)
+{
+    bool keep_outbound = strcmp(node_name, peer->node) < 0;
+
+    for (int i = 0; i < FEDERATION_MAX_LINKS; i++)
+    {
+        FederationPeer *other = &peers[i];
+        if (other == peer || other->fd < 0 || !other->ready ||
+            strcmp(other->node, peer->node) != 0)
+            continue;
+
+        if (peer->outbound != keep_outbound)
+            return true;
+
+        log_debug("Replacing duplicate federation link to %s", other->node);
+        other->ready = false;
+        peer_reset(other);
+        return false;
+    }
+    return false;
+}
+
+// True while another link to the node an outbound peer leads to is up,
+// or when the peer turned out to be this node
+static bool peer_served_elsewhere(const FederationPeer *peer)
+{
+    if (!peer->known_node[0])
+        return false;
+    if (strcmp(peer->known_node, node_name) == 0)
+        return true;
+
+    for (int i = 0; i < FEDERATION_MAX_LINKS; i++)
+    {
+        if (&peers[i] != peer && peers[i].ready && strcmp(peers[i].node, peer->known_node) == 0)
+            return true;
+    }
+    return false;
+}
+
+static void peer_deliver(const char *room, const char *payload)
+{
+    int shard = chat_shard_for_name(room);
+    ChatShardMessage *message = chat_shard_message_create(SHARD_MSG_REMOTE, payload);
+    if (!message)
+        return;
+
+    snprintf(message->target, sizeof(message->target), "%s", room);
+    chat_shard_post(shard, message);
+}
+
+static int peer_handle_line(FederationPeer *peer, char *line)
+{
+    char *verb = line;
+    char *args = strchr(line, ' ');
+    if (!args)
+        return -1;
+    *args++ = '\0';
+
+    if (strcmp(verb, "HELLO") == 0)
+    {
+        snprintf(peer->node, sizeof(peer->node), "%s", args);
+        if (peer->outbound)
+            snprintf(peer->known_node, sizeof(peer->known_node), "%s", peer->node);
+        if (strcmp(peer->node, node_name) == 0)
+        {
+            // Usually our own entry in a peer list shared by all nodes
+            log_debug("Federation peer %s:%d is this node, not dialing it again",
+                      peer->host, peer->port);
+            return -1;
+        }
+        if (peer_is_duplicate(peer))
+        {
+            log_debug("Dropping duplicate federation link to %s", peer->node);
+            return -1;
+        }
+        peer->ready = true;
+        log_info("Federation link to %s established", peer->node);
+    }
+    else if (strcmp(verb, "SUB") == 0 || strcmp(verb, "UNSUB") == 0)
+    {
+        if (!peer->ready || strlen(args) >= MAX_ROOM_NAME_LENGTH)
+            return -1;
+        if (!room_set_update(peer->rooms, &peer->room_count, args, verb[0] == 'S'))
+        {
+            // Traffic for the room will not be forwarded; tell the peer
+            log_warn("Federation peer %s subscribed to more than %d rooms, ignoring #%s",
+                     peer->node, MAX_ROOMS, args);
+            peer_queue_line(peer, "ERR", "room limit reached");
+        }
+    }
+    else if (strcmp(verb, "ERR") == 0)
+    {
+        log_warn("Federation peer %s reported an error: %s", peer->node, args);
+    }
+    else if (strcmp(verb, "MSG") == 0)
+    {
+        // MSG <room> <line>; remote traffic is delivered, never re-forwarded
+        char *payload = strchr(args, ' ');
+        if (!peer->ready || !payload)
+            return -1;
+        *payload++ = '\0';
+        if (strlen(args) >= MAX_ROOM_NAME_LENGTH)
+            return -1;
+
+        size_t length = strlen(payload);
+        payload[length] = '\n';
+        payload[length + 1] = '\0';
+        peer_deliver(args, payload);
+    }
+    else
+    {
+        log_warn("Unknown federation command from %s: %s", peer->node, verb);
+    }
+    return 0;
+}
+
+static int peer_read(FederationPeer *peer)
+{
+    // Leave room for the newline and terminator restored on delivery
+    size_t space = sizeof(peer->input) - peer->input_used - 2;
+    ssize_t received = recv(peer->fd, peer->input + peer->input_used, space, 0);
+    if (received == 0)
+        return -1;
+    if (received < 0)
+        return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+    peer->input_used += received;
+
+    size_t start = 0;
+    for (;;)
+    {
+        char *newline = memchr(peer->input + start, '\n', peer->input_used - start);
+        if (!newline)
+            break;
+
+        *newline = '\0';
+        char line[FEDERATION_MAX_LINE];
+        size_t length = newline - (peer->input + start);
+        memcpy(line, peer->input + start, length + 1);
+        start += length + 1;
+
+        if (peer_handle_line(peer, line) < 0)
+            return -1;
+    }
+
+    if (start > 0)
+    {
+        memmove(peer->input, peer->input + start, peer->input_used - start);
+        peer->input_used -= start;
+    }
+
+    // An unterminated line that fills the buffer is a protocol error
+    return peer->input_used >= sizeof(peer->input) - 2 ? -1 : 0;
+}
+
+static int peer_write(FederationPeer *peer)
+{
+    if (peer->connecting)
+    {
+        int error = 0;
+        socklen_t length = sizeof(error);
+        if (getsockopt(peer->fd, SOL_SOCKET, SO_ERROR, &error, &length) < 0 || error != 0)
+            return -1;
+        peer->connecting = false;
+        peer_greet(peer);
+    }
+
+    if (peer->output_used == 0)
+        return 0;
+
+    ssize_t sent = send(peer->fd, peer->output, peer->output_used, MSG_NOSIGNAL);
+    if (sent < 0)
+        return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+
+    memmove(peer->output, peer->output + sent, peer->output_used - sent);
+    peer->output_used -= sent;
+    return 0;
+}
+
+// Encode a room message once and queue it for every node that has
+// members in the room
+static void forward_message(const char *room, const char *data, size_t length)
+{
+    if (length > 0 && data[length - 1] == '\n')
+        length--;
+
+    char line[FEDERATION_MAX_LINE];
+    int header = snprintf(line, sizeof(line), "MSG %s ", room);
+    if (header < 0 || (size_t)header + length + 1 > sizeof(line) - 2)
+        return;
+
+    memcpy(line + header, data, length);
+    line[header + length] = '\n';
+    size_t line_length = header + length + 1;
+
+    for (int i = 0; i < FEDERATION_MAX_LINKS; i++)
+    {
+        FederationPeer *peer = &peers[i];
+        if (peer->fd >= 0 && peer->ready &&
+            room_index(peer->rooms, peer->room_count, room) >= 0)
+        {
+            peer_queue(peer, line, line_length);
+        }
+    }
+}
+
+static void process_commands(void)
+{
+    uint64_t value;
+    if (read(wake_fd, &value, sizeof(value)) < 0 && errno != EAGAIN)
+    {
+        log_warn("Federation wakeup read failed: %s", strerror(errno));
+    }
+
+    pthread_mutex_lock(&command_lock);
+    FederationCommand *command = command_head;
+    command_head = command_tail = NULL;
+    wake_pending = false;
+    pthread_mutex_unlock(&command_lock);
+
+    while (command)
+    {
+        FederationCommand *next = command->next;
+
+        if (command->type == FED_CMD_PUBLISH)
+        {
+            forward_message(command->room, command->data, command->length);
+        }
+        else
+        {
+            bool subscribed = command->type == FED_CMD_SUBSCRIBE;
+            if (!room_set_update(local_rooms, &local_room_count, command->room, subscribed))
+            {
+                log_warn("Federation room limit (%d) reached, #%s is not announced to peers",
+                         MAX_ROOMS, command->room);
+            }
+            else
+            {
+                for (int i = 0; i < FEDERATION_MAX_LINKS; i++)
+                {
+                    if (peers[i].fd >= 0 && !peers[i].connecting)
+                        peer_queue_line(&peers[i], subscribed ? "SUB" : "UNSUB", command->room);
+                }
+            }
+        }
+
+        free(command);
+        command = next;
+    }
+}
+
+static void *federation_main(void *arg)
+{
+    (void)arg;
+
+    // Not a chat shard: posts to every shard go through its inbox
+    chat_shard_set_external();
+
+    fd_set read_fds, write_fds;
+    struct timeval timeout;
+
+    while (!fed_stop)
+    {
+        clock_update();
+        long long now = clock_now_ms();
+
+        FD_ZERO(&read_fds);
+        FD_ZERO(&write_fds);
+        FD_SET(wake_fd, &read_fds);
+        int max_fd = wake_fd;
+
+        if (listen_fd >= 0)
+        {
+            FD_SET(listen_fd, &read_fds);
+            if (listen_fd > max_fd)
+                max_fd = listen_fd;
+        }
+
+        for (int i = 0; i < FEDERATION_MAX_LINKS; i++)
+        {
+            FederationPeer *peer = &peers[i];
+            if (peer->fd < 0 && peer->outbound && now >= peer->retry_at &&
+                !peer_served_elsewhere(peer))
+                peer_connect(peer);
+            if (peer->fd < 0)
+                continue;
+
+            if (!peer->connecting)
+                FD_SET(peer->fd, &read_fds);
+            if (peer->connecting || peer->output_used > 0)
+                FD_SET(peer->fd, &write_fds);
+            if (peer->fd > max_fd)
+                max_fd = peer->fd;
+        }
+
+        timeout.tv_sec = 0;
+        timeout.tv_usec = 250000; // Reconnect granularity
+
+        int activity = select(max_fd + 1, &read_fds, &write_fds, NULL, &timeout);
+        if (activity < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            log_error("Federation select error: %s", strerror(errno));
+            break;
+        }
+
+        clock_update();
+
+        if (FD_ISSET(wake_fd, &read_fds))
+            process_commands();
+
+        if (listen_fd >= 0 && FD_ISSET(listen_fd, &read_fds))
+            peer_accept();
+
+        for (int i = 0; i < FEDERATION_MAX_LINKS; i++)
+        {
+            FederationPeer *peer = &peers[i];
+            if (peer->fd < 0)
+                continue;
+
+            if (FD_ISSET(peer->fd, &read_fds) && peer_read(peer) < 0)
+            {
+                peer_reset(peer);
+                continue;
+            }
+
+            // Flush what this iteration queued without waiting for select
+            if ((peer->connecting ? FD_ISSET(peer->fd, &write_fds) : peer->output_used > 0) &&
+                peer_write(peer) < 0)
+            {
+                peer_reset(peer);
+            }
+        }
+    }
+
+    return NULL;
+}
+
+static int parse_peers(const char *list)
+{
+    char buffer[sizeof(((ServerConfig *)0)->federation_peers)];
+    snprintf(buffer, sizeof(buffer), "%s", list);
+
+    char *save = NULL;
+    for (char *item = strtok_r(buffer, ", ", &save); item; item = strtok_r(NULL, ", ", &save))
+    {
+        char *colon = strrchr(item, ':');
+        int port = colon ? atoi(colon + 1) : 0;
+        if (!colon || port < 1 || port > 65535)
+        {
+            log_error("Invalid federation peer '%s' (expected host:port)", item);
+            return -1;
+        }
+        if (outbound_count >= FEDERATION_MAX_PEERS)
+        {
+            log_error("Too many federation peers (max %d)", FEDERATION_MAX_PEERS);
+            return -1;
+        }
+
+        *colon = '\0';
+        FederationPeer *peer = &peers[outbound_count++];
+        snprintf(peer->host, sizeof(peer->host), "%s", item);
+        peer->port = port;
+        peer->outbound = true;
+        peer->retry_at = 0;
+    }
+    return 0;
+}
+
+static int open_listener(const char *address, int port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+
+    if (inet_pton(AF_INET, address, &addr.sin_addr) != 1 ||
+        bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(fd, FEDERATION_MAX_PEERS) < 0 || set_nonblocking(fd) < 0)
+    {
+        log_error("Failed to listen for federation peers on %s:%d: %s", address, port, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int federation_start(const ServerConfig *config)
+{
+    if (!config || !config->federation_enabled)
+        return 0;
+
+    snprintf(node_name, sizeof(node_name), "%s", config->federation_node);
+    reconnect_ms = config->federation_reconnect_ms;
+
+    for (int i = 0; i < FEDERATION_MAX_LINKS; i++)
+    {
+        memset(&peers[i], 0, sizeof(peers[i]));
+        peers[i].fd = -1;
+    }
+    outbound_count = 0;
+    local_room_count = 0;
+
+    if (parse_peers(config->federation_peers) < 0)
+        return -1;
+
+    // Resolve the peer list before the thread starts; dialing refreshes it
+    struct addrinfo hints = {0};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    for (int i = 0; i < outbound_count; i++)
+    {
+        struct addrinfo *result = NULL;
+        if (getaddrinfo(peers[i].host, NULL, &hints, &result) != 0)
+        {
+            log_warn("Failed to resolve federation peer %s", peers[i].host);
+            continue;
+        }
+        peer_remember_addresses(&peers[i], result);
+        freeaddrinfo(result);
+    }
+
+    if (config->federation_port > 0)
+    {
+        listen_fd = open_listener(config->federation_bind, config->federation_port);
+        if (listen_fd < 0)
+            return -1;
+    }
+
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wake_fd < 0)
+    {
+        log_error("Failed to create federation eventfd: %s", strerror(errno));
+        if (listen_fd >= 0)
+            close(listen_fd);
+        listen_fd = -1;
+        return -1;
+    }
+
+    // Signals are handled by the main thread only
+    sigset_t all_signals, previous;
+    sigfillset(&all_signals);
+    pthread_sigmask(SIG_BLOCK, &all_signals, &previous);
+
+    fed_stop = false;
+    int rc = pthread_create(&fed_thread, NULL, federation_main, NULL);
+    pthread_sigmask(SIG_SETMASK, &previous, NULL);
+
+    if (rc != 0)
+    {
+        log_error("Failed to start federation thread");
+        close(wake_fd);
+        wake_fd = -1;
+        if (listen_fd >= 0)
+            close(listen_fd);
+        listen_fd = -1;
+        return -1;
+    }
+
+    __atomic_store_n(&fed_enabled, true, __ATOMIC_RELAXED);
+    log_info("Federation node %s started (%s:%d, %d peer%s)", node_name,
+             config->federation_bind, config->federation_port, outbound_count, outbound_count == 1 ? "" : "s");
+    return 0;
+}
+
+void federation_stop(void)
+{
+    if (!fed_enabled)
+        return;
+
+    pthread_mutex_lock(&command_lock);
+    __atomic_store_n(&fed_enabled, false, __ATOMIC_RELAXED);
+    fed_stop = true;
+    pthread_mutex_unlock(&command_lock);
+
+    uint64_t one = 1;
+    if (write(wake_fd, &one, sizeof(one)) < 0)
+    {
+        log_warn("Failed to wake federation thread: %s", strerror(errno));
+    }
+    pthread_join(fed_thread, NULL);
+
+    for (int i = 0; i < FEDERATION_MAX_LINKS; i++)
+    {
+        if (peers[i].fd >= 0)
+            close(peers[i].fd);
+        peers[i].fd = -1;
+        free(peers[i].output);
+        peers[i].output = NULL;
+    }
+
+    while (command_head)
+    {
+        FederationCommand *next = command_head->next;
+        free(command_head);
+        command_head = next;
+    }
+    command_tail = NULL;
+
+    if (listen_fd >= 0)
+        close(listen_fd);
+    listen_fd = -1;
+    close(wake_fd);
+    wake_fd = -1;
+
+    log_info("Federation stopped");
+}
+
+bool federation_enabled(void)
+{
+    return __atomic_load_n(&fed_enabled, __ATOMIC_RELAXED);
+}
+
+static void post_command(FederationCommandType type, const char *room,
+                         const char *data, size_t length)
+{
+    FederationCommand *command = malloc(sizeof(FederationCommand) + length);
+    if (!command)
+        return;
+
+    command->next = NULL;
+    command->type = type;
+    snprintf(command->room, sizeof(command->room), "%s", room);
+    command->length = length;
+    if (length > 0)
+        memcpy(command->data, data, length);
+
+    pthread_mutex_lock(&command_lock);
+    if (!fed_enabled)
+    {
+        pthread_mutex_unlock(&command_lock);
+        free(command);
+        return;
+    }
+
+    if (command_tail)
+        command_tail->next = command;
+    else
+        command_head = command;
+    command_tail = command;
+
+    bool wake = !wake_pending;
+    wake_pending = true;
+    pthread_mutex_unlock(&command_lock);
+
+    if (wake)
+    {
+        uint64_t one = 1;
+        if (write(wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+        {
+            log_warn("Failed to wake federation thread: %s", strerror(errno));
+        }
+    }
+}
+
+void federation_publish(const char *room, const char *data, size_t length)
+{
+    if (!federation_enabled())
+        return;
+    post_command(FED_CMD_PUBLISH, room, data, length);
+}
+
+void federation_subscribe(const char *room, bool subscribed)
+{
+    if (!federation_enabled())
+        return;
+    post_command(subscribed ? FED_CMD_SUBSCRIBE : FED_CMD_UNSUBSCRIBE, room, NULL, 0);
+}
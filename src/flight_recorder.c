@@ -0,0 +1,253 @@
+#include "flight_recorder.h"
+#include "clock.h"
+#include "connection.h"
+#include "logging.h"
+#include "metrics.h"
+
+// Each event loop owns one ring for itself, and every connection carries
+// its own. Recording is a handful of plain stores into whichever ring the
+// calling loop owns; nothing is shared. A dump request only bumps a
+// generation number, and each loop writes out its own rings and its own
+// connections when it next sees the new generation, so no loop ever reads
+// memory another loop may be changing or freeing.
+typedef struct
+{
+    FlightEvent events[FLIGHT_LOOP_EVENTS];
+    unsigned int next;
+    char name[16];
+} FlightLoopRing;
+
+static bool recording = false;
+static char dump_path[PATH_MAX];
+static unsigned int dump_generation = 0;
+static pthread_mutex_t dump_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static __thread FlightLoopRing *loop_ring = NULL;
+static __thread unsigned int dumped_generation = 0;
+
+static const char *close_reasons[FLIGHT_CLOSE_REASON_COUNT] = {
+    "unknown", "closed by peer", "read error", "write error", "idle timeout",
+    "header timeout", "write timeout", "closed by handler", "response complete",
+};
+
+static const char *state_names[] = {
+    "new", "reading", "processing", "writing", "closing", "handoff",
+};
+
+void flight_recorder_init(const char *path, bool enabled)
+{
+    snprintf(dump_path, sizeof(dump_path), "%s", path);
+    recording = enabled && path[0] != '\0';
+}
+
+// Give the calling event loop thread its own ring
+void flight_recorder_attach(const char *loop_name)
+{
+    if (!recording || loop_ring)
+        return;
+
+    loop_ring = calloc(1, sizeof(FlightLoopRing));
+    if (!loop_ring)
+    {
+        log_warn("Flight recorder disabled for %s loop, out of memory", loop_name);
+        return;
+    }
+    snprintf(loop_ring->name, sizeof(loop_ring->name), "%s", loop_name);
+    dumped_generation = __atomic_load_n(&dump_generation, __ATOMIC_ACQUIRE);
+}
+
+void flight_record(FlightRing *ring, FlightEventType type, int detail, int value)
+{
+    if (!recording)
+        return;
+
+    FlightEvent *event = &ring->events[ring->next++ & (FLIGHT_CONNECTION_EVENTS - 1)];
+    event->ms = clock_now_ms();
+    event->type = (unsigned short)type;
+    event->detail = (unsigned short)detail;
+    event->value = value;
+}
+
+// Only the first reason sticks; a read error usually brings a handler
+// failure right behind it
+void flight_record_close(FlightRing *ring, FlightCloseReason reason)
+{
+    if (ring->close_reason != FLIGHT_CLOSE_UNKNOWN)
+        return;
+
+    ring->close_reason = (unsigned short)reason;
+    flight_record(ring, FLIGHT_CLOSE, reason, 0);
+}
+
+void flight_record_loop(FlightEventType type, int detail, int value)
+{
+    FlightLoopRing *ring = loop_ring;
+    if (!ring)
+        return;
+
+    FlightEvent *event = &ring->events[ring->next++ & (FLIGHT_LOOP_EVENTS - 1)];
+    event->ms = clock_now_ms();
+    event->type = (unsigned short)type;
+    event->detail = (unsigned short)detail;
+    event->value = value;
+}
+
+static void describe_event(char *out, size_t size, const FlightEvent *event)
+{
+    switch (event->type)
+    {
+    case FLIGHT_ACCEPT:
+        if (event->detail != PROTOCOL_UNKNOWN)
+            snprintf(out, size, "accepted fd %d (%s)", event->value,
+                     connection_protocol_name((ProtocolType)event->detail));
+        else
+            snprintf(out, size, "accepted fd %d", event->value);
+        break;
+    case FLIGHT_READ:
+        snprintf(out, size, "read %d bytes", event->value);
+        break;
+    case FLIGHT_READ_EAGAIN:
+        snprintf(out, size, "read would block");
+        break;
+    case FLIGHT_PROTOCOL:
+        snprintf(out, size, "protocol %s", connection_protocol_name((ProtocolType)event->detail));
+        break;
+    case FLIGHT_COMMAND:
+        snprintf(out, size, "command %s",
+                 event->detail < HISTOGRAM_COUNT ? metrics_histogram_name((Histogram)event->detail) : "?");
+        break;
+    case FLIGHT_WRITE:
+        snprintf(out, size, "wrote %d bytes", event->value);
+        break;
+    case FLIGHT_WRITE_EAGAIN:
+        snprintf(out, size, "write would block, %d bytes pending", event->value);
+        break;
+    case FLIGHT_HANDOFF:
+        snprintf(out, size, "handed off by shard %d", event->value);
+        break;
+    case FLIGHT_ADOPT:
+        snprintf(out, size, "adopted by shard %d", event->value);
+        break;
+    case FLIGHT_CLOSE:
+        if (event->value > 0)
+            snprintf(out, size, "closed fd %d: %s", event->value,
+                     event->detail < FLIGHT_CLOSE_REASON_COUNT ? close_reasons[event->detail] : "?");
+        else
+            snprintf(out, size, "closing: %s",
+                     event->detail < FLIGHT_CLOSE_REASON_COUNT ? close_reasons[event->detail] : "?");
+        break;
+    case FLIGHT_WAKEUP:
+        snprintf(out, size, "wakeup, %d ready", event->value);
+        break;
+    case FLIGHT_SLOW_LOOP:
+        snprintf(out, size, "slow iteration, %d ms busy", event->value);
+        break;
+    case FLIGHT_SIGNAL:
+        snprintf(out, size, "signal %d (%s)", event->value, strsignal(event->value));
+        break;
+    default:
+        snprintf(out, size, "event %u", event->type);
+        break;
+    }
+}
+
+// Events oldest first, stamped with wall clock time
+static void write_events(FILE *file, const FlightEvent *events, unsigned int next, unsigned int capacity,
+                         long long now_ms, long long wall_ms)
+{
+    unsigned int count = next < capacity ? next : capacity;
+    for (unsigned int i = next - count; i != next; i++)
+    {
+        const FlightEvent *event = &events[i & (capacity - 1)];
+        long long at_ms = wall_ms - (now_ms - event->ms);
+        time_t at = (time_t)(at_ms / 1000);
+        struct tm tm_info;
+        char stamp[16];
+        localtime_r(&at, &tm_info);
+        strftime(stamp, sizeof(stamp), "%H:%M:%S", &tm_info);
+
+        char text[128];
+        describe_event(text, sizeof(text), event);
+        fprintf(file, "  %s.%03lld  %s\n", stamp, at_ms % 1000, text);
+    }
+}
+
+static void dump_loop(ConnectionPool *pool)
+{
+    pthread_mutex_lock(&dump_lock);
+    FILE *file = fopen(dump_path, "a");
+    if (!file)
+    {
+        pthread_mutex_unlock(&dump_lock);
+        log_error("Failed to open flight recorder file %s: %s", dump_path, strerror(errno));
+        return;
+    }
+
+    struct timespec wall;
+    clock_gettime(CLOCK_REALTIME, &wall);
+    long long wall_ms = (long long)wall.tv_sec * 1000 + wall.tv_nsec / 1000000;
+    long long now_ms = clock_now_ms();
+    time_t now = clock_now_sec();
+
+    fprintf(file, "--- %s loop ---\n", loop_ring->name);
+    write_events(file, loop_ring->events, loop_ring->next, FLIGHT_LOOP_EVENTS, now_ms, wall_ms);
+
+    int connections = 0;
+    for (int i = 0; pool && i < pool->max_connections; i++)
+    {
+        const Connection *conn = pool->connections[i];
+        if (!conn)
+            continue;
+
+        fprintf(file, "--- %s loop, fd %d %s:%d %s, %s, connected %lds ago, idle %lds, "
+                      "%zu bytes unread, %zu bytes unsent ---\n",
+                loop_ring->name, conn->fd, conn->ip, conn->port, connection_protocol_name(conn->protocol),
+                state_names[conn->state], (long)(now - conn->connected_at), (long)(now - conn->last_activity),
+                conn->read_buffer_used, conn->write_buffer_used - conn->write_buffer_sent);
+        write_events(file, conn->flight.events, conn->flight.next, FLIGHT_CONNECTION_EVENTS, now_ms, wall_ms);
+        connections++;
+    }
+
+    fclose(file);
+    pthread_mutex_unlock(&dump_lock);
+    log_info("Flight recorder: %s loop wrote %d connections to %s", loop_ring->name, connections, dump_path);
+}
+
+// Start a dump; every loop appends its part on its next iteration, within
+// a second even when idle
+int flight_recorder_request_dump(const char *reason)
+{
+    if (!recording)
+        return -1;
+
+    pthread_mutex_lock(&dump_lock);
+    FILE *file = fopen(dump_path, "a");
+    if (!file)
+    {
+        pthread_mutex_unlock(&dump_lock);
+        log_error("Failed to open flight recorder file %s: %s", dump_path, strerror(errno));
+        return -1;
+    }
+
+    unsigned int generation = __atomic_add_fetch(&dump_generation, 1, __ATOMIC_ACQ_REL);
+    fprintf(file, "=== Flight recorder dump %u (%s) at %s ===\n", generation, reason, clock_log_timestamp());
+    fclose(file);
+    pthread_mutex_unlock(&dump_lock);
+
+    log_info("Flight recorder dump %u requested (%s), writing to %s", generation, reason, dump_path);
+    return 0;
+}
+
+// Called by every event loop once per iteration with the pool it drives
+void flight_recorder_poll(ConnectionPool *pool)
+{
+    if (!loop_ring)
+        return;
+
+    unsigned int generation = __atomic_load_n(&dump_generation, __ATOMIC_ACQUIRE);
+    if (generation == dumped_generation)
+        return;
+
+    dumped_generation = generation;
+    dump_loop(pool);
+}
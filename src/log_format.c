@@ -0,0 +1,361 @@
+#include "log_format.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+// One printf conversion, split into the parts that matter for its arguments
+typedef struct
+{
+    char flags[8];
+    int width;       // -1: none, -2: taken from an argument
+    int precision;   // -1: none, -2: taken from an argument
+    char length[3];  // Length modifier as written
+    char conversion; // 0 for a malformed or unsupported conversion
+} FormatSpec;
+
+// Parse the conversion after a '%'; returns the first byte behind it
+static const char *parse_spec(const char *p, FormatSpec *spec)
+{
+    memset(spec, 0, sizeof(*spec));
+    spec->width = -1;
+    spec->precision = -1;
+
+    size_t flags = 0;
+    while (*p && strchr("-+ #0'", *p))
+    {
+        if (flags < sizeof(spec->flags) - 1)
+            spec->flags[flags++] = *p;
+        p++;
+    }
+
+    if (*p == '*')
+    {
+        spec->width = -2;
+        p++;
+    }
+    else if (*p >= '0' && *p <= '9')
+    {
+        spec->width = 0;
+        while (*p >= '0' && *p <= '9')
+            spec->width = spec->width * 10 + (*p++ - '0');
+    }
+
+    if (*p == '.')
+    {
+        p++;
+        spec->precision = 0;
+        if (*p == '*')
+        {
+            spec->precision = -2;
+            p++;
+        }
+        else
+        {
+            while (*p >= '0' && *p <= '9')
+                spec->precision = spec->precision * 10 + (*p++ - '0');
+        }
+    }
+
+    size_t length = 0;
+    while (*p && strchr("hlLqjzt", *p) && length < sizeof(spec->length) - 1)
+    {
+        spec->length[length++] = *p++;
+    }
+
+    if (*p && strchr("diouxXcsfFeEgGaApn%", *p))
+        spec->conversion = *p++;
+    return p;
+}
+
+static int put_value(char *out, size_t size, size_t *used, char tag, const void *value, size_t length)
+{
+    if (*used + 1 + length > size)
+        return -1;
+    out[*used] = tag;
+    memcpy(out + *used + 1, value, length);
+    *used += 1 + length;
+    return 0;
+}
+
+static int put_signed(char *out, size_t size, size_t *used, long long value)
+{
+    int64_t encoded = value;
+    return put_value(out, size, used, LOG_ARG_SIGNED, &encoded, sizeof(encoded));
+}
+
+// Copy the raw arguments a format string consumes, so that formatting can
+// happen later (or in another process). Stops at the first argument that
+// does not fit; returns the bytes written.
+size_t log_args_encode(char *out, size_t size, const char *format, va_list args)
+{
+    size_t used = 0;
+    const char *p = format;
+
+    while ((p = strchr(p, '%')) != NULL)
+    {
+        FormatSpec spec;
+        p = parse_spec(p + 1, &spec);
+        if (spec.conversion == '%')
+            continue;
+        if (spec.conversion == 0)
+            break; // Unknown argument type; nothing after it can be trusted
+
+        int precision = spec.precision;
+        if (spec.width == -2 && put_signed(out, size, &used, va_arg(args, int)) < 0)
+            break;
+        if (spec.precision == -2)
+        {
+            precision = va_arg(args, int);
+            if (put_signed(out, size, &used, precision) < 0)
+                break;
+        }
+
+        const char *length = spec.length;
+        int result = 0;
+        switch (spec.conversion)
+        {
+        case 'd':
+        case 'i':
+        {
+            long long value;
+            if (strcmp(length, "ll") == 0 || strcmp(length, "q") == 0 || strcmp(length, "j") == 0)
+                value = va_arg(args, long long);
+            else if (strcmp(length, "l") == 0 || strcmp(length, "z") == 0 || strcmp(length, "t") == 0)
+                value = va_arg(args, long);
+            else
+                value = va_arg(args, int);
+            result = put_signed(out, size, &used, value);
+            break;
+        }
+        case 'o':
+        case 'u':
+        case 'x':
+        case 'X':
+        {
+            uint64_t value;
+            if (strcmp(length, "ll") == 0 || strcmp(length, "q") == 0 || strcmp(length, "j") == 0)
+                value = va_arg(args, unsigned long long);
+            else if (strcmp(length, "l") == 0 || strcmp(length, "z") == 0 || strcmp(length, "t") == 0)
+                value = va_arg(args, unsigned long);
+            else
+                value = va_arg(args, unsigned int);
+            result = put_value(out, size, &used, LOG_ARG_UNSIGNED, &value, sizeof(value));
+            break;
+        }
+        case 'c':
+            result = put_signed(out, size, &used, va_arg(args, int));
+            break;
+        case 'p':
+        {
+            uint64_t value = (uint64_t)(uintptr_t)va_arg(args, void *);
+            result = put_value(out, size, &used, LOG_ARG_POINTER, &value, sizeof(value));
+            break;
+        }
+        case 's':
+        {
+            const char *text = va_arg(args, const char *);
+            if (!text)
+                text = "(null)";
+
+            // A precision may cover a buffer without a terminator
+            size_t text_length = precision >= 0 ? strnlen(text, (size_t)precision) : strlen(text);
+            if (used + 3 > size)
+            {
+                result = -1;
+                break;
+            }
+            if (text_length > size - used - 3)
+                text_length = size - used - 3;
+            if (text_length > UINT16_MAX)
+                text_length = UINT16_MAX;
+
+            uint16_t encoded = (uint16_t)text_length;
+            out[used] = LOG_ARG_STRING;
+            memcpy(out + used + 1, &encoded, sizeof(encoded));
+            memcpy(out + used + 3, text, text_length);
+            used += 3 + text_length;
+            break;
+        }
+        case 'n':
+            (void)va_arg(args, void *); // Never written through
+            break;
+        default:
+        {
+            double value = strcmp(length, "L") == 0 ? (double)va_arg(args, long double) : va_arg(args, double);
+            result = put_value(out, size, &used, LOG_ARG_DOUBLE, &value, sizeof(value));
+            break;
+        }
+        }
+
+        if (result < 0)
+            break;
+    }
+
+    return used;
+}
+
+// Next encoded argument; returns its tag, or 0 when none is left
+static char next_arg(const char **args, const char *end, const char **value, size_t *length)
+{
+    if (*args >= end)
+        return 0;
+
+    char tag = **args;
+    const char *data = *args + 1;
+    size_t size;
+    if (tag == LOG_ARG_STRING)
+    {
+        uint16_t text_length;
+        if (data + sizeof(text_length) > end)
+            return 0;
+        memcpy(&text_length, data, sizeof(text_length));
+        data += sizeof(text_length);
+        size = text_length;
+    }
+    else
+    {
+        size = 8;
+    }
+
+    if (data + size > end)
+        return 0;
+
+    *value = data;
+    *length = size;
+    *args = data + size;
+    return tag;
+}
+
+static int64_t arg_integer(char tag, const char *value)
+{
+    if (tag == LOG_ARG_DOUBLE)
+    {
+        double number;
+        memcpy(&number, value, sizeof(number));
+        return (int64_t)number;
+    }
+
+    int64_t number;
+    memcpy(&number, value, sizeof(number));
+    return number;
+}
+
+// Format a message from its format string and encoded arguments, the way
+// vsnprintf would have; returns the length written (output is truncated
+// to size - 1 bytes and always terminated)
+size_t log_args_render(char *out, size_t size, const char *format, const char *args, size_t length)
+{
+    if (size == 0)
+        return 0;
+
+    const char *end = args + length;
+    size_t used = 0;
+    const char *p = format;
+
+    while (*p && used < size - 1)
+    {
+        if (*p != '%')
+        {
+            out[used++] = *p++;
+            continue;
+        }
+
+        FormatSpec spec;
+        const char *start = p;
+        p = parse_spec(p + 1, &spec);
+        if (spec.conversion == '%')
+        {
+            out[used++] = '%';
+            continue;
+        }
+        if (spec.conversion == 0)
+        {
+            // Unsupported conversion: show it as written
+            size_t literal = (size_t)(p - start);
+            if (literal > size - 1 - used)
+                literal = size - 1 - used;
+            memcpy(out + used, start, literal);
+            used += literal;
+            continue;
+        }
+        if (spec.conversion == 'n')
+            continue;
+
+        const char *value;
+        size_t value_length;
+        char tag;
+        int width = spec.width;
+        bool has_width = width >= 0;
+        int precision = spec.precision;
+        if (width == -2)
+        {
+            if (!(tag = next_arg(&args, end, &value, &value_length)))
+                break;
+            width = (int)arg_integer(tag, value);
+            has_width = true;
+        }
+        if (precision == -2)
+        {
+            if (!(tag = next_arg(&args, end, &value, &value_length)))
+                break;
+            precision = (int)arg_integer(tag, value); // Negative means none
+        }
+        if (!(tag = next_arg(&args, end, &value, &value_length)))
+            break;
+
+        // Rebuild the conversion for the widened argument type
+        char conversion[48];
+        int prefix = snprintf(conversion, sizeof(conversion), "%%%s", spec.flags);
+        if (has_width)
+            prefix += snprintf(conversion + prefix, sizeof(conversion) - prefix, "%d", width);
+        if (precision >= 0 && spec.conversion != 's')
+            prefix += snprintf(conversion + prefix, sizeof(conversion) - prefix, ".%d", precision);
+
+        int written;
+        switch (spec.conversion)
+        {
+        case 's':
+            snprintf(conversion + prefix, sizeof(conversion) - prefix, ".*s");
+            written = tag == LOG_ARG_STRING
+                          ? snprintf(out + used, size - used, conversion, (int)value_length, value)
+                          : snprintf(out + used, size - used, conversion, 1, "?");
+            break;
+        case 'p':
+            snprintf(conversion + prefix, sizeof(conversion) - prefix, "p");
+            written = snprintf(out + used, size - used, conversion,
+                               (void *)(uintptr_t)arg_integer(tag, value));
+            break;
+        case 'c':
+            snprintf(conversion + prefix, sizeof(conversion) - prefix, "c");
+            written = snprintf(out + used, size - used, conversion, (int)arg_integer(tag, value));
+            break;
+        case 'd':
+        case 'i':
+        case 'o':
+        case 'u':
+        case 'x':
+        case 'X':
+            snprintf(conversion + prefix, sizeof(conversion) - prefix, "ll%c", spec.conversion);
+            written = snprintf(out + used, size - used, conversion, (long long)arg_integer(tag, value));
+            break;
+        default:
+        {
+            double number = 0;
+            if (tag == LOG_ARG_DOUBLE)
+                memcpy(&number, value, sizeof(number));
+            else
+                number = (double)arg_integer(tag, value);
+            snprintf(conversion + prefix, sizeof(conversion) - prefix, "%c", spec.conversion);
+            written = snprintf(out + used, size - used, conversion, number);
+            break;
+        }
+        }
+
+        if (written < 0)
+            break;
+        used += (size_t)written < size - used ? (size_t)written : size - 1 - used;
+    }
+
+    out[used] = '\0';
+    return used;
+}
@@ -0,0 +1,311 @@
+#include "log_rotate.h"
+#include "logging.h"
+#include <dirent.h>
+#include <spawn.h>
+#include <sys/wait.h>
+
+// Rotation policy. The logging backend decides when to roll over and
+// renames the file itself (on the writer thread in async mode); gzip and
+// pruning of old segments run on the worker below.
+static long long rotate_bytes = 0;
+static int rotate_interval = 0;
+static int rotate_keep = 0;
+static bool rotate_compress = false;
+static time_t next_rotation = 0;
+
+static char log_directory[PATH_MAX];
+static char log_basename[PATH_MAX];
+
+// Worker state; the worker rescans the directory on every request, so a
+// request made while it is busy is simply folded into the next pass
+static pthread_t worker_thread;
+static pthread_mutex_t worker_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t worker_cond = PTHREAD_COND_INITIALIZER;
+static bool worker_started = false;
+static bool worker_requested = false;
+static bool worker_stop = false;
+static bool gzip_missing = false;
+
+// Start of the next interval, aligned to UTC so daily rotation happens at
+// midnight regardless of when the server started
+static time_t interval_after(time_t now)
+{
+    return (now / rotate_interval + 1) * rotate_interval;
+}
+
+void log_rotate_init(const ServerConfig *config)
+{
+    rotate_bytes = (long long)config->log_rotate_size_mb * 1024 * 1024;
+    rotate_interval = config->log_rotate_interval;
+    rotate_keep = config->log_rotate_keep;
+    rotate_compress = config->log_rotate_compress;
+    next_rotation = rotate_interval > 0 ? interval_after(time(NULL)) : 0;
+
+    const char *slash = strrchr(config->log_file, '/');
+    if (slash)
+    {
+        size_t length = (size_t)(slash - config->log_file);
+        if (length == 0)
+            length = 1; // File in the root directory
+        if (length >= sizeof(log_directory))
+            length = sizeof(log_directory) - 1;
+        memcpy(log_directory, config->log_file, length);
+        log_directory[length] = '\0';
+        snprintf(log_basename, sizeof(log_basename), "%s", slash + 1);
+    }
+    else
+    {
+        snprintf(log_directory, sizeof(log_directory), ".");
+        snprintf(log_basename, sizeof(log_basename), "%s", config->log_file);
+    }
+}
+
+bool log_rotate_enabled(void)
+{
+    return rotate_bytes > 0 || rotate_interval > 0;
+}
+
+bool log_rotate_due(long long file_bytes, time_t now)
+{
+    if (rotate_bytes > 0 && file_bytes >= rotate_bytes)
+        return true;
+    return next_rotation > 0 && now >= next_rotation;
+}
+
+// Rotated files are "<basename>.YYYYmmdd-HHMMSS", then "-NNN" when several
+// rotations share a second, then ".gz" once compressed
+static bool is_archive(const char *name, bool *compressed)
+{
+    size_t base = strlen(log_basename);
+    if (strncmp(name, log_basename, base) != 0 || name[base] != '.')
+        return false;
+
+    const char *p = name + base + 1;
+    for (int i = 0; i < 15; i++)
+    {
+        bool digit = p[i] >= '0' && p[i] <= '9';
+        if (i == 8 ? p[i] != '-' : !digit)
+            return false;
+    }
+    p += 15;
+
+    if (*p == '-')
+    {
+        p++;
+        if (*p < '0' || *p > '9')
+            return false;
+        while (*p >= '0' && *p <= '9')
+            p++;
+    }
+
+    *compressed = strcmp(p, ".gz") == 0;
+    return *p == '\0' || *compressed;
+}
+
+static void compress_archive(const char *path)
+{
+    char *argv[] = {"gzip", "-f", (char *)path, NULL};
+    pid_t pid;
+    int error = posix_spawnp(&pid, "gzip", NULL, NULL, argv, environ);
+    if (error != 0)
+    {
+        log_warn("Cannot compress rotated logs, failed to run gzip: %s", strerror(error));
+        gzip_missing = true;
+        return;
+    }
+
+    int status;
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+        ;
+    if (!WIFEXITED(status) || WEXITSTATUS(status) == 127)
+    {
+        log_warn("Cannot compress rotated logs, gzip is not available");
+        gzip_missing = true;
+    }
+    else if (WEXITSTATUS(status) != 0)
+    {
+        log_warn("Failed to compress rotated log %s (gzip exit status %d)", path, WEXITSTATUS(status));
+    }
+}
+
+static size_t archive_length(const char *name)
+{
+    size_t length = strlen(name);
+    if (length > 3 && strcmp(name + length - 3, ".gz") == 0)
+        length -= 3;
+    return length;
+}
+
+// Oldest first: names compare by timestamp, and "-NNN" (later in the same
+// second) sorts after the bare timestamp once ".gz" is ignored
+static int compare_names(const void *a, const void *b)
+{
+    const char *left = *(char *const *)a;
+    const char *right = *(char *const *)b;
+    size_t left_length = archive_length(left);
+    size_t right_length = archive_length(right);
+
+    int order = memcmp(left, right, left_length < right_length ? left_length : right_length);
+    if (order != 0)
+        return order;
+    return left_length < right_length ? -1 : left_length > right_length;
+}
+
+// Compress finished segments, then delete the oldest beyond rotate_keep
+static void maintain_archives(void)
+{
+    DIR *dir = opendir(log_directory);
+    if (!dir)
+    {
+        log_warn("Cannot scan log directory %s: %s", log_directory, strerror(errno));
+        return;
+    }
+
+    char **names = NULL;
+    size_t count = 0;
+    size_t capacity = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        bool compressed;
+        if (!is_archive(entry->d_name, &compressed))
+            continue;
+
+        if (count == capacity)
+        {
+            size_t grown = capacity ? capacity * 2 : 32;
+            char **resized = realloc(names, grown * sizeof(char *));
+            if (!resized)
+                break;
+            names = resized;
+            capacity = grown;
+        }
+
+        char path[PATH_MAX + NAME_MAX + 2];
+        snprintf(path, sizeof(path), "%s/%s", log_directory, entry->d_name);
+        names[count] = strdup(path);
+        if (names[count])
+            count++;
+    }
+    closedir(dir);
+
+    // Compressed only after the scan, which would otherwise see the .gz files
+    for (size_t i = 0; i < count && rotate_compress && !gzip_missing; i++)
+    {
+        size_t length = strlen(names[i]);
+        if (length > 3 && strcmp(names[i] + length - 3, ".gz") == 0)
+            continue;
+
+        compress_archive(names[i]);
+        char *compressed = malloc(length + 4);
+        if (!gzip_missing && compressed)
+        {
+            snprintf(compressed, length + 4, "%s.gz", names[i]);
+            free(names[i]);
+            names[i] = compressed;
+        }
+        else
+        {
+            free(compressed);
+        }
+    }
+
+    // Timestamps in the names sort in rotation order
+    if (rotate_keep > 0 && count > (size_t)rotate_keep)
+    {
+        qsort(names, count, sizeof(char *), compare_names);
+        for (size_t i = 0; i < count - (size_t)rotate_keep; i++)
+        {
+            if (unlink(names[i]) == 0)
+                log_debug("Removed old log file %s", names[i]);
+            else if (errno != ENOENT)
+                log_warn("Failed to remove old log file %s: %s", names[i], strerror(errno));
+        }
+    }
+
+    for (size_t i = 0; i < count; i++)
+        free(names[i]);
+    free(names);
+}
+
+static void *rotate_worker(void *arg)
+{
+    (void)arg;
+
+    pthread_mutex_lock(&worker_lock);
+    for (;;)
+    {
+        while (!worker_requested && !worker_stop)
+            pthread_cond_wait(&worker_cond, &worker_lock);
+        if (worker_stop)
+            break;
+        worker_requested = false;
+
+        // Leftovers of an interrupted pass are picked up on the next one
+        pthread_mutex_unlock(&worker_lock);
+        maintain_archives();
+        pthread_mutex_lock(&worker_lock);
+    }
+    pthread_mutex_unlock(&worker_lock);
+    return NULL;
+}
+
+static void request_maintenance(void)
+{
+    if (!rotate_compress && rotate_keep == 0)
+        return;
+
+    pthread_mutex_lock(&worker_lock);
+    if (!worker_started && !worker_stop)
+    {
+        // Started on first use rather than at init, which runs before daemonizing
+        worker_started = pthread_create(&worker_thread, NULL, rotate_worker, NULL) == 0;
+    }
+    worker_requested = true;
+    pthread_cond_signal(&worker_cond);
+    pthread_mutex_unlock(&worker_lock);
+}
+
+// Move the current file aside under a timestamped name and schedule the
+// next time-based rotation. Called by the logging backend with its lock
+// held and the file closed, so it must not log.
+int log_rotate_archive(const char *path, char *archive, size_t size)
+{
+    time_t now = time(NULL);
+    if (rotate_interval > 0)
+        next_rotation = interval_after(now);
+
+    struct tm tm_info;
+    char stamp[32];
+    localtime_r(&now, &tm_info);
+    strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &tm_info);
+
+    snprintf(archive, size, "%s.%s", path, stamp);
+    for (int n = 1; n < 1000; n++)
+    {
+        char compressed[PATH_MAX + 4];
+        snprintf(compressed, sizeof(compressed), "%s.gz", archive);
+        if (access(archive, F_OK) != 0 && access(compressed, F_OK) != 0)
+            break;
+        snprintf(archive, size, "%s.%s-%03d", path, stamp, n);
+    }
+
+    if (rename(path, archive) != 0)
+        return -1;
+
+    request_maintenance();
+    return 0;
+}
+
+void log_rotate_cleanup(void)
+{
+    pthread_mutex_lock(&worker_lock);
+    worker_stop = true;
+    bool started = worker_started;
+    pthread_cond_signal(&worker_cond);
+    pthread_mutex_unlock(&worker_lock);
+
+    // A gzip in progress is allowed to finish
+    if (started)
+        pthread_join(worker_thread, NULL);
+}
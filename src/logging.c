@@ -1,18 +1,95 @@
 #include "logging.h"
+#include "clock.h"
+#include "log_format.h"
+#include "log_rotate.h"
 #include <stdarg.h>
 #include <pthread.h>
+#include <poll.h>
+#include <sched.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
 
-// Global logging state
+// Global logging state; messages logged before logging_init use INFO
+LogLevel log_module_levels[LOG_MODULE_COUNT] = {LOG_INFO, LOG_INFO, LOG_INFO, LOG_INFO};
 static FILE *log_file_handle = NULL;
 static LogLevel current_log_level = LOG_INFO;
 static bool log_to_console_enabled = true;
 static bool log_to_file_enabled = false;
+static bool binary_file = false;
+static char log_file_path[PATH_MAX];
+static long long log_file_bytes = 0;          // Size of the current file
+static unsigned long log_file_generation = 0; // Bumped for every file opened
+static bool reopen_requested = false;
 static pthread_mutex_t log_mutex = PTHREAD_MUTEX_INITIALIZER;
 
+// Asynchronous pipeline: every logging thread owns a single-producer ring
+// that only the writer thread consumes, so producers never take a lock.
+// Lines of one thread stay in order; lines of different threads are
+// interleaved per writer pass.
+#define LOG_MESSAGE_MAX 1024
+#define LOG_MAX_RINGS 128
+#define LOG_FLUSH_INTERVAL_MS 20
+#define LOG_BATCH_SIZE (64 * 1024)
+#define LOG_RECORD_WRAP 0xff // Padding to the end of the ring
+
+// Ring record payloads: a formatted message, or for binary log files the
+// format string pointer followed by the encoded arguments
+#define LOG_ENCODING_TEXT 0
+#define LOG_ENCODING_ARGS 1
+
+typedef struct
+{
+    uint32_t size;    // Bytes to the next record, header included
+    uint16_t length;  // Payload bytes following the header
+    uint8_t level;    // LogLevel, or LOG_RECORD_WRAP
+    uint8_t encoding; // LOG_ENCODING_*
+    int64_t time;     // Wall clock nanoseconds
+} LogRecord;
+
+#define LOG_RECORD_ALIGN sizeof(LogRecord)
+#define LOG_RECORD_MAX (sizeof(LogRecord) + LOG_MESSAGE_MAX)
+
+typedef struct
+{
+    // Producer side
+    size_t head __attribute__((aligned(64)));
+    unsigned long dropped; // Records lost to overflow
+
+    // Writer side
+    size_t tail __attribute__((aligned(64)));
+    unsigned long reported; // Drops already reported
+
+    char *data __attribute__((aligned(64)));
+    size_t size;
+} LogRing;
+
+static LogRing *rings[LOG_MAX_RINGS];
+static int ring_count = 0;
+static size_t ring_size = 0;
+static LogOverflow overflow_policy = LOG_OVERFLOW_BLOCK;
+static bool async_configured = false;
+static bool async_enabled = false;
+static bool writer_stop = false;
+static unsigned long writer_passes = 0; // Completed drain-and-write passes
+static pthread_t writer_thread;
+static int wake_fd = -1;
+
+// Binary files: format id 0 always means "%s" and carries lines that were
+// formatted before reaching the file; the writer numbers the others
+#define LOG_FORMAT_TEXT_ID 0
+#define LOG_FORMAT_TABLE 4096
+
+static __thread LogRing *thread_ring = NULL;
+static __thread bool thread_ring_failed = false;
+static __thread volatile sig_atomic_t thread_producing = 0;
+
 // Log level strings and colors
 const char *log_level_strings[] = {
     "DEBUG", "INFO", "WARN", "ERROR", "FATAL"};
 
+const char *log_module_names[] = {
+    "server", "connection", "chat", "config"};
+
 const char *log_level_colors[] = {
     COLOR_GRAY,   // DEBUG
     COLOR_GREEN,  // INFO
@@ -21,6 +98,103 @@ const char *log_level_colors[] = {
     COLOR_MAGENTA // FATAL
 };
 
+static int64_t now_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static size_t binary_header(char *out)
+{
+    uint32_t byte_order = LOG_BINARY_BYTE_ORDER;
+    out[0] = LOG_RECORD_HEADER;
+    memcpy(out + 1, LOG_BINARY_MAGIC, 5);
+    out[6] = LOG_BINARY_VERSION;
+    memcpy(out + 7, &byte_order, sizeof(byte_order));
+    return LOG_BINARY_HEADER_SIZE;
+}
+
+static size_t binary_message(char *out, int64_t time_ns, int level, uint32_t format_id, size_t args_length)
+{
+    uint16_t length = (uint16_t)args_length;
+    out[0] = LOG_RECORD_MESSAGE;
+    memcpy(out + 1, &time_ns, sizeof(time_ns));
+    out[9] = (char)level;
+    memcpy(out + 10, &format_id, sizeof(format_id));
+    memcpy(out + 14, &length, sizeof(length));
+    return LOG_BINARY_MESSAGE_SIZE;
+}
+
+// A formatted line as a message of the implicit "%s" format
+static size_t binary_text_message(char *out, int64_t time_ns, int level, const char *text, size_t length)
+{
+    uint16_t text_length = (uint16_t)length;
+    size_t used = binary_message(out, time_ns, level, LOG_FORMAT_TEXT_ID, 3 + length);
+    out[used] = LOG_ARG_STRING;
+    memcpy(out + used + 1, &text_length, sizeof(text_length));
+    memcpy(out + used + 3, text, length);
+    return used + 3 + length;
+}
+
+// Open (or reopen) log_file_path for appending; called with log_mutex held
+static int open_log_file(void)
+{
+    log_file_handle = fopen(log_file_path, "a");
+    if (!log_file_handle)
+        return -1;
+
+    // Set line buffering for immediate flush
+    setvbuf(log_file_handle, NULL, _IOLBF, 0);
+
+    struct stat st;
+    log_file_bytes = fstat(fileno(log_file_handle), &st) == 0 ? (long long)st.st_size : 0;
+    log_file_generation++;
+
+    // Every file section starts a new format table in binary files
+    if (binary_file)
+    {
+        char header[LOG_BINARY_HEADER_SIZE];
+        log_file_bytes += (long long)fwrite(header, 1, binary_header(header), log_file_handle);
+        fflush(log_file_handle);
+    }
+    return 0;
+}
+
+// Roll the file over when it is due, or reopen it after SIGHUP. Called
+// with log_mutex held, so the outcome is returned as a notice for the
+// caller to log instead of being logged here.
+static void check_rotation(char *notice, size_t size)
+{
+    bool reopen = __atomic_exchange_n(&reopen_requested, false, __ATOMIC_ACQ_REL);
+    bool rotate = log_rotate_due(log_file_bytes, clock_now_sec());
+    if (!reopen && !rotate)
+        return;
+
+    fclose(log_file_handle);
+    log_file_handle = NULL;
+
+    char archive[PATH_MAX];
+    if (!rotate)
+        snprintf(notice, size, "Log file reopened");
+    else if (log_rotate_archive(log_file_path, archive, sizeof(archive)) == 0)
+        snprintf(notice, size, "Log file rotated to %s", archive);
+    else
+        snprintf(notice, size, "Failed to rotate log file %s: %s", log_file_path, strerror(errno));
+
+    if (open_log_file() < 0)
+    {
+        snprintf(notice, size, "Failed to reopen log file %s: %s", log_file_path, strerror(errno));
+        log_to_file_enabled = false;
+        return;
+    }
+
+    // A failed rename leaves the full file in place; try again one
+    // rotation size later rather than on every write
+    if (rotate && log_rotate_due(log_file_bytes, clock_now_sec()))
+        log_file_bytes = 0;
+}
+
 int logging_init(const ServerConfig *config)
 {
     if (!config)
@@ -29,9 +203,21 @@ int logging_init(const ServerConfig *config)
     pthread_mutex_lock(&log_mutex);
 
     current_log_level = config->log_level;
+    for (int i = 0; i < LOG_MODULE_COUNT; i++)
+    {
+        int level = config->log_module_levels[i];
+        log_module_levels[i] = level >= 0 ? (LogLevel)level : current_log_level;
+    }
     log_to_console_enabled = config->log_to_console;
     log_to_file_enabled = config->log_to_file;
 
+    // The writer thread itself is started by logging_start, after daemonizing
+    async_configured = config->log_async;
+    overflow_policy = config->log_overflow;
+    ring_size = ((size_t)config->log_buffer_kb * 1024) & ~(LOG_RECORD_ALIGN - 1);
+    if (ring_size < 4 * LOG_RECORD_MAX)
+        ring_size = 4 * LOG_RECORD_MAX;
+
     // Open log file if file logging is enabled
     if (log_to_file_enabled)
     {
@@ -56,36 +242,567 @@ int logging_init(const ServerConfig *config)
             }
         }
 
-        log_file_handle = fopen(config->log_file, "a");
-        if (!log_file_handle)
+        binary_file = config->log_file_format == LOG_FILE_BINARY;
+        snprintf(log_file_path, sizeof(log_file_path), "%s", config->log_file);
+        log_rotate_init(config);
+        if (open_log_file() < 0)
         {
             fprintf(stderr, "Failed to open log file: %s\n", config->log_file);
             log_to_file_enabled = false;
             pthread_mutex_unlock(&log_mutex);
             return -1;
         }
-
-        // Set line buffering for immediate flush
-        setvbuf(log_file_handle, NULL, _IOLBF, 0);
     }
 
     pthread_mutex_unlock(&log_mutex);
 
     log_info("Logging system initialized");
     log_info("Log level: %s", log_level_strings[current_log_level]);
+    for (int i = 0; i < LOG_MODULE_COUNT; i++)
+    {
+        if (log_module_levels[i] != current_log_level)
+            log_info("Log level for %s: %s", log_module_names[i], log_level_strings[log_module_levels[i]]);
+        if (log_module_levels[i] < LOG_COMPILE_LEVEL)
+            log_warn("%s %s messages are compiled out of this build (LOG_MIN_LEVEL=%s)",
+                     log_module_names[i], log_level_strings[log_module_levels[i]],
+                     log_level_strings[LOG_COMPILE_LEVEL]);
+    }
     log_info("Console logging: %s", log_to_console_enabled ? "enabled" : "disabled");
     log_info("File logging: %s", log_to_file_enabled ? "enabled" : "disabled");
+    if (log_to_file_enabled && log_rotate_enabled())
+    {
+        log_info("Log rotation: at %d MB or every %d seconds, keeping %d%s", config->log_rotate_size_mb,
+                 config->log_rotate_interval, config->log_rotate_keep,
+                 config->log_rotate_compress ? " (gzip)" : "");
+    }
+
+    return 0;
+}
+
+static void wake_writer(void)
+{
+    uint64_t one = 1;
+    ssize_t ignored = write(wake_fd, &one, sizeof(one));
+    (void)ignored;
+}
+
+// Render one line in the format of the synchronous path
+static size_t render_line(char *buffer, size_t size, bool color, const char *timestamp,
+                          int level, const char *message, size_t length)
+{
+    int written;
+    if (color)
+    {
+        written = snprintf(buffer, size, "%s[%s] %s%s%s %.*s\n",
+                           COLOR_GRAY, timestamp,
+                           log_level_colors[level], log_level_strings[level], COLOR_RESET,
+                           (int)length, message);
+    }
+    else
+    {
+        written = snprintf(buffer, size, "[%s] %s %.*s\n",
+                           timestamp, log_level_strings[level], (int)length, message);
+    }
+
+    if (written < 0)
+        return 0;
+    return (size_t)written < size ? (size_t)written : size - 1;
+}
+
+typedef struct
+{
+    char console[LOG_BATCH_SIZE];
+    size_t console_used;
+    char file[LOG_BATCH_SIZE];
+    size_t file_used;
+    time_t rendered_time;
+    char timestamp[32];
+    char message[LOG_MESSAGE_MAX]; // Rendered from encoded arguments
+
+    // Binary files: format strings already defined, by address
+    const char *formats[LOG_FORMAT_TABLE];
+    uint32_t format_ids[LOG_FORMAT_TABLE];
+    uint32_t next_format_id;
+    int format_count;
+    unsigned long format_generation; // File the definitions were written to
+} LogBatch;
+
+static void batch_append(LogBatch *batch, int64_t time_ns, int level, const char *format,
+                         const char *payload, size_t length);
+
+// Also runs on idle passes, so time-based rotation and reopening happen
+// without waiting for the next message
+static void batch_flush(LogBatch *batch)
+{
+    char notice[PATH_MAX + 64];
+    notice[0] = '\0';
+
+    // One write per destination for the whole batch; the mutex keeps
+    // synchronous lines (startup, shutdown, fatal) from interleaving
+    pthread_mutex_lock(&log_mutex);
+    if (log_to_console_enabled && batch->console_used > 0)
+    {
+        fwrite(batch->console, 1, batch->console_used, stdout);
+        fflush(stdout);
+    }
+    if (log_to_file_enabled && log_file_handle && batch->file_used > 0)
+    {
+        fwrite(batch->file, 1, batch->file_used, log_file_handle);
+        fflush(log_file_handle);
+        log_file_bytes += (long long)batch->file_used;
+    }
+
+    // Rolling over between batches keeps format definitions in the file
+    // that uses them
+    if (log_to_file_enabled && log_file_handle)
+        check_rotation(notice, sizeof(notice));
+    unsigned long generation = log_file_generation;
+    pthread_mutex_unlock(&log_mutex);
+
+    batch->console_used = 0;
+    batch->file_used = 0;
+
+    if (generation != batch->format_generation)
+    {
+        memset(batch->formats, 0, sizeof(batch->formats));
+        batch->next_format_id = 0;
+        batch->format_count = 0;
+        batch->format_generation = generation;
+    }
+    if (notice[0])
+        batch_append(batch, now_ns(), LOG_INFO, NULL, notice, strlen(notice));
+}
+
+// Id of a format string in the binary file, defining it on first use.
+// Returns LOG_FORMAT_TEXT_ID once the table is full.
+static uint32_t batch_format_id(LogBatch *batch, const char *format)
+{
+    size_t slot = ((uintptr_t)format >> 3) * 2654435761u % LOG_FORMAT_TABLE;
+    while (batch->formats[slot])
+    {
+        if (batch->formats[slot] == format)
+            return batch->format_ids[slot];
+        slot = (slot + 1) % LOG_FORMAT_TABLE;
+    }
+
+    if (batch->format_count >= LOG_FORMAT_TABLE * 3 / 4)
+        return LOG_FORMAT_TEXT_ID;
+
+    uint32_t id = ++batch->next_format_id;
+    batch->formats[slot] = format;
+    batch->format_ids[slot] = id;
+    batch->format_count++;
+
+    size_t length = strnlen(format, LOG_MESSAGE_MAX);
+    uint16_t format_length = (uint16_t)length;
+    char *out = batch->file + batch->file_used;
+    out[0] = LOG_RECORD_FORMAT;
+    memcpy(out + 1, &id, sizeof(id));
+    memcpy(out + 5, &format_length, sizeof(format_length));
+    memcpy(out + LOG_BINARY_FORMAT_SIZE, format, length);
+    batch->file_used += LOG_BINARY_FORMAT_SIZE + length;
+    return id;
+}
+
+// Queue one message for every destination. format is NULL when payload is
+// already text, otherwise payload holds its encoded arguments.
+static void batch_append(LogBatch *batch, int64_t time_ns, int level, const char *format,
+                         const char *payload, size_t length)
+{
+    // Colors, a format definition and the longest message must fit
+    // behind what is already queued
+    const size_t line_max = 2 * LOG_MESSAGE_MAX + 96;
+    if (batch->console_used + line_max > sizeof(batch->console) ||
+        batch->file_used + line_max > sizeof(batch->file))
+    {
+        batch_flush(batch);
+    }
+
+    // Binary files keep the arguments; only text destinations need formatting
+    uint32_t format_id = LOG_FORMAT_TEXT_ID;
+    if (log_to_file_enabled && binary_file && format)
+        format_id = batch_format_id(batch, format);
+
+    const char *message = payload;
+    size_t message_length = length;
+    bool text_file = log_to_file_enabled && (!binary_file || format_id == LOG_FORMAT_TEXT_ID);
+    if (format && (log_to_console_enabled || text_file))
+    {
+        message_length = log_args_render(batch->message, sizeof(batch->message), format, payload, length);
+        message = batch->message;
+    }
+
+    time_t seconds = (time_t)(time_ns / 1000000000);
+    if (seconds != batch->rendered_time)
+    {
+        struct tm tm_info;
+        localtime_r(&seconds, &tm_info);
+        strftime(batch->timestamp, sizeof(batch->timestamp), "%Y-%m-%d %H:%M:%S", &tm_info);
+        batch->rendered_time = seconds;
+    }
+
+    if (log_to_console_enabled)
+    {
+        batch->console_used += render_line(batch->console + batch->console_used,
+                                           sizeof(batch->console) - batch->console_used,
+                                           true, batch->timestamp, level, message, message_length);
+    }
+    if (!log_to_file_enabled)
+        return;
+
+    char *out = batch->file + batch->file_used;
+    if (!binary_file)
+    {
+        batch->file_used += render_line(out, sizeof(batch->file) - batch->file_used,
+                                        false, batch->timestamp, level, message, message_length);
+    }
+    else if (format_id == LOG_FORMAT_TEXT_ID)
+    {
+        batch->file_used += binary_text_message(out, time_ns, level, message, message_length);
+    }
+    else
+    {
+        size_t used = binary_message(out, time_ns, level, format_id, length);
+        memcpy(out + used, payload, length);
+        batch->file_used += used + length;
+    }
+}
+
+// Next record of a ring below limit, skipping end-of-ring padding
+static const LogRecord *ring_peek(LogRing *ring, size_t limit)
+{
+    while (ring->tail != limit)
+    {
+        const LogRecord *record = (const LogRecord *)(ring->data + ring->tail % ring->size);
+        if (record->level != LOG_RECORD_WRAP)
+            return record;
+        __atomic_store_n(&ring->tail, ring->tail + record->size, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+// Move everything the producers have committed into the batch, merging
+// the rings by timestamp so lines of different threads come out in order
+static void drain_rings(LogBatch *batch)
+{
+    int count = __atomic_load_n(&ring_count, __ATOMIC_ACQUIRE);
+    if (count > LOG_MAX_RINGS)
+        count = LOG_MAX_RINGS;
+
+    // Records committed after this snapshot wait for the next pass
+    size_t limits[LOG_MAX_RINGS];
+    for (int i = 0; i < count; i++)
+    {
+        LogRing *ring = __atomic_load_n(&rings[i], __ATOMIC_ACQUIRE);
+        limits[i] = ring ? __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) : 0;
+    }
+
+    for (;;)
+    {
+        LogRing *next = NULL;
+        const LogRecord *oldest = NULL;
+        for (int i = 0; i < count; i++)
+        {
+            LogRing *ring = __atomic_load_n(&rings[i], __ATOMIC_ACQUIRE);
+            if (!ring)
+                continue;
+
+            const LogRecord *record = ring_peek(ring, limits[i]);
+            if (record && (!oldest || record->time < oldest->time))
+            {
+                next = ring;
+                oldest = record;
+            }
+        }
+        if (!next)
+            break;
+
+        const char *payload = (const char *)(oldest + 1);
+        if (oldest->encoding == LOG_ENCODING_ARGS)
+        {
+            const char *format;
+            memcpy(&format, payload, sizeof(format));
+            batch_append(batch, oldest->time, oldest->level, format,
+                         payload + sizeof(format), oldest->length - sizeof(format));
+        }
+        else
+        {
+            batch_append(batch, oldest->time, oldest->level, NULL, payload, oldest->length);
+        }
+
+        // Hand space back as we go so blocked producers resume early
+        __atomic_store_n(&next->tail, next->tail + oldest->size, __ATOMIC_RELEASE);
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        LogRing *ring = __atomic_load_n(&rings[i], __ATOMIC_ACQUIRE);
+        if (!ring)
+            continue;
+
+        unsigned long dropped = __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+        if (dropped != ring->reported)
+        {
+            char notice[96];
+            int length = snprintf(notice, sizeof(notice),
+                                  "Log buffer full, dropped %lu messages", dropped - ring->reported);
+            batch_append(batch, now_ns(), LOG_WARN, NULL, notice, (size_t)length);
+            ring->reported = dropped;
+        }
+    }
+}
+
+static void *log_writer(void *arg)
+{
+    (void)arg;
+
+    LogBatch *batch = calloc(1, sizeof(LogBatch));
+    if (!batch)
+        return NULL;
+
+    pthread_mutex_lock(&log_mutex);
+    batch->format_generation = log_file_generation;
+    pthread_mutex_unlock(&log_mutex);
+
+    struct pollfd wake = {wake_fd, POLLIN, 0};
+    for (;;)
+    {
+        // Producers only signal when a ring fills up or on errors; the
+        // interval bounds how stale the output can get otherwise
+        if (poll(&wake, 1, LOG_FLUSH_INTERVAL_MS) > 0)
+        {
+            uint64_t signals;
+            ssize_t ignored = read(wake_fd, &signals, sizeof(signals));
+            (void)ignored;
+        }
+
+        bool stopping = __atomic_load_n(&writer_stop, __ATOMIC_ACQUIRE);
+        drain_rings(batch);
+        batch_flush(batch);
+        __atomic_add_fetch(&writer_passes, 1, __ATOMIC_RELEASE);
+
+        if (stopping)
+            break;
+    }
+
+    free(batch);
+    return NULL;
+}
+
+int logging_start(void)
+{
+    if (!async_configured || async_enabled)
+        return 0;
+
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wake_fd < 0)
+    {
+        log_error("Failed to create log writer wakeup fd: %s", strerror(errno));
+        return -1;
+    }
+
+    writer_stop = false;
+    if (pthread_create(&writer_thread, NULL, log_writer, NULL) != 0)
+    {
+        log_error("Failed to start log writer thread");
+        close(wake_fd);
+        wake_fd = -1;
+        return -1;
+    }
 
+    __atomic_store_n(&async_enabled, true, __ATOMIC_RELEASE);
+    log_info("Async logging enabled (%zu KB per thread, %s when full)", ring_size / 1024,
+             overflow_policy == LOG_OVERFLOW_BLOCK ? "block" : "drop");
     return 0;
 }
 
+static LogRing *ring_for_thread(void)
+{
+    if (thread_ring || thread_ring_failed)
+        return thread_ring;
+
+    thread_ring_failed = true;
+
+    LogRing *ring = aligned_alloc(64, sizeof(LogRing));
+    if (!ring)
+        return NULL;
+    memset(ring, 0, sizeof(LogRing));
+
+    ring->size = ring_size;
+    ring->data = malloc(ring->size);
+    if (!ring->data)
+    {
+        free(ring);
+        return NULL;
+    }
+
+    int index = __atomic_fetch_add(&ring_count, 1, __ATOMIC_ACQ_REL);
+    if (index >= LOG_MAX_RINGS)
+    {
+        // Too many threads; this one keeps logging synchronously
+        free(ring->data);
+        free(ring);
+        return NULL;
+    }
+
+    __atomic_store_n(&rings[index], ring, __ATOMIC_RELEASE);
+    thread_ring = ring;
+    thread_ring_failed = false;
+    return ring;
+}
+
+// Claim room for one record of up to LOG_MESSAGE_MAX message bytes.
+// Returns 1 with *record set, 0 when the record was dropped, and -1 when
+// the caller should log synchronously instead.
+static int ring_reserve(LogRing **ring_out, LogRecord **record)
+{
+    if (!__atomic_load_n(&async_enabled, __ATOMIC_ACQUIRE))
+        return -1;
+
+    LogRing *ring = ring_for_thread();
+    if (!ring)
+        return -1;
+
+    // A signal handler logging on top of an interrupted producer
+    if (thread_producing)
+    {
+        __atomic_add_fetch(&ring->dropped, 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+
+    size_t head = ring->head;
+    size_t contiguous = ring->size - head % ring->size;
+    size_t needed = contiguous < LOG_RECORD_MAX ? contiguous + LOG_RECORD_MAX : LOG_RECORD_MAX;
+
+    for (;;)
+    {
+        size_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+        if (ring->size - (head - tail) >= needed)
+            break;
+
+        if (overflow_policy == LOG_OVERFLOW_DROP ||
+            __atomic_load_n(&writer_stop, __ATOMIC_ACQUIRE))
+        {
+            __atomic_add_fetch(&ring->dropped, 1, __ATOMIC_RELAXED);
+            return 0;
+        }
+
+        wake_writer();
+        sched_yield();
+    }
+
+    thread_producing = 1;
+
+    // Records never straddle the end of the ring
+    if (contiguous < LOG_RECORD_MAX)
+    {
+        LogRecord *wrap = (LogRecord *)(ring->data + head % ring->size);
+        wrap->size = (uint32_t)contiguous;
+        wrap->length = 0;
+        wrap->level = LOG_RECORD_WRAP;
+        head += contiguous;
+        __atomic_store_n(&ring->head, head, __ATOMIC_RELEASE);
+    }
+
+    *ring_out = ring;
+    *record = (LogRecord *)(ring->data + head % ring->size);
+    return 1;
+}
+
+static void ring_commit(LogRing *ring, LogRecord *record, LogLevel level, int encoding, size_t length)
+{
+    if (length > LOG_MESSAGE_MAX - 1)
+        length = LOG_MESSAGE_MAX - 1;
+
+    size_t size = (sizeof(LogRecord) + length + LOG_RECORD_ALIGN - 1) & ~(LOG_RECORD_ALIGN - 1);
+    record->size = (uint32_t)size;
+    record->length = (uint16_t)length;
+    record->level = (uint8_t)level;
+    record->encoding = (uint8_t)encoding;
+    record->time = now_ns();
+
+    size_t tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+    size_t before = ring->head - tail;
+    size_t head = ring->head + size;
+    __atomic_store_n(&ring->head, head, __ATOMIC_RELEASE);
+    thread_producing = 0;
+
+    // Wake the writer early when the ring passes half full or on errors
+    if (level >= LOG_ERROR || (before < ring->size / 2 && head - tail >= ring->size / 2))
+        wake_writer();
+}
+
+// Wait until the writer has written out everything queued so far
+static void logging_flush(void)
+{
+    if (!__atomic_load_n(&async_enabled, __ATOMIC_ACQUIRE))
+        return;
+
+    int count = __atomic_load_n(&ring_count, __ATOMIC_ACQUIRE);
+    if (count > LOG_MAX_RINGS)
+        count = LOG_MAX_RINGS;
+
+    for (int attempt = 0; attempt < 1000; attempt++)
+    {
+        unsigned long passes = __atomic_load_n(&writer_passes, __ATOMIC_ACQUIRE);
+        bool pending = false;
+        for (int i = 0; i < count; i++)
+        {
+            LogRing *ring = __atomic_load_n(&rings[i], __ATOMIC_ACQUIRE);
+            if (ring && __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) !=
+                            __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE))
+                pending = true;
+        }
+        if (!pending)
+        {
+            // The pass that drained the rings has written them once it ends
+            while (attempt++ < 1000 && __atomic_load_n(&writer_passes, __ATOMIC_ACQUIRE) == passes)
+            {
+                usleep(1000);
+            }
+            break;
+        }
+
+        wake_writer();
+        usleep(1000);
+    }
+}
+
+// Ask for the log file to be reopened, e.g. after an external tool moved
+// it aside. Safe to call from the event loop: the file is reopened by the
+// writer thread, or by the next synchronous write.
+void logging_reopen(void)
+{
+    __atomic_store_n(&reopen_requested, true, __ATOMIC_RELEASE);
+    if (__atomic_load_n(&async_enabled, __ATOMIC_ACQUIRE))
+        wake_writer();
+}
+
 void logging_cleanup(void)
 {
+    // Logged before taking the mutex, which log_message needs as well
+    if (log_file_handle)
+        log_info("Shutting down logging system");
+
+    if (async_enabled)
+    {
+        // The writer drains every ring once more before it exits
+        __atomic_store_n(&writer_stop, true, __ATOMIC_RELEASE);
+        wake_writer();
+        pthread_join(writer_thread, NULL);
+        __atomic_store_n(&async_enabled, false, __ATOMIC_RELEASE);
+
+        close(wake_fd);
+        wake_fd = -1;
+    }
+
+    // Nothing rotates any more; let a running gzip finish
+    log_rotate_cleanup();
+
     pthread_mutex_lock(&log_mutex);
 
     if (log_file_handle)
     {
-        log_info("Shutting down logging system");
         fclose(log_file_handle);
         log_file_handle = NULL;
     }
@@ -93,24 +810,80 @@ void logging_cleanup(void)
     pthread_mutex_unlock(&log_mutex);
 }
 
-const char *get_timestamp(void)
+// Synchronous path; called with log_mutex held
+static void write_file_line(const char *timestamp, LogLevel level, const char *message)
 {
-    static char timestamp[32];
-    time_t now = time(NULL);
-    struct tm *tm_info = localtime(&now);
+    if (binary_file)
+    {
+        char record[LOG_BINARY_MESSAGE_SIZE + 3 + LOG_MESSAGE_MAX];
+        size_t length = binary_text_message(record, now_ns(), level, message,
+                                            strnlen(message, LOG_MESSAGE_MAX - 1));
+        log_file_bytes += (long long)fwrite(record, 1, length, log_file_handle);
+    }
+    else
+    {
+        int length = fprintf(log_file_handle, "[%s] %s %s\n", timestamp, log_level_strings[level], message);
+        if (length > 0)
+            log_file_bytes += length;
+    }
+    fflush(log_file_handle);
 
-    strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S", tm_info);
-    return timestamp;
+    // The writer thread owns rotation while it runs
+    if (!__atomic_load_n(&async_enabled, __ATOMIC_ACQUIRE))
+    {
+        char notice[PATH_MAX + 64];
+        notice[0] = '\0';
+        check_rotation(notice, sizeof(notice));
+        if (notice[0] && log_file_handle)
+            write_file_line(timestamp, LOG_INFO, notice);
+    }
 }
 
-void log_message(LogLevel level, const char *format, ...)
+// Rendered once per second per thread by the clock, so callers on any
+// thread get their own stable buffer
+const char *get_timestamp(void)
 {
-    if (level < current_log_level)
-        return;
+    return clock_log_timestamp();
+}
 
+// Callers go through the log_* macros, which already checked the level
+void log_message(LogLevel level, const char *format, ...)
+{
     va_list args;
     char message[1024];
 
+    // Async mode: format straight into this thread's ring, or for binary
+    // files just copy the arguments and leave formatting to the decoder
+    LogRing *ring;
+    LogRecord *record;
+    int reserved = ring_reserve(&ring, &record);
+    if (reserved > 0 && binary_file)
+    {
+        char *payload = (char *)(record + 1);
+        memcpy(payload, &format, sizeof(format));
+        va_start(args, format);
+        size_t length = log_args_encode(payload + sizeof(format), LOG_MESSAGE_MAX - 1 - sizeof(format),
+                                        format, args);
+        va_end(args);
+        ring_commit(ring, record, level, LOG_ENCODING_ARGS, sizeof(format) + length);
+    }
+    else if (reserved > 0)
+    {
+        va_start(args, format);
+        int length = vsnprintf((char *)(record + 1), LOG_MESSAGE_MAX, format, args);
+        va_end(args);
+        ring_commit(ring, record, level, LOG_ENCODING_TEXT, length > 0 ? (size_t)length : 0);
+    }
+    if (reserved >= 0)
+    {
+        if (level == LOG_FATAL)
+        {
+            logging_flush();
+            exit(EXIT_FAILURE);
+        }
+        return;
+    }
+
     // Format the message
     va_start(args, format);
     vsnprintf(message, sizeof(message), format, args);
@@ -135,8 +908,7 @@ void log_message(LogLevel level, const char *format, ...)
     // Log to file
     if (log_to_file_enabled && log_file_handle)
     {
-        fprintf(log_file_handle, "[%s] %s %s\n", timestamp, level_str, message);
-        fflush(log_file_handle);
+        write_file_line(timestamp, level, message);
     }
 
     pthread_mutex_unlock(&log_mutex);
@@ -153,6 +925,25 @@ void log_raw(LogLevel level, const char *message)
     if (level < current_log_level)
         return;
 
+    LogRing *ring;
+    LogRecord *record;
+    int reserved = ring_reserve(&ring, &record);
+    if (reserved > 0)
+    {
+        size_t length = strnlen(message, LOG_MESSAGE_MAX - 1);
+        memcpy(record + 1, message, length);
+        ring_commit(ring, record, level, LOG_ENCODING_TEXT, length);
+    }
+    if (reserved >= 0)
+    {
+        if (level == LOG_FATAL)
+        {
+            logging_flush();
+            exit(EXIT_FAILURE);
+        }
+        return;
+    }
+
     pthread_mutex_lock(&log_mutex);
 
     const char *timestamp = get_timestamp();
@@ -172,8 +963,7 @@ void log_raw(LogLevel level, const char *message)
     // Log to file
     if (log_to_file_enabled && log_file_handle)
     {
-        fprintf(log_file_handle, "[%s] %s %s\n", timestamp, level_str, message);
-        fflush(log_file_handle);
+        write_file_line(timestamp, level, message);
     }
 
     pthread_mutex_unlock(&log_mutex);
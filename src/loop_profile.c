@@ -0,0 +1,129 @@
+#include "loop_profile.h"
+#include "clock.h"
+#include "flight_recorder.h"
+#include "logging.h"
+#include "metrics.h"
+
+static const char *stage_names[LOOP_STAGE_COUNT] = {
+    "inbox", "accept", "read", "timers", "expire", "write", "handoff",
+};
+
+void loop_profile_init(LoopProfile *profile, const char *name, int slow_ms)
+{
+    memset(profile, 0, sizeof(*profile));
+    snprintf(profile->name, sizeof(profile->name), "%s", name);
+    profile->slow_ns = (long long)slow_ms * 1000000;
+}
+
+void loop_profile_begin(LoopProfile *profile)
+{
+    profile->iteration_started_ns = clock_precise_ns();
+    profile->wait_ns = 0;
+    profile->events = 0;
+    profile->handlers = 0;
+    profile->top_count = 0;
+}
+
+void loop_profile_wait_begin(LoopProfile *profile)
+{
+    profile->wait_started_ns = clock_precise_ns();
+}
+
+void loop_profile_wait_end(LoopProfile *profile, int events)
+{
+    profile->wait_ns = clock_precise_ns() - profile->wait_started_ns;
+    profile->events = events;
+    metrics_observe(HISTOGRAM_LOOP_SELECT, profile->wait_ns);
+    metrics_add(METRIC_LOOP_WAKEUPS, 1);
+    metrics_add(METRIC_LOOP_EVENTS, events);
+    if (events > 0)
+        flight_record_loop(FLIGHT_WAKEUP, 0, events);
+}
+
+void loop_profile_handler_begin(LoopProfile *profile)
+{
+    profile->handler_started_ns = clock_precise_ns();
+}
+
+// Keep the handler if it is among the iteration's longest; the peer is
+// copied only then, since the connection may be gone by the report
+void loop_profile_handler_end(LoopProfile *profile, LoopStage stage, const Connection *conn)
+{
+    long long ns = clock_precise_ns() - profile->handler_started_ns;
+    metrics_observe(HISTOGRAM_LOOP_HANDLER, ns);
+    profile->handlers++;
+
+    if (profile->slow_ns == 0)
+        return;
+
+    int slot = profile->top_count;
+    while (slot > 0 && profile->top[slot - 1].ns < ns)
+        slot--;
+    if (slot >= LOOP_PROFILE_TOP)
+        return;
+
+    int last = profile->top_count < LOOP_PROFILE_TOP ? profile->top_count : LOOP_PROFILE_TOP - 1;
+    memmove(&profile->top[slot + 1], &profile->top[slot], (size_t)(last - slot) * sizeof(LoopHandlerSample));
+    if (profile->top_count < LOOP_PROFILE_TOP)
+        profile->top_count++;
+
+    LoopHandlerSample *sample = &profile->top[slot];
+    sample->stage = stage;
+    sample->ns = ns;
+    sample->fd = conn ? conn->fd : -1;
+    sample->protocol = conn ? conn->protocol : PROTOCOL_UNKNOWN;
+    if (conn)
+        snprintf(sample->peer, sizeof(sample->peer), "%s:%d", conn->ip, conn->port);
+    else
+        sample->peer[0] = '\0';
+}
+
+// At most one report per second; the others are only counted
+static void report_slow_iteration(LoopProfile *profile, long long busy_ns)
+{
+    metrics_add(METRIC_SLOW_LOOPS, 1);
+    flight_record_loop(FLIGHT_SLOW_LOOP, 0, (int)(busy_ns / 1000000));
+
+    time_t now = clock_now_sec();
+    if (now == profile->last_report)
+    {
+        profile->suppressed_reports++;
+        return;
+    }
+    profile->last_report = now;
+
+    char handlers[LOOP_PROFILE_TOP * 96];
+    size_t used = 0;
+    handlers[0] = '\0';
+    for (int i = 0; i < profile->top_count && used < sizeof(handlers); i++)
+    {
+        const LoopHandlerSample *sample = &profile->top[i];
+        if (sample->fd >= 0)
+            used += snprintf(handlers + used, sizeof(handlers) - used, "%s%s %.1f ms on %s (fd=%d, %s)",
+                             i ? "; " : "", stage_names[sample->stage], sample->ns / 1e6,
+                             sample->peer, sample->fd, connection_protocol_name(sample->protocol));
+        else
+            used += snprintf(handlers + used, sizeof(handlers) - used, "%s%s %.1f ms",
+                             i ? "; " : "", stage_names[sample->stage], sample->ns / 1e6);
+    }
+
+    char suppressed[64] = "";
+    if (profile->suppressed_reports > 0)
+        snprintf(suppressed, sizeof(suppressed), " (%d more not reported)", profile->suppressed_reports);
+
+    log_warn("Slow %s loop iteration: %.1f ms busy, %.1f ms in select, %d events, %d handlers%s; longest: %s",
+             profile->name, busy_ns / 1e6, profile->wait_ns / 1e6, profile->events, profile->handlers,
+             suppressed, handlers[0] ? handlers : "none");
+    profile->suppressed_reports = 0;
+}
+
+void loop_profile_end(LoopProfile *profile)
+{
+    long long total_ns = clock_precise_ns() - profile->iteration_started_ns;
+    metrics_observe(HISTOGRAM_LOOP_ITERATION, total_ns);
+
+    // Time in select is idle, not lag
+    long long busy_ns = total_ns - profile->wait_ns;
+    if (profile->slow_ns > 0 && busy_ns >= profile->slow_ns)
+        report_slow_iteration(profile, busy_ns);
+}
@@ -1,5 +1,7 @@
 #include "common.h"
+#include "access_log.h"
 #include "config.h"
+#include "flight_recorder.h"
 #include "logging.h"
 #include "server.h"
 #include "enhanced_chat.h"
@@ -117,9 +119,10 @@ int main(int argc, char *argv[])
 
     // Setup signal handlers
     setup_signal_handlers();
+    flight_recorder_init(config.flight_file, config.flight_recorder);
 
     // Initialize chat system
-    if (chat_system_init() < 0)
+    if (chat_system_init(&config) < 0)
     {
         log_fatal("Failed to initialize chat system");
         exit(EXIT_FAILURE);
@@ -180,10 +183,35 @@ int main(int argc, char *argv[])
             log_warn("Failed to change working directory to /");
         }
 
-        // Close standard file descriptors
-        close(STDIN_FILENO);
-        close(STDOUT_FILENO);
-        close(STDERR_FILENO);
+        // Point the standard descriptors at /dev/null rather than closing
+        // them, or a reopened log file could become stdout
+        int null_fd = open("/dev/null", O_RDWR);
+        if (null_fd >= 0)
+        {
+            dup2(null_fd, STDIN_FILENO);
+            dup2(null_fd, STDOUT_FILENO);
+            dup2(null_fd, STDERR_FILENO);
+            if (null_fd > STDERR_FILENO)
+                close(null_fd);
+        }
+    }
+
+    // Threads do not survive fork(), so start them after daemonizing
+    if (logging_start() < 0)
+    {
+        fprintf(stderr, "Failed to start log writer, logging synchronously\n");
+    }
+
+    if (access_log_open(&config) < 0)
+    {
+        log_warn("Continuing without an access log");
+    }
+
+    if (chat_system_start(&config, server->conn_pool) < 0)
+    {
+        log_fatal("Failed to start chat threads");
+        server_destroy(server);
+        exit(EXIT_FAILURE);
     }
 
     log_info("Server initialization complete");
@@ -199,6 +227,8 @@ int main(int argc, char *argv[])
     log_info("Server shutting down");
     server_print_stats(server);
     server_destroy(server);
+    chat_system_cleanup();
+    access_log_close();
     logging_cleanup();
 
     log_info("Server shutdown complete");
@@ -0,0 +1,320 @@
+#include "metrics.h"
+
+// Each thread counts into its own cache-line-aligned slot with plain
+// relaxed stores, so the hot path never shares a line with another
+// thread. Scrapes sum the slots; gauges are kept as per-thread deltas
+// that only add up to the right value in that sum. Histograms follow the
+// same scheme with one heap-allocated slot per thread.
+typedef struct
+{
+    unsigned long values[METRIC_COUNT];
+} __attribute__((aligned(64))) MetricsSlot;
+
+typedef struct
+{
+    const char *name;
+    const char *help;
+    bool gauge;
+} MetricInfo;
+
+static const MetricInfo metric_info[METRIC_COUNT] = {
+    {"multiserver_connections_accepted_total", "Client connections accepted.", false},
+    {"multiserver_connections_active", "Client connections currently open.", true},
+    {"multiserver_connection_timeouts_total", "Connections closed by a deadline (idle, header or write).", false},
+    {"multiserver_http_requests_total", "HTTP requests with complete headers.", false},
+    {"multiserver_chat_messages_total", "Chat messages said in rooms.", false},
+    {"multiserver_received_bytes_total", "Bytes read from client connections.", false},
+    {"multiserver_sent_bytes_total", "Bytes written to client connections.", false},
+    {"multiserver_rate_limited_total", "Requests and connections refused by the rate limiter.", false},
+    {"multiserver_access_denied_total", "Connections refused by the access list.", false},
+    {"multiserver_loop_wakeups_total", "Event loop returns from select.", false},
+    {"multiserver_loop_events_total", "Ready descriptors reported by select.", false},
+    {"multiserver_loop_slow_iterations_total", "Event loop iterations busy for longer than slow_loop_ms.", false},
+};
+
+// Histogram buckets per thread, allocated on a thread's first sample since
+// most threads never record any
+typedef struct
+{
+    unsigned long counts[HISTOGRAM_COUNT][HISTOGRAM_BUCKETS];
+    unsigned long sum_ns[HISTOGRAM_COUNT];
+} HistogramSlot;
+
+typedef struct
+{
+    const char *family;
+    const char *label; // Value of the command label, or NULL
+    const char *help;
+    const char *display;
+} HistogramInfo;
+
+static const HistogramInfo histogram_info[HISTOGRAM_COUNT] = {
+    {"multiserver_first_byte_seconds", NULL, "Time from accept to the first byte sent to the client.", "first byte"},
+    {"multiserver_http_request_seconds", NULL, "Time to handle one HTTP request once its headers are complete.", "HTTP request"},
+    {"multiserver_loop_iteration_seconds", NULL, "Duration of one event loop iteration, select included.", "loop iteration"},
+    {"multiserver_loop_select_seconds", NULL, "Time an event loop spent waiting in select.", "loop select"},
+    {"multiserver_loop_handler_seconds", NULL, "Duration of one handler invocation in an event loop.", "loop handler"},
+    {"multiserver_chat_fanout_seconds", NULL, "Time to queue one room message for every member.", "room fan-out"},
+    {"multiserver_chat_command_seconds", "message", "Time to process one chat line, by command.", "message"},
+    {"multiserver_chat_command_seconds", "help", NULL, "/help"},
+    {"multiserver_chat_command_seconds", "join", NULL, "/join"},
+    {"multiserver_chat_command_seconds", "leave", NULL, "/leave"},
+    {"multiserver_chat_command_seconds", "msg", NULL, "/msg"},
+    {"multiserver_chat_command_seconds", "nick", NULL, "/nick"},
+    {"multiserver_chat_command_seconds", "list", NULL, "/list"},
+    {"multiserver_chat_command_seconds", "stats", NULL, "/stats"},
+    {"multiserver_chat_command_seconds", "history", NULL, "/history"},
+    {"multiserver_chat_command_seconds", "binary", NULL, "/binary"},
+    {"multiserver_chat_command_seconds", "time", NULL, "/time"},
+    {"multiserver_chat_command_seconds", "clear", NULL, "/clear"},
+    {"multiserver_chat_command_seconds", "quit", NULL, "/quit"},
+    {"multiserver_chat_command_seconds", "unknown", NULL, "unknown command"},
+};
+
+static MetricsSlot slots[METRICS_MAX_THREADS];
+static int slot_count = 0;
+static MetricsSlot shared_slot; // Updated atomically once slots run out
+static pthread_mutex_t slot_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static HistogramSlot *histogram_slots[METRICS_MAX_THREADS];
+static int histogram_slot_count = 0;
+static HistogramSlot shared_histograms;
+
+static __thread MetricsSlot *thread_slot = NULL;
+static __thread HistogramSlot *thread_histograms = NULL;
+
+static MetricsSlot *slot_for_thread(void)
+{
+    pthread_mutex_lock(&slot_mutex);
+    thread_slot = slot_count < METRICS_MAX_THREADS ? &slots[slot_count++] : &shared_slot;
+    pthread_mutex_unlock(&slot_mutex);
+    return thread_slot;
+}
+
+void metrics_add(Metric metric, long delta)
+{
+    MetricsSlot *slot = thread_slot ? thread_slot : slot_for_thread();
+    if (slot == &shared_slot)
+    {
+        __atomic_add_fetch(&slot->values[metric], (unsigned long)delta, __ATOMIC_RELAXED);
+        return;
+    }
+
+    // Only this thread writes the slot; the store just has to be untorn
+    __atomic_store_n(&slot->values[metric], slot->values[metric] + (unsigned long)delta, __ATOMIC_RELAXED);
+}
+
+// Sum over every thread; wraps around like the slots, so gauge deltas of
+// opposite signs cancel out
+long metrics_value(Metric metric)
+{
+    int count = __atomic_load_n(&slot_count, __ATOMIC_ACQUIRE);
+    unsigned long total = __atomic_load_n(&shared_slot.values[metric], __ATOMIC_RELAXED);
+    for (int i = 0; i < count; i++)
+    {
+        total += __atomic_load_n(&slots[i].values[metric], __ATOMIC_RELAXED);
+    }
+    return (long)total;
+}
+
+static HistogramSlot *histograms_for_thread(void)
+{
+    HistogramSlot *slot = calloc(1, sizeof(HistogramSlot));
+
+    pthread_mutex_lock(&slot_mutex);
+    if (slot && histogram_slot_count < METRICS_MAX_THREADS)
+    {
+        histogram_slots[histogram_slot_count] = slot;
+        __atomic_store_n(&histogram_slot_count, histogram_slot_count + 1, __ATOMIC_RELEASE);
+        thread_histograms = slot;
+    }
+    else
+    {
+        free(slot);
+        thread_histograms = &shared_histograms;
+    }
+    pthread_mutex_unlock(&slot_mutex);
+    return thread_histograms;
+}
+
+static int bucket_of(long long ns)
+{
+    unsigned long long value = ns > 0 ? (unsigned long long)ns : 0;
+    if (value < (1ULL << HISTOGRAM_SUB_BUCKET_BITS))
+        return (int)value;
+
+    int exponent = 63 - __builtin_clzll(value);
+    if (exponent >= HISTOGRAM_MAX_BITS)
+        return HISTOGRAM_BUCKETS - 1;
+
+    int shift = exponent - HISTOGRAM_SUB_BUCKET_BITS;
+    int sub_bucket = (int)(value >> shift) & ((1 << HISTOGRAM_SUB_BUCKET_BITS) - 1);
+    return ((shift + 1) << HISTOGRAM_SUB_BUCKET_BITS) | sub_bucket;
+}
+
+// Highest value that falls into bucket
+static long long bucket_upper(int bucket)
+{
+    if (bucket < (1 << HISTOGRAM_SUB_BUCKET_BITS))
+        return bucket;
+
+    int shift = (bucket >> HISTOGRAM_SUB_BUCKET_BITS) - 1;
+    long long sub_bucket = bucket & ((1 << HISTOGRAM_SUB_BUCKET_BITS) - 1);
+    long long lower = ((1LL << HISTOGRAM_SUB_BUCKET_BITS) | sub_bucket) << shift;
+    return lower + (1LL << shift) - 1;
+}
+
+void metrics_observe(Histogram histogram, long long ns)
+{
+    HistogramSlot *slot = thread_histograms ? thread_histograms : histograms_for_thread();
+    int bucket = bucket_of(ns);
+    unsigned long sample = ns > 0 ? (unsigned long)ns : 0;
+
+    if (slot == &shared_histograms)
+    {
+        __atomic_add_fetch(&slot->counts[histogram][bucket], 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&slot->sum_ns[histogram], sample, __ATOMIC_RELAXED);
+        return;
+    }
+
+    __atomic_store_n(&slot->counts[histogram][bucket], slot->counts[histogram][bucket] + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->sum_ns[histogram], slot->sum_ns[histogram] + sample, __ATOMIC_RELAXED);
+}
+
+static long long percentile(const unsigned long *counts, unsigned long total, double quantile)
+{
+    unsigned long rank = (unsigned long)(quantile * (double)total);
+    if (rank < 1)
+        rank = 1;
+
+    unsigned long seen = 0;
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++)
+    {
+        seen += counts[i];
+        if (seen >= rank)
+            return bucket_upper(i);
+    }
+    return bucket_upper(HISTOGRAM_BUCKETS - 1);
+}
+
+// Merge every thread's buckets; false when nothing was recorded
+bool metrics_summarize(Histogram histogram, HistogramSummary *summary)
+{
+    unsigned long counts[HISTOGRAM_BUCKETS];
+    unsigned long sum = __atomic_load_n(&shared_histograms.sum_ns[histogram], __ATOMIC_RELAXED);
+    for (int b = 0; b < HISTOGRAM_BUCKETS; b++)
+        counts[b] = __atomic_load_n(&shared_histograms.counts[histogram][b], __ATOMIC_RELAXED);
+
+    int count = __atomic_load_n(&histogram_slot_count, __ATOMIC_ACQUIRE);
+    for (int i = 0; i < count; i++)
+    {
+        const HistogramSlot *slot = histogram_slots[i];
+        sum += __atomic_load_n(&slot->sum_ns[histogram], __ATOMIC_RELAXED);
+        for (int b = 0; b < HISTOGRAM_BUCKETS; b++)
+            counts[b] += __atomic_load_n(&slot->counts[histogram][b], __ATOMIC_RELAXED);
+    }
+
+    memset(summary, 0, sizeof(*summary));
+    int highest = -1;
+    for (int b = 0; b < HISTOGRAM_BUCKETS; b++)
+    {
+        summary->count += counts[b];
+        if (counts[b] > 0)
+            highest = b;
+    }
+    if (summary->count == 0)
+        return false;
+
+    summary->sum_ns = (long long)sum;
+    summary->p50_ns = percentile(counts, summary->count, 0.5);
+    summary->p90_ns = percentile(counts, summary->count, 0.9);
+    summary->p99_ns = percentile(counts, summary->count, 0.99);
+    summary->p999_ns = percentile(counts, summary->count, 0.999);
+    summary->max_ns = bucket_upper(highest);
+    return true;
+}
+
+const char *metrics_histogram_name(Histogram histogram)
+{
+    return histogram_info[histogram].display;
+}
+
+static int render_histogram(char *out, size_t size, Histogram histogram)
+{
+    const HistogramInfo *info = &histogram_info[histogram];
+    HistogramSummary summary;
+    bool recorded = metrics_summarize(histogram, &summary);
+
+    char labels[64] = "";
+    char quantile_prefix[80] = "";
+    if (info->label)
+    {
+        snprintf(labels, sizeof(labels), "{command=\"%s\"}", info->label);
+        snprintf(quantile_prefix, sizeof(quantile_prefix), "command=\"%s\",", info->label);
+    }
+
+    const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+    const long long values[] = {summary.p50_ns, summary.p90_ns, summary.p99_ns, summary.p999_ns};
+    int used = 0;
+    if (info->help)
+    {
+        used = snprintf(out, size, "# HELP %s %s\n# TYPE %s summary\n", info->family, info->help, info->family);
+        if (used < 0 || (size_t)used >= size)
+            return -1;
+    }
+
+    for (int i = 0; i < 4; i++)
+    {
+        int written = recorded
+                          ? snprintf(out + used, size - used, "%s{%squantile=\"%g\"} %.9f\n", info->family,
+                                     quantile_prefix, quantiles[i], values[i] / 1e9)
+                          : snprintf(out + used, size - used, "%s{%squantile=\"%g\"} NaN\n", info->family,
+                                     quantile_prefix, quantiles[i]);
+        if (written < 0 || (size_t)written >= size - used)
+            return -1;
+        used += written;
+    }
+
+    int written = snprintf(out + used, size - used, "%s_sum%s %.9f\n%s_count%s %lu\n",
+                           info->family, labels, summary.sum_ns / 1e9, info->family, labels, summary.count);
+    if (written < 0 || (size_t)written >= size - used)
+        return -1;
+    return used + written;
+}
+
+// Text exposition format, as scraped by Prometheus; returns the length
+// written, or 0 when size is too small
+size_t metrics_render(char *out, size_t size, time_t uptime)
+{
+    size_t used = 0;
+    int written = snprintf(out, size,
+                           "# HELP multiserver_uptime_seconds Seconds since the server started.\n"
+                           "# TYPE multiserver_uptime_seconds gauge\n"
+                           "multiserver_uptime_seconds %ld\n",
+                           (long)uptime);
+    if (written < 0 || (size_t)written >= size)
+        return 0;
+    used = (size_t)written;
+
+    for (int i = 0; i < METRIC_COUNT; i++)
+    {
+        const MetricInfo *info = &metric_info[i];
+        long value = metrics_value((Metric)i);
+        written = snprintf(out + used, size - used, "# HELP %s %s\n# TYPE %s %s\n%s %ld\n",
+                           info->name, info->help, info->name, info->gauge ? "gauge" : "counter",
+                           info->name, info->gauge || value >= 0 ? value : 0);
+        if (written < 0 || (size_t)written >= size - used)
+            return 0;
+        used += (size_t)written;
+    }
+
+    // A family's HELP and TYPE come with its first histogram only
+    for (int i = 0; i < HISTOGRAM_COUNT; i++)
+    {
+        written = render_histogram(out + used, size - used, (Histogram)i);
+        if (written < 0)
+            return 0;
+        used += (size_t)written;
+    }
+    return used;
+}
@@ -0,0 +1,107 @@
+#include "rate_limit.h"
+#include "clock.h"
+#include "logging.h"
+
+RateLimiter *rate_limit_create(int requests, int window_seconds)
+{
+    RateLimiter *limiter = aligned_alloc(64, sizeof(RateLimiter));
+    if (!limiter)
+    {
+        log_error("Failed to allocate rate limiter");
+        return NULL;
+    }
+
+    memset(limiter, 0, sizeof(RateLimiter));
+    limiter->limit = requests;
+    limiter->window_ms = (long long)window_seconds * 1000;
+
+    // Rejections are answered with a fixed buffer, no formatting per hit
+    int length = snprintf(limiter->response, sizeof(limiter->response),
+                          "HTTP/1.1 429 Too Many Requests\r\n"
+                          "Content-Type: text/plain\r\n"
+                          "Content-Length: 18\r\n"
+                          "Retry-After: %d\r\n"
+                          "Connection: close\r\n"
+                          "\r\n"
+                          "Too many requests\n",
+                          window_seconds);
+    limiter->response_length = length;
+
+    log_info("Rate limiter: %d requests per %d seconds per address", requests, window_seconds);
+    return limiter;
+}
+
+void rate_limit_destroy(RateLimiter *limiter)
+{
+    free(limiter);
+}
+
+static uint32_t rate_limit_hash(uint32_t addr)
+{
+    uint32_t hash = addr * 0x9E3779B1u;
+    return (hash ^ (hash >> 16)) & (RATE_LIMIT_SETS - 1);
+}
+
+// Check an address against the limit in O(1) and, with consume, count one
+// request for it. A rejected request is not counted, so clients that
+// back off recover once the window slides past their burst.
+bool rate_limit_check(RateLimiter *limiter, struct in_addr addr, bool consume)
+{
+    if (!limiter)
+        return true;
+
+    long long now = clock_now_ms();
+    uint32_t window = (uint32_t)(now / limiter->window_ms);
+    long long into_window = now % limiter->window_ms;
+
+    RateLimitEntry *set = limiter->sets[rate_limit_hash(addr.s_addr)];
+    RateLimitEntry *entry = NULL;
+    RateLimitEntry *victim = &set[0];
+
+    for (int i = 0; i < RATE_LIMIT_WAYS; i++)
+    {
+        if (set[i].addr == addr.s_addr)
+        {
+            entry = &set[i];
+            break;
+        }
+
+        // Free slots first, then the least recently active address
+        if (set[i].addr == 0 ||
+            (victim->addr != 0 && (set[i].window < victim->window ||
+                                   (set[i].window == victim->window && set[i].current < victim->current))))
+        {
+            victim = &set[i];
+        }
+    }
+
+    if (!entry)
+    {
+        // Unknown addresses are under any limit
+        if (!consume)
+            return true;
+
+        entry = victim;
+        entry->addr = addr.s_addr;
+        entry->window = window;
+        entry->current = 0;
+        entry->previous = 0;
+    }
+
+    if (entry->window != window)
+    {
+        entry->previous = entry->window + 1 == window ? entry->current : 0;
+        entry->current = 0;
+        entry->window = window;
+    }
+
+    // Weight the previous window by how much of it still overlaps
+    uint64_t estimate = entry->current +
+                        (uint64_t)entry->previous * (limiter->window_ms - into_window) / limiter->window_ms;
+    if (estimate >= limiter->limit)
+        return false;
+
+    if (consume)
+        entry->current++;
+    return true;
+}
@@ -1,9 +1,85 @@
 #include "server.h"
+#include "access_log.h"
+#include "chat_shard.h"
+#include "clock.h"
+#include "flight_recorder.h"
 #include "logging.h"
+#include "loop_profile.h"
+#include "metrics.h"
+#include "sse.h"
+#include "websocket.h"
 
 // Global variables for signal handling
 volatile sig_atomic_t running = 1;
 volatile sig_atomic_t reload_config = 0;
+static volatile sig_atomic_t dump_requested = 0;
+
+// What the HTTP handler needs from the server it belongs to
+static bool metrics_endpoint = false;
+static bool flight_endpoint = false;
+static time_t server_started = 0;
+
+// True for "GET <path>" with an optional query string
+static bool is_get_request(const char *request, size_t length, const char *path)
+{
+    size_t path_length = strlen(path);
+    return length > path_length + 4 && strncmp(request, "GET ", 4) == 0 &&
+           strncmp(request + 4, path, path_length) == 0 &&
+           (request[4 + path_length] == ' ' || request[4 + path_length] == '?');
+}
+
+// Counters are summed over every thread's slot only here, per scrape
+static void serve_metrics(Connection *conn)
+{
+    char body[32768];
+    size_t body_length = metrics_render(body, sizeof(body), clock_now_sec() - server_started);
+
+    char head[256];
+    int head_length = snprintf(head, sizeof(head),
+                               "HTTP/1.1 200 OK\r\n"
+                               "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+                               "Content-Length: %zu\r\n"
+                               "Connection: close\r\n"
+                               "Date: %s\r\n"
+                               "Server: MultiServer/1.0.0\r\n"
+                               "\r\n",
+                               body_length, clock_http_date());
+
+    connection_prepare_response(conn, head, (size_t)head_length);
+    connection_queue_raw(conn, body, body_length);
+    conn->state = CONN_STATE_WRITING;
+}
+
+// Admin trigger for the flight recorder, same as SIGUSR1; loopback only and
+// only routed while the recorder is on
+static void serve_flight_dump(Connection *conn)
+{
+    const char *response;
+    if ((ntohl(conn->addr.s_addr) >> 24) != 127)
+        response = "HTTP/1.1 403 Forbidden\r\n"
+                   "Content-Type: text/plain\r\n"
+                   "Content-Length: 10\r\n"
+                   "Connection: close\r\n"
+                   "\r\n"
+                   "Forbidden\n";
+    else if (flight_recorder_request_dump("admin request") < 0)
+        response = "HTTP/1.1 503 Service Unavailable\r\n"
+                   "Content-Type: text/plain\r\n"
+                   "Content-Length: 28\r\n"
+                   "Connection: close\r\n"
+                   "\r\n"
+                   "Flight recorder dump failed\n";
+    else
+        response = "HTTP/1.1 202 Accepted\r\n"
+                   "Content-Type: text/plain\r\n"
+                   "Content-Length: 31\r\n"
+                   "Connection: close\r\n"
+                   "\r\n"
+                   "Flight recorder dump requested\n";
+
+    connection_prepare_response(conn, response, strlen(response));
+    conn->state = CONN_STATE_WRITING;
+}
 
 // Enhanced HTTP handler
 static int simple_http_handler(Connection *conn)
@@ -11,6 +87,71 @@ static int simple_http_handler(Connection *conn)
     if (!conn || conn->read_buffer_used == 0)
         return 0;
 
+    // Room event streams stay open and are fed by the chat engine
+    char room[MAX_ROOM_NAME_LENGTH];
+    int stream = sse_parse_request(conn->read_buffer, conn->read_buffer_used, room, sizeof(room));
+    if (stream > 0 && chat_room_name_valid(room))
+    {
+        return chat_watch_room(conn, room);
+    }
+    if (stream != 0)
+    {
+        const char *response =
+            "HTTP/1.1 404 Not Found\r\n"
+            "Content-Type: text/plain\r\n"
+            "Content-Length: 15\r\n"
+            "Connection: close\r\n"
+            "\r\n"
+            "Unknown stream\n";
+
+        connection_prepare_response(conn, response, strlen(response));
+        conn->state = CONN_STATE_WRITING;
+        return 1;
+    }
+
+    if (metrics_endpoint && is_get_request(conn->read_buffer, conn->read_buffer_used, "/metrics"))
+    {
+        serve_metrics(conn);
+        return 1;
+    }
+    if (flight_endpoint && is_get_request(conn->read_buffer, conn->read_buffer_used, "/debug/flight-recorder"))
+    {
+        serve_flight_dump(conn);
+        return 1;
+    }
+
+    // Browsers reach the chat engine through a WebSocket upgrade
+    if (websocket_is_upgrade(conn->read_buffer, conn->read_buffer_used))
+    {
+        int upgraded = websocket_accept(conn);
+        if (upgraded == 0)
+            return 0;
+
+        if (upgraded < 0)
+        {
+            const char *response =
+                "HTTP/1.1 400 Bad Request\r\n"
+                "Content-Type: text/plain\r\n"
+                "Content-Length: 28\r\n"
+                "Connection: close\r\n"
+                "\r\n"
+                "Invalid WebSocket handshake\n";
+
+            connection_prepare_response(conn, response, strlen(response));
+            conn->state = CONN_STATE_WRITING;
+            return 1;
+        }
+
+        ChatServer *chat = chat_get_server();
+        if (!chat || !chat_attach_connection(chat, conn))
+            return -1;
+
+        // Frames sent right behind the handshake
+        if (conn->read_buffer_used > 0)
+            return enhanced_chat_handler(chat, conn);
+        return 1;
+    }
+
     // Try to serve the index.html file
     char filepath[PATH_MAX];
     snprintf(filepath, sizeof(filepath), "./www/index.html");
@@ -37,10 +178,11 @@ static int simple_http_handler(Connection *conn)
                      "Content-Type: text/html; charset=utf-8\r\n"
                      "Content-Length: %ld\r\n"
                      "Connection: close\r\n"
+                     "Date: %s\r\n"
                      "Server: MultiServer/1.0.0\r\n"
                      "\r\n"
                      "%s",
-                     file_size, file_content);
+                     file_size, clock_http_date(), file_content);
 
             connection_prepare_response(conn, response, strlen(response));
             free(file_content);
@@ -68,7 +210,7 @@ static int simple_http_handler(Connection *conn)
     }
 
     conn->state = CONN_STATE_WRITING;
-    log_info("Served HTTP request from %s:%d", conn->ip, conn->port);
+    log_debug("Served HTTP request from %s:%d", conn->ip, conn->port);
     return 1;
 }
 
@@ -100,7 +242,7 @@ static int simple_chat_handler(Connection *conn)
     }
     else if (strncmp(message, "TIME", 4) == 0)
     {
-        time_t now = time(NULL);
+        time_t now = clock_now_sec();
         snprintf(response, sizeof(response), "Server time: %s", ctime(&now));
     }
     else if (strncmp(message, "STATUS", 6) == 0)
@@ -156,9 +298,47 @@ Server *server_create(ServerConfig *config)
         free(server);
         return NULL;
     }
+    connection_pool_set_timeouts(server->conn_pool, config->idle_timeout,
+                                 config->header_timeout, config->write_timeout);
+
+    // Per-address request limit ([security] rate_limit_requests = 0 turns it off)
+    if (config->rate_limit_requests > 0)
+    {
+        server->rate_limiter = rate_limit_create(config->rate_limit_requests, config->rate_limit_window);
+        if (!server->rate_limiter)
+        {
+            connection_pool_destroy(server->conn_pool);
+            free(server);
+            return NULL;
+        }
+    }
+
+    // CIDR allow/deny rules, checked on every accepted socket
+    if (config->enable_access_control)
+    {
+        server->access_list = acl_create();
+        if (!server->access_list ||
+            (config->access_allow[0] && acl_add_list(server->access_list, config->access_allow, ACL_ALLOW) < 0) ||
+            (config->access_deny[0] && acl_add_list(server->access_list, config->access_deny, ACL_DENY) < 0) ||
+            (config->access_file[0] && acl_load_file(server->access_list, config->access_file) < 0) ||
+            acl_build_index(server->access_list) < 0)
+        {
+            acl_destroy(server->access_list);
+            rate_limit_destroy(server->rate_limiter);
+            connection_pool_destroy(server->conn_pool);
+            free(server);
+            return NULL;
+        }
+
+        log_info("Access control: %d allow and %d deny rules",
+                 server->access_list->allow_rules, server->access_list->deny_rules);
+    }
 
     // Initialize statistics
     server->stats.start_time = time(NULL);
+    server_started = server->stats.start_time;
+    metrics_endpoint = config->http_metrics;
+    flight_endpoint = config->flight_recorder;
 
     // Set protocol handlers
     server->http_handler = simple_http_handler;
@@ -189,6 +369,8 @@ void server_destroy(Server *server)
     }
 
     connection_pool_destroy(server->conn_pool);
+    rate_limit_destroy(server->rate_limiter);
+    acl_destroy(server->access_list);
     free(server);
 }
 
@@ -315,6 +497,33 @@ int server_handle_new_connection(Server *server, int server_fd)
         return -1;
     }
 
+    // Denied networks are dropped without a word
+    if (!acl_allows(server->access_list, (struct sockaddr *)&client_addr))
+    {
+        close(client_fd);
+        metrics_add(METRIC_ACCESS_DENIED, 1);
+        log_debug("Access denied for %s", inet_ntoa(client_addr.sin_addr));
+        return -1;
+    }
+
+    // Refuse addresses over their limit before spending anything on them;
+    // HTTP requests are counted when they arrive, chat connections here
+    bool http = server_fd == server->http_socket;
+    if (!rate_limit_check(server->rate_limiter, client_addr.sin_addr, !http))
+    {
+        const char *chat_response = "Too many connections, try again later\n";
+        if (http)
+            send(client_fd, server->rate_limiter->response, server->rate_limiter->response_length,
+                 MSG_DONTWAIT | MSG_NOSIGNAL);
+        else
+            send(client_fd, chat_response, strlen(chat_response), MSG_DONTWAIT | MSG_NOSIGNAL);
+
+        close(client_fd);
+        metrics_add(METRIC_RATE_LIMITED, 1);
+        log_debug("Rate limited connection from %s", inet_ntoa(client_addr.sin_addr));
+        return -1;
+    }
+
     // Make client socket non-blocking
     int flags = fcntl(client_fd, F_GETFL, 0);
     if (flags < 0 || fcntl(client_fd, F_SETFL, flags | O_NONBLOCK) < 0)
@@ -343,6 +552,17 @@ int server_handle_new_connection(Server *server, int server_fd)
         conn->protocol = PROTOCOL_CHAT;
         log_debug("Connection from %s:%d assigned to CHAT protocol", conn->ip, conn->port);
     }
+    flight_record(&conn->flight, FLIGHT_PROTOCOL, conn->protocol, 0);
+    flight_record_loop(FLIGHT_ACCEPT, conn->protocol, client_fd);
+
+    // Chat connections may be served by another shard's event loop
+    if (conn->protocol == PROTOCOL_CHAT && chat_shard_assign(conn))
+    {
+        metrics_add(METRIC_CONNECTIONS_ACCEPTED, 1);
+        log_info("New connection from %s:%d (fd=%d, protocol=CHAT, handed to shard)",
+                 conn->ip, conn->port, client_fd);
+        return 0;
+    }
 
     // Add to connection pool
     if (connection_pool_add(server->conn_pool, conn) < 0)
@@ -351,7 +571,7 @@ int server_handle_new_connection(Server *server, int server_fd)
         return -1;
     }
 
-    server->stats.total_connections++;
+    metrics_add(METRIC_CONNECTIONS_ACCEPTED, 1);
 
     log_info("New connection from %s:%d (fd=%d, protocol=%s)",
              conn->ip, conn->port, client_fd,
@@ -379,23 +599,59 @@ int server_handle_connection_read(Server *server, Connection *conn)
         conn->protocol = server_detect_protocol(conn->read_buffer, conn->read_buffer_used);
         log_debug("Detected protocol %d for connection %s:%d",
                   conn->protocol, conn->ip, conn->port);
+        flight_record(&conn->flight, FLIGHT_PROTOCOL, conn->protocol, 0);
     }
 
     // Handle based on protocol
     switch (conn->protocol)
     {
     case PROTOCOL_HTTP:
-        if (server->http_handler)
+    {
+        if (conn->request_started_us == 0)
+            conn->request_started_us = clock_precise_us();
+
+        // Nothing is answered before the headers are complete; clients that
+        // never finish them are closed by the header deadline
+        if (!memmem(conn->read_buffer, conn->read_buffer_used, "\r\n\r\n", 4) &&
+            !memmem(conn->read_buffer, conn->read_buffer_used, "\n\n", 2))
+            return 0;
+        connection_cancel_deadline(conn, CONN_DEADLINE_HEADER);
+
+        metrics_add(METRIC_HTTP_REQUESTS, 1);
+
+        AccessLogRequest request;
+        access_log_begin(conn, &request);
+
+        long long handler_started_ns = clock_precise_ns();
+        int handled = 0;
+        if (!rate_limit_check(server->rate_limiter, conn->addr, true))
         {
-            return server->http_handler(conn);
+            connection_prepare_response(conn, server->rate_limiter->response,
+                                        server->rate_limiter->response_length);
+            conn->state = CONN_STATE_WRITING;
+            metrics_add(METRIC_RATE_LIMITED, 1);
+            handled = 1;
         }
-        break;
+        else if (server->http_handler)
+        {
+            handled = server->http_handler(conn);
+            if (conn->protocol != PROTOCOL_HTTP)
+                flight_record(&conn->flight, FLIGHT_PROTOCOL, conn->protocol, 0); // Upgraded
+        }
+        metrics_observe(HISTOGRAM_HTTP_REQUEST, clock_precise_ns() - handler_started_ns);
+
+        access_log_finish(conn, &request);
+        return handled;
+    }
 
     case PROTOCOL_CHAT:
         // Use enhanced chat system
         log_debug("Processing chat data: '%.*s'", (int)conn->read_buffer_used, conn->read_buffer);
         return enhanced_chat_handler(chat_get_server(), conn);
 
+    case PROTOCOL_WEBSOCKET:
+        return enhanced_chat_handler(chat_get_server(), conn);
+
     default:
         log_warn("Unknown protocol for connection %s:%d", conn->ip, conn->port);
         return -1;
@@ -417,6 +673,7 @@ int server_handle_connection_write(Server *server, Connection *conn)
     // If all data sent and not keep-alive, mark for closing
     if (!conn->has_data_to_send && !conn->keep_alive)
     {
+        flight_record_close(&conn->flight, FLIGHT_CLOSE_DONE);
         conn->state = CONN_STATE_CLOSING;
     }
 
@@ -434,15 +691,32 @@ int server_run(Server *server)
     int max_fd;
     struct timeval timeout;
 
+    LoopProfile profile;
+    loop_profile_init(&profile, "main", server->config->slow_loop_ms);
+    flight_recorder_attach("main");
+
     while (running)
     {
+        clock_update();
+        loop_profile_begin(&profile);
+
         // Handle config reload signal
         if (reload_config)
         {
-            log_info("Config reload requested (not implemented yet)");
+            log_info("SIGHUP received, reopening log file (config reload is not implemented yet)");
+            flight_record_loop(FLIGHT_SIGNAL, 0, SIGHUP);
+            logging_reopen();
+            access_log_reopen();
             reload_config = 0;
         }
 
+        if (dump_requested)
+        {
+            flight_record_loop(FLIGHT_SIGNAL, 0, SIGUSR1);
+            flight_recorder_request_dump("SIGUSR1");
+            dump_requested = 0;
+        }
+
         FD_ZERO(&read_fds);
         FD_ZERO(&write_fds);
 
@@ -451,13 +725,23 @@ int server_run(Server *server)
         FD_SET(server->chat_socket, &read_fds);
         max_fd = (server->http_socket > server->chat_socket) ? server->http_socket : server->chat_socket;
 
+        // Wakeups for messages posted by other chat shards
+        int wake_fd = chat_shard_wake_fd();
+        if (wake_fd >= 0)
+        {
+            FD_SET(wake_fd, &read_fds);
+            if (wake_fd > max_fd)
+                max_fd = wake_fd;
+        }
+
         // Add client connections to appropriate sets
         for (int i = 0; i < server->conn_pool->max_connections; i++)
         {
             Connection *conn = server->conn_pool->connections[i];
             if (conn)
             {
-                if (conn->state != CONN_STATE_CLOSING)
+                if (conn->state != CONN_STATE_CLOSING && conn->state != CONN_STATE_HANDOFF &&
+                    !chat_connection_paused(conn))
                 {
                     FD_SET(conn->fd, &read_fds);
                 }
@@ -472,11 +756,21 @@ int server_run(Server *server)
             }
         }
 
-        // Set timeout for periodic cleanup
+        // Wake at least once a second for deadlines, sooner if a broadcast
+        // batching window closes or a delayed sender resumes earlier
         timeout.tv_sec = 1;
         timeout.tv_usec = 0;
 
+        int chat_timeout = chat_next_timeout_ms(chat_get_server());
+        if (chat_timeout >= 0 && chat_timeout < 1000)
+        {
+            timeout.tv_sec = 0;
+            timeout.tv_usec = chat_timeout * 1000;
+        }
+
+        loop_profile_wait_begin(&profile);
         int activity = select(max_fd + 1, &read_fds, &write_fds, NULL, &timeout);
+        loop_profile_wait_end(&profile, activity > 0 ? activity : 0);
 
         if (activity < 0)
         {
@@ -488,59 +782,99 @@ int server_run(Server *server)
             break;
         }
 
+        // Handlers below see the time at which this wakeup happened
+        clock_update();
+
+        // Messages from other chat shards, including adopted connections
+        if (wake_fd >= 0 && FD_ISSET(wake_fd, &read_fds))
+        {
+            loop_profile_handler_begin(&profile);
+            chat_shard_process_inbox();
+            loop_profile_handler_end(&profile, LOOP_STAGE_INBOX, NULL);
+        }
+
         // Handle new connections
         if (FD_ISSET(server->http_socket, &read_fds))
         {
+            loop_profile_handler_begin(&profile);
             server_handle_new_connection(server, server->http_socket);
+            loop_profile_handler_end(&profile, LOOP_STAGE_ACCEPT, NULL);
         }
 
         if (FD_ISSET(server->chat_socket, &read_fds))
         {
+            loop_profile_handler_begin(&profile);
             server_handle_new_connection(server, server->chat_socket);
+            loop_profile_handler_end(&profile, LOOP_STAGE_ACCEPT, NULL);
         }
 
-        // Handle existing connections
+        // Handle read events; handlers only queue output
         for (int i = 0; i < server->conn_pool->max_connections; i++)
         {
             Connection *conn = server->conn_pool->connections[i];
-            if (!conn)
+            if (!conn || conn->state == CONN_STATE_HANDOFF || !FD_ISSET(conn->fd, &read_fds))
                 continue;
 
-            bool should_close = false;
+            loop_profile_handler_begin(&profile);
+            if (server_handle_connection_read(server, conn) < 0)
+            {
+                flight_record_close(&conn->flight, FLIGHT_CLOSE_HANDLER);
+                conn->state = CONN_STATE_CLOSING;
+            }
+            loop_profile_handler_end(&profile, LOOP_STAGE_READ, conn);
+        }
 
-            // Handle read events
-            if (FD_ISSET(conn->fd, &read_fds))
+        // Fan out room batches whose window has closed
+        loop_profile_handler_begin(&profile);
+        chat_flush_batches(chat_get_server(), false);
+        chat_send_heartbeats(chat_get_server());
+        chat_release_delayed(chat_get_server());
+        loop_profile_handler_end(&profile, LOOP_STAGE_TIMERS, NULL);
+
+        // Mark connections past their idle, header or write deadline
+        loop_profile_handler_begin(&profile);
+        connection_pool_expire(server->conn_pool);
+        loop_profile_handler_end(&profile, LOOP_STAGE_EXPIRE, NULL);
+
+        // Flush everything queued during this iteration with one send per
+        // connection, then close the connections that are done
+        for (int i = 0; i < server->conn_pool->max_connections; i++)
+        {
+            Connection *conn = server->conn_pool->connections[i];
+            if (!conn)
+                continue;
+
+            // Connection joined a room owned by another shard; its pending
+            // output is flushed by the new owner
+            if (conn->state == CONN_STATE_HANDOFF)
             {
-                if (server_handle_connection_read(server, conn) < 0)
-                {
-                    should_close = true;
-                }
+                // conn belongs to the other shard once posted
+                flight_record(&conn->flight, FLIGHT_HANDOFF, 0, chat_shard_current());
+                loop_profile_handler_begin(&profile);
+                connection_pool_detach(server->conn_pool, conn);
+                chat_handoff_connection(conn);
+                loop_profile_handler_end(&profile, LOOP_STAGE_HANDOFF, NULL);
+                continue;
             }
 
-            // Handle write events
-            if (!should_close && FD_ISSET(conn->fd, &write_fds))
+            if (conn->has_data_to_send)
             {
+                loop_profile_handler_begin(&profile);
                 if (server_handle_connection_write(server, conn) < 0)
                 {
-                    should_close = true;
+                    conn->state = CONN_STATE_CLOSING;
                 }
+                loop_profile_handler_end(&profile, LOOP_STAGE_WRITE, conn);
             }
 
-            // Close connection if needed
-            if (should_close || conn->state == CONN_STATE_CLOSING)
+            if (conn->state == CONN_STATE_CLOSING)
             {
                 connection_pool_remove(server->conn_pool, conn);
             }
         }
 
-        // Periodic cleanup of idle connections
-        static time_t last_cleanup = 0;
-        time_t now = time(NULL);
-        if (now - last_cleanup > 60)
-        { // Cleanup every minute
-            connection_pool_cleanup_idle(server->conn_pool, server->config->idle_timeout);
-            last_cleanup = now;
-        }
+        flight_recorder_poll(server->conn_pool);
+        loop_profile_end(&profile);
     }
 
     log_info("Server main loop terminated");
@@ -565,12 +899,24 @@ void server_print_stats(const Server *server)
 
     log_info("=== Server Statistics ===");
     log_info("Uptime: %ld seconds", uptime);
-    log_info("Total connections: %d", server->stats.total_connections);
-    log_info("Active connections: %d", server->conn_pool->active_connections);
-    log_info("HTTP requests: %d", server->stats.http_requests);
-    log_info("Chat messages: %d", server->stats.chat_messages);
-    log_info("Bytes sent: %lu", server->stats.bytes_sent);
-    log_info("Bytes received: %lu", server->stats.bytes_received);
+    log_info("Total connections: %ld", metrics_value(METRIC_CONNECTIONS_ACCEPTED));
+    log_info("Active connections: %ld", metrics_value(METRIC_CONNECTIONS_ACTIVE));
+    log_info("Connection timeouts: %ld", metrics_value(METRIC_CONNECTION_TIMEOUTS));
+    log_info("HTTP requests: %ld", metrics_value(METRIC_HTTP_REQUESTS));
+    log_info("Chat messages: %ld", metrics_value(METRIC_CHAT_MESSAGES));
+    log_info("Rate limited: %ld", metrics_value(METRIC_RATE_LIMITED));
+    log_info("Access denied: %ld", metrics_value(METRIC_ACCESS_DENIED));
+    log_info("Bytes sent: %lu", (unsigned long)metrics_value(METRIC_BYTES_SENT));
+    log_info("Bytes received: %lu", (unsigned long)metrics_value(METRIC_BYTES_RECEIVED));
+    for (int i = 0; i < HISTOGRAM_COUNT; i++)
+    {
+        HistogramSummary summary;
+        if (!metrics_summarize((Histogram)i, &summary))
+            continue;
+        log_info("Latency of %s: %lu samples, p50 %.1f us, p99 %.1f us, p99.9 %.1f us, max %.1f us",
+                 metrics_histogram_name((Histogram)i), summary.count, summary.p50_ns / 1000.0,
+                 summary.p99_ns / 1000.0, summary.p999_ns / 1000.0, summary.max_ns / 1000.0);
+    }
     log_info("========================");
 }
 
@@ -588,6 +934,9 @@ void signal_handler(int signum)
         log_info("Received config reload signal");
         reload_config = 1;
         break;
+    case SIGUSR1:
+        dump_requested = 1;
+        break;
     default:
         break;
     }
@@ -604,6 +953,7 @@ void setup_signal_handlers(void)
     sigaction(SIGTERM, &sa, NULL);
     sigaction(SIGINT, &sa, NULL);
     sigaction(SIGHUP, &sa, NULL);
+    sigaction(SIGUSR1, &sa, NULL);
 
     // Ignore SIGPIPE (broken pipe)
     signal(SIGPIPE, SIG_IGN);
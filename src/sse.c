@@ -0,0 +1,90 @@
+#include "sse.h"
+#include "logging.h"
+
+// Recognise an event stream request. Returns 1 with the room name copied
+// out, 0 for any other request (or one still incomplete) and -1 for an
+// event stream request naming an invalid room.
+int sse_parse_request(const char *request, size_t length, char *room, size_t room_size)
+{
+    size_t prefix_length = strlen("GET " SSE_PATH_PREFIX);
+    if (length < prefix_length || strncmp(request, "GET " SSE_PATH_PREFIX, prefix_length) != 0)
+        return 0;
+
+    if (!strstr(request, "\r\n\r\n"))
+        return 0;
+
+    const char *name = request + prefix_length;
+    size_t name_length = strcspn(name, " ?/\r\n");
+    if (name_length == 0 || name_length >= room_size || name[name_length] == '/')
+        return -1;
+
+    memcpy(room, name, name_length);
+    room[name_length] = '\0';
+    return 1;
+}
+
+// Send the response head that opens the stream
+int sse_accept(Connection *conn)
+{
+    const char *response =
+        "HTTP/1.1 200 OK\r\n"
+        "Content-Type: text/event-stream\r\n"
+        "Cache-Control: no-cache\r\n"
+        "Connection: keep-alive\r\n"
+        "Server: MultiServer/1.0.0\r\n"
+        "\r\n"
+        "retry: 3000\n\n";
+
+    conn->keep_alive = true;
+    return connection_queue_data(conn, response, strlen(response));
+}
+
+// Encode one chat line (or several) as a single event, prefixing every
+// line with "data: ". The event is allocated once and shared by all
+// subscribers of the room.
+char *sse_encode_event(const char *data, size_t length, size_t *event_length)
+{
+    while (length > 0 && data[length - 1] == '\n')
+        length--;
+
+    size_t lines = 1;
+    for (size_t i = 0; i < length; i++)
+    {
+        if (data[i] == '\n')
+            lines++;
+    }
+
+    char *event = malloc(length + lines * 7 + 2);
+    if (!event)
+        return NULL;
+
+    char *out = event;
+    const char *line = data;
+    const char *end = data + length;
+    for (;;)
+    {
+        const char *newline = memchr(line, '\n', end - line);
+        size_t line_length = newline ? (size_t)(newline - line) : (size_t)(end - line);
+
+        memcpy(out, "data: ", 6);
+        out += 6;
+        memcpy(out, line, line_length);
+        out += line_length;
+        *out++ = '\n';
+
+        if (!newline)
+            break;
+        line = newline + 1;
+    }
+    *out++ = '\n';
+
+    *event_length = out - event;
+    return event;
+}
+
+// Comment line that keeps proxies and the idle reaper off quiet streams
+int sse_queue_heartbeat(Connection *conn)
+{
+    const char *comment = ": keep-alive\n\n";
+    return connection_queue_data(conn, comment, strlen(comment));
+}
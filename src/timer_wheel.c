@@ -0,0 +1,163 @@
+#include "timer_wheel.h"
+
+#define TIMER_WHEEL_MASK (TIMER_WHEEL_SLOTS - 1)
+#define TIMER_WHEEL_SPAN (1ULL << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS))
+
+static void link_append(TimerLink *head, TimerLink *link)
+{
+    link->prev = head->prev;
+    link->next = head;
+    head->prev->next = link;
+    head->prev = link;
+}
+
+static void link_remove(TimerLink *link)
+{
+    link->prev->next = link->next;
+    link->next->prev = link->prev;
+    link->next = NULL;
+    link->prev = NULL;
+}
+
+// File the timer under the coarsest level that still resolves its distance
+// from the wheel's position; cascading refines it as that position advances
+static void place(TimerWheel *wheel, Timer *timer)
+{
+    unsigned long long expires = timer->expires;
+    if (expires < wheel->next_tick)
+        expires = wheel->next_tick;
+    if (expires - wheel->next_tick >= TIMER_WHEEL_SPAN)
+        expires = wheel->next_tick + TIMER_WHEEL_SPAN - 1;
+    timer->expires = expires;
+
+    unsigned long long delta = expires - wheel->next_tick;
+    int level = 0;
+    while (level < TIMER_WHEEL_LEVELS - 1 &&
+           delta >= 1ULL << (TIMER_WHEEL_BITS * (level + 1)))
+    {
+        level++;
+    }
+
+    int slot = (int)((expires >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK);
+    link_append(&wheel->slots[level][slot], &timer->link);
+}
+
+// Move the timers of one upper-level slot down now that it comes into range
+static void cascade(TimerWheel *wheel, int level, int slot)
+{
+    TimerLink *head = &wheel->slots[level][slot];
+    TimerLink pending = {&pending, &pending};
+
+    if (head->next == head)
+        return;
+
+    // Detach the whole slot first; placing may land timers back in it
+    pending.next = head->next;
+    pending.prev = head->prev;
+    pending.next->prev = &pending;
+    pending.prev->next = &pending;
+    head->next = head;
+    head->prev = head;
+
+    while (pending.next != &pending)
+    {
+        Timer *timer = (Timer *)pending.next;
+        link_remove(&timer->link);
+        place(wheel, timer);
+    }
+}
+
+void timer_wheel_init(TimerWheel *wheel, long long now_ms)
+{
+    for (int level = 0; level < TIMER_WHEEL_LEVELS; level++)
+    {
+        for (int slot = 0; slot < TIMER_WHEEL_SLOTS; slot++)
+        {
+            wheel->slots[level][slot].next = &wheel->slots[level][slot];
+            wheel->slots[level][slot].prev = &wheel->slots[level][slot];
+        }
+    }
+
+    wheel->next_tick = (unsigned long long)now_ms / TIMER_WHEEL_TICK_MS;
+    wheel->armed = 0;
+}
+
+void timer_init(Timer *timer, void (*callback)(Timer *timer), void *data)
+{
+    timer->link.next = NULL;
+    timer->link.prev = NULL;
+    timer->expires = 0;
+    timer->callback = callback;
+    timer->data = data;
+}
+
+bool timer_pending(const Timer *timer)
+{
+    return timer->link.next != NULL;
+}
+
+// Arm or rearm; the timer never fires before expires_ms
+void timer_wheel_schedule(TimerWheel *wheel, Timer *timer, long long expires_ms)
+{
+    if (timer_pending(timer))
+        link_remove(&timer->link);
+    else
+        wheel->armed++;
+
+    if (expires_ms < 0)
+        expires_ms = 0;
+    timer->expires = ((unsigned long long)expires_ms + TIMER_WHEEL_TICK_MS - 1) / TIMER_WHEEL_TICK_MS;
+    place(wheel, timer);
+}
+
+void timer_wheel_cancel(TimerWheel *wheel, Timer *timer)
+{
+    if (!timer_pending(timer))
+        return;
+
+    link_remove(&timer->link);
+    wheel->armed--;
+}
+
+// Process every tick up to now and run the timers that came due.
+// Callbacks may arm or cancel any timer, including the one being run.
+int timer_wheel_advance(TimerWheel *wheel, long long now_ms)
+{
+    unsigned long long target = (unsigned long long)now_ms / TIMER_WHEEL_TICK_MS;
+    int fired = 0;
+
+    while (wheel->next_tick <= target)
+    {
+        int slot = (int)(wheel->next_tick & TIMER_WHEEL_MASK);
+
+        // Wrapping a level pulls the next slot of the level above into range
+        if (wheel->armed > 0 && slot == 0)
+        {
+            for (int level = 1; level < TIMER_WHEEL_LEVELS; level++)
+            {
+                int upper = (int)((wheel->next_tick >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK);
+                cascade(wheel, level, upper);
+                if (upper != 0)
+                    break;
+            }
+        }
+
+        TimerLink *head = &wheel->slots[0][slot];
+        while (head->next != head)
+        {
+            Timer *timer = (Timer *)head->next;
+            link_remove(&timer->link);
+            wheel->armed--;
+            fired++;
+            timer->callback(timer);
+        }
+
+        wheel->next_tick++;
+
+        // Nothing armed: jump straight to the target instead of stepping
+        if (wheel->armed == 0 && wheel->next_tick <= target)
+            wheel->next_tick = target + 1;
+    }
+
+    return fired;
+}
@@ -0,0 +1,43 @@
+#include "token_bucket.h"
+
+#define TOKEN_UNITS 1000
+
+void token_bucket_refill(TokenBucket *bucket, int rate, int burst, long long now_ms)
+{
+    long long capacity = (long long)burst * TOKEN_UNITS;
+    if (bucket->updated_ms == 0)
+    {
+        bucket->units = capacity;
+        bucket->updated_ms = now_ms;
+        return;
+    }
+
+    long long elapsed = now_ms - bucket->updated_ms;
+    if (elapsed <= 0)
+        return;
+
+    bucket->units += elapsed * rate;
+    if (bucket->units > capacity)
+    {
+        bucket->units = capacity;
+    }
+    bucket->updated_ms = now_ms;
+}
+
+bool token_bucket_available(const TokenBucket *bucket)
+{
+    return bucket->units >= TOKEN_UNITS;
+}
+
+void token_bucket_take(TokenBucket *bucket)
+{
+    bucket->units -= TOKEN_UNITS;
+}
+
+// Milliseconds until the next whole token is available
+long long token_bucket_wait_ms(const TokenBucket *bucket, int rate)
+{
+    if (bucket->units >= TOKEN_UNITS || rate <= 0)
+        return 0;
+    return (TOKEN_UNITS - bucket->units + rate - 1) / rate;
+}
@@ -0,0 +1,482 @@
+#define LOG_MODULE LOG_MODULE_CONNECTION
+
+#include "websocket.h"
+#include "clock.h"
+#include "logging.h"
+#include <stdint.h>
+
+// SHA-1 (RFC 3174), only used to answer the opening handshake
+typedef struct
+{
+    uint32_t state[5];
+    uint64_t length;
+    unsigned char block[64];
+    size_t used;
+} Sha1Context;
+
+static uint32_t rotl32(uint32_t value, int bits)
+{
+    return (value << bits) | (value >> (32 - bits));
+}
+
+static void sha1_transform(Sha1Context *ctx, const unsigned char *block)
+{
+    uint32_t w[80];
+    for (int i = 0; i < 16; i++)
+    {
+        w[i] = ((uint32_t)block[i * 4] << 24) | ((uint32_t)block[i * 4 + 1] << 16) |
+               ((uint32_t)block[i * 4 + 2] << 8) | block[i * 4 + 3];
+    }
+    for (int i = 16; i < 80; i++)
+    {
+        w[i] = rotl32(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+    }
+
+    uint32_t a = ctx->state[0], b = ctx->state[1], c = ctx->state[2];
+    uint32_t d = ctx->state[3], e = ctx->state[4];
+
+    for (int i = 0; i < 80; i++)
+    {
+        uint32_t f, k;
+        if (i < 20)
+        {
+            f = (b & c) | (~b & d);
+            k = 0x5A827999;
+        }
+        else if (i < 40)
+        {
+            f = b ^ c ^ d;
+            k = 0x6ED9EBA1;
+        }
+        else if (i < 60)
+        {
+            f = (b & c) | (b & d) | (c & d);
+            k = 0x8F1BBCDC;
+        }
+        else
+        {
+            f = b ^ c ^ d;
+            k = 0xCA62C1D6;
+        }
+
+        uint32_t temp = rotl32(a, 5) + f + e + k + w[i];
+        e = d;
+        d = c;
+        c = rotl32(b, 30);
+        b = a;
+        a = temp;
+    }
+
+    ctx->state[0] += a;
+    ctx->state[1] += b;
+    ctx->state[2] += c;
+    ctx->state[3] += d;
+    ctx->state[4] += e;
+}
+
+static void sha1_init(Sha1Context *ctx)
+{
+    ctx->state[0] = 0x67452301;
+    ctx->state[1] = 0xEFCDAB89;
+    ctx->state[2] = 0x98BADCFE;
+    ctx->state[3] = 0x10325476;
+    ctx->state[4] = 0xC3D2E1F0;
+    ctx->length = 0;
+    ctx->used = 0;
+}
+
+static void sha1_update(Sha1Context *ctx, const void *data, size_t length)
+{
+    const unsigned char *p = data;
+    ctx->length += length;
+
+    while (length > 0)
+    {
+        size_t chunk = 64 - ctx->used;
+        if (chunk > length)
+            chunk = length;
+
+        memcpy(ctx->block + ctx->used, p, chunk);
+        ctx->used += chunk;
+        p += chunk;
+        length -= chunk;
+
+        if (ctx->used == 64)
+        {
+            sha1_transform(ctx, ctx->block);
+            ctx->used = 0;
+        }
+    }
+}
+
+static void sha1_final(Sha1Context *ctx, unsigned char digest[20])
+{
+    uint64_t bits = ctx->length * 8;
+    unsigned char pad = 0x80;
+    sha1_update(ctx, &pad, 1);
+
+    pad = 0;
+    while (ctx->used != 56)
+    {
+        sha1_update(ctx, &pad, 1);
+    }
+
+    unsigned char length_bytes[8];
+    for (int i = 0; i < 8; i++)
+    {
+        length_bytes[i] = (unsigned char)(bits >> (56 - i * 8));
+    }
+    sha1_update(ctx, length_bytes, 8);
+
+    for (int i = 0; i < 5; i++)
+    {
+        digest[i * 4] = (unsigned char)(ctx->state[i] >> 24);
+        digest[i * 4 + 1] = (unsigned char)(ctx->state[i] >> 16);
+        digest[i * 4 + 2] = (unsigned char)(ctx->state[i] >> 8);
+        digest[i * 4 + 3] = (unsigned char)ctx->state[i];
+    }
+}
+
+static void base64_encode(const unsigned char *data, size_t length, char *out)
+{
+    static const char alphabet[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+    size_t i = 0;
+    for (; i + 2 < length; i += 3)
+    {
+        uint32_t v = (data[i] << 16) | (data[i + 1] << 8) | data[i + 2];
+        *out++ = alphabet[(v >> 18) & 63];
+        *out++ = alphabet[(v >> 12) & 63];
+        *out++ = alphabet[(v >> 6) & 63];
+        *out++ = alphabet[v & 63];
+    }
+
+    if (i < length)
+    {
+        uint32_t v = data[i] << 16;
+        if (i + 1 < length)
+            v |= data[i + 1] << 8;
+
+        *out++ = alphabet[(v >> 18) & 63];
+        *out++ = alphabet[(v >> 12) & 63];
+        *out++ = i + 1 < length ? alphabet[(v >> 6) & 63] : '=';
+        *out++ = '=';
+    }
+    *out = '\0';
+}
+
+// Find a header value in a request; copies it without surrounding blanks
+static bool find_header(const char *request, const char *end, const char *name,
+                        char *value, size_t value_size)
+{
+    size_t name_length = strlen(name);
+    const char *line = strstr(request, "\r\n");
+
+    while (line && line + 2 < end)
+    {
+        line += 2;
+        const char *line_end = strstr(line, "\r\n");
+        if (!line_end || line_end == line)
+            break;
+
+        if ((size_t)(line_end - line) > name_length && line[name_length] == ':' &&
+            strncasecmp(line, name, name_length) == 0)
+        {
+            const char *v = line + name_length + 1;
+            while (v < line_end && (*v == ' ' || *v == '\t'))
+                v++;
+
+            size_t length = line_end - v;
+            while (length > 0 && (v[length - 1] == ' ' || v[length - 1] == '\t'))
+                length--;
+            if (length >= value_size)
+                return false;
+
+            memcpy(value, v, length);
+            value[length] = '\0';
+            return true;
+        }
+        line = line_end;
+    }
+    return false;
+}
+
+// Case-insensitive token match in a comma-separated header value
+static bool header_has_token(const char *value, const char *token)
+{
+    size_t token_length = strlen(token);
+    const char *p = value;
+
+    while (*p)
+    {
+        while (*p == ' ' || *p == ',')
+            p++;
+        const char *start = p;
+        while (*p && *p != ',')
+            p++;
+
+        const char *stop = p;
+        while (stop > start && stop[-1] == ' ')
+            stop--;
+        if ((size_t)(stop - start) == token_length && strncasecmp(start, token, token_length) == 0)
+            return true;
+    }
+    return false;
+}
+
+bool websocket_is_upgrade(const char *request, size_t length)
+{
+    if (length < 4 || strncmp(request, "GET ", 4) != 0)
+        return false;
+
+    const char *end = strstr(request, "\r\n\r\n");
+    if (!end)
+        end = request + length;
+
+    char upgrade[64];
+    return find_header(request, end, "Upgrade", upgrade, sizeof(upgrade)) &&
+           header_has_token(upgrade, "websocket");
+}
+
+// Answer the opening handshake held in the read buffer and switch the
+// connection to WebSocket framing. Returns 1 when upgraded, 0 while the
+// request is incomplete and -1 for a request that cannot be upgraded.
+int websocket_accept(Connection *conn)
+{
+    const char *request = conn->read_buffer;
+    const char *end = strstr(request, "\r\n\r\n");
+    if (!end)
+        return conn->read_buffer_used + 1 >= conn->read_buffer_size ? -1 : 0;
+
+    char key[128];
+    char version[16];
+    char connection_header[128];
+    if (!find_header(request, end, "Sec-WebSocket-Key", key, sizeof(key)) ||
+        !find_header(request, end, "Sec-WebSocket-Version", version, sizeof(version)) ||
+        strcmp(version, "13") != 0 ||
+        !find_header(request, end, "Connection", connection_header, sizeof(connection_header)) ||
+        !header_has_token(connection_header, "upgrade"))
+    {
+        log_warn("Rejected WebSocket handshake from %s:%d", conn->ip, conn->port);
+        return -1;
+    }
+
+    unsigned char digest[20];
+    Sha1Context sha;
+    sha1_init(&sha);
+    sha1_update(&sha, key, strlen(key));
+    sha1_update(&sha, WS_GUID, strlen(WS_GUID));
+    sha1_final(&sha, digest);
+
+    char accept[32];
+    base64_encode(digest, sizeof(digest), accept);
+
+    char response[256];
+    int response_length = snprintf(response, sizeof(response),
+                                   "HTTP/1.1 101 Switching Protocols\r\n"
+                                   "Upgrade: websocket\r\n"
+                                   "Connection: Upgrade\r\n"
+                                   "Sec-WebSocket-Accept: %s\r\n"
+                                   "Date: %s\r\n"
+                                   "Server: MultiServer/1.0.0\r\n"
+                                   "\r\n",
+                                   accept, clock_http_date());
+
+    // Frames may already follow the request; keep them buffered
+    conn->read_line_start = (end + 4) - conn->read_buffer;
+    conn->read_scan_offset = conn->read_line_start;
+    connection_compact_read_buffer(conn);
+
+    connection_queue_raw(conn, response, response_length);
+    conn->protocol = PROTOCOL_WEBSOCKET;
+    conn->state = CONN_STATE_READING;
+    conn->keep_alive = true;
+
+    log_info("WebSocket connection established with %s:%d", conn->ip, conn->port);
+    return 1;
+}
+
+size_t websocket_encode_header(unsigned char *header, WebSocketOpcode opcode, size_t length)
+{
+    header[0] = 0x80 | (unsigned char)opcode; // FIN, never fragmented
+
+    if (length < 126)
+    {
+        header[1] = (unsigned char)length;
+        return 2;
+    }
+
+    if (length <= 0xFFFF)
+    {
+        header[1] = 126;
+        header[2] = (unsigned char)(length >> 8);
+        header[3] = (unsigned char)length;
+        return 4;
+    }
+
+    header[1] = 127;
+    for (int i = 0; i < 8; i++)
+    {
+        header[2 + i] = (unsigned char)((uint64_t)length >> (56 - i * 8));
+    }
+    return 10;
+}
+
+// Build a complete frame in one allocation, for output shared by several
+// connections
+char *websocket_encode_frame(WebSocketOpcode opcode, const char *data, size_t length, size_t *frame_length)
+{
+    char *frame = malloc(WS_MAX_HEADER_SIZE + length);
+    if (!frame)
+        return NULL;
+
+    size_t header_length = websocket_encode_header((unsigned char *)frame, opcode, length);
+    memcpy(frame + header_length, data, length);
+    *frame_length = header_length + length;
+    return frame;
+}
+
+// Queue the header and payload together or not at all, so a full write
+// buffer drops whole frames and never breaks the stream
+int websocket_queue_frame(Connection *conn, WebSocketOpcode opcode, const char *data, size_t length)
+{
+    unsigned char header[WS_MAX_HEADER_SIZE];
+    size_t header_length = websocket_encode_header(header, opcode, length);
+
+    if (connection_reserve_write(conn, header_length + length) < 0)
+        return -1;
+
+    connection_queue_raw(conn, (const char *)header, header_length);
+    if (length > 0)
+        connection_queue_raw(conn, data, length);
+    return 0;
+}
+
+static int websocket_fail(Connection *conn, int code)
+{
+    char payload[2] = {(char)(code >> 8), (char)(code & 0xff)};
+    websocket_queue_frame(conn, WS_OP_CLOSE, payload, sizeof(payload));
+    return -1;
+}
+
+// Assemble the next complete data message from the read buffer, answering
+// control frames on the way. The message is NUL-terminated and stays
+// valid until the next call. Returns 1 for a message, 0 when more bytes
+// are needed and -1 once the connection should close (a close frame has
+// been queued).
+int websocket_next_message(Connection *conn, size_t max_length, char **message, size_t *length)
+{
+    if (max_length > WS_MAX_MESSAGE)
+        max_length = WS_MAX_MESSAGE;
+
+    for (;;)
+    {
+        size_t start = conn->read_line_start;
+        size_t available = conn->read_buffer_used - start;
+        const unsigned char *frame = (const unsigned char *)conn->read_buffer + start;
+
+        if (available < 2)
+            return 0;
+
+        bool fin = frame[0] & 0x80;
+        WebSocketOpcode opcode = frame[0] & 0x0F;
+        bool masked = frame[1] & 0x80;
+        uint64_t payload_length = frame[1] & 0x7F;
+        size_t header_length = 2;
+
+        // Clients must mask, and extensions are never negotiated
+        if (!masked || (frame[0] & 0x70))
+            return websocket_fail(conn, WS_CLOSE_PROTOCOL_ERROR);
+
+        if (payload_length == 126)
+        {
+            if (available < 4)
+                return 0;
+            payload_length = ((uint64_t)frame[2] << 8) | frame[3];
+            header_length = 4;
+        }
+        else if (payload_length == 127)
+        {
+            if (available < 10)
+                return 0;
+            payload_length = 0;
+            for (int i = 0; i < 8; i++)
+                payload_length = (payload_length << 8) | frame[2 + i];
+            header_length = 10;
+        }
+
+        // Control frames are never fragmented and carry at most 125 bytes
+        if ((opcode & 0x08) && (!fin || payload_length > 125))
+            return websocket_fail(conn, WS_CLOSE_PROTOCOL_ERROR);
+
+        if (payload_length > max_length)
+            return websocket_fail(conn, WS_CLOSE_TOO_BIG);
+
+        if (available < header_length + 4 + payload_length)
+            return 0;
+
+        const unsigned char *mask = frame + header_length;
+        char *payload = conn->read_buffer + start + header_length + 4;
+        for (uint64_t i = 0; i < payload_length; i++)
+        {
+            payload[i] ^= mask[i & 3];
+        }
+
+        conn->read_line_start = start + header_length + 4 + payload_length;
+        conn->read_scan_offset = conn->read_line_start;
+
+        switch (opcode)
+        {
+        case WS_OP_PING:
+            websocket_queue_frame(conn, WS_OP_PONG, payload, payload_length);
+            continue;
+
+        case WS_OP_PONG:
+            continue;
+
+        case WS_OP_CLOSE:
+            websocket_queue_frame(conn, WS_OP_CLOSE, payload, payload_length >= 2 ? 2 : 0);
+            return -1;
+
+        case WS_OP_TEXT:
+        case WS_OP_BINARY:
+        case WS_OP_CONTINUATION:
+            break;
+
+        default:
+            return websocket_fail(conn, WS_CLOSE_PROTOCOL_ERROR);
+        }
+
+        // A new data frame must not interrupt a fragmented message
+        bool continuing = conn->ws_message_used > 0 || conn->ws_fragmented;
+        if ((opcode == WS_OP_CONTINUATION) != continuing)
+            return websocket_fail(conn, WS_CLOSE_PROTOCOL_ERROR);
+
+        if (conn->ws_message_used + payload_length > max_length)
+            return websocket_fail(conn, WS_CLOSE_TOO_BIG);
+
+        if (!conn->ws_message)
+        {
+            conn->ws_message = malloc(WS_MAX_MESSAGE + 1);
+            if (!conn->ws_message)
+                return websocket_fail(conn, WS_CLOSE_TOO_BIG);
+        }
+
+        memcpy(conn->ws_message + conn->ws_message_used, payload, payload_length);
+        conn->ws_message_used += payload_length;
+
+        if (!fin)
+        {
+            conn->ws_fragmented = true;
+            continue;
+        }
+
+        conn->ws_message[conn->ws_message_used] = '\0';
+        *message = conn->ws_message;
+        *length = conn->ws_message_used;
+        conn->ws_message_used = 0;
+        conn->ws_fragmented = false;
+        return 1;
+    }
+}
@@ -0,0 +1,307 @@
+// Render binary multiserver log files as text or JSON lines.
+//
+//   logdecode [-j] [file]
+//
+// Reads standard input when no file is given. Build with `make`.
+
+#include "log_format.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_FORMATS 65536
+#define MESSAGE_MAX 4096
+
+// Same names as the text log
+static const char *level_strings[] = {
+    "DEBUG", "INFO", "WARN", "ERROR", "FATAL"};
+
+// Format strings of the current file section, by id; id 0 is always "%s"
+static char *formats[MAX_FORMATS];
+
+static void reset_formats(void)
+{
+    for (int i = 1; i < MAX_FORMATS; i++)
+    {
+        free(formats[i]);
+        formats[i] = NULL;
+    }
+}
+
+static int read_exact(FILE *in, void *buffer, size_t length)
+{
+    return fread(buffer, 1, length, in) == length ? 0 : -1;
+}
+
+static void print_json_string(const char *text, size_t length)
+{
+    putchar('"');
+    for (size_t i = 0; i < length; i++)
+    {
+        unsigned char c = (unsigned char)text[i];
+        if (c == '"' || c == '\\')
+            printf("\\%c", c);
+        else if (c == '\n')
+            fputs("\\n", stdout);
+        else if (c == '\r')
+            fputs("\\r", stdout);
+        else if (c == '\t')
+            fputs("\\t", stdout);
+        else if (c < 0x20)
+            printf("\\u%04x", c);
+        else
+            putchar(c);
+    }
+    putchar('"');
+}
+
+// The raw argument values as a JSON array
+static void print_json_args(const char *args, size_t length)
+{
+    const char *p = args;
+    const char *end = args + length;
+    bool first = true;
+
+    putchar('[');
+    while (p < end)
+    {
+        char tag = *p++;
+        if (!first)
+            putchar(',');
+        first = false;
+
+        if (tag == LOG_ARG_STRING)
+        {
+            uint16_t text_length;
+            if (p + sizeof(text_length) > end)
+                break;
+            memcpy(&text_length, p, sizeof(text_length));
+            p += sizeof(text_length);
+            if (p + text_length > end)
+                break;
+            print_json_string(p, text_length);
+            p += text_length;
+            continue;
+        }
+
+        if (p + 8 > end)
+            break;
+        if (tag == LOG_ARG_SIGNED)
+        {
+            int64_t value;
+            memcpy(&value, p, sizeof(value));
+            printf("%lld", (long long)value);
+        }
+        else if (tag == LOG_ARG_DOUBLE)
+        {
+            double value;
+            memcpy(&value, p, sizeof(value));
+            printf("%.17g", value);
+        }
+        else
+        {
+            uint64_t value;
+            memcpy(&value, p, sizeof(value));
+            printf("%llu", (unsigned long long)value);
+        }
+        p += 8;
+    }
+    putchar(']');
+}
+
+static void print_message(bool json, int64_t time_ns, int level, uint32_t format_id,
+                          const char *args, size_t length)
+{
+    const char *format = format_id < MAX_FORMATS ? formats[format_id] : NULL;
+    char message[MESSAGE_MAX];
+    size_t message_length;
+    if (format)
+    {
+        message_length = log_args_render(message, sizeof(message), format, args, length);
+    }
+    else
+    {
+        message_length = (size_t)snprintf(message, sizeof(message), "<undefined format %u>", format_id);
+        if (message_length >= sizeof(message))
+            message_length = sizeof(message) - 1;
+    }
+
+    time_t seconds = (time_t)(time_ns / 1000000000);
+    struct tm tm_info;
+    char timestamp[32];
+    localtime_r(&seconds, &tm_info);
+    strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S", &tm_info);
+    const char *level_str = level >= 0 && level <= 4 ? level_strings[level] : "?";
+
+    if (!json)
+    {
+        printf("[%s] %s %.*s\n", timestamp, level_str, (int)message_length, message);
+        return;
+    }
+
+    printf("{\"ts_ns\":%lld,\"time\":\"%s.%09lld\",\"level\":\"%s\",\"format_id\":%u,\"format\":",
+           (long long)time_ns, timestamp, (long long)(time_ns % 1000000000), level_str, format_id);
+    if (format)
+        print_json_string(format, strlen(format));
+    else
+        fputs("null", stdout);
+    fputs(",\"args\":", stdout);
+    print_json_args(args, length);
+    fputs(",\"message\":", stdout);
+    print_json_string(message, message_length);
+    fputs("}\n", stdout);
+}
+
+static int decode(FILE *in, const char *name, bool json)
+{
+    bool have_header = false;
+    char args[UINT16_MAX];
+    int type;
+
+    while ((type = fgetc(in)) != EOF)
+    {
+        if (type == LOG_RECORD_HEADER)
+        {
+            char magic[5];
+            unsigned char version;
+            uint32_t byte_order;
+            if (read_exact(in, magic, sizeof(magic)) < 0 || read_exact(in, &version, 1) < 0 ||
+                read_exact(in, &byte_order, sizeof(byte_order)) < 0)
+            {
+                break;
+            }
+            if (memcmp(magic, LOG_BINARY_MAGIC, sizeof(magic)) != 0)
+            {
+                fprintf(stderr, "%s: not a binary multiserver log\n", name);
+                return -1;
+            }
+            if (version != LOG_BINARY_VERSION)
+            {
+                fprintf(stderr, "%s: unsupported format version %d\n", name, version);
+                return -1;
+            }
+            if (byte_order != LOG_BINARY_BYTE_ORDER)
+            {
+                fprintf(stderr, "%s: written on a host with a different byte order\n", name);
+                return -1;
+            }
+
+            // A new header starts a new format table (restart or rotation)
+            reset_formats();
+            have_header = true;
+        }
+        else if (!have_header)
+        {
+            fprintf(stderr, "%s: not a binary multiserver log\n", name);
+            return -1;
+        }
+        else if (type == LOG_RECORD_FORMAT)
+        {
+            uint32_t id;
+            uint16_t length;
+            if (read_exact(in, &id, sizeof(id)) < 0 || read_exact(in, &length, sizeof(length)) < 0)
+                break;
+
+            char *format = malloc((size_t)length + 1);
+            if (!format || read_exact(in, format, length) < 0)
+            {
+                free(format);
+                break;
+            }
+            format[length] = '\0';
+
+            if (id == 0 || id >= MAX_FORMATS)
+            {
+                fprintf(stderr, "%s: format id %u out of range\n", name, id);
+                free(format);
+                continue;
+            }
+            free(formats[id]);
+            formats[id] = format;
+        }
+        else if (type == LOG_RECORD_MESSAGE)
+        {
+            int64_t time_ns;
+            unsigned char level;
+            uint32_t format_id;
+            uint16_t length;
+            if (read_exact(in, &time_ns, sizeof(time_ns)) < 0 || read_exact(in, &level, 1) < 0 ||
+                read_exact(in, &format_id, sizeof(format_id)) < 0 ||
+                read_exact(in, &length, sizeof(length)) < 0 || read_exact(in, args, length) < 0)
+            {
+                break;
+            }
+            print_message(json, time_ns, level, format_id, args, length);
+        }
+        else
+        {
+            fprintf(stderr, "%s: unknown record type 0x%02x at offset %ld\n", name, type, ftell(in) - 1);
+            return -1;
+        }
+    }
+
+    if (ferror(in))
+    {
+        perror(name);
+        return -1;
+    }
+    // Leaving the loop early means a record was cut short, e.g. by a crash
+    if (type != EOF)
+        fprintf(stderr, "%s: truncated record at end of file\n", name);
+    return 0;
+}
+
+static void usage(const char *program)
+{
+    fprintf(stderr, "Usage: %s [-j] [file]\n", program);
+    fprintf(stderr, "  -j  Print one JSON object per message\n");
+}
+
+int main(int argc, char *argv[])
+{
+    bool json = false;
+    int option;
+
+    while ((option = getopt(argc, argv, "jh")) != -1)
+    {
+        switch (option)
+        {
+        case 'j':
+            json = true;
+            break;
+        default:
+            usage(argv[0]);
+            return option == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+
+    if (argc - optind > 1)
+    {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    formats[0] = "%s";
+
+    FILE *in = stdin;
+    const char *name = "<stdin>";
+    if (optind < argc)
+    {
+        name = argv[optind];
+        in = fopen(name, "rb");
+        if (!in)
+        {
+            perror(name);
+            return EXIT_FAILURE;
+        }
+    }
+
+    int result = decode(in, name, json);
+    if (in != stdin)
+        fclose(in);
+    reset_formats();
+    return result == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,42 @@
+#ifndef TEST_H
+#define TEST_H
+
+// Shared harness for the unit checks in tools/test_*.c. A failed check is
+// reported and counted, and the run carries on to report the rest.
+
+#include <stdio.h>
+
+static int test_failures = 0;
+
+#define CHECK(condition)                                                    \
+    do                                                                      \
+    {                                                                       \
+        if (!(condition))                                                   \
+        {                                                                   \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, \
+                    #condition);                                            \
+            test_failures++;                                                \
+        }                                                                   \
+    } while (0)
+
+// Report a failure found by hand, with a printf-style message
+#define FAIL(...)                     \
+    do                                \
+    {                                 \
+        fprintf(stderr, __VA_ARGS__); \
+        test_failures++;              \
+    } while (0)
+
+// Exit status for main: 0 when every check passed
+static inline int test_report(const char *name)
+{
+    if (test_failures > 0)
+    {
+        fprintf(stderr, "%s: %d check(s) failed\n", name, test_failures);
+        return 1;
+    }
+    printf("%s: ok\n", name);
+    return 0;
+}
+
+#endif // TEST_H
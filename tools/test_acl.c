@@ -0,0 +1,174 @@
+// Checks for the CIDR access list: node splits and covering rules in the
+// radix tree, the IPv4 /16 jump table, IPv6 rules, and randomized rule
+// sets against a linear longest-prefix reference.
+//
+//   make check
+
+#include "acl.h"
+#include "test.h"
+
+static bool allows(const AccessList *acl, const char *address)
+{
+    struct sockaddr_storage storage = {0};
+    if (strchr(address, ':'))
+    {
+        struct sockaddr_in6 *addr6 = (struct sockaddr_in6 *)&storage;
+        addr6->sin6_family = AF_INET6;
+        inet_pton(AF_INET6, address, &addr6->sin6_addr);
+    }
+    else
+    {
+        struct sockaddr_in *addr4 = (struct sockaddr_in *)&storage;
+        addr4->sin_family = AF_INET;
+        inet_pton(AF_INET, address, &addr4->sin_addr);
+    }
+    return acl_allows(acl, (const struct sockaddr *)&storage);
+}
+
+static void test_rules(void)
+{
+    AccessList *acl = acl_create();
+
+    // Inserted so that later rules split and cover earlier nodes
+    CHECK(acl_add_rule(acl, "10.1.2.0/24", ACL_DENY) == 0);
+    CHECK(acl_add_rule(acl, "10.1.3.0/24", ACL_DENY) == 0);  // Splits at /23
+    CHECK(acl_add_rule(acl, "10.0.0.0/8", ACL_ALLOW) == 0);  // Covers both
+    CHECK(acl_add_rule(acl, "10.1.2.128/25", ACL_ALLOW) == 0);
+    CHECK(acl_add_rule(acl, "192.168.0.0/16", ACL_ALLOW) == 0);
+    CHECK(acl_add_rule(acl, "192.168.7.7", ACL_DENY) == 0);
+    CHECK(acl_add_rule(acl, "2001:db8::/32", ACL_ALLOW) == 0);
+    CHECK(acl_add_rule(acl, "2001:db8:bad::/48", ACL_DENY) == 0);
+    CHECK(acl_add_rule(acl, "10.0.0.0/33", ACL_DENY) < 0);
+    CHECK(acl_add_rule(acl, "not-an-address", ACL_DENY) < 0);
+
+    // Twice: walking the tree, then through the jump table
+    for (int pass = 0; pass < 2; pass++)
+    {
+        CHECK(allows(acl, "10.9.9.9"));
+        CHECK(!allows(acl, "10.1.2.1"));
+        CHECK(allows(acl, "10.1.2.200"));
+        CHECK(!allows(acl, "10.1.3.1"));
+        CHECK(allows(acl, "10.1.4.1"));
+        CHECK(allows(acl, "192.168.7.6"));
+        CHECK(!allows(acl, "192.168.7.7"));
+        CHECK(!allows(acl, "11.0.0.1")); // Allow rules make it a whitelist
+        CHECK(allows(acl, "2001:db8:1::1"));
+        CHECK(!allows(acl, "2001:db8:bad::1"));
+        CHECK(!allows(acl, "2001:db9::1"));
+        CHECK(acl_build_index(acl) == 0);
+    }
+
+    // The same prefix again replaces the earlier action
+    AccessList *replace = acl_create();
+    CHECK(acl_add_rule(replace, "172.16.0.0/12", ACL_DENY) == 0);
+    CHECK(acl_add_rule(replace, "172.16.0.0/12", ACL_ALLOW) == 0);
+    CHECK(allows(replace, "172.20.1.1"));
+    acl_destroy(replace);
+
+    // Deny rules alone leave everything else allowed
+    AccessList *deny = acl_create();
+    CHECK(acl_add_rule(deny, "0.0.0.0/1", ACL_DENY) == 0);
+    CHECK(acl_build_index(deny) == 0);
+    CHECK(!allows(deny, "127.0.0.1"));
+    CHECK(allows(deny, "128.0.0.1"));
+    CHECK(allows(deny, "::1"));
+    acl_destroy(deny);
+
+    acl_destroy(acl);
+}
+
+// Linear reference: the longest matching prefix decides, later rules win
+// ties, and without a match allow rules make it a whitelist
+typedef struct
+{
+    uint32_t address;
+    int length;
+    int action;
+} Rule;
+
+static bool reference_allows(const Rule *rules, int count, int allow_rules, uint32_t address)
+{
+    int best_length = -1;
+    int decision = -1;
+    for (int i = 0; i < count; i++)
+    {
+        uint32_t mask = rules[i].length ? ~0u << (32 - rules[i].length) : 0;
+        if ((address & mask) == (rules[i].address & mask) && rules[i].length >= best_length)
+        {
+            best_length = rules[i].length;
+            decision = rules[i].action;
+        }
+    }
+    return decision < 0 ? allow_rules == 0 : decision == ACL_ALLOW;
+}
+
+static uint32_t random_state = 2463534242u;
+
+static uint32_t next_random(void)
+{
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+    return random_state;
+}
+
+// Addresses drawn from a few /8s so that rules overlap and split often
+static uint32_t random_address(void)
+{
+    static const uint32_t bases[] = {0x0A000000, 0x0A010000, 0xC0A80000, 0x7F000000};
+    return bases[next_random() % 4] | (next_random() & 0x0003FFFF);
+}
+
+static void test_random_rule_sets(void)
+{
+    for (int round = 0; round < 200; round++)
+    {
+        AccessList *acl = acl_create();
+        Rule rules[64];
+        int count = 1 + next_random() % 64;
+        int allow_rules = 0;
+
+        for (int i = 0; i < count; i++)
+        {
+            rules[i].address = random_address();
+            rules[i].length = next_random() % 33;
+            rules[i].action = next_random() % 2 ? ACL_ALLOW : ACL_DENY;
+            allow_rules += rules[i].action == ACL_ALLOW;
+
+            char cidr[32];
+            struct in_addr addr = {htonl(rules[i].address)};
+            snprintf(cidr, sizeof(cidr), "%s/%d", inet_ntoa(addr), rules[i].length);
+            CHECK(acl_add_rule(acl, cidr, rules[i].action) == 0);
+        }
+
+        for (int pass = 0; pass < 2; pass++)
+        {
+            for (int probe = 0; probe < 500; probe++)
+            {
+                // Probe rule boundaries as well as random addresses
+                uint32_t address = probe % 2 ? random_address()
+                                             : rules[probe % count].address ^ (1u << (next_random() % 32));
+
+                struct sockaddr_in addr = {0};
+                addr.sin_family = AF_INET;
+                addr.sin_addr.s_addr = htonl(address);
+                bool expected = reference_allows(rules, count, allow_rules, address);
+                if (acl_allows(acl, (struct sockaddr *)&addr) != expected)
+                {
+                    FAIL("round %d%s: %s should be %s\n", round, pass ? " (indexed)" : "",
+                            inet_ntoa(addr.sin_addr), expected ? "allowed" : "denied");
+                }
+            }
+            CHECK(acl_build_index(acl) == 0);
+        }
+        acl_destroy(acl);
+    }
+}
+
+int main(void)
+{
+    test_rules();
+    test_random_rule_sets();
+
+    return test_report("test_acl");
+}
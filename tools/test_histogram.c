@@ -0,0 +1,144 @@
+// Checks for the latency histograms: log-linear bucket edges at every
+// power of two, clamping past the top bucket, percentile error bounds
+// and merging the slots of several threads.
+//
+//   make check
+
+#include "metrics.h"
+#include "test.h"
+#include <stdint.h>
+
+// Highest value sharing a bucket with value, worked out independently of
+// metrics.c: exact below 16, then 16 buckets per power of two
+static long long expected_upper(long long value)
+{
+    if (value <= 0)
+        return 0;
+    if (value >= 1LL << HISTOGRAM_MAX_BITS)
+        return (1LL << HISTOGRAM_MAX_BITS) - 1;
+    if (value < 1LL << HISTOGRAM_SUB_BUCKET_BITS)
+        return value;
+
+    int exponent = 0;
+    while (value >> (exponent + 1))
+        exponent++;
+    long long width = 1LL << (exponent - HISTOGRAM_SUB_BUCKET_BITS);
+    return value / width * width + width - 1;
+}
+
+static int compare(const void *a, const void *b)
+{
+    long long x = *(const long long *)a, y = *(const long long *)b;
+    return (x > y) - (x < y);
+}
+
+// Values are observed in increasing order, so the maximum reported after
+// each one is the upper edge of that value's bucket
+static void test_bucket_edges(void)
+{
+    long long values[512];
+    int count = 0;
+    values[count++] = -5;
+    values[count++] = 0;
+    for (long long v = 1; v <= 40; v++)
+        values[count++] = v;
+    for (int bits = 5; bits <= HISTOGRAM_MAX_BITS + 2; bits++)
+    {
+        long long power = 1LL << bits;
+        long long step = power >> HISTOGRAM_SUB_BUCKET_BITS; // Bucket width below power
+        values[count++] = power - step - 1;
+        values[count++] = power - step;
+        values[count++] = power - 1;
+        values[count++] = power;
+        values[count++] = power + 1;
+        values[count++] = power + power / 3;
+    }
+    qsort(values, count, sizeof(values[0]), compare);
+
+    unsigned long observed = 0;
+    for (int i = 0; i < count; i++)
+    {
+        if (i > 0 && values[i] == values[i - 1])
+            continue;
+
+        metrics_observe(HISTOGRAM_FIRST_BYTE, values[i]);
+        observed++;
+
+        HistogramSummary summary;
+        CHECK(metrics_summarize(HISTOGRAM_FIRST_BYTE, &summary));
+        CHECK(summary.count == observed);
+        if (summary.max_ns != expected_upper(values[i]))
+        {
+            FAIL("%lld ns: bucket ends at %lld, expected %lld\n", values[i],
+                    summary.max_ns, expected_upper(values[i]));
+        }
+    }
+}
+
+// Reported percentiles are bucket upper edges: never below the true
+// value and at most one bucket width (1/16) above it
+static void test_percentiles(void)
+{
+    HistogramSummary summary;
+    CHECK(!metrics_summarize(HISTOGRAM_HTTP_REQUEST, &summary));
+
+    for (long long us = 1; us <= 1000; us++)
+    {
+        metrics_observe(HISTOGRAM_HTTP_REQUEST, us * 1000);
+    }
+
+    CHECK(metrics_summarize(HISTOGRAM_HTTP_REQUEST, &summary));
+    CHECK(summary.count == 1000);
+    CHECK(summary.sum_ns == 500500LL * 1000);
+
+    const long long truth[] = {500000, 900000, 990000, 999000};
+    const long long reported[] = {summary.p50_ns, summary.p90_ns, summary.p99_ns, summary.p999_ns};
+    for (int i = 0; i < 4; i++)
+    {
+        if (reported[i] < truth[i] || reported[i] > truth[i] + truth[i] / 16)
+        {
+            FAIL("percentile %d: %lld ns for a true %lld ns\n", i, reported[i], truth[i]);
+        }
+    }
+}
+
+#define THREADS 4
+#define SAMPLES_PER_THREAD 10000
+
+static void *observe_from_thread(void *arg)
+{
+    long long base = (long long)(intptr_t)arg;
+    for (int i = 0; i < SAMPLES_PER_THREAD; i++)
+    {
+        metrics_observe(HISTOGRAM_CHAT_FANOUT, base + i);
+    }
+    return NULL;
+}
+
+// Each thread records into its own slot; summaries merge all of them
+static void test_thread_merge(void)
+{
+    pthread_t threads[THREADS];
+    for (int i = 0; i < THREADS; i++)
+    {
+        pthread_create(&threads[i], NULL, observe_from_thread, (void *)(intptr_t)(i * 1000000));
+    }
+    for (int i = 0; i < THREADS; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    HistogramSummary summary;
+    CHECK(metrics_summarize(HISTOGRAM_CHAT_FANOUT, &summary));
+    CHECK(summary.count == THREADS * SAMPLES_PER_THREAD);
+    CHECK(summary.max_ns == expected_upper((THREADS - 1) * 1000000 + SAMPLES_PER_THREAD - 1));
+}
+
+int main(void)
+{
+    test_bucket_edges();
+    test_percentiles();
+    test_thread_merge();
+
+    return test_report("test_histogram");
+}
@@ -0,0 +1,225 @@
+// Checks for the hierarchical timer wheel: timers on every level fire on
+// their exact tick after cascading down, far deadlines clamp to the
+// horizon, callbacks may rearm, and random schedules with cancels and
+// uneven advances match a simple deadline model.
+//
+//   make check
+
+#include "timer_wheel.h"
+#include "test.h"
+#include <stdint.h>
+
+typedef struct
+{
+    Timer timer;
+    long long deadline_ms; // As scheduled
+    long long fired_ms;    // Wheel time it fired at, -1 while pending
+    int rearm;             // Times the callback schedules it again
+    long long period_ms;
+} TestTimer;
+
+static TimerWheel wheel;
+static long long now_ms;      // Time passed to the running advance
+static long long previous_ms; // Time of the advance before it
+
+static long long tick_of(long long ms)
+{
+    return (ms + TIMER_WHEEL_TICK_MS - 1) / TIMER_WHEEL_TICK_MS;
+}
+
+static void expired(Timer *timer)
+{
+    TestTimer *test = timer->data;
+
+    // Due in this advance and in no earlier one
+    long long due = tick_of(test->deadline_ms);
+    if (due > now_ms / TIMER_WHEEL_TICK_MS || due <= previous_ms / TIMER_WHEEL_TICK_MS)
+    {
+        FAIL("timer for %lld ms fired in the advance to %lld ms (previous %lld ms)\n",
+                test->deadline_ms, now_ms, previous_ms);
+    }
+    test->fired_ms = now_ms;
+
+    if (test->rearm > 0)
+    {
+        test->rearm--;
+        test->deadline_ms += test->period_ms;
+        test->fired_ms = -1;
+        timer_wheel_schedule(&wheel, timer, test->deadline_ms);
+    }
+}
+
+static void advance_to(long long ms)
+{
+    previous_ms = now_ms;
+    now_ms = ms;
+    timer_wheel_advance(&wheel, ms);
+}
+
+static void arm(TestTimer *test, long long deadline_ms)
+{
+    timer_init(&test->timer, expired, test);
+    test->deadline_ms = deadline_ms;
+    test->fired_ms = -1;
+    test->rearm = 0;
+    timer_wheel_schedule(&wheel, &test->timer, deadline_ms);
+}
+
+// One timer just below and just above every level boundary, stepped one
+// tick at a time from an unaligned start
+static void test_levels(void)
+{
+    const long long start = 123456789;
+    static const long long offsets[] = {
+        0, 1, 99, 100, 101, 6399, 6400, 6401, 409599, 409600, 409601,
+        26214399, 26214400, 26214401, 60000000};
+    enum
+    {
+        COUNT = sizeof(offsets) / sizeof(offsets[0])
+    };
+    TestTimer timers[COUNT];
+
+    now_ms = previous_ms = start;
+    timer_wheel_init(&wheel, start);
+    for (int i = 0; i < COUNT; i++)
+    {
+        arm(&timers[i], start + offsets[i]);
+    }
+    CHECK(wheel.armed == COUNT);
+
+    long long end = start + offsets[COUNT - 1] + TIMER_WHEEL_TICK_MS;
+    for (long long ms = start; ms <= end; ms += TIMER_WHEEL_TICK_MS)
+    {
+        advance_to(ms);
+    }
+
+    for (int i = 0; i < COUNT; i++)
+    {
+        if (timers[i].fired_ms < 0)
+        {
+            FAIL("timer %lld ms ahead never fired\n", offsets[i]);
+        }
+    }
+    CHECK(wheel.armed == 0);
+}
+
+static void ignore(Timer *timer)
+{
+    (void)timer;
+}
+
+// Deadlines past the last level fire at the horizon instead
+static void test_horizon(void)
+{
+    const long long span_ticks = 1LL << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS);
+    TestTimer far;
+
+    now_ms = previous_ms = 0;
+    timer_wheel_init(&wheel, 0);
+    timer_init(&far.timer, ignore, &far);
+    timer_wheel_schedule(&wheel, &far.timer, span_ticks * 10 * TIMER_WHEEL_TICK_MS);
+    CHECK(far.timer.expires == (unsigned long long)span_ticks - 1);
+
+    timer_wheel_advance(&wheel, (span_ticks - 2) * TIMER_WHEEL_TICK_MS);
+    CHECK(timer_pending(&far.timer));
+    timer_wheel_advance(&wheel, (span_ticks - 1) * TIMER_WHEEL_TICK_MS);
+    CHECK(!timer_pending(&far.timer));
+    CHECK(wheel.armed == 0);
+}
+
+// Periodic timers rearm from their own callback, across level wraps
+static void test_rearm(void)
+{
+    TestTimer periodic;
+
+    now_ms = previous_ms = 0;
+    timer_wheel_init(&wheel, 0);
+    arm(&periodic, 250);
+    periodic.rearm = 100;
+    periodic.period_ms = 7000; // Lands in level 1 every time
+
+    for (long long ms = 0; ms <= 800000; ms += 300)
+    {
+        advance_to(ms);
+    }
+    CHECK(periodic.rearm == 0 && periodic.fired_ms >= 0);
+    CHECK(wheel.armed == 0);
+}
+
+static uint32_t random_state = 88172645u;
+
+static uint32_t next_random(void)
+{
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+    return random_state;
+}
+
+// Random deadlines over all levels, random cancels and reschedules, and
+// advances of uneven size, some far past many cascades at once
+static void test_random(void)
+{
+    enum
+    {
+        COUNT = 2000
+    };
+    static TestTimer timers[COUNT];
+    static bool cancelled[COUNT];
+
+    const long long start = 987654321;
+    now_ms = previous_ms = start;
+    timer_wheel_init(&wheel, start);
+
+    for (int i = 0; i < COUNT; i++)
+    {
+        long long ahead = next_random() % 4 == 0 ? next_random() % 50000000 : next_random() % 200000;
+        arm(&timers[i], start + ahead);
+        cancelled[i] = false;
+    }
+
+    long long ms = start;
+    while (wheel.armed > 0)
+    {
+        ms += next_random() % 8 == 0 ? next_random() % 3000000 : next_random() % 5000;
+        advance_to(ms);
+
+        // Move or drop a few pending timers between advances
+        for (int j = 0; j < 5; j++)
+        {
+            TestTimer *test = &timers[next_random() % COUNT];
+            int index = (int)(test - timers);
+            if (!timer_pending(&test->timer))
+                continue;
+
+            if (next_random() % 3 == 0)
+            {
+                timer_wheel_cancel(&wheel, &test->timer);
+                cancelled[index] = true;
+            }
+            else
+            {
+                test->deadline_ms = ms + TIMER_WHEEL_TICK_MS + next_random() % 1000000;
+                timer_wheel_schedule(&wheel, &test->timer, test->deadline_ms);
+            }
+        }
+    }
+
+    for (int i = 0; i < COUNT; i++)
+    {
+        if (cancelled[i] != (timers[i].fired_ms < 0))
+        {
+            FAIL("timer %d: %s\n", i, cancelled[i] ? "fired after cancel" : "never fired");
+        }
+    }
+}
+
+int main(void)
+{
+    test_levels();
+    test_horizon();
+    test_rearm();
+    test_random();
+
+    return test_report("test_timer_wheel");
+}
@@ -0,0 +1,226 @@
+// Checks for the WebSocket frame parser: masking, extended lengths,
+// partial frames, fragmentation with interleaved control frames, whole-frame
+// queueing and the protocol errors that close the connection.
+//
+//   make check
+
+#include "websocket.h"
+#include "test.h"
+
+static Connection *new_connection(void)
+{
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    Connection *conn = connection_create(-1, &addr);
+    conn->protocol = PROTOCOL_WEBSOCKET;
+    return conn;
+}
+
+// Append one client frame, masked as clients must
+static void add_frame(Connection *conn, bool fin, int opcode, const char *payload, size_t length,
+                      bool masked)
+{
+    static const unsigned char mask[4] = {0x37, 0xfa, 0x21, 0x3d};
+    unsigned char *out = (unsigned char *)conn->read_buffer + conn->read_buffer_used;
+    size_t used = 0;
+
+    out[used++] = (fin ? 0x80 : 0) | opcode;
+    if (length < 126)
+    {
+        out[used++] = (masked ? 0x80 : 0) | length;
+    }
+    else
+    {
+        out[used++] = (masked ? 0x80 : 0) | 126;
+        out[used++] = length >> 8;
+        out[used++] = length & 0xff;
+    }
+
+    if (masked)
+    {
+        memcpy(out + used, mask, 4);
+        used += 4;
+    }
+    for (size_t i = 0; i < length; i++)
+    {
+        out[used++] = payload[i] ^ (masked ? mask[i & 3] : 0);
+    }
+    conn->read_buffer_used += used;
+}
+
+// Opcode of the last frame the server queued, or -1
+static int last_reply(const Connection *conn)
+{
+    return conn->write_buffer_used >= 2 ? (unsigned char)conn->write_buffer[0] & 0x0f : -1;
+}
+
+static void test_single_frame(void)
+{
+    Connection *conn = new_connection();
+    char *message;
+    size_t length;
+
+    add_frame(conn, true, WS_OP_TEXT, "hello", 5, true);
+    CHECK(websocket_next_message(conn, WS_MAX_MESSAGE, &message, &length) == 1);
+    CHECK(length == 5 && strcmp(message, "hello") == 0);
+    CHECK(websocket_next_message(conn, WS_MAX_MESSAGE, &message, &length) == 0);
+    connection_destroy(conn);
+}
+
+static void test_partial_frame(void)
+{
+    Connection *conn = new_connection();
+    char *message;
+    size_t length;
+
+    // Deliver the frame one byte at a time
+    char frame[64];
+    add_frame(conn, true, WS_OP_TEXT, "split", 5, true);
+    size_t total = conn->read_buffer_used;
+    memcpy(frame, conn->read_buffer, total);
+
+    conn->read_buffer_used = 0;
+    for (size_t i = 0; i < total - 1; i++)
+    {
+        conn->read_buffer[conn->read_buffer_used++] = frame[i];
+        CHECK(websocket_next_message(conn, WS_MAX_MESSAGE, &message, &length) == 0);
+    }
+    conn->read_buffer[conn->read_buffer_used++] = frame[total - 1];
+    CHECK(websocket_next_message(conn, WS_MAX_MESSAGE, &message, &length) == 1);
+    CHECK(length == 5 && strcmp(message, "split") == 0);
+    connection_destroy(conn);
+}
+
+static void test_extended_length(void)
+{
+    Connection *conn = new_connection();
+    char *message;
+    size_t length;
+    char payload[300];
+    for (size_t i = 0; i < sizeof(payload); i++)
+        payload[i] = 'a' + i % 26;
+
+    add_frame(conn, true, WS_OP_BINARY, payload, sizeof(payload), true);
+    CHECK(websocket_next_message(conn, WS_MAX_MESSAGE, &message, &length) == 1);
+    CHECK(length == sizeof(payload) && memcmp(message, payload, sizeof(payload)) == 0);
+    connection_destroy(conn);
+}
+
+static void test_fragmentation(void)
+{
+    Connection *conn = new_connection();
+    char *message;
+    size_t length;
+
+    // Control frames may arrive between the fragments of a message
+    add_frame(conn, false, WS_OP_TEXT, "frag", 4, true);
+    add_frame(conn, true, WS_OP_PING, "p", 1, true);
+    add_frame(conn, false, WS_OP_CONTINUATION, "men", 3, true);
+    CHECK(websocket_next_message(conn, WS_MAX_MESSAGE, &message, &length) == 0);
+    CHECK(last_reply(conn) == WS_OP_PONG);
+    CHECK(conn->ws_fragmented);
+
+    add_frame(conn, true, WS_OP_CONTINUATION, "ted", 3, true);
+    CHECK(websocket_next_message(conn, WS_MAX_MESSAGE, &message, &length) == 1);
+    CHECK(length == 10 && strcmp(message, "fragmented") == 0);
+    CHECK(!conn->ws_fragmented && conn->ws_message_used == 0);
+
+    // The next message starts fresh
+    add_frame(conn, true, WS_OP_TEXT, "next", 4, true);
+    CHECK(websocket_next_message(conn, WS_MAX_MESSAGE, &message, &length) == 1);
+    CHECK(length == 4 && strcmp(message, "next") == 0);
+    connection_destroy(conn);
+}
+
+static void expect_failure(const char *name, void (*setup)(Connection *conn), size_t max_length)
+{
+    Connection *conn = new_connection();
+    char *message;
+    size_t length;
+
+    setup(conn);
+    int result = websocket_next_message(conn, max_length, &message, &length);
+    if (result != -1 || last_reply(conn) != WS_OP_CLOSE)
+    {
+        FAIL("%s: expected a close, got %d\n", name, result);
+    }
+    connection_destroy(conn);
+}
+
+static void setup_unmasked(Connection *conn)
+{
+    add_frame(conn, true, WS_OP_TEXT, "plain", 5, false);
+}
+
+static void setup_stray_continuation(Connection *conn)
+{
+    add_frame(conn, true, WS_OP_CONTINUATION, "late", 4, true);
+}
+
+static void setup_interrupted_fragments(Connection *conn)
+{
+    add_frame(conn, false, WS_OP_TEXT, "one", 3, true);
+    add_frame(conn, true, WS_OP_TEXT, "two", 3, true);
+}
+
+static void setup_oversized_fragments(Connection *conn)
+{
+    add_frame(conn, false, WS_OP_TEXT, "abcdef", 6, true);
+    add_frame(conn, true, WS_OP_CONTINUATION, "ghijkl", 6, true);
+}
+
+static void setup_close(Connection *conn)
+{
+    add_frame(conn, true, WS_OP_CLOSE, "\x03\xe8", 2, true);
+}
+
+static void setup_unknown_opcode(Connection *conn)
+{
+    add_frame(conn, true, 0x3, "?", 1, true);
+}
+
+static void setup_fragmented_ping(Connection *conn)
+{
+    add_frame(conn, false, WS_OP_PING, "p", 1, true);
+}
+
+static void setup_long_ping(Connection *conn)
+{
+    char payload[126];
+    memset(payload, 'p', sizeof(payload));
+    add_frame(conn, true, WS_OP_PING, payload, sizeof(payload), true);
+}
+
+// A frame that does not fit the write buffer is dropped whole
+static void test_queue_full(void)
+{
+    Connection *conn = new_connection();
+    static char filler[MAX_WRITE_BUFFER];
+
+    CHECK(connection_queue_raw(conn, filler, MAX_WRITE_BUFFER - 4) == 0);
+    CHECK(websocket_queue_frame(conn, WS_OP_TEXT, "too long", 8) == -1);
+    CHECK(conn->write_buffer_used == MAX_WRITE_BUFFER - 4);
+    CHECK(websocket_queue_frame(conn, WS_OP_TEXT, "ok", 2) == 0);
+    CHECK(conn->write_buffer_used == MAX_WRITE_BUFFER);
+    connection_destroy(conn);
+}
+
+int main(void)
+{
+    test_single_frame();
+    test_partial_frame();
+    test_extended_length();
+    test_fragmentation();
+    test_queue_full();
+
+    expect_failure("unmasked frame", setup_unmasked, WS_MAX_MESSAGE);
+    expect_failure("continuation without a message", setup_stray_continuation, WS_MAX_MESSAGE);
+    expect_failure("data frame inside a fragmented message", setup_interrupted_fragments, WS_MAX_MESSAGE);
+    expect_failure("fragments over the size limit", setup_oversized_fragments, 10);
+    expect_failure("close frame", setup_close, WS_MAX_MESSAGE);
+    expect_failure("reserved opcode", setup_unknown_opcode, WS_MAX_MESSAGE);
+    expect_failure("fragmented control frame", setup_fragmented_ping, WS_MAX_MESSAGE);
+    expect_failure("control frame over 125 bytes", setup_long_ping, WS_MAX_MESSAGE);
+
+    return test_report("test_websocket");
+}